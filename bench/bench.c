@@ -0,0 +1,811 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <opus/opus.h>
+
+#include "../src/chacha20/chacha20.h"
+#include "../src/packet/packet.h"
+#include "../src/dsp/dsp.h"
+#include "../src/resampler/resampler.h"
+#include "../src/mixer/mixer.h"
+#include "../src/complexity_tuner/complexity_tuner.h"
+#include "../src/task_scheduler/connection_table/connection_table.h"
+
+#define BENCH_CALIBRATION_TIME 10000000L // Nanoseconds a calibration run must reach.
+#define BENCH_RUN_TIME 100000000L
+#define BENCH_DEFAULT_RUNS 5
+#define BENCH_MAX_RUNS 50
+
+#define BENCH_SAMPLE_RATE 48000
+#define BENCH_CHANNELS 2
+#define BENCH_FRAME_SIZE 960 // 20ms, the default profile.
+#define BENCH_SIGNAL_FRAMES 50 // One second of input, encoded in a loop.
+#define BENCH_LOOKUPS 4096
+#define BENCH_QUALITY_SECONDS 2 // Of the tones the resampler quality is measured on.
+#define BENCH_TUNER_SECONDS 3 // Of real-time encoding per contention level.
+#define BENCH_TUNER_MAX_HOGS 64
+
+typedef void (*bench_function)(void *state, long iterations);
+
+struct bench_options {
+    const char *filter;
+    int runs;
+    FILE *out;
+    int results_count;
+    int quality_count;
+    bool quality_failed;
+    int tuner_count;
+};
+
+struct bench_result {
+    long iterations;
+    double ns_per_op[BENCH_MAX_RUNS];
+};
+
+/* Keeps results alive, so the compiler can't drop the benchmarked work. */
+static volatile unsigned long bench_sink;
+
+static int64_t bench_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Deterministic noise, every run of the suite sees the same input. */
+static uint32_t bench_random(uint32_t *state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+/*
+ * Runs fn until the iteration count takes about BENCH_RUN_TIME, then measures runs of that many iterations.
+ * bytes is the payload of one operation, 0 if throughput makes no sense.
+ */
+static void run_benchmark(struct bench_options *options, const char *name, bench_function fn, void *state,
+                          size_t bytes) {
+    if (options->filter != NULL && strstr(name, options->filter) == NULL)
+        return;
+
+    long iterations = 1;
+    int64_t elapsed;
+    while (1) {
+        int64_t start = bench_time();
+        fn(state, iterations);
+        elapsed = bench_time() - start;
+        if (elapsed >= BENCH_CALIBRATION_TIME)
+            break;
+        iterations *= 2;
+    }
+    iterations = (long) ((double) iterations * BENCH_RUN_TIME / (double) elapsed);
+    if (iterations < 1)
+        iterations = 1;
+
+    struct bench_result result = {.iterations = iterations};
+    for (int run = 0; run < options->runs; run++) {
+        int64_t start = bench_time();
+        fn(state, iterations);
+        result.ns_per_op[run] = (double) (bench_time() - start) / (double) iterations;
+    }
+    qsort(result.ns_per_op, (size_t) options->runs, sizeof(double), compare_doubles);
+    double median = result.ns_per_op[options->runs / 2];
+
+    fprintf(options->out, "%s\n    {\"name\": \"%s\", \"iterations\": %ld, \"runs\": %d, "
+                          "\"ns_per_op\": %.2f, \"ns_per_op_min\": %.2f, \"ns_per_op_max\": %.2f",
+            options->results_count++ > 0 ? "," : "", name, iterations, options->runs, median, result.ns_per_op[0],
+            result.ns_per_op[options->runs - 1]);
+    if (bytes > 0)
+        fprintf(options->out, ", \"bytes_per_second\": %.0f", (double) bytes * 1000000000.0 / median);
+    fprintf(options->out, "}");
+    fflush(options->out);
+
+    fprintf(stderr, "%-36s %12.2f ns/op\n", name, median);
+}
+
+struct chacha20_state {
+    unsigned char key[CHACHA20_KEYBYTES];
+    unsigned char nonce[CHACHA20_NONCEBYTES];
+    unsigned char packet[MAX_PACKET_SIZE];
+    size_t packet_len;
+};
+
+/* Every frame gets a fresh context, as the opus builder and player do. */
+static void bench_chacha20_xor(void *p_state, long iterations) {
+    struct chacha20_state *state = p_state;
+    struct chacha20_context ctx;
+    for (long i = 0; i < iterations; i++) {
+        chacha20_init_context(&ctx, state->nonce, state->key, 0);
+        chacha20_xor(&ctx, state->packet, state->packet_len);
+    }
+    bench_sink += state->packet[0];
+}
+
+struct conversion_state {
+    int16_t signal[BENCH_FRAME_SIZE * BENCH_CHANNELS];
+    int16_t s16le[BENCH_FRAME_SIZE * BENCH_CHANNELS]; // The signal as read from a file or STDIN.
+    int16_t samples[BENCH_FRAME_SIZE * BENCH_CHANNELS];
+    float floats[BENCH_FRAME_SIZE * BENCH_CHANNELS];
+    float scaled[BENCH_FRAME_SIZE * BENCH_CHANNELS];
+    int16_t planes[BENCH_CHANNELS][BENCH_FRAME_SIZE];
+};
+
+/* The builder's way from the bytes read to floats, the swap only costs on big-endian CPUs. */
+static void bench_s16le_to_samples(void *p_state, long iterations) {
+    struct conversion_state *state = p_state;
+    for (long i = 0; i < iterations; i++) {
+        s16le_to_native(state->s16le, BENCH_FRAME_SIZE * BENCH_CHANNELS);
+        samples_to_float(state->s16le, state->floats, BENCH_FRAME_SIZE * BENCH_CHANNELS);
+    }
+    bench_sink += (unsigned long) state->floats[1];
+}
+
+/* The player's way from decoded floats to the bytes written to a file or STDOUT. */
+static void bench_samples_to_s16le(void *p_state, long iterations) {
+    struct conversion_state *state = p_state;
+    for (long i = 0; i < iterations; i++) {
+        float_to_samples(state->floats, state->samples, BENCH_FRAME_SIZE * BENCH_CHANNELS);
+        native_to_s16le(state->samples, BENCH_FRAME_SIZE * BENCH_CHANNELS);
+    }
+    bench_sink += (unsigned long) state->samples[1];
+}
+
+static void bench_samples_to_float(void *p_state, long iterations) {
+    struct conversion_state *state = p_state;
+    for (long i = 0; i < iterations; i++)
+        samples_to_float(state->signal, state->floats, BENCH_FRAME_SIZE * BENCH_CHANNELS);
+    bench_sink += (unsigned long) state->floats[1];
+}
+
+static void bench_float_to_samples(void *p_state, long iterations) {
+    struct conversion_state *state = p_state;
+    for (long i = 0; i < iterations; i++)
+        float_to_samples(state->floats, state->samples, BENCH_FRAME_SIZE * BENCH_CHANNELS);
+    bench_sink += (unsigned long) state->samples[1];
+}
+
+/* A steady volume, the input is copied back first so it doesn't fade to silence. */
+static void bench_apply_gain(void *p_state, long iterations) {
+    struct conversion_state *state = p_state;
+    for (long i = 0; i < iterations; i++) {
+        float gain = 0.5f;
+        memcpy(state->samples, state->signal, sizeof(state->samples));
+        apply_gain(state->samples, BENCH_FRAME_SIZE, BENCH_CHANNELS, &gain, 0.5f);
+    }
+    bench_sink += (unsigned long) state->samples[1];
+}
+
+/* A volume step, ramped over the frame. */
+static void bench_apply_gain_ramp(void *p_state, long iterations) {
+    struct conversion_state *state = p_state;
+    for (long i = 0; i < iterations; i++) {
+        float gain = 0.5f;
+        memcpy(state->samples, state->signal, sizeof(state->samples));
+        apply_gain(state->samples, BENCH_FRAME_SIZE, BENCH_CHANNELS, &gain, 0.51f);
+    }
+    bench_sink += (unsigned long) state->samples[1];
+}
+
+/* The volume step of the float decode path. */
+static void bench_apply_float_gain_ramp(void *p_state, long iterations) {
+    struct conversion_state *state = p_state;
+    for (long i = 0; i < iterations; i++) {
+        float gain = 0.5f;
+        memcpy(state->scaled, state->floats, sizeof(state->scaled));
+        apply_float_gain(state->scaled, BENCH_FRAME_SIZE, BENCH_CHANNELS, &gain, 0.51f);
+    }
+    bench_sink += (unsigned long) (state->scaled[1] * 32768);
+}
+
+static void bench_deinterleave(void *p_state, long iterations) {
+    struct conversion_state *state = p_state;
+    int16_t *planes[BENCH_CHANNELS];
+    for (int channel = 0; channel < BENCH_CHANNELS; channel++)
+        planes[channel] = state->planes[channel];
+    for (long i = 0; i < iterations; i++)
+        deinterleave_samples(state->signal, planes, BENCH_CHANNELS, BENCH_FRAME_SIZE);
+    bench_sink += (unsigned long) state->planes[1][0];
+}
+
+static void bench_interleave(void *p_state, long iterations) {
+    struct conversion_state *state = p_state;
+    const int16_t *planes[BENCH_CHANNELS];
+    for (int channel = 0; channel < BENCH_CHANNELS; channel++)
+        planes[channel] = state->planes[channel];
+    for (long i = 0; i < iterations; i++)
+        interleave_samples(planes, state->samples, BENCH_CHANNELS, BENCH_FRAME_SIZE);
+    bench_sink += (unsigned long) state->samples[1];
+}
+
+struct resample_state {
+    Resampler resampler;
+    float *input;
+    float *output;
+    int in_frames; // 20ms at the input rate.
+};
+
+static void bench_resample(void *p_state, long iterations) {
+    struct resample_state *state = p_state;
+    int out_frames = 0;
+    for (long i = 0; i < iterations; i++)
+        out_frames += resample(&state->resampler, state->input, state->in_frames, state->output);
+    bench_sink += (unsigned long) out_frames;
+}
+
+struct encode_state {
+    OpusEncoder *encoder;
+    int16_t *signal;
+    int frame;
+};
+
+static void bench_opus_encode(void *p_state, long iterations) {
+    struct encode_state *state = p_state;
+    unsigned char packet[MAX_PACKET_SIZE];
+    for (long i = 0; i < iterations; i++) {
+        const int16_t *in = state->signal + (size_t) state->frame * BENCH_FRAME_SIZE * BENCH_CHANNELS;
+        state->frame = (state->frame + 1) % BENCH_SIGNAL_FRAMES;
+        bench_sink += (unsigned long) opus_encode(state->encoder, in, BENCH_FRAME_SIZE, packet, MAX_PACKET_SIZE);
+    }
+}
+
+struct packet_state {
+    struct opus_packet packet;
+    unsigned char frames[MAX_AGGREGATED_FRAMES][160];
+    unsigned char buffer[MAX_DATA_SIZE];
+    size_t buffer_len;
+};
+
+static void bench_build_opus_packet(void *p_state, long iterations) {
+    struct packet_state *state = p_state;
+    for (long i = 0; i < iterations; i++) {
+        state->packet.sequence = (uint32_t) i;
+        bench_sink += build_opus_packet(&state->packet, state->buffer, sizeof(state->buffer));
+    }
+}
+
+static void bench_parse_opus_packet(void *p_state, long iterations) {
+    struct packet_state *state = p_state;
+    struct opus_packet packet;
+    for (long i = 0; i < iterations; i++)
+        bench_sink += parse_opus_packet(&packet, state->buffer, state->buffer_len);
+}
+
+/* One task through the queue per iteration, as the scheduler appends and a handler performs. */
+static void bench_task_queue(void *p_state, long iterations) {
+    TaskQueue *queue = p_state;
+    Task task;
+    for (long i = 0; i < iterations; i++) {
+        append_task(queue, &task);
+        bench_sink += (unsigned long) perf_task(queue)->buffer_len;
+    }
+}
+
+struct lookup_state {
+    ConnectionTable table;
+    struct sockaddr_in *addrs;
+    int lookups[BENCH_LOOKUPS];
+};
+
+/* Looks up connected clients in a random order, as the scheduler does for every datagram. */
+static void bench_find_connection(void *p_state, long iterations) {
+    struct lookup_state *state = p_state;
+    for (long i = 0; i < iterations; i++)
+        bench_sink += (unsigned long) (find_connection(&state->table, &state->addrs[state->lookups[i % BENCH_LOOKUPS]])
+                                       != NULL);
+}
+
+static void bench_crypto(struct bench_options *options) {
+    static const size_t packet_lens[] = {64, 160, 320, 1275, MAX_PACKET_SIZE};
+    struct chacha20_state *state = calloc(1, sizeof(struct chacha20_state));
+
+    for (size_t i = 0; i < sizeof(packet_lens) / sizeof(packet_lens[0]); i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "chacha20_xor/%zu", packet_lens[i]);
+        state->packet_len = packet_lens[i];
+        run_benchmark(options, name, bench_chacha20_xor, state, packet_lens[i]);
+    }
+    free(state);
+}
+
+/* Every kernel once for each set of routines the CPU supports, named like "apply_gain/avx2/1920". */
+static void bench_conversions(struct bench_options *options) {
+    static const struct {
+        const char *name;
+        bench_function fn;
+    } conversions[] = {
+            {"samples_to_float", bench_samples_to_float},
+            {"float_to_samples", bench_float_to_samples},
+            {"apply_gain", bench_apply_gain},
+            {"apply_gain_ramp", bench_apply_gain_ramp},
+            {"apply_float_gain_ramp", bench_apply_float_gain_ramp},
+            {"deinterleave", bench_deinterleave},
+            {"interleave", bench_interleave}
+    };
+    struct conversion_state *state = calloc(1, sizeof(struct conversion_state));
+    uint32_t seed = 1;
+    for (size_t i = 0; i < BENCH_FRAME_SIZE * BENCH_CHANNELS; i++)
+        state->signal[i] = (int16_t) bench_random(&seed);
+    samples_to_float(state->signal, state->floats, BENCH_FRAME_SIZE * BENCH_CHANNELS);
+    memcpy(state->s16le, state->signal, sizeof(state->s16le));
+    native_to_s16le(state->s16le, BENCH_FRAME_SIZE * BENCH_CHANNELS);
+
+    /* The end-to-end conversions with the kernels raplayer picked, named as before the kernels were split out. */
+    const size_t frame_bytes = sizeof(state->samples);
+    run_benchmark(options, "s16le_to_samples/1920", bench_s16le_to_samples, state, frame_bytes);
+    run_benchmark(options, "samples_to_s16le/1920", bench_samples_to_s16le, state, frame_bytes);
+
+    const char *default_kernels = dsp_kernels();
+    const char *kernels[DSP_MAX_KERNELS];
+    int kernels_count = list_dsp_kernels(kernels);
+    for (int k = 0; k < kernels_count; k++) {
+        use_dsp_kernels(kernels[k]);
+        for (size_t i = 0; i < sizeof(conversions) / sizeof(conversions[0]); i++) {
+            char name[64];
+            snprintf(name, sizeof(name), "%s/%s/1920", conversions[i].name, kernels[k]);
+            run_benchmark(options, name, conversions[i].fn, state, frame_bytes);
+        }
+    }
+    use_dsp_kernels(default_kernels);
+    free(state);
+}
+
+/* 20ms of stereo noise at the common rates, converted to the stream rate with each set of routines. */
+static void bench_resamplers(struct bench_options *options) {
+    static const uint32_t in_rates[] = {44100, 96000, 32000};
+    const char *default_kernels = dsp_kernels();
+    const char *kernels[DSP_MAX_KERNELS];
+    int kernels_count = list_dsp_kernels(kernels);
+
+    for (size_t r = 0; r < sizeof(in_rates) / sizeof(in_rates[0]); r++) {
+        struct resample_state state = {.in_frames = (int) (in_rates[r] / 50)};
+        if (!init_resampler(&state.resampler, in_rates[r], BENCH_SAMPLE_RATE, BENCH_CHANNELS, state.in_frames)) {
+            printf("Error: failed to create a resampler from %uHz.\n", in_rates[r]);
+            exit(EXIT_FAILURE);
+        }
+        state.input = malloc((size_t) state.in_frames * BENCH_CHANNELS * sizeof(float));
+        state.output = malloc((size_t) max_resampled_frames(&state.resampler, state.in_frames) * BENCH_CHANNELS *
+                              sizeof(float));
+        uint32_t seed = 1;
+        for (int i = 0; i < state.in_frames * BENCH_CHANNELS; i++)
+            state.input[i] = (float) (bench_random(&seed) & 0xFFFF) / 0x8000 - 1;
+
+        for (int k = 0; k < kernels_count; k++) {
+            char name[64];
+            snprintf(name, sizeof(name), "resample/%u->%u/%s", in_rates[r], BENCH_SAMPLE_RATE, kernels[k]);
+            use_dsp_kernels(kernels[k]);
+            run_benchmark(options, name, bench_resample, &state,
+                          (size_t) state.in_frames * BENCH_CHANNELS * sizeof(float));
+        }
+
+        destroy_resampler(&state.resampler);
+        free(state.input);
+        free(state.output);
+    }
+    use_dsp_kernels(default_kernels);
+}
+
+struct mix_source {
+    const int16_t *signal;
+    int position; // In frames.
+};
+
+/* Loops over the shared signal, every source from its own place in it. */
+static bool read_mix_source(void *p_source, int16_t *pcm, int frames) {
+    struct mix_source *source = p_source;
+    memcpy(pcm, source->signal + (size_t) source->position * BENCH_CHANNELS,
+           (size_t) frames * BENCH_CHANNELS * sizeof(int16_t));
+    source->position = (source->position + frames) % ((BENCH_SIGNAL_FRAMES - 1) * BENCH_FRAME_SIZE);
+    return true;
+}
+
+struct mix_state {
+    Mixer mixer;
+    int16_t out[BENCH_FRAME_SIZE * BENCH_CHANNELS];
+};
+
+static void bench_mix(void *p_state, long iterations) {
+    struct mix_state *state = p_state;
+    for (long i = 0; i < iterations; i++)
+        read_mixer(&state->mixer, state->out, BENCH_FRAME_SIZE);
+    bench_sink += (unsigned long) state->out[1];
+}
+
+/* A 20ms frame of 8 and 32 noise inputs at -18dB, one of them ducking the others, as each set of routines mixes it. */
+static void bench_mixers(struct bench_options *options) {
+    static const int input_counts[] = {8, MIXER_MAX_INPUTS};
+    const char *default_kernels = dsp_kernels();
+    const char *kernels[DSP_MAX_KERNELS];
+    int kernels_count = list_dsp_kernels(kernels);
+
+    int16_t *signal = malloc((size_t) BENCH_SIGNAL_FRAMES * BENCH_FRAME_SIZE * BENCH_CHANNELS * sizeof(int16_t));
+    uint32_t seed = 1;
+    for (int i = 0; i < BENCH_SIGNAL_FRAMES * BENCH_FRAME_SIZE * BENCH_CHANNELS; i++)
+        signal[i] = (int16_t) bench_random(&seed);
+    struct mix_source sources[MIXER_MAX_INPUTS];
+    struct mix_state *state = malloc(sizeof(struct mix_state));
+
+    for (size_t c = 0; c < sizeof(input_counts) / sizeof(input_counts[0]); c++) {
+        for (int k = 0; k < kernels_count; k++) {
+            use_dsp_kernels(kernels[k]);
+            init_mixer(&state->mixer, BENCH_CHANNELS, BENCH_SAMPLE_RATE);
+            for (int i = 0; i < input_counts[c]; i++) {
+                sources[i] = (struct mix_source) {signal, i * BENCH_FRAME_SIZE};
+                add_mixer_input(&state->mixer, (RaInput) {read_mix_source, NULL, &sources[i]}, -18, i == 0 ? 12 : 0);
+            }
+
+            char name[64];
+            snprintf(name, sizeof(name), "mix/%s/inputs=%d", kernels[k], input_counts[c]);
+            run_benchmark(options, name, bench_mix, state,
+                          (size_t) input_counts[c] * BENCH_FRAME_SIZE * BENCH_CHANNELS * sizeof(int16_t));
+            close_mixer(&state->mixer);
+        }
+    }
+    use_dsp_kernels(default_kernels);
+    free(state);
+    free(signal);
+}
+
+/* Resamples a mono tone of BENCH_QUALITY_SECONDS, out gets the frames at the stream rate. */
+static int resample_tone(uint32_t in_rate, double frequency, float **out) {
+    Resampler resampler;
+    if (!init_resampler(&resampler, in_rate, BENCH_SAMPLE_RATE, 1, (int) in_rate / 50)) {
+        printf("Error: failed to create a resampler from %uHz.\n", in_rate);
+        exit(EXIT_FAILURE);
+    }
+    const int block = (int) in_rate / 50;
+    float input[block];
+    *out = malloc(((size_t) BENCH_QUALITY_SECONDS * BENCH_SAMPLE_RATE + (size_t) resampler.taps * 8) * sizeof(float));
+
+    int out_frames = 0;
+    for (int frame = 0; frame < (int) in_rate * BENCH_QUALITY_SECONDS; frame += block) {
+        for (int i = 0; i < block; i++)
+            input[i] = (float) (0.5 * sin(2 * M_PI * frequency * (frame + i) / in_rate));
+        out_frames += resample(&resampler, input, block, *out + out_frames);
+    }
+    out_frames += flush_resampler(&resampler, *out + out_frames);
+    destroy_resampler(&resampler);
+    return out_frames;
+}
+
+static void report_quality(struct bench_options *options, const char *name, double db, double target) {
+    if (options->filter != NULL && strstr(name, options->filter) == NULL)
+        return;
+    bool passed = db >= target;
+    options->quality_failed |= !passed;
+    fprintf(options->out, "%s\n    {\"name\": \"%s\", \"db\": %.1f, \"target_db\": %.1f, \"passed\": %s}",
+            options->quality_count++ > 0 ? "," : "", name, db, target, passed ? "true" : "false");
+    fprintf(stderr, "%-36s %12.1f dB%s\n", name, db, passed ? "" : " FAILED");
+}
+
+/*
+ * The error of a resampled 1kHz tone against the ideal one, in the middle second so the edges don't count,
+ * and how far a tone above the stream's Nyquist frequency is pushed down instead of aliasing.
+ */
+static void bench_resampler_quality(struct bench_options *options) {
+    static const struct {
+        uint32_t in_rate;
+        double frequency;
+        bool stopband;
+        double target;
+    } cases[] = {
+            {44100, 1000,  false, 80},
+            {96000, 1000,  false, 80},
+            {32000, 1000,  false, 80},
+            {96000, 30000, true,  60}
+    };
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        float *out;
+        resample_tone(cases[c].in_rate, cases[c].frequency, &out);
+        double signal = 0.5 * 0.5 / 2, error = 0;
+        for (int i = BENCH_SAMPLE_RATE / 2; i < BENCH_SAMPLE_RATE * 3 / 2; i++) {
+            double ideal = cases[c].stopband ? 0 : 0.5 * sin(2 * M_PI * cases[c].frequency * i / BENCH_SAMPLE_RATE);
+            error += (out[i] - ideal) * (out[i] - ideal);
+        }
+        error /= BENCH_SAMPLE_RATE;
+        free(out);
+
+        char name[64];
+        snprintf(name, sizeof(name), "resample/%u->%u/%s=%.0f", cases[c].in_rate, BENCH_SAMPLE_RATE,
+                 cases[c].stopband ? "rejection" : "snr", cases[c].frequency);
+        report_quality(options, name, 10 * log10(signal / (error > 0 ? error : 1e-30)), cases[c].target);
+    }
+}
+
+/* A few tones over noise, something for the encoder to work on at every complexity. */
+static int16_t *encoder_signal(void) {
+    const size_t samples = (size_t) BENCH_SIGNAL_FRAMES * BENCH_FRAME_SIZE;
+    int16_t *signal = malloc(samples * BENCH_CHANNELS * sizeof(int16_t));
+
+    uint32_t seed = 1;
+    for (size_t i = 0; i < samples; i++) {
+        double t = (double) i / BENCH_SAMPLE_RATE;
+        double tone = 0.3 * sin(2 * M_PI * 220 * t) + 0.2 * sin(2 * M_PI * 1760 * t) + 0.1 * sin(2 * M_PI * 5274 * t);
+        for (int channel = 0; channel < BENCH_CHANNELS; channel++) {
+            double noise = ((double) (bench_random(&seed) & 0xFFFF) / 0xFFFF - 0.5) * 0.05;
+            signal[i * BENCH_CHANNELS + channel] = (int16_t) ((tone + noise) * 32767 * (channel ? 0.9 : 1.0));
+        }
+    }
+    return signal;
+}
+
+static OpusEncoder *create_bench_encoder(void) {
+    int err;
+    OpusEncoder *encoder = opus_encoder_create(BENCH_SAMPLE_RATE, BENCH_CHANNELS, OPUS_APPLICATION_AUDIO, &err);
+    if (err < 0) {
+        printf("Error: failed to create an encoder - %s\n", opus_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(BENCH_SAMPLE_RATE * BENCH_CHANNELS)); // As the server does.
+    return encoder;
+}
+
+static void bench_encoder(struct bench_options *options) {
+    struct encode_state state = {0};
+    state.signal = encoder_signal();
+    state.encoder = create_bench_encoder();
+
+    for (int complexity = 0; complexity <= 10; complexity++) {
+        char name[64];
+        snprintf(name, sizeof(name), "opus_encode/complexity=%d", complexity);
+        opus_encoder_ctl(state.encoder, OPUS_SET_COMPLEXITY(complexity));
+        opus_encoder_ctl(state.encoder, OPUS_RESET_STATE);
+        state.frame = 0;
+        run_benchmark(options, name, bench_opus_encode, &state, 0);
+    }
+
+    opus_encoder_destroy(state.encoder);
+    free(state.signal);
+}
+
+static void bench_packets(struct bench_options *options) {
+    struct packet_state *state = calloc(1, sizeof(struct packet_state));
+
+    for (int frame_count = 1; frame_count <= MAX_AGGREGATED_FRAMES; frame_count++) {
+        state->packet.frame_count = (uint8_t) frame_count;
+        for (int i = 0; i < frame_count; i++) {
+            state->packet.frame_len[i] = sizeof(state->frames[i]);
+            state->packet.frames[i] = state->frames[i];
+        }
+        state->buffer_len = build_opus_packet(&state->packet, state->buffer, sizeof(state->buffer));
+
+        char name[64];
+        snprintf(name, sizeof(name), "build_opus_packet/frames=%d", frame_count);
+        run_benchmark(options, name, bench_build_opus_packet, state, state->buffer_len);
+        snprintf(name, sizeof(name), "parse_opus_packet/frames=%d", frame_count);
+        run_benchmark(options, name, bench_parse_opus_packet, state, state->buffer_len);
+    }
+    free(state);
+}
+
+static void bench_task_queues(struct bench_options *options) {
+    TaskQueue *queue = malloc(sizeof(TaskQueue));
+    init_queue(0, NULL, queue);
+    run_benchmark(options, "task_queue/append_perf", bench_task_queue, queue, 0);
+    free(queue->queue_info);
+    free(queue);
+}
+
+static void bench_connection_lookups(struct bench_options *options) {
+    static const int client_counts[] = {10, 1000, 10000};
+
+    for (size_t n = 0; n < sizeof(client_counts) / sizeof(client_counts[0]); n++) {
+        const int clients = client_counts[n];
+        struct lookup_state *state = calloc(1, sizeof(struct lookup_state));
+        state->addrs = calloc((size_t) clients, sizeof(struct sockaddr_in));
+        init_connection_table(&state->table);
+
+        /* Clients behind a few addresses with ephemeral ports, like a NAT gateway and a LAN. */
+        uint32_t seed = 1;
+        for (int i = 0; i < clients; i++) {
+            state->addrs[i].sin_family = AF_INET;
+            state->addrs[i].sin_addr.s_addr = htonl(0x0A000000u | (bench_random(&seed) & 0xFF));
+            state->addrs[i].sin_port = htons((uint16_t) (32768 + i));
+            add_connection(&state->table, &state->addrs[i], (TaskQueue *) &state->addrs[i]);
+        }
+        for (int i = 0; i < BENCH_LOOKUPS; i++)
+            state->lookups[i] = (int) (bench_random(&seed) % (uint32_t) clients);
+
+        char name[64];
+        snprintf(name, sizeof(name), "find_connection/clients=%d", clients);
+        run_benchmark(options, name, bench_find_connection, state, 0);
+
+        destroy_connection_table(&state->table);
+        free(state->addrs);
+        free(state);
+    }
+}
+
+static atomic_bool hogs_stopping;
+
+/* Burns a CPU until the run is over, the synthetic contention. */
+static void *hog_cpu(void *unused) {
+    unsigned long spins = 0;
+    while (!atomic_load_explicit(&hogs_stopping, memory_order_relaxed))
+        spins++;
+    return (void *) spins;
+}
+
+static void sleep_until(int64_t time) {
+    struct timespec timespec = {time / 1000000000L, time % 1000000000L};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &timespec, NULL) == EINTR);
+}
+
+/*
+ * Encodes at the pace of the default profile's frame clock for BENCH_TUNER_SECONDS, as the opus builder does. A frame
+ * that isn't encoded by its tick is late, it waits for the next one and every following frame slips with it.
+ */
+static void run_tuner(struct bench_options *options, const char *name, const int16_t *signal, int min_complexity,
+                      int max_complexity) {
+    const int64_t interval = (int64_t) BENCH_FRAME_SIZE * 1000000000L / BENCH_SAMPLE_RATE;
+    OpusEncoder *encoder = create_bench_encoder();
+    ComplexityTuner tuner;
+    init_complexity_tuner(&tuner, min_complexity, max_complexity, interval);
+    opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(max_complexity));
+
+    unsigned char packet[MAX_PACKET_SIZE];
+    long frames = 0, late_frames = 0, complexity_sum = 0;
+    int64_t max_encode_time = 0;
+    const int64_t start = bench_time();
+    int64_t tick = start + interval;
+    while (tick < start + BENCH_TUNER_SECONDS * 1000000000L) {
+        const int16_t *in = signal + (size_t) (frames % BENCH_SIGNAL_FRAMES) * BENCH_FRAME_SIZE * BENCH_CHANNELS;
+        const int complexity = atomic_load(&tuner.complexity);
+        int64_t encode_start = bench_time();
+        bench_sink += (unsigned long) opus_encode(encoder, in, BENCH_FRAME_SIZE, packet, MAX_PACKET_SIZE);
+        int64_t encode_end = bench_time();
+
+        const int next_complexity = tune_complexity(&tuner, encode_end - encode_start);
+        if (next_complexity != complexity)
+            opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(next_complexity));
+        if (encode_end - encode_start > max_encode_time)
+            max_encode_time = encode_end - encode_start;
+        complexity_sum += complexity;
+        frames++;
+
+        if (encode_end > tick) {
+            late_frames++;
+            tick += (encode_end - tick) / interval * interval + interval;
+        }
+        sleep_until(tick);
+        tick += interval;
+    }
+    opus_encoder_destroy(encoder);
+
+    fprintf(options->out, "%s\n    {\"name\": \"%s\", \"frames\": %ld, \"late_frames\": %ld, \"mean_complexity\": %.2f, "
+                          "\"lowered\": %lu, \"raised\": %lu, \"max_encode_ms\": %.3f}",
+            options->tuner_count++ > 0 ? "," : "", name, frames, late_frames, (double) complexity_sum / (double) frames,
+            atomic_load(&tuner.lowered), atomic_load(&tuner.raised), (double) max_encode_time / 1000000.0);
+    fflush(options->out);
+    fprintf(stderr, "%-36s %5ld of %ld frames late, complexity %.2f on average\n", name, late_frames, frames,
+            (double) complexity_sum / (double) frames);
+}
+
+/*
+ * The encoder at the highest complexity against the tuned one, with no contention, a busy thread per CPU and four.
+ * Busy threads take their fair share of every CPU, so the encodes are preempted as on a loaded host.
+ */
+static void bench_complexity_tuner(struct bench_options *options) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        cpus = 1;
+    int16_t *signal = encoder_signal();
+
+    static const int loads[] = {0, 1, 4}; // Busy threads per CPU.
+    for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+        char fixed_name[64], tuned_name[64];
+        snprintf(fixed_name, sizeof(fixed_name), "complexity_tuner/hogs=%dx/fixed", loads[l]);
+        snprintf(tuned_name, sizeof(tuned_name), "complexity_tuner/hogs=%dx/tuned", loads[l]);
+        if (options->filter != NULL && strstr(fixed_name, options->filter) == NULL &&
+            strstr(tuned_name, options->filter) == NULL)
+            continue;
+
+        pthread_t hogs[BENCH_TUNER_MAX_HOGS];
+        int hogs_count = 0;
+        atomic_store(&hogs_stopping, false);
+        for (long i = 0; i < cpus * loads[l] && hogs_count < BENCH_TUNER_MAX_HOGS; i++)
+            if (pthread_create(&hogs[hogs_count], NULL, hog_cpu, NULL) == 0)
+                hogs_count++;
+
+        if (options->filter == NULL || strstr(fixed_name, options->filter) != NULL)
+            run_tuner(options, fixed_name, signal, MAX_COMPLEXITY, MAX_COMPLEXITY);
+        if (options->filter == NULL || strstr(tuned_name, options->filter) != NULL)
+            run_tuner(options, tuned_name, signal, RA_DEFAULT_MIN_COMPLEXITY, RA_DEFAULT_MAX_COMPLEXITY);
+
+        atomic_store(&hogs_stopping, true);
+        for (int i = 0; i < hogs_count; i++) {
+            void *spins;
+            pthread_join(hogs[i], &spins);
+            bench_sink += (unsigned long) spins;
+        }
+    }
+    free(signal);
+}
+
+int main(int argc, char **argv) {
+    struct bench_options options = {.filter = NULL, .runs = BENCH_DEFAULT_RUNS, .out = stdout, .results_count = 0};
+    const char *output = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+            options.filter = argv[++i];
+        else if (!strcmp(argv[i], "--runs") && i + 1 < argc) {
+            options.runs = (int) strtol(argv[++i], NULL, 10);
+            if (options.runs < 1 || options.runs > BENCH_MAX_RUNS) {
+                printf("Invalid argument: Runs must be between 1 and %d.\n", BENCH_MAX_RUNS);
+                return EXIT_FAILURE;
+            }
+        } else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+            output = argv[++i];
+        else {
+            puts("");
+            printf("Usage: %s [--filter <Name>] [--runs <N>] [--output <File>]\n\n", argv[0]);
+            puts("[--filter]: Runs only the benchmarks whose name contains this.");
+            printf("[--runs]: Measured runs of each benchmark, the median is reported. (default: %d)\n",
+                   BENCH_DEFAULT_RUNS);
+            puts("[--output]: Writes the JSON results to this file instead of STDOUT.");
+            puts("");
+            return !strcmp(argv[i], "help") ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (output != NULL && (options.out = fopen(output, "w")) == NULL) {
+        printf("Error: Failed to open output file: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    time_t now = time(NULL);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    fprintf(options.out, "{\n  \"context\": {\"date\": \"%s\", \"opus\": \"%s\", \"dsp\": \"%s\", \"runs\": %d},\n"
+                         "  \"benchmarks\": [", date, opus_get_version_string(), dsp_kernels(), options.runs);
+
+    bench_crypto(&options);
+    bench_conversions(&options);
+    bench_resamplers(&options);
+    bench_mixers(&options);
+    bench_encoder(&options);
+    bench_packets(&options);
+    bench_task_queues(&options);
+    bench_connection_lookups(&options);
+
+    fprintf(options.out, "\n  ],\n  \"quality\": [");
+    bench_resampler_quality(&options);
+
+    fprintf(options.out, "\n  ],\n  \"tuner\": [");
+    bench_complexity_tuner(&options);
+
+    fprintf(options.out, "\n  ]\n}\n");
+    if (output != NULL)
+        fclose(options.out);
+    return options.quality_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
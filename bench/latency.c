@@ -0,0 +1,741 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Measures the end-to-end latency of raplayer on the loopback interface, no sound hardware needed.
+ *
+ * A server is fed in real time through STDIN with silence and a short tone burst every interval,
+ * and headless clients write their decoded audio back to this process. The latency of a marker is
+ * the time between its burst entering the server and its decoded onset leaving a client.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../src/pacing/pacing.h"
+
+#define LATENCY_SAMPLE_RATE 48000
+#define LATENCY_CHANNELS 2
+#define LATENCY_CHUNK_SIZE 480 // Samples written to the server at once, 10ms.
+#define LATENCY_LEAD_IN 9600 // Samples of silence before the first marker, the server may drop the first frames.
+#define LATENCY_MAX_CLIENTS 64
+#define LATENCY_MAX_ARGS 64
+
+#define MARKER_FREQUENCY 1000
+#define MARKER_DURATION 240 // Samples of the tone burst, 5ms.
+#define MARKER_AMPLITUDE 16384
+#define MARKER_THRESHOLD 4096 // Decoded samples above this are a marker, if the ones before were quiet.
+
+#define STARTUP_DELAY 300000000L // Nanoseconds for the server to bind before the clients start.
+#define PACING_GAP_TOLERANCE 0.25 // How far the mean gap may stray from the expected one with --check-pacing.
+#define PACING_BURST_GAP (PACING_SLOT_TIME / 2) // Arrivals closer than this belong to the same burst.
+#define PACING_BURST_TOLERANCE 0.05 // The share of bursts that may outgrow a slot, a late wakeup sends two slots at once.
+#define METRICS_SIZE 262144 // Bytes of a metrics scrape kept, the per-client metrics come after the ones read here.
+#define SHUTDOWN_TIMEOUT 5000000000L
+
+struct latency_options {
+    const char *raplayer;
+    const char *impairer;
+    int clients;
+    double duration; // Seconds of signal fed to the server.
+    int interval; // Milliseconds between markers, latencies must stay below it.
+    int port;
+    char *server_args;
+    char *client_args;
+    char *impair_args; // Routes the clients through raplayer-impair with these options.
+    const char *output;
+    bool check_pacing;
+    bool verbose;
+};
+
+struct client_probe {
+    pid_t pid;
+    int fd;
+    bool open;
+
+    unsigned char partial[LATENCY_CHANNELS * 2]; // Bytes of a sample split across reads.
+    int partial_len;
+    long quiet_samples;
+    int64_t *onsets; // Output time of every marker, 0 if it never arrived.
+};
+
+/* The server side of a run, from its metrics before the end of the stream and its resource usage after exit. */
+struct server_stats {
+    bool scraped;
+    double datagrams;
+    double send_syscalls;
+    double datagrams_per_second;
+    double cpu_seconds;
+    double cpu_percent; // Of one CPU, over the life of the server process.
+
+    double pacing_slice; // Seconds, 0 without pacing.
+    double pacing_fanouts;
+    double pacing_bursts;
+    double pacing_burst_datagrams;
+    double pacing_max_burst;
+    double pacing_gaps;
+    double pacing_gap_sum;
+    double pacing_min_gap;
+    double pacing_max_gap;
+};
+
+/* The fan-outs as the proxy received them, from the kernel receive times it logs with --arrivals. */
+struct arrival_stats {
+    int fanouts; // Frames every client received, the others can't show the pacing.
+    int bursts;
+    int burst_datagrams;
+    int max_burst;
+    int oversized_bursts; // Bigger than a pacing slot.
+    int gaps;
+    double gap_sum; // Seconds between the starts of consecutive bursts of a fan-out.
+    double min_gap;
+    double max_gap;
+};
+
+struct arrival {
+    uint32_t sequence;
+    int64_t time;
+};
+
+struct latency_stats {
+    int count;
+    double min, p50, p90, p99, max, mean, stddev;
+};
+
+static int64_t latency_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Sorts the values in place. */
+static struct latency_stats compute_stats(double *values, int count) {
+    struct latency_stats stats = {0};
+    if (count == 0)
+        return stats;
+
+    qsort(values, (size_t) count, sizeof(double), compare_doubles);
+    double sum = 0, square_sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += values[i];
+        square_sum += values[i] * values[i];
+    }
+
+    stats.count = count;
+    stats.min = values[0];
+    stats.p50 = values[(int) ceil(0.50 * count) - 1];
+    stats.p90 = values[(int) ceil(0.90 * count) - 1];
+    stats.p99 = values[(int) ceil(0.99 * count) - 1];
+    stats.max = values[count - 1];
+    stats.mean = sum / count;
+    stats.stddev = sqrt(fmax(square_sum / count - stats.mean * stats.mean, 0));
+    return stats;
+}
+
+static void write_stats(FILE *out, const struct latency_stats *stats) {
+    fprintf(out, "{\"count\": %d, \"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f, "
+                 "\"mean\": %.3f, \"stddev\": %.3f}", stats->count, stats->min, stats->p50, stats->p90, stats->p99,
+            stats->max, stats->mean, stats->stddev);
+}
+
+/* Fetches the server metrics over its UNIX socket into buffer, returns false if the server didn't answer. */
+static bool scrape_metrics(const char *path, char *buffer, size_t buffer_size) {
+    struct sockaddr_un unix_addr = {0};
+    unix_addr.sun_family = AF_UNIX;
+    snprintf(unix_addr.sun_path, sizeof(unix_addr.sun_path), "%s", path);
+
+    int sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock_fd < 0)
+        return false;
+    if (connect(sock_fd, (const struct sockaddr *) &unix_addr, sizeof(unix_addr)) < 0) {
+        close(sock_fd);
+        return false;
+    }
+
+    static const char request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+    size_t buffer_len = 0;
+    if (write(sock_fd, request, sizeof(request) - 1) == (ssize_t) sizeof(request) - 1) {
+        ssize_t received;
+        while (buffer_len < buffer_size - 1 &&
+               (received = read(sock_fd, buffer + buffer_len, buffer_size - 1 - buffer_len)) > 0)
+            buffer_len += (size_t) received;
+    }
+    buffer[buffer_len] = '\0';
+    close(sock_fd);
+    return strstr(buffer, "\r\n\r\n") != NULL;
+}
+
+/* The value of an unlabelled metric, NAN if the scrape doesn't have it. */
+static double find_metric(const char *metrics, const char *name) {
+    const size_t name_len = strlen(name);
+    for (const char *line = metrics; line != NULL; line = strchr(line, '\n')) {
+        if (*line == '\n')
+            line++;
+        if (!strncmp(line, name, name_len) && line[name_len] == ' ')
+            return strtod(line + name_len + 1, NULL);
+    }
+    return NAN;
+}
+
+/* Splits on spaces, no quoting. */
+static int split_args(char *args, char **argv, int max_args) {
+    int argc = 0;
+    if (args == NULL)
+        return 0;
+    for (char *arg = strtok(args, " "); arg != NULL && argc < max_args; arg = strtok(NULL, " "))
+        argv[argc++] = arg;
+    return argc;
+}
+
+/* Runs argv, the given descriptors become its STDIN and STDOUT, -1 for /dev/null. STDERR is shown with --verbose. */
+static pid_t spawn(const struct latency_options *options, char **argv, int stdin_fd, int stdout_fd) {
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+
+    int null_fd = open("/dev/null", O_RDWR);
+    dup2(stdin_fd >= 0 ? stdin_fd : null_fd, STDIN_FILENO);
+    dup2(stdout_fd >= 0 ? stdout_fd : options->verbose ? STDERR_FILENO : null_fd, STDOUT_FILENO);
+    if (!options->verbose)
+        dup2(null_fd, STDERR_FILENO);
+    for (int fd = STDERR_FILENO + 1; fd < 256; fd++)
+        close(fd);
+
+    execv(argv[0], argv);
+    fprintf(stderr, "Error: Failed to run %s: %s\n", argv[0], strerror(errno));
+    _exit(EXIT_FAILURE);
+}
+
+/* Silence with a tone burst at the start of every interval, after the lead-in. */
+static int16_t marker_sample(long sample, long interval_samples) {
+    long offset = (sample - LATENCY_LEAD_IN) % interval_samples;
+    if (sample < LATENCY_LEAD_IN || offset >= MARKER_DURATION)
+        return 0;
+    return (int16_t) (MARKER_AMPLITUDE * sin(2 * M_PI * MARKER_FREQUENCY * offset / LATENCY_SAMPLE_RATE));
+}
+
+/* Looks for marker onsets in the client's output, they are stamped with the time the bytes arrived. */
+static void read_client(struct client_probe *client, int64_t start_time, long interval_samples, int markers) {
+    unsigned char buffer[65536];
+    ssize_t buffer_len = read(client->fd, buffer, sizeof(buffer));
+    const int64_t arrival_time = latency_time();
+    if (buffer_len <= 0) {
+        if (buffer_len == 0 || errno != EINTR) {
+            close(client->fd);
+            client->open = false;
+        }
+        return;
+    }
+
+    const int sample_bytes = LATENCY_CHANNELS * 2;
+    for (ssize_t i = 0; i < buffer_len; i++) {
+        client->partial[client->partial_len++] = buffer[i];
+        if (client->partial_len < sample_bytes)
+            continue;
+        client->partial_len = 0;
+
+        int16_t sample = (int16_t) (client->partial[1] << 8 | client->partial[0]); // The left channel.
+        if (abs(sample) < MARKER_THRESHOLD) {
+            client->quiet_samples++;
+            continue;
+        }
+
+        /* The first loud sample after half an interval of quiet is an onset, the rest of the burst is not. */
+        if (client->quiet_samples >= interval_samples / 2) {
+            long marker = (long) ((double) (arrival_time - start_time) * LATENCY_SAMPLE_RATE / 1000000000.0 /
+                                  (double) interval_samples);
+            if (marker >= 0 && marker < markers && client->onsets[marker] == 0)
+                client->onsets[marker] = arrival_time;
+        }
+        client->quiet_samples = 0;
+    }
+}
+
+static int compare_arrivals(const void *a, const void *b) {
+    const struct arrival *x = a, *y = b;
+    if (x->sequence != y->sequence)
+        return x->sequence < y->sequence ? -1 : 1;
+    return x->time < y->time ? -1 : x->time > y->time;
+}
+
+/* Splits every fan-out the proxy logged into bursts, the datagrams that arrived back to back. */
+static bool measure_arrivals(const char *path, int clients, int slot_size, struct arrival_stats *stats) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Error: Failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    size_t count = 0, capacity = 4096;
+    struct arrival *arrivals = malloc(sizeof(struct arrival) * capacity);
+    long long time;
+    int client;
+    unsigned int sequence;
+    while (arrivals != NULL && fscanf(file, "%lld %d %u", &time, &client, &sequence) == 3) {
+        if (count == capacity) {
+            struct arrival *grown = realloc(arrivals, sizeof(struct arrival) * (capacity *= 2));
+            if (grown == NULL) {
+                free(arrivals);
+                arrivals = NULL;
+                break;
+            }
+            arrivals = grown;
+        }
+        arrivals[count++] = (struct arrival) {.sequence = sequence, .time = time};
+    }
+    fclose(file);
+    if (arrivals == NULL) {
+        printf("Error: Failed to allocate the arrivals.\n");
+        return false;
+    }
+    qsort(arrivals, count, sizeof(struct arrival), compare_arrivals);
+
+    *stats = (struct arrival_stats) {.min_gap = INFINITY};
+    for (size_t first = 0, end; first < count; first = end) {
+        for (end = first + 1; end < count && arrivals[end].sequence == arrivals[first].sequence; end++);
+        if (end - first != (size_t) clients)
+            continue;
+        stats->fanouts++;
+        size_t burst_start = first;
+        for (size_t i = first + 1; i <= end; i++) {
+            if (i < end && arrivals[i].time - arrivals[i - 1].time < PACING_BURST_GAP)
+                continue;
+            const int burst = (int) (i - burst_start);
+            stats->bursts++;
+            stats->burst_datagrams += burst;
+            stats->max_burst = burst > stats->max_burst ? burst : stats->max_burst;
+            stats->oversized_bursts += burst > slot_size;
+            if (i < end) {
+                const double gap = (double) (arrivals[i].time - arrivals[burst_start].time) / 1000000000.0;
+                stats->gaps++;
+                stats->gap_sum += gap;
+                stats->min_gap = fmin(stats->min_gap, gap);
+                stats->max_gap = fmax(stats->max_gap, gap);
+                burst_start = i;
+            }
+        }
+    }
+    if (stats->gaps == 0)
+        stats->min_gap = 0;
+    free(arrivals);
+    return true;
+}
+
+static void print_usage(char **argv) {
+    puts("");
+    printf("Usage: %s [--raplayer <Path>] [--clients <N>] [--duration <s>] [--interval <ms>] [--port <Port>] [--server-args <Args>] [--client-args <Args>] [--impair <Args>] [--output <File>] [--check-pacing] [--verbose]\n\n",
+           argv[0]);
+    puts("[--raplayer]: The raplayer executable to measure. (default: raplayer next to this program)");
+    puts("[--clients]: Headless clients connected to the server. (default: 3)");
+    puts("[--duration]: Seconds of audio to stream. (default: 15)");
+    puts("[--interval]: Milliseconds between timing markers, latencies must stay below it. (default: 500)");
+    puts("[--port]: The loopback port of the server. (default: 3845)");
+    puts("[--server-args]: Extra server options, like \"--profile low-latency\".");
+    puts("[--client-args]: Extra client options, like \"--retransmit 60\".");
+    puts("[--impair]: Connects the clients through raplayer-impair on the next port, like \"--gilbert 5,30 --jitter 10\".");
+    puts("[--output]: Writes the JSON results to this file instead of STDOUT.");
+    puts("[--check-pacing]: Routes the clients through raplayer-impair, fails if the datagrams arrive in bursts bigger than a pacing slot, or with gaps that stray from the slice per client.");
+    puts("[--verbose]: Shows the server messages.");
+    puts("");
+}
+
+int main(int argc, char **argv) {
+    char raplayer_path[4096], impairer_path[4096];
+    char *directory = dirname(strdup(argv[0]));
+    snprintf(raplayer_path, sizeof(raplayer_path), "%s/raplayer", directory);
+    snprintf(impairer_path, sizeof(impairer_path), "%s/raplayer-impair", directory);
+
+    struct latency_options options = {.raplayer = raplayer_path, .impairer = impairer_path, .clients = 3, .duration = 15, .interval = 500,
+                                      .port = 3845};
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--raplayer") && i + 1 < argc)
+            options.raplayer = argv[++i];
+        else if (!strcmp(argv[i], "--clients") && i + 1 < argc)
+            options.clients = (int) strtol(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--duration") && i + 1 < argc)
+            options.duration = strtod(argv[++i], NULL);
+        else if (!strcmp(argv[i], "--interval") && i + 1 < argc)
+            options.interval = (int) strtol(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--port") && i + 1 < argc)
+            options.port = (int) strtol(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--server-args") && i + 1 < argc)
+            options.server_args = strdup(argv[++i]);
+        else if (!strcmp(argv[i], "--client-args") && i + 1 < argc)
+            options.client_args = strdup(argv[++i]);
+        else if (!strcmp(argv[i], "--impair") && i + 1 < argc)
+            options.impair_args = strdup(argv[++i]);
+        else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+            options.output = argv[++i];
+        else if (!strcmp(argv[i], "--check-pacing"))
+            options.check_pacing = true;
+        else if (!strcmp(argv[i], "--verbose"))
+            options.verbose = true;
+        else {
+            print_usage(argv);
+            return !strcmp(argv[i], "help") ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (options.clients < 1 || options.clients > LATENCY_MAX_CLIENTS) {
+        printf("Invalid argument: Clients must be between 1 and %d.\n", LATENCY_MAX_CLIENTS);
+        return EXIT_FAILURE;
+    }
+    if (options.duration <= 0 || options.interval < 20) {
+        printf("Invalid argument: Duration must be positive and the interval at least 20ms.\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = stdout;
+    if (options.output != NULL && (out = fopen(options.output, "w")) == NULL) {
+        printf("Error: Failed to open output file: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    const long interval_samples = (long) options.interval * LATENCY_SAMPLE_RATE / 1000;
+    const long total_samples = (long) (options.duration * LATENCY_SAMPLE_RATE);
+    const int markers = (int) ((total_samples + interval_samples - 1) / interval_samples);
+    char port[16], client_port[16];
+    snprintf(port, sizeof(port), "%d", options.port);
+    const bool proxied = options.impair_args != NULL || options.check_pacing;
+    snprintf(client_port, sizeof(client_port), "%d", proxied ? options.port + 1 : options.port);
+
+    /* The server, fed through a pipe in --stream mode, so nothing piles up before the first client. */
+    int server_pipe[2];
+    if (pipe(server_pipe) < 0) {
+        printf("Error: Failed to create a pipe: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    char metrics_path[108], metrics_address[128];
+    snprintf(metrics_path, sizeof(metrics_path), "/tmp/raplayer-latency-%d.sock", (int) getpid());
+    snprintf(metrics_address, sizeof(metrics_address), "unix:%s", metrics_path);
+    char *server_argv[LATENCY_MAX_ARGS + 8] = {(char *) options.raplayer, "--server", "--stream", "--metrics", metrics_address};
+    int server_argc = 5 + split_args(options.server_args, server_argv + 5, LATENCY_MAX_ARGS);
+    server_argv[server_argc++] = "-";
+    server_argv[server_argc++] = port;
+    server_argv[server_argc] = NULL;
+    const int64_t server_start_time = latency_time();
+    pid_t server_pid = spawn(&options, server_argv, server_pipe[0], -1);
+    close(server_pipe[0]);
+    const int server_fd = server_pipe[1];
+
+    /* The impairment proxy listens on the next port, its summary goes to STDERR when it stops.
+     * --check-pacing routes the clients through it as well, it logs when the datagrams of the server really arrived. */
+    char arrivals_path[108];
+    snprintf(arrivals_path, sizeof(arrivals_path), "/tmp/raplayer-latency-%d.arrivals", (int) getpid());
+    pid_t impairer_pid = -1;
+    if (proxied) {
+        char *impair_args = options.impair_args != NULL ? strdup(options.impair_args) : NULL;
+        char *impairer_argv[LATENCY_MAX_ARGS + 7] = {(char *) options.impairer};
+        int impairer_argc = 1 + split_args(impair_args, impairer_argv + 1, LATENCY_MAX_ARGS);
+        if (options.check_pacing) {
+            impairer_argv[impairer_argc++] = "--arrivals";
+            impairer_argv[impairer_argc++] = arrivals_path;
+        }
+        impairer_argv[impairer_argc++] = client_port;
+        impairer_argv[impairer_argc++] = "127.0.0.1";
+        impairer_argv[impairer_argc++] = port;
+        impairer_argv[impairer_argc] = NULL;
+        impairer_pid = spawn(&options, impairer_argv, -1, STDERR_FILENO);
+        free(impair_args);
+    }
+
+    struct timespec startup_delay = {0, STARTUP_DELAY};
+    nanosleep(&startup_delay, NULL);
+
+    struct client_probe clients[LATENCY_MAX_CLIENTS] = {0};
+    struct pollfd poll_fds[LATENCY_MAX_CLIENTS];
+    for (int i = 0; i < options.clients; i++) {
+        int client_pipe[2];
+        if (pipe(client_pipe) < 0) {
+            printf("Error: Failed to create a pipe: %s\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+        char *client_argv[LATENCY_MAX_ARGS + 8] = {(char *) options.raplayer, "--client", "--output", "-"};
+        char *client_args = options.client_args != NULL ? strdup(options.client_args) : NULL;
+        int client_argc = 4 + split_args(client_args, client_argv + 4, LATENCY_MAX_ARGS);
+        client_argv[client_argc++] = "127.0.0.1";
+        client_argv[client_argc++] = client_port;
+        client_argv[client_argc] = NULL;
+
+        clients[i].pid = spawn(&options, client_argv, -1, client_pipe[1]);
+        close(client_pipe[1]);
+        free(client_args);
+        clients[i].fd = client_pipe[0];
+        clients[i].open = true;
+        clients[i].quiet_samples = interval_samples; // So the first marker counts.
+        clients[i].onsets = calloc((size_t) markers, sizeof(int64_t));
+    }
+
+    /* Feeds the signal in real time, every chunk is written once its last sample would have been captured. */
+    const int64_t feed_time = latency_time();
+    const int64_t start_time = feed_time + (int64_t) LATENCY_LEAD_IN * 1000000000L / LATENCY_SAMPLE_RATE;
+    int16_t chunk[LATENCY_CHUNK_SIZE * LATENCY_CHANNELS];
+    unsigned char chunk_bytes[sizeof(chunk)];
+    for (long written_samples = 0; written_samples < LATENCY_LEAD_IN + total_samples;
+         written_samples += LATENCY_CHUNK_SIZE) {
+        const int64_t write_time = feed_time + (int64_t) ((double) (written_samples + LATENCY_CHUNK_SIZE) *
+                                                           1000000000.0 / LATENCY_SAMPLE_RATE);
+        int64_t now;
+        while ((now = latency_time()) < write_time) {
+            int poll_count = 0;
+            for (int i = 0; i < options.clients; i++) {
+                poll_fds[poll_count].fd = clients[i].open ? clients[i].fd : -1;
+                poll_fds[poll_count++].events = POLLIN;
+            }
+            if (poll(poll_fds, (nfds_t) poll_count, (int) ((write_time - now + 999999) / 1000000)) <= 0)
+                continue;
+            for (int i = 0; i < options.clients; i++)
+                if (poll_fds[i].revents & (POLLIN | POLLHUP))
+                    read_client(&clients[i], start_time, interval_samples, markers);
+        }
+
+        for (int i = 0; i < LATENCY_CHUNK_SIZE; i++)
+            for (int channel = 0; channel < LATENCY_CHANNELS; channel++)
+                chunk[i * LATENCY_CHANNELS + channel] = marker_sample(written_samples + i, interval_samples);
+        for (size_t i = 0; i < sizeof(chunk) / sizeof(chunk[0]); i++) {
+            chunk_bytes[2 * i] = chunk[i] & 0xFF;
+            chunk_bytes[2 * i + 1] = (chunk[i] >> 8) & 0xFF;
+        }
+        if (write(server_fd, chunk_bytes, sizeof(chunk_bytes)) != (ssize_t) sizeof(chunk_bytes)) {
+            printf("Error: The server stopped reading: %s\n", strerror(errno));
+            break;
+        }
+    }
+
+    /* The server exits at the end of the stream, so it's scraped while the last frames are still buffered. */
+    struct server_stats server_stats = {0};
+    char *metrics = malloc(METRICS_SIZE);
+    if (scrape_metrics(metrics_path, metrics, METRICS_SIZE)) {
+        server_stats.scraped = true;
+        server_stats.datagrams = find_metric(metrics, "raplayer_datagrams_sent_total");
+        server_stats.send_syscalls = find_metric(metrics, "raplayer_send_syscalls_total");
+        server_stats.datagrams_per_second = server_stats.datagrams * 1000000000.0 / (double) (latency_time() - feed_time);
+        server_stats.pacing_slice = find_metric(metrics, "raplayer_pacing_slice_seconds");
+        server_stats.pacing_fanouts = find_metric(metrics, "raplayer_pacing_fanouts_total");
+        server_stats.pacing_bursts = find_metric(metrics, "raplayer_pacing_bursts_total");
+        server_stats.pacing_burst_datagrams = find_metric(metrics, "raplayer_pacing_burst_datagrams_total");
+        server_stats.pacing_max_burst = find_metric(metrics, "raplayer_pacing_max_burst_datagrams");
+        server_stats.pacing_gaps = find_metric(metrics, "raplayer_pacing_gap_seconds_count");
+        server_stats.pacing_gap_sum = find_metric(metrics, "raplayer_pacing_gap_seconds_sum");
+        server_stats.pacing_min_gap = find_metric(metrics, "raplayer_pacing_min_gap_seconds");
+        server_stats.pacing_max_gap = find_metric(metrics, "raplayer_pacing_max_gap_seconds");
+    } else
+        fprintf(stderr, "Warning: Failed to scrape the server metrics.\n");
+    free(metrics);
+
+    /* End of stream, the clients exit once they got the rest. */
+    close(server_fd);
+    const int64_t shutdown_time = latency_time();
+    while (latency_time() - shutdown_time < SHUTDOWN_TIMEOUT) {
+        int open_clients = 0;
+        for (int i = 0; i < options.clients; i++) {
+            poll_fds[i].fd = clients[i].open ? clients[i].fd : -1;
+            poll_fds[i].events = POLLIN;
+            open_clients += clients[i].open;
+        }
+        if (open_clients == 0)
+            break;
+        if (poll(poll_fds, (nfds_t) options.clients, 100) <= 0)
+            continue;
+        for (int i = 0; i < options.clients; i++)
+            if (poll_fds[i].revents & (POLLIN | POLLHUP))
+                read_client(&clients[i], start_time, interval_samples, markers);
+    }
+    kill(server_pid, SIGTERM);
+    struct rusage server_usage;
+    if (wait4(server_pid, NULL, 0, &server_usage) == server_pid) {
+        server_stats.cpu_seconds = (double) server_usage.ru_utime.tv_sec + (double) server_usage.ru_utime.tv_usec / 1000000.0 +
+                                   (double) server_usage.ru_stime.tv_sec + (double) server_usage.ru_stime.tv_usec / 1000000.0;
+        server_stats.cpu_percent = server_stats.cpu_seconds * 100.0 * 1000000000.0 /
+                                   (double) (latency_time() - server_start_time);
+    }
+    unlink(metrics_path);
+    if (impairer_pid > 0) {
+        kill(impairer_pid, SIGTERM);
+        waitpid(impairer_pid, NULL, 0);
+    }
+    for (int i = 0; i < options.clients; i++) {
+        if (clients[i].open)
+            close(clients[i].fd);
+        kill(clients[i].pid, SIGTERM);
+        waitpid(clients[i].pid, NULL, 0);
+    }
+
+    /* Latencies in milliseconds, the markers heard by every client give the skew between them. */
+    double *all_latencies = malloc(sizeof(double) * (size_t) (markers * options.clients));
+    double *skews = malloc(sizeof(double) * (size_t) markers);
+    int all_count = 0, skew_count = 0;
+    double max_latency = 0;
+
+    fprintf(out, "{\n  \"config\": {\"clients\": %d, \"duration\": %.1f, \"interval_ms\": %d, \"server_args\": \"%s\", "
+                 "\"client_args\": \"%s\", \"impair_args\": \"%s\"},\n  \"clients\": [", options.clients, options.duration,
+            options.interval, options.server_args != NULL ? options.server_args : "",
+            options.client_args != NULL ? options.client_args : "", options.impair_args != NULL ? options.impair_args : "");
+
+    for (int i = 0; i < options.clients; i++) {
+        double latencies[markers];
+        int count = 0, jitter_count = 0;
+        double jitter_sum = 0, previous_latency = -1;
+
+        for (int marker = 0; marker < markers; marker++) {
+            if (clients[i].onsets[marker] == 0) {
+                previous_latency = -1;
+                continue;
+            }
+            const int64_t capture_time = start_time + (int64_t) ((double) marker * (double) interval_samples *
+                                                                 1000000000.0 / LATENCY_SAMPLE_RATE);
+            double latency = (double) (clients[i].onsets[marker] - capture_time) / 1000000.0;
+            latencies[count++] = latency;
+            all_latencies[all_count++] = latency;
+            max_latency = fmax(max_latency, latency);
+
+            /* Jitter as the mean difference between consecutive markers. */
+            if (previous_latency >= 0) {
+                jitter_sum += fabs(latency - previous_latency);
+                jitter_count++;
+            }
+            previous_latency = latency;
+        }
+
+        int missed = markers - count;
+        struct latency_stats stats = compute_stats(latencies, count);
+        double jitter = jitter_count > 0 ? jitter_sum / jitter_count : 0;
+        fprintf(out, "%s\n    {\"client\": %d, \"missed\": %d, \"jitter_ms\": %.3f, \"latency_ms\": ",
+                i > 0 ? "," : "", i + 1, missed, jitter);
+        write_stats(out, &stats);
+        fprintf(out, "}");
+        fprintf(stderr, "Client %d: %d markers, %d missed, latency p50 %.1fms p99 %.1fms, jitter %.2fms\n", i + 1,
+                count, missed, stats.p50, stats.p99, jitter);
+    }
+
+    for (int marker = 0; marker < markers; marker++) {
+        int64_t earliest = INT64_MAX, latest = 0;
+        bool heard_by_all = true;
+        for (int i = 0; i < options.clients && heard_by_all; i++) {
+            heard_by_all = clients[i].onsets[marker] != 0;
+            earliest = clients[i].onsets[marker] < earliest ? clients[i].onsets[marker] : earliest;
+            latest = clients[i].onsets[marker] > latest ? clients[i].onsets[marker] : latest;
+        }
+        if (heard_by_all)
+            skews[skew_count++] = (double) (latest - earliest) / 1000000.0;
+    }
+
+    struct latency_stats latency_stats = compute_stats(all_latencies, all_count);
+    struct latency_stats skew_stats = compute_stats(skews, skew_count);
+    fprintf(out, "\n  ],\n  \"latency_ms\": ");
+    write_stats(out, &latency_stats);
+    fprintf(out, ",\n  \"skew_ms\": ");
+    write_stats(out, &skew_stats);
+    /* Every client gets one datagram per frame, so a fan-out fills up to one slot per client. */
+    const double pacing_slots = fmin(options.clients, floor(server_stats.pacing_slice * 1000000000.0 / PACING_SLOT_TIME));
+    const double expected_burst = pacing_slots > 0 ? ceil(options.clients / pacing_slots) : 0;
+    const double expected_gap = pacing_slots > 0 ? server_stats.pacing_slice / pacing_slots : 0;
+    const double mean_burst = server_stats.pacing_bursts > 0 ? server_stats.pacing_burst_datagrams / server_stats.pacing_bursts : 0;
+    const double mean_gap = server_stats.pacing_gaps > 0 ? server_stats.pacing_gap_sum / server_stats.pacing_gaps : 0;
+    struct arrival_stats arrival_stats = {0};
+    if (options.check_pacing) {
+        if (!measure_arrivals(arrivals_path, options.clients, (int) expected_burst, &arrival_stats))
+            return EXIT_FAILURE;
+        unlink(arrivals_path);
+    }
+
+    fprintf(out, ",\n  \"server\": {\"datagrams\": %.0f, \"send_syscalls\": %.0f, \"datagrams_per_second\": %.1f, "
+                 "\"cpu_seconds\": %.3f, \"cpu_percent\": %.2f}", server_stats.datagrams, server_stats.send_syscalls,
+            server_stats.datagrams_per_second, server_stats.cpu_seconds, server_stats.cpu_percent);
+    fprintf(out, ",\n  \"pacing\": {\"slice_ms\": %.3f, \"fanouts\": %.0f, \"mean_burst\": %.2f, \"max_burst\": %.0f, "
+                 "\"expected_burst\": %.0f, \"mean_gap_ms\": %.3f, \"min_gap_ms\": %.3f, \"max_gap_ms\": %.3f, "
+                 "\"expected_gap_ms\": %.3f}", server_stats.pacing_slice * 1000.0, server_stats.pacing_fanouts, mean_burst,
+            server_stats.pacing_max_burst, expected_burst, mean_gap * 1000.0, server_stats.pacing_min_gap * 1000.0,
+            server_stats.pacing_max_gap * 1000.0, expected_gap * 1000.0);
+    const double arrival_mean_burst = arrival_stats.bursts > 0 ? (double) arrival_stats.burst_datagrams / arrival_stats.bursts : 0;
+    const double arrival_mean_gap = arrival_stats.gaps > 0 ? arrival_stats.gap_sum / arrival_stats.gaps : 0;
+    if (options.check_pacing)
+        fprintf(out, ",\n  \"arrivals\": {\"fanouts\": %d, \"mean_burst\": %.2f, \"max_burst\": %d, \"oversized_bursts\": %d, "
+                     "\"mean_gap_ms\": %.3f, \"min_gap_ms\": %.3f, \"max_gap_ms\": %.3f}", arrival_stats.fanouts,
+                arrival_mean_burst, arrival_stats.max_burst, arrival_stats.oversized_bursts, arrival_mean_gap * 1000.0, arrival_stats.min_gap * 1000.0,
+                arrival_stats.max_gap * 1000.0);
+    fprintf(out, "\n}\n");
+    if (out != stdout)
+        fclose(out);
+
+    fprintf(stderr, "Latency p50 %.1fms p90 %.1fms p99 %.1fms, inter-client skew p50 %.2fms max %.2fms\n",
+            latency_stats.p50, latency_stats.p90, latency_stats.p99, skew_stats.p50, skew_stats.max);
+    if (server_stats.scraped)
+        fprintf(stderr, "Server %.0f datagrams/s in %.0f send calls, %.2fs CPU (%.1f%%)\n",
+                server_stats.datagrams_per_second, server_stats.send_syscalls, server_stats.cpu_seconds,
+                server_stats.cpu_percent);
+    if (server_stats.pacing_slice > 0)
+        fprintf(stderr, "Pacing %.1fms slice, scheduled: bursts of %.2f datagrams (max %.0f), gaps %.3f/%.3f/%.3fms (min/avg/max), "
+                        "%.3fms expected\n", server_stats.pacing_slice * 1000.0, mean_burst, server_stats.pacing_max_burst,
+                server_stats.pacing_min_gap * 1000.0, mean_gap * 1000.0, server_stats.pacing_max_gap * 1000.0,
+                expected_gap * 1000.0);
+    if (options.check_pacing)
+        fprintf(stderr, "Arrivals of %d fan-outs: bursts of %.2f datagrams (max %d, %d oversized), gaps %.3f/%.3f/%.3fms (min/avg/max)\n",
+                arrival_stats.fanouts, arrival_mean_burst, arrival_stats.max_burst, arrival_stats.oversized_bursts,
+                arrival_stats.min_gap * 1000.0,
+                arrival_mean_gap * 1000.0, arrival_stats.max_gap * 1000.0);
+    if (max_latency > options.interval * 0.9)
+        fprintf(stderr, "Warning: Latencies come close to the marker interval, raise --interval to measure them.\n");
+    if (all_count == 0) {
+        fprintf(stderr, "Error: No marker came through.\n");
+        return EXIT_FAILURE;
+    }
+    if (options.check_pacing) {
+        if (!(server_stats.pacing_slice > 0) || !(server_stats.pacing_gaps > 0)) {
+            fprintf(stderr, "Error: The server didn't pace, pass --pacing in --server-args.\n");
+            return EXIT_FAILURE;
+        }
+        if (arrival_stats.fanouts == 0) {
+            fprintf(stderr, "Error: No fan-out reached every client through the proxy.\n");
+            return EXIT_FAILURE;
+        }
+        if (arrival_stats.oversized_bursts > arrival_stats.bursts * PACING_BURST_TOLERANCE) {
+            fprintf(stderr, "Error: %d of %d bursts arrived bigger than the %.0f datagrams of a slot.\n",
+                    arrival_stats.oversized_bursts, arrival_stats.bursts, expected_burst);
+            return EXIT_FAILURE;
+        }
+        if (fabs(arrival_mean_gap - expected_gap) > expected_gap * PACING_GAP_TOLERANCE) {
+            fprintf(stderr, "Error: The mean gap of %.3fms between arrivals is more than %.0f%% off the %.3fms of slice/N.\n",
+                    arrival_mean_gap * 1000.0, PACING_GAP_TOLERANCE * 100, expected_gap * 1000.0);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
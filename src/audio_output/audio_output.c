@@ -0,0 +1,283 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "audio_output.h"
+#include "../dsp/dsp.h"
+
+static int64_t output_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*
+ * Picks the rate and format to open the device with, so the host API has nothing left to convert. PortAudio tells
+ * the device's default rate but not its format, floats are tried first as the host APIs mix in them.
+ * Falls back to 16 bit samples at the stream's rate and returns that rate.
+ */
+static int negotiate_output(PaStreamParameters *output_parameters, int stream_rate) {
+    const double rates[] = {Pa_GetDeviceInfo(output_parameters->device)->defaultSampleRate, stream_rate};
+    const PaSampleFormat formats[] = {paFloat32, paInt16};
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        for (size_t j = 0; j < sizeof(formats) / sizeof(formats[0]) && rates[i] > 0; j++) {
+            output_parameters->sampleFormat = formats[j];
+            if (Pa_IsFormatSupported(NULL, output_parameters, rates[i]) == paFormatIsSupported)
+                return (int) rates[i];
+        }
+    }
+    output_parameters->sampleFormat = paInt16;
+    return stream_rate;
+}
+
+static void *initialize_portaudio(void *p_device) {
+    DeviceOutput *device = (DeviceOutput *) p_device;
+    device->init_error = Pa_Initialize();
+    device->init_end = output_time();
+    return NULL;
+}
+
+/* Waits for PortAudio to be initialized, returns false if it failed. */
+static bool join_initializer(DeviceOutput *device) {
+    if (device->initializing) {
+        pthread_join(device->initializer, NULL);
+        device->initializing = false;
+    }
+    return device->init_error == paNoError;
+}
+
+static bool open_device(void *p_device, int channels, int stream_rate, int *output_rate, bool *float_output) {
+    DeviceOutput *device = (DeviceOutput *) p_device;
+    PaStreamParameters outputParameters;
+
+    const int64_t wait_start = output_time();
+    if (!join_initializer(device)) {
+        printf("PortAudio error: %s\n", Pa_GetErrorText(device->init_error));
+        return false;
+    }
+    const int64_t wait_end = output_time();
+    printf("Audio initialized in %.1fms, waited %.1fms for it\n", (double) (device->init_end - device->init_start) / 1000,
+           (double) (wait_end - wait_start) / 1000);
+
+    outputParameters.device = Pa_GetDefaultOutputDevice(); /* Get default output device */
+    if (outputParameters.device == paNoDevice) {
+        printf("Error: No default output device.\n");
+        return false;
+    }
+
+    outputParameters.channelCount = channels;
+    outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
+    outputParameters.hostApiSpecificStreamInfo = NULL;
+    *output_rate = negotiate_output(&outputParameters, stream_rate);
+    *float_output = outputParameters.sampleFormat == paFloat32;
+
+    PaError err = Pa_OpenStream(
+            &device->stream,
+            NULL, /* no input */
+            &outputParameters,
+            (double) *output_rate,
+            paFramesPerBufferUnspecified,
+            paClipOff, /* samples saturate on conversion, floats are clipped to [-1, 1] before they are written */
+            NULL, /* no callback, use blocking I/O */
+            NULL);
+    if (err != paNoError) {
+        printf("PortAudio error: %s\n", Pa_GetErrorText(err));
+        device->stream = NULL;
+        return false;
+    }
+
+    printf("Output: %dHz, %s\n", *output_rate, *float_output ? "float" : "16 bit");
+    const PaStreamInfo *stream_info = Pa_GetStreamInfo(device->stream);
+    if (stream_info != NULL)
+        printf("Output latency: %.1fms\n", stream_info->outputLatency * 1000);
+
+    Pa_StartStream(device->stream);
+    device->device_frames = Pa_GetStreamWriteAvailable(device->stream); // Nothing is written yet.
+    return true;
+}
+
+static bool write_device(void *p_device, void *samples, int frames) {
+    Pa_WriteStream(((DeviceOutput *) p_device)->stream, samples, frames);
+    return true;
+}
+
+static long device_queued(void *p_device) {
+    DeviceOutput *device = (DeviceOutput *) p_device;
+    long available = Pa_GetStreamWriteAvailable(device->stream);
+    if (available >= 0 && available < device->device_frames)
+        return device->device_frames - available;
+    return 0;
+}
+
+static void close_device(void *p_device) {
+    DeviceOutput *device = (DeviceOutput *) p_device;
+    Pa_StopStream(device->stream);
+    Pa_CloseStream(device->stream);
+    device->stream = NULL;
+}
+
+/* Starts initializing PortAudio in the background. */
+void init_device_output(RaOutput *output, DeviceOutput *device) {
+    device->stream = NULL;
+    device->device_frames = 0;
+    device->init_start = output_time();
+    device->init_end = device->init_start;
+    device->init_error = paNoError;
+    device->initializing = pthread_create(&device->initializer, NULL, initialize_portaudio, device) == 0;
+    if (!device->initializing)
+        initialize_portaudio(device);
+
+    output->open = open_device;
+    output->write = write_device;
+    output->queued = device_queued;
+    output->close = close_device;
+    output->user_data = device;
+}
+
+/* After the output was closed, or if it was never opened. */
+void destroy_device_output(DeviceOutput *device) {
+    if (join_initializer(device))
+        Pa_Terminate();
+}
+
+void init_simulated_device(SimulatedDevice *device, double skew) {
+    memset(device, 0, sizeof(SimulatedDevice));
+    device->skew = skew;
+}
+
+/* Frames written but not played yet. */
+static int64_t simulated_device_queued(SimulatedDevice *device, int64_t now) {
+    if (!device->started)
+        return device->written;
+
+    int64_t queued = device->written - (int64_t) ((double) (now - device->start_time) * device->frames_per_us);
+    if (queued < 0) {
+        device->underruns++;
+        device->started = false;
+        device->written = 0;
+        return 0;
+    }
+    return queued;
+}
+
+static void simulated_device_write(SimulatedDevice *device, int frames) {
+    int64_t excess = simulated_device_queued(device, output_time()) + frames - device->buffer_frames;
+    if (device->started && excess > 0) {
+        int64_t wait_time = (int64_t) ceil((double) excess / device->frames_per_us);
+        struct timespec timespec = {wait_time / 1000000, (wait_time % 1000000) * 1000};
+        nanosleep(&timespec, NULL);
+    }
+
+    device->written += frames;
+    if (!device->started && device->written >= device->buffer_frames) {
+        device->started = true;
+        device->start_time = output_time();
+    }
+}
+
+static bool write_output(int output_fd, const unsigned char *bytes, size_t bytes_len) {
+    while (bytes_len > 0) {
+        ssize_t written = write(output_fd, bytes, bytes_len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            printf("Error: Failed to write the output: %s\n", strerror(errno));
+            return false;
+        }
+        bytes += written;
+        bytes_len -= (size_t) written;
+    }
+    return true;
+}
+
+/* The headless output is written at the stream's rate, as 16 bits samples. */
+static bool open_file(void *p_file, int channels, int stream_rate, int *output_rate, bool *float_output) {
+    FileOutput *file = (FileOutput *) p_file;
+    file->channels = channels;
+    *output_rate = stream_rate;
+    *float_output = false;
+
+    if (file->simulated_device != NULL) {
+        SimulatedDevice *device = file->simulated_device;
+        device->frames_per_us = stream_rate * (1 + device->skew / 1000000) / 1000000;
+        device->buffer_frames = (int64_t) stream_rate * SIMULATED_DEVICE_BUFFER / 1000000;
+    }
+    return true;
+}
+
+static bool write_file(void *p_file, void *samples, int frames) {
+    FileOutput *file = (FileOutput *) p_file;
+    if (file->simulated_device != NULL)
+        simulated_device_write(file->simulated_device, frames);
+    native_to_s16le((int16_t *) samples, file->channels * frames);
+    return write_output(file->output_fd, (unsigned char *) samples, (size_t) (file->channels * frames) * sizeof(int16_t));
+}
+
+static long file_queued(void *p_file) {
+    return (long) simulated_device_queued(((FileOutput *) p_file)->simulated_device, output_time());
+}
+
+static void close_file(void *p_file) {
+    FileOutput *file = (FileOutput *) p_file;
+    close(file->output_fd);
+    file->output_fd = -1;
+}
+
+/* Opens the headless output, STDOUT gets the audio then and the messages go to STDERR, if it's open. */
+static int open_output(const char *output_path) {
+    if (strcmp(output_path, STDOUT_OUTPUT) != 0)
+        return open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    /* Kept clear of STDERR's descriptor, which may be closed and would be reused. */
+    bool stderr_open = fcntl(STDERR_FILENO, F_GETFD) >= 0;
+    int output_fd = fcntl(STDOUT_FILENO, F_DUPFD, STDERR_FILENO + 1);
+    fflush(stdout);
+    if (!stderr_open || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+    return output_fd;
+}
+
+/*
+ * Opens the file right away, so a bad path fails before connecting. Only a simulated device gives the output a
+ * clock of its own to compensate the drift of.
+ */
+bool open_file_output(RaOutput *output, FileOutput *file, const char *output_path, SimulatedDevice *simulated_device) {
+    if ((file->output_fd = open_output(output_path)) < 0)
+        return false;
+    file->channels = 0;
+    file->simulated_device = simulated_device;
+
+    output->open = open_file;
+    output->write = write_file;
+    output->queued = simulated_device != NULL ? file_queued : NULL;
+    output->close = close_file;
+    output->user_data = file;
+    return true;
+}
@@ -0,0 +1,78 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAPLAYER_AUDIO_OUTPUT_H
+#define RAPLAYER_AUDIO_OUTPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <portaudio.h>
+
+#include "../raplayer.h"
+
+#define STDOUT_OUTPUT "-" // Headless output of the decoded audio to STDOUT.
+#define SIMULATED_DEVICE_BUFFER 40000 // Microseconds of audio the simulated sound card of --device-skew holds.
+
+/*
+ * The default sound card, opened at its own rate and format with blocking writes. PortAudio enumerates the devices
+ * of every host API when it's initialized, which takes a while, so that runs on a thread of its own while the
+ * client connects.
+ */
+typedef struct {
+    pthread_t initializer;
+    bool initializing; // The initializer wasn't joined yet.
+    PaError init_error;
+    int64_t init_start, init_end; // Microseconds.
+
+    PaStream *stream;
+    long device_frames; // Of the stream's buffer, to tell how much is queued.
+} DeviceOutput;
+
+/*
+ * A sound card for the headless output, playing at its own skewed rate. It starts once its buffer is full,
+ * again after an underrun, and writes block while the buffer is full, like PortAudio's blocking writes.
+ */
+typedef struct {
+    double skew; // ppm.
+    double frames_per_us;
+    int64_t buffer_frames;
+    bool started;
+    int64_t start_time;
+    int64_t written; // Frames since the start.
+    unsigned long underruns;
+} SimulatedDevice;
+
+/* Headless output of S16LE PCM to a file or STDOUT, at the stream's rate. */
+typedef struct {
+    int output_fd;
+    int channels;
+    SimulatedDevice *simulated_device; // Paces the output, NULL to write at once.
+} FileOutput;
+
+void init_device_output(RaOutput *output, DeviceOutput *device);
+
+void destroy_device_output(DeviceOutput *device);
+
+bool open_file_output(RaOutput *output, FileOutput *file, const char *output_path, SimulatedDevice *simulated_device);
+
+void init_simulated_device(SimulatedDevice *device, double skew);
+
+#endif
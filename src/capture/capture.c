@@ -0,0 +1,128 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "capture.h"
+
+#define CAPTURE_FLUSH_INTERVAL 1000000 // Microseconds, bounds what a killed client loses.
+
+static void put_le16(unsigned char *buffer, uint16_t value) {
+    buffer[0] = value & 0xFF;
+    buffer[1] = (value >> 8) & 0xFF;
+}
+
+static void put_le32(unsigned char *buffer, uint32_t value) {
+    put_le16(buffer, value & 0xFFFF);
+    put_le16(buffer + 2, (value >> 16) & 0xFFFF);
+}
+
+static uint16_t get_le16(const unsigned char *buffer) {
+    return (uint16_t) (buffer[0] | buffer[1] << 8);
+}
+
+static uint32_t get_le32(const unsigned char *buffer) {
+    return get_le16(buffer) | (uint32_t) get_le16(buffer + 2) << 16;
+}
+
+bool open_capture(Capture *capture, const char *path, const CaptureHeader *header) {
+    unsigned char buffer[CAPTURE_HEADER_SIZE];
+    memcpy(buffer, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE);
+    put_le16(buffer + CAPTURE_MAGIC_SIZE, header->channels);
+    put_le16(buffer + CAPTURE_MAGIC_SIZE + 2, header->bits_per_sample);
+    put_le32(buffer + CAPTURE_MAGIC_SIZE + 4, header->sample_rate);
+    put_le32(buffer + CAPTURE_MAGIC_SIZE + 8, header->frame_duration);
+    put_le32(buffer + CAPTURE_MAGIC_SIZE + 12, header->pcm_size);
+    put_le32(buffer + CAPTURE_MAGIC_SIZE + 16, header->retransmit_delay);
+    memcpy(buffer + CAPTURE_MAGIC_SIZE + 20, header->crypto_payload, sizeof(header->crypto_payload));
+
+    capture->last_time = -1;
+    capture->flush_time = 0;
+    if ((capture->file = fopen(path, "wb")) == NULL)
+        return false;
+    return fwrite(buffer, 1, sizeof(buffer), capture->file) == sizeof(buffer);
+}
+
+/* Arrival times are in microseconds, gaps longer than an hour are cut short. */
+bool write_capture(Capture *capture, const unsigned char *datagram, uint16_t datagram_len, int64_t arrival_time) {
+    unsigned char record[CAPTURE_RECORD_SIZE];
+    int64_t delta = capture->last_time < 0 ? 0 : arrival_time - capture->last_time;
+    put_le32(record, (uint32_t) (delta < 0 ? 0 : delta > UINT32_MAX ? UINT32_MAX : delta));
+    put_le16(record + 4, datagram_len);
+    capture->last_time = arrival_time;
+
+    if (fwrite(record, 1, sizeof(record), capture->file) != sizeof(record) ||
+        fwrite(datagram, 1, datagram_len, capture->file) != datagram_len)
+        return false;
+
+    if (arrival_time - capture->flush_time >= CAPTURE_FLUSH_INTERVAL) {
+        capture->flush_time = arrival_time;
+        return fflush(capture->file) == 0;
+    }
+    return true;
+}
+
+bool open_replay(Capture *capture, const char *path, CaptureHeader *header) {
+    unsigned char buffer[CAPTURE_HEADER_SIZE];
+    capture->last_time = 0;
+    if ((capture->file = fopen(path, "rb")) == NULL)
+        return false;
+    if (fread(buffer, 1, sizeof(buffer), capture->file) != sizeof(buffer) ||
+        memcmp(buffer, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE) != 0) {
+        fclose(capture->file);
+        capture->file = NULL;
+        return false;
+    }
+
+    header->channels = get_le16(buffer + CAPTURE_MAGIC_SIZE);
+    header->bits_per_sample = get_le16(buffer + CAPTURE_MAGIC_SIZE + 2);
+    header->sample_rate = get_le32(buffer + CAPTURE_MAGIC_SIZE + 4);
+    header->frame_duration = get_le32(buffer + CAPTURE_MAGIC_SIZE + 8);
+    header->pcm_size = get_le32(buffer + CAPTURE_MAGIC_SIZE + 12);
+    header->retransmit_delay = get_le32(buffer + CAPTURE_MAGIC_SIZE + 16);
+    memcpy(header->crypto_payload, buffer + CAPTURE_MAGIC_SIZE + 20, sizeof(header->crypto_payload));
+    return true;
+}
+
+/*
+ * Reads the next datagram, *arrival_time is its microseconds since the first one.
+ * Returns its length, 0 at the end of the capture and -1 if the capture is cut off or the datagram too large.
+ */
+int read_capture(Capture *capture, unsigned char *datagram, size_t datagram_size, int64_t *arrival_time) {
+    unsigned char record[CAPTURE_RECORD_SIZE];
+    size_t record_len = fread(record, 1, sizeof(record), capture->file);
+    if (record_len == 0)
+        return 0;
+
+    uint16_t datagram_len = get_le16(record + 4);
+    if (record_len != sizeof(record) || datagram_len > datagram_size ||
+        fread(datagram, 1, datagram_len, capture->file) != datagram_len)
+        return -1;
+
+    capture->last_time += get_le32(record);
+    *arrival_time = capture->last_time;
+    return datagram_len;
+}
+
+void close_capture(Capture *capture) {
+    if (capture->file != NULL)
+        fclose(capture->file);
+    capture->file = NULL;
+}
@@ -0,0 +1,66 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAPLAYER_CAPTURE_H
+#define RAPLAYER_CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../chacha20/chacha20.h"
+
+#define CAPTURE_MAGIC "RACAPTR1"
+#define CAPTURE_MAGIC_SIZE 8
+#define CAPTURE_HEADER_SIZE (CAPTURE_MAGIC_SIZE + 20 + CHACHA20_NONCEBYTES + CHACHA20_KEYBYTES)
+#define CAPTURE_RECORD_SIZE 6 // Arrival time delta and length before every datagram.
+
+/* What the handshake told the client, a replay needs it in place of the server. */
+typedef struct {
+    uint16_t channels;
+    uint16_t bits_per_sample;
+    uint32_t sample_rate;
+    uint32_t frame_duration; // Microseconds.
+    uint32_t pcm_size;
+    uint32_t retransmit_delay; // Microseconds the client held frames back for retransmissions.
+    unsigned char crypto_payload[CHACHA20_NONCEBYTES + CHACHA20_KEYBYTES];
+} CaptureHeader;
+
+/*
+ * A file of received datagrams, each stored with the microseconds since the previous one.
+ * All fields are little-endian.
+ */
+typedef struct {
+    FILE *file;
+    int64_t last_time; // Arrival of the previous datagram, -1 before the first.
+    int64_t flush_time;
+} Capture;
+
+bool open_capture(Capture *capture, const char *path, const CaptureHeader *header);
+
+bool write_capture(Capture *capture, const unsigned char *datagram, uint16_t datagram_len, int64_t arrival_time);
+
+bool open_replay(Capture *capture, const char *path, CaptureHeader *header);
+
+int read_capture(Capture *capture, unsigned char *datagram, size_t datagram_size, int64_t *arrival_time);
+
+void close_capture(Capture *capture);
+
+#endif
@@ -26,6 +26,9 @@
 #include <time.h>
 #include <sys/time.h>
 
+#ifndef RAPLAYER_CHACHA20_H
+#define RAPLAYER_CHACHA20_H
+
 #define CHACHA20_NONCEBYTES 12
 #define CHACHA20_KEYBYTES 32
 
@@ -45,3 +48,5 @@ unsigned char *generate_random_bytestream(size_t num_bytes);
 void chacha20_init_context(struct chacha20_context *ctx, uint8_t nonce[], uint8_t key[], uint64_t counter);
 
 void chacha20_xor(struct chacha20_context *ctx, uint8_t *bytes, size_t n_bytes);
+
+#endif
@@ -0,0 +1,32 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAPLAYER_CLI_H
+#define RAPLAYER_CLI_H
+
+/*
+ * The command line front ends, they parse the options and run one engine each. The command is how the usage calls
+ * the program, the options follow it in argv.
+ */
+int ra_server(const char *command, int argc, char **argv);
+
+int ra_client(const char *command, int argc, char **argv);
+
+#endif
@@ -0,0 +1,340 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/select.h>
+
+#include "cli.h"
+#include "../raplayer.h"
+#include "../packet/packet.h"
+#include "../tracer/tracer.h"
+#include "../audio_output/audio_output.h"
+
+#define KEY_POLL_INTERVAL 50000 // Microseconds, how long the end of playback may go unnoticed by the volume keys.
+
+/* The status line and the volume keys of a client playing on the sound card. */
+struct client_console {
+    RaClient *client;
+    struct termios orig_termios;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // Signalled on a volume change and when playback ends.
+    bool done;
+    bool volume_changed;
+    double volume;
+};
+
+static void set_conio_terminal_mode(struct client_console *console) {
+    struct termios new_termios;
+
+    /* take two copies - one for now, one for later */
+    tcgetattr(0, &console->orig_termios);
+    memcpy(&new_termios, &console->orig_termios, sizeof(new_termios));
+
+    cfmakeraw(&new_termios);
+    tcsetattr(0, TCSANOW, &new_termios);
+}
+
+static void reset_terminal_mode(struct client_console *console) {
+    tcsetattr(0, TCSANOW, &console->orig_termios);
+}
+
+/* Waits up to timeout microseconds for a key. */
+static int kbhit(long timeout) {
+    struct timeval timeval = {timeout / 1000000, timeout % 1000000};
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(STDIN_FILENO, &fds);
+    return select(1, &fds, NULL, NULL, &timeval);
+}
+
+static int getch() {
+    int result;
+    unsigned char ch;
+    if ((result = (int) read(STDIN_FILENO, &ch, sizeof(ch))) < 0) {
+        return result;
+    } else {
+        return ch;
+    }
+}
+
+static bool console_done(struct client_console *console) {
+    pthread_mutex_lock(&console->mutex);
+    bool done = console->done;
+    pthread_mutex_unlock(&console->mutex);
+    return done;
+}
+
+static void *print_info(void *p_console) {
+    struct client_console *console = (struct client_console *) p_console;
+    char symbols[] = {'-', '\\', '|', '/'};
+    int print_volume_remain_cnt = 0;
+    RaClientStats stats;
+
+    set_conio_terminal_mode(console);
+    puts("");
+
+    pthread_mutex_lock(&console->mutex);
+    for (unsigned int print_cnt = 0; !console->done; print_cnt++) {
+        if (console->volume_changed) {
+            console->volume_changed = false;
+            print_volume_remain_cnt = 20;
+        }
+        const double volume = console->volume;
+        pthread_mutex_unlock(&console->mutex);
+
+        get_ra_client_stats(console->client, &stats);
+        const double elapsed_time = (double) stats.played_frames * stats.frame_duration / 1000000;
+        const double received_size = (double) stats.received_bytes / 1000;
+        const char symbol = symbols[print_cnt / 5 % 4]; // Turns every 250ms.
+
+        if (print_volume_remain_cnt > 0) {
+            if (volume >= 1)
+                printf("[%c] Elapsed time: %.2lfs, Received frame size: %.2lfKB, Muted%*c\r", symbol, elapsed_time,
+                       received_size, 8, ' ');
+            else
+                printf("[%c] Elapsed time: %.2lfs, Received frame size: %.2lfKB, %0.f%%%*c\r", symbol, elapsed_time,
+                       received_size, ((1 - volume) * 100), 8, ' ');
+            print_volume_remain_cnt--;
+        } else
+            printf("[%c] Elapsed time: %.2lfs, Received frame size: %.2lfKB%*c\r", symbol, elapsed_time,
+                   received_size, 8, ' ');
+
+        fflush(stdout);
+
+        struct timespec timespec;
+        clock_gettime(CLOCK_REALTIME, &timespec);
+        timespec.tv_nsec += 50000000;
+        if (timespec.tv_nsec >= 1000000000) {
+            timespec.tv_sec++;
+            timespec.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock(&console->mutex);
+        while (!console->done && !console->volume_changed &&
+               pthread_cond_timedwait(&console->cond, &console->mutex, &timespec) == 0);
+    }
+    pthread_mutex_unlock(&console->mutex);
+
+    get_ra_client_stats(console->client, &stats);
+    printf("[*] Elapsed time: %.2lfs, Received frame size: %.2lfKB%*c\r\n",
+           (double) stats.played_frames * stats.frame_duration / 1000000, (double) stats.received_bytes / 1000, 8, ' ');
+    reset_terminal_mode(console);
+    return NULL;
+}
+
+static void change_volume(struct client_console *console, double step) {
+    pthread_mutex_lock(&console->mutex);
+    double volume = console->volume + step;
+    if (volume >= -0.01 && volume <= 1.01) {
+        console->volume = volume;
+        set_ra_client_volume(console->client, volume);
+    }
+    console->volume_changed = true;
+    pthread_cond_signal(&console->cond);
+    pthread_mutex_unlock(&console->mutex);
+}
+
+static void *control_volume(void *p_console) {
+    struct client_console *console = (struct client_console *) p_console;
+
+    while (!console_done(console)) {
+        if (kbhit(KEY_POLL_INTERVAL) > 0) {
+            switch (getch()) {
+                case '\033':
+                    getch(); /* skip the '[' */
+                    switch (getch()) { /* the real value */
+                        case 'A':
+                            change_volume(console, -0.01); /* Increase volume. */
+                            break;
+                        case 'B':
+                            change_volume(console, 0.01); /* Decrease volume. */
+                            break;
+                        default:
+                            break;
+                    }
+                    break;
+
+                case 0x03: // The raw terminal delivers Ctrl-C as a key, it ends playback like the end of the stream.
+                    stop_ra_client(console->client);
+                    break;
+
+                case 0x1A:
+                    raise(SIGSTOP);
+                    break;
+
+                default:
+                    break;
+            }
+        }
+    }
+    return NULL;
+}
+
+int ra_client(const char *command, int argc, char **argv) {
+    const char *trace_path = NULL;
+    const char *output_path = NULL;
+    bool device_skewed = false;
+    double device_skew = 0;
+
+    RaClientConfig config;
+    init_ra_client_config(&config);
+
+    for (int i = 0; i < argc; i++) {
+        if (!strcmp(argv[i], "--retransmit") && i + 1 < argc) {
+            config.retransmit_delay = strtod(argv[++i], NULL);
+            if (config.retransmit_delay < 0) {
+                printf("Invalid argument: Retransmission delay must not be negative.\n");
+                return EXIT_FAILURE;
+            }
+        } else if (!strcmp(argv[i], "--aggregate") && i + 1 < argc) {
+            config.aggregated_frames = (int) strtol(argv[++i], NULL, 10);
+            if (config.aggregated_frames < 1 || config.aggregated_frames > MAX_AGGREGATED_FRAMES) {
+                printf("Invalid argument: Aggregated frames must be between 1 and %d.\n", MAX_AGGREGATED_FRAMES);
+                return EXIT_FAILURE;
+            }
+        } else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+            trace_path = argv[++i];
+        else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+            output_path = argv[++i];
+        else if (!strcmp(argv[i], "--capture") && i + 1 < argc)
+            config.capture_path = argv[++i];
+        else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+            config.replay_path = argv[++i];
+        else if (!strcmp(argv[i], "--fast"))
+            config.fast_replay = true;
+        else if (!strcmp(argv[i], "--no-drift"))
+            config.drift_compensation = false;
+        else if (!strcmp(argv[i], "--device-skew") && i + 1 < argc) {
+            device_skew = strtod(argv[++i], NULL);
+            device_skewed = true;
+            if (fabs(device_skew) > 10000) {
+                printf("Invalid argument: Device skew must be between -10000 and 10000 ppm.\n");
+                return EXIT_FAILURE;
+            }
+        } else if (config.address == NULL)
+            config.address = argv[i];
+        else
+            config.port = (int) strtol(argv[i], NULL, 10);
+    }
+
+    if ((config.address == NULL && config.replay_path == NULL) ||
+        (config.address != NULL && strcmp(config.address, "help") == 0)) {
+        puts("");
+        printf("Usage: %s [--aggregate <Frames>] [--retransmit <ms>] [--no-drift] [--trace <File>] [--output <File> [--device-skew <ppm>]] [--capture <File>] <Server Address> [Port]\n", command);
+        printf("       %s --replay <File> [--fast] [--retransmit <ms>] [--no-drift] [--trace <File>] [--output <File> [--device-skew <ppm>]]\n\n", command);
+        puts("<Server Address>: The IP or address of the server to which you want to connect.");
+        puts("[--aggregate]: Receive up to 3 opus frames per packet. (fewer packets, adds latency of the extra frames)");
+        puts("[--retransmit]: Request lost frames again, delaying playback by the given ms to wait for them. (a replay defaults to the captured delay)");
+        puts("[--no-drift]: Plays at the server's pace, without resampling for the sound card's clock drift.");
+        puts("[--trace]: Records per-frame timings, written as a Perfetto trace at exit or on SIGUSR1.");
+        puts("[--output]: Writes the decoded audio as S16LE PCM to the file instead of playing it. (\"-\" for STDOUT)");
+        puts("[--device-skew]: Paces the output like a sound card whose clock runs off by the given ppm, to test the drift compensation.");
+        puts("[--capture]: Records every received datagram with its arrival time to the file.");
+        puts("[--replay]: Plays a capture with its original timing instead of connecting to a server.");
+        puts("[--fast]: Replays the capture as fast as possible.");
+        puts("[Port]: The port on the server to which you want to connect.");
+        puts("");
+        return 0;
+    }
+
+    if (trace_path != NULL && !init_tracer(trace_path, "raplayer client")) {
+        printf("Error: Failed to start the tracer.\n");
+        return EXIT_FAILURE;
+    }
+    trace_thread("main");
+
+    DeviceOutput device;
+    FileOutput file = {.output_fd = -1};
+    SimulatedDevice simulated_device;
+    init_simulated_device(&simulated_device, device_skew);
+    if (output_path != NULL &&
+        !open_file_output(&config.output, &file, output_path, device_skewed ? &simulated_device : NULL)) {
+        printf("Error: Failed to open output file: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (device_skewed && output_path == NULL) {
+        printf("Invalid argument: --device-skew argument cannot run without --output argument.\n");
+        return EXIT_FAILURE;
+    }
+    if (output_path == NULL)
+        init_device_output(&config.output, &device);
+    config.volume = output_path == NULL ? 0.5 : 0; // Headless output is written at full volume.
+
+    /* The sound card is initialized while the client connects. */
+    RaClient *client = create_ra_client(&config);
+    if (client == NULL || !start_ra_client(client)) {
+        destroy_ra_client(client);
+        if (file.output_fd >= 0)
+            close(file.output_fd);
+        if (output_path == NULL)
+            destroy_device_output(&device);
+        return EXIT_FAILURE;
+    }
+
+    struct client_console console = {.client = client, .volume = config.volume};
+    pthread_t info_printer;
+    pthread_t volume_controller;
+    if (output_path == NULL) {
+        pthread_mutex_init(&console.mutex, NULL);
+        pthread_cond_init(&console.cond, NULL);
+        pthread_create(&info_printer, NULL, print_info, &console); // Activate info printer.
+        pthread_create(&volume_controller, NULL, control_volume, &console); // Activate volume controller.
+    }
+
+    bool played = wait_ra_client(client);
+
+    /* Wait for joining threads. */
+    if (output_path == NULL) {
+        pthread_mutex_lock(&console.mutex);
+        console.done = true;
+        pthread_cond_signal(&console.cond);
+        pthread_mutex_unlock(&console.mutex);
+        pthread_join(info_printer, NULL);
+        pthread_join(volume_controller, NULL);
+        pthread_cond_destroy(&console.cond);
+        pthread_mutex_destroy(&console.mutex);
+    }
+
+    RaClientStats stats;
+    get_ra_client_stats(client, &stats);
+    printf("Lost frames: %lu (recovered by retransmission: %lu, concealed: %lu), late frames: %lu, DTX frames: %lu\r\n",
+           stats.lost_frames, stats.recovered_frames, stats.concealed_frames, stats.late_frames, stats.dtx_frames);
+    if (stats.drift_compensated)
+        printf("Clock drift: %+.1fppm compensated\r\n", stats.drift);
+    if (device_skewed)
+        printf("Simulated device underruns: %lu\r\n", simulated_device.underruns);
+    if (config.replay_path != NULL)
+        printf("Replayed %lu datagrams in %.3fs\r\n", stats.replayed_datagrams, stats.replay_time);
+    destroy_ra_client(client);
+    if (output_path == NULL)
+        destroy_device_output(&device);
+
+    if (dump_trace())
+        printf("Trace written to %s\r\n", trace_path);
+    return played ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,451 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "cli.h"
+#include "../ra_server.h"
+#include "../tracer/tracer.h"
+#include "../pcm_ingest/pcm_ingest.h"
+#include "../mixer/mixer.h"
+
+#include <sys/stat.h>
+
+/* An input of the mix, a wav file, or STDIN or a FIFO read ahead on a thread. */
+struct server_input {
+    char *name;
+    double gain; // dB.
+    double duck; // dB taken from the inputs without a ducking rule while this one is active.
+    bool live;
+    int fd; // Of a FIFO, -1 for a file or STDIN.
+    FILE *fin;
+    PcmSource pcm_source;
+    PcmIngest ingest;
+};
+
+/* Parses a frame duration in milliseconds, returns it in microseconds or 0 if opus does not support it. */
+static uint32_t parse_frame_duration(const char *str_frame_duration) {
+    char *end;
+    double frame_duration = strtod(str_frame_duration, &end) * 1000;
+    if (*end != '\0' || frame_duration <= 0 || !supported_frame_duration((uint32_t) frame_duration))
+        return 0;
+    return (uint32_t) frame_duration;
+}
+
+/* Parses "<N>" or "<Min>-<Max>" into the bounds, false if they aren't opus complexities. */
+static bool parse_complexity(const char *str_complexity, RaServerConfig *config) {
+    char *end;
+    long min = strtol(str_complexity, &end, 10), max = min;
+    if (end != str_complexity && *end == '-')
+        max = strtol(end + 1, &end, 10);
+    if (end == str_complexity || *end != '\0' || min < 0 || min > max || max > MAX_COMPLEXITY)
+        return false;
+    config->min_complexity = (int) min;
+    config->max_complexity = (int) max;
+    return true;
+}
+
+static bool read_pcm_input(void *p_pcm_source, int16_t *pcm, int frames) {
+    return read_pcm_frames((PcmSource *) p_pcm_source, pcm, frames);
+}
+
+static bool read_mixer_input(void *p_mixer, int16_t *pcm, int frames) {
+    return read_mixer((Mixer *) p_mixer, pcm, frames);
+}
+
+static void get_mixer_input_stats(void *p_mixer, RaInputStats *stats) {
+    get_mixer_stats((Mixer *) p_mixer, stats);
+}
+
+static bool read_ingest_input(void *p_ingest, int16_t *pcm, int frames) {
+    return read_pcm_ingest((PcmIngest *) p_ingest, pcm, frames);
+}
+
+static void get_ingest_input_stats(void *p_ingest, RaInputStats *stats) {
+    get_pcm_ingest_stats((PcmIngest *) p_ingest, stats);
+}
+
+static const char *const overflow_policy_names[] = {"block", "drop-oldest", "stretch"};
+static const char *const underflow_policy_names[] = {"silence", "stretch"};
+
+/* Returns the index of name in names, -1 if it isn't one of them. */
+static int parse_policy(const char *name, const char *const *names, int count) {
+    for (int i = 0; i < count; i++)
+        if (!strcmp(name, names[i]))
+            return i;
+    return -1;
+}
+
+/* Splits the trailing ",gain=<dB>" and ",duck=<dB>" off a file name, false if one of them is invalid. */
+static bool parse_input(char *arg, struct server_input *input) {
+    memset(input, 0, sizeof(struct server_input));
+    input->fd = -1;
+    input->name = arg;
+
+    char *option;
+    while ((option = strrchr(arg, ',')) != NULL && (!strncmp(option, ",gain=", 6) || !strncmp(option, ",duck=", 6))) {
+        char *end;
+        double value = strtod(option + 6, &end);
+        if (*end != '\0' || value < (option[1] == 'g' ? -60 : 0) || value > 60) {
+            fprintf(stdout, "Invalid argument: Gain of \"%s\" must be between -60 and 60 dB, ducking between 0 and 60.\n",
+                    arg);
+            return false;
+        }
+        if (option[1] == 'g')
+            input->gain = value;
+        else
+            input->duck = value;
+        *option = '\0';
+    }
+    return true;
+}
+
+/*
+ * Opens a wav file, or starts reading STDIN ("-") or a FIFO ahead. A FIFO is opened for writing too, so it stays
+ * open while no writer is connected, and is silent until one comes.
+ */
+static bool open_input(struct server_input *input, int capacity, IngestOverflowPolicy overflow,
+                       IngestUnderflowPolicy underflow) {
+    if (!strcmp(input->name, "-")) {
+        input->name = "STDIN";
+        input->live = true;
+        return start_pcm_ingest(&input->ingest, fileno(stdin), STREAM_CHANNELS, capacity, overflow, underflow);
+    }
+
+    struct stat input_stat;
+    if (stat(input->name, &input_stat) == 0 && S_ISFIFO(input_stat.st_mode)) {
+        if ((input->fd = open(input->name, O_RDWR)) < 0) {
+            fprintf(stdout, "Error: Failed to open input FIFO %s: %s\n", input->name, strerror(errno));
+            return false;
+        }
+        input->live = true;
+        if (!start_pcm_ingest(&input->ingest, input->fd, STREAM_CHANNELS, capacity, overflow, underflow)) {
+            close(input->fd);
+            return false;
+        }
+        return true;
+    }
+
+    if ((input->fin = fopen(input->name, "rb")) == NULL) {
+        fprintf(stdout, "Error: Failed to open input file %s: %s\n", input->name, strerror(errno));
+        return false;
+    }
+    /* Files in another format are converted while streaming, a pipe must be in the stream format already. */
+    if (!open_wav_source(&input->pcm_source, input->fin, STREAM_CHANNELS, STREAM_SAMPLE_RATE)) {
+        fclose(input->fin);
+        return false;
+    }
+    return true;
+}
+
+static void close_input(struct server_input *input) {
+    if (input->live) {
+        close_pcm_ingest(&input->ingest);
+        if (input->fd >= 0)
+            close(input->fd);
+    } else {
+        close_pcm_source(&input->pcm_source);
+        fclose(input->fin);
+    }
+}
+
+static void print_input(struct server_input *input) {
+    printf("\nFile %s info: \n", input->name);
+    if (input->live) {
+        printf("Channels: %d\n", STREAM_CHANNELS);
+        printf("Sample rate: %u\n", STREAM_SAMPLE_RATE);
+        printf("Bit per sample: %d (%s)\n", WORD * 8, pcm_format_name(PCM_FORMAT_S16));
+        printf("Input buffer: %.1fms, Overflow: %s, Underflow: %s\n",
+               (double) input->ingest.capacity / input->ingest.frame_bytes * 1000 / STREAM_SAMPLE_RATE,
+               overflow_policy_names[input->ingest.overflow], underflow_policy_names[input->ingest.underflow]);
+    } else {
+        printf("Channels: %d\n", input->pcm_source.channels);
+        printf("Sample rate: %u\n", input->pcm_source.sample_rate);
+        printf("Bit per sample: %d (%s)\n", input->pcm_source.bits_per_sample,
+               pcm_format_name(input->pcm_source.format));
+        if (!input->pcm_source.passthrough)
+            printf("Converted to: %s, %uHz, %d channels%s\n", pcm_format_name(PCM_FORMAT_S16), STREAM_SAMPLE_RATE,
+                   STREAM_CHANNELS, input->pcm_source.resampling ? ", resampled" : "");
+    }
+    if (input->gain != 0 || input->duck != 0)
+        printf("Gain: %+.1fdB, Ducks the others by: %.1fdB\n", input->gain, input->duck);
+}
+
+int ra_server(const char *command, int argc, char **argv) {
+    bool stream_mode = false;
+    bool ingest_options = false;
+    int overflow = -1;
+    int underflow = INGEST_UNDERFLOW_SILENCE;
+    double ingest_buffer = PCM_INGEST_DEFAULT_BUFFER;
+
+    char *fin_name = NULL;
+    char *mix_names[MIXER_MAX_INPUTS];
+    int mix_count = 0;
+    struct stream_profile profile = *find_stream_profile("default");
+    uint32_t frame_duration = 0;
+    struct realtime_config realtime = {0};
+    const char *trace_path = NULL;
+
+    RaServerConfig config;
+    init_ra_server_config(&config);
+
+    for (int i = 0; i < argc; i++) {
+        if (!strcmp(argv[i], "--stream"))
+            stream_mode = true;
+        else if (!strcmp(argv[i], "--overflow") && i + 1 < argc) {
+            if ((overflow = parse_policy(argv[++i], overflow_policy_names, 3)) < 0) {
+                fprintf(stdout, "Invalid argument: Overflow policy must be block, drop-oldest or stretch.\n");
+                return EXIT_FAILURE;
+            }
+            ingest_options = true;
+        } else if (!strcmp(argv[i], "--underflow") && i + 1 < argc) {
+            if ((underflow = parse_policy(argv[++i], underflow_policy_names, 2)) < 0) {
+                fprintf(stdout, "Invalid argument: Underflow policy must be silence or stretch.\n");
+                return EXIT_FAILURE;
+            }
+            ingest_options = true;
+        } else if (!strcmp(argv[i], "--ingest-buffer") && i + 1 < argc) {
+            ingest_buffer = strtod(argv[++i], NULL);
+            if (ingest_buffer <= 0 || ingest_buffer > 10000) {
+                fprintf(stdout, "Invalid argument: Ingest buffer must be between 0 and 10000 ms.\n");
+                return EXIT_FAILURE;
+            }
+            ingest_options = true;
+        } else if (!strcmp(argv[i], "--mix") && i + 1 < argc) {
+            if (mix_count == MIXER_MAX_INPUTS - 1) {
+                fprintf(stdout, "Invalid argument: At most %d inputs can be mixed.\n", MIXER_MAX_INPUTS);
+                return EXIT_FAILURE;
+            }
+            mix_names[mix_count++] = argv[++i];
+        } else if (!strcmp(argv[i], "--dtx"))
+            config.dtx = true;
+        else if (!strcmp(argv[i], "--profile") && i + 1 < argc) {
+            const struct stream_profile *p_profile = find_stream_profile(argv[++i]);
+            if (p_profile == NULL) {
+                fprintf(stdout, "Invalid argument: Unknown profile \"%s\".\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            profile = *p_profile;
+            config.profile = argv[i];
+        } else if (!strcmp(argv[i], "--frame-duration") && i + 1 < argc) {
+            if ((frame_duration = parse_frame_duration(argv[++i])) == 0) {
+                fprintf(stdout, "Invalid argument: Frame duration must be one of 2.5, 5, 10, 20, 40, 60.\n");
+                return EXIT_FAILURE;
+            }
+            config.frame_duration = frame_duration;
+        } else if (!strcmp(argv[i], "--complexity") && i + 1 < argc) {
+            if (!parse_complexity(argv[++i], &config)) {
+                fprintf(stdout, "Invalid argument: Complexity must be a number or a range like \"3-10\", between 0 and %d.\n",
+                        MAX_COMPLEXITY);
+                return EXIT_FAILURE;
+            }
+        } else if (!strcmp(argv[i], "--nack-budget") && i + 1 < argc) {
+            config.nack_budget = strtod(argv[++i], NULL);
+            if (config.nack_budget < 0 || config.nack_budget > 100) {
+                fprintf(stdout, "Invalid argument: NACK budget must be between 0 and 100 percent.\n");
+                return EXIT_FAILURE;
+            }
+        } else if (!strcmp(argv[i], "--shards") && i + 1 < argc) {
+            config.shards = (int) strtol(argv[++i], NULL, 10);
+            if (config.shards < 1 || config.shards > MAX_INGRESS_SHARDS) {
+                fprintf(stdout, "Invalid argument: Shards must be between 1 and %d.\n", MAX_INGRESS_SHARDS);
+                return EXIT_FAILURE;
+            }
+        } else if (!strcmp(argv[i], "--pacing") && i + 1 < argc) {
+            config.pacing = strtod(argv[++i], NULL);
+            if (config.pacing < 0 || config.pacing > 100) {
+                fprintf(stdout, "Invalid argument: Pacing must be between 0 and 100 percent.\n");
+                return EXIT_FAILURE;
+            }
+        } else if (!strcmp(argv[i], "--pacing-mode") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "txtime"))
+                config.pacing_mode = RA_PACING_TXTIME;
+            else if (!strcmp(argv[i], "user"))
+                config.pacing_mode = RA_PACING_USER;
+            else {
+                fprintf(stdout, "Invalid argument: Pacing mode must be txtime or user.\n");
+                return EXIT_FAILURE;
+            }
+        } else if (!strcmp(argv[i], "--realtime"))
+            config.realtime = true;
+        else if (!strcmp(argv[i], "--cpus") && i + 1 < argc) {
+            if (!parse_cpu_list(argv[++i], &realtime)) {
+                fprintf(stdout, "Invalid argument: CPUs must be a list of up to %d CPU numbers, like \"2,3\".\n",
+                        REALTIME_MAX_CPUS);
+                return EXIT_FAILURE;
+            }
+            config.cpus = argv[i];
+        } else if (!strcmp(argv[i], "--metrics") && i + 1 < argc)
+            config.metrics_address = argv[++i];
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+            trace_path = argv[++i];
+        else if (fin_name == NULL)
+            fin_name = argv[i];
+        else
+            config.port = (int) strtol(argv[i], NULL, 10);
+    }
+
+    if (frame_duration != 0) // An explicit frame duration overrides the profile's one.
+        profile.frame_duration = frame_duration;
+
+    if (fin_name == NULL || !strcmp(fin_name, "help")) {
+        puts("");
+        printf("Usage: %s [--stream] [--overflow <Policy>] [--underflow <Policy>] [--ingest-buffer <ms>] [--mix <FILE>]... [--dtx] [--profile <Profile>] [--frame-duration <ms>] [--complexity <N|Min-Max>] [--nack-budget <%%>] [--shards <N>] [--pacing <%%>] [--pacing-mode <Mode>] [--realtime] [--cpus <List>] [--metrics <Port|unix:Path>] [--trace <File>] <FILE> [Port]\n\n",
+               command);
+        puts("<FILE>: The name of the wav file to play, other formats than pcm_s16le 48000hz stereo are converted. (\"-\" to receive pcm_s16le 48000hz stereo from STDIN, or a FIFO)");
+        puts("        Append \",gain=<dB>\" to change its volume, \",duck=<dB>\" to lower the inputs without it while it plays.");
+
+        puts("[--stream]: Keeps STDIN and FIFOs from stacking up while nobody listens, same as --overflow drop-oldest.");
+        puts("[--overflow]: What a full STDIN or FIFO buffer does: block (the writer waits), drop-oldest, stretch (plays faster). (default: block)");
+        puts("[--underflow]: What a late STDIN or FIFO does: silence, stretch (slows a frame that's almost there). (default: silence)");
+        puts("[--ingest-buffer]: The STDIN and FIFO buffer in ms, at least two frames. (default: 200)");
+        puts("[--mix]: Another input to mix into the stream, like <FILE>, up to 32 in all. The stream ends with the last one.");
+        puts("[--dtx]: Stops sending audio during silence, only a tiny marker is sent per frame.");
+        puts("[--profile]: low-latency (5ms, low delay mode), default (20ms), bandwidth-saver (60ms).");
+        puts("[--frame-duration]: The opus frame duration in ms. (2.5, 5, 10, 20, 40, 60)");
+        puts("[--complexity]: The opus complexity, or bounds it's tuned within to keep encoding well inside the frame interval. (default: 3-10)");
+        puts("[--nack-budget]: Retransmitted frames allowed per client, in percent of the frame rate. (default: 25, 0 to disable)");
+        puts("[--shards]: Sockets sharing the port with SO_REUSEPORT, each received by its own thread. (default: 1)");
+        puts("[--pacing]: Spreads the packets of each frame across this percent of the frame interval. (default: 0)");
+        puts("[--pacing-mode]: txtime (kernel launch times, needs the fq or etf qdisc), user (sleeps between packets).");
+        puts("[--realtime]: Runs the opus timer and builder with SCHED_FIFO and locks the memory, if permitted.");
+        puts("[--cpus]: CPUs to pin the opus timer and builder to in realtime mode, like \"2,3\".");
+        puts("[--metrics]: Serves Prometheus metrics over HTTP on this loopback port, or on a UNIX socket \"unix:/path\".");
+        puts("[--trace]: Records per-frame timings, written as a Perfetto trace at exit or on SIGUSR1.");
+        puts("[Port]: The port on the server to which you want to open.");
+        puts("");
+        return 0;
+    }
+
+    /* Before any thread is created, the tracing flag is only read after. */
+    if (trace_path != NULL && !init_tracer(trace_path, "raplayer server")) {
+        fprintf(stdout, "Error: Failed to start the tracer.\n");
+        return EXIT_FAILURE;
+    }
+
+    struct server_input *inputs = calloc(mix_count + 1, sizeof(struct server_input));
+    if (inputs == NULL) {
+        fprintf(stdout, "Error: Failed to allocate the inputs.\n");
+        return EXIT_FAILURE;
+    }
+    int inputs_count = mix_count + 1;
+    bool parsed = parse_input(fin_name, &inputs[0]);
+    for (int i = 0; parsed && i < mix_count; i++)
+        parsed = parse_input(mix_names[i], &inputs[i + 1]);
+
+    int stdin_inputs = 0;
+    for (int i = 0; i < inputs_count; i++)
+        stdin_inputs += !strcmp(inputs[i].name, "-");
+    if (parsed && stdin_inputs > 1) {
+        fprintf(stdout, "Invalid argument: STDIN can only be mixed once.\n");
+        parsed = false;
+    }
+    if (!parsed) {
+        free(inputs);
+        return EXIT_FAILURE;
+    }
+
+    if (overflow < 0) // --stream only keeps the pipe from stacking up, like it always did.
+        overflow = stream_mode ? INGEST_OVERFLOW_DROP_OLDEST : INGEST_OVERFLOW_BLOCK;
+
+    /* Pipes are read ahead into at least two frames, so the frames never wait on them. */
+    int frame_size = (int) ((uint64_t) profile.frame_duration * STREAM_SAMPLE_RATE / 1000000);
+    int capacity = (int) (ingest_buffer * STREAM_SAMPLE_RATE / 1000);
+    if (capacity < frame_size * 2)
+        capacity = frame_size * 2;
+
+    Mixer mixer;
+    init_mixer(&mixer, STREAM_CHANNELS, STREAM_SAMPLE_RATE);
+    const char *live_name = NULL;
+    uint64_t pcm_size = 0;
+    int opened = 0;
+    for (; opened < inputs_count; opened++) {
+        struct server_input *input = &inputs[opened];
+        if (!open_input(input, capacity, (IngestOverflowPolicy) overflow, (IngestUnderflowPolicy) underflow))
+            break;
+
+        RaInput mixer_input = {read_pcm_input, NULL, &input->pcm_source};
+        if (input->live) {
+            mixer_input = (RaInput) {read_ingest_input, get_ingest_input_stats, &input->ingest};
+            if (live_name == NULL)
+                live_name = input->name;
+        } else if (pcm_source_frames(&input->pcm_source) * STREAM_CHANNELS * WORD > pcm_size)
+            pcm_size = pcm_source_frames(&input->pcm_source) * STREAM_CHANNELS * WORD; // The mix lasts the longest.
+        add_mixer_input(&mixer, mixer_input, input->gain, input->duck);
+        print_input(input);
+    }
+
+    bool opened_all = opened == inputs_count;
+    if (opened_all && live_name == NULL && (stream_mode || ingest_options)) {
+        fprintf(stdout, "Invalid argument: --stream, --overflow, --underflow and --ingest-buffer arguments cannot run without <file> argument \"-\" or a FIFO.\n");
+        opened_all = false;
+    }
+    if (!opened_all) {
+        for (int i = 0; i < opened; i++)
+            close_input(&inputs[i]);
+        free(inputs);
+        return EXIT_FAILURE;
+    }
+
+    if (live_name == NULL)
+        config.pcm_size = pcm_size > UINT32_MAX ? UINT32_MAX : (uint32_t) pcm_size;
+    printf("Profile: %s, Frame duration: %.1fms\n", profile.name, profile.frame_duration / 1000.0);
+    if (live_name != NULL)
+        printf("PCM data length: %s\n\n", live_name);
+    else
+        printf("PCM data length: %u\n\n", config.pcm_size);
+    fflush(stdout);
+
+    config.input.read = read_mixer_input;
+    config.input.stats = live_name != NULL ? get_mixer_input_stats : NULL;
+    config.input.user_data = &mixer;
+
+    RaServer *server = create_ra_server(&config);
+    if (server == NULL || !start_ra_server(server)) {
+        destroy_ra_server(server);
+        for (int i = 0; i < inputs_count; i++)
+            close_input(&inputs[i]);
+        close_mixer(&mixer);
+        free(inputs);
+        return EXIT_FAILURE;
+    }
+
+    puts("Waiting for Client... ");
+    fflush(stdout);
+
+    bool streamed = wait_ra_server(server);
+    destroy_ra_server(server);
+
+    if (dump_trace())
+        printf("\nTrace written to %s\n", trace_path);
+
+    if (live_name != NULL) {
+        RaInputStats stats;
+        get_mixer_stats(&mixer, &stats);
+        printf("\nInput underruns: %lu, Overruns: %lu frames, Stretched: %lu frames\n", stats.underruns,
+               stats.overruns, stats.stretched_frames);
+    }
+
+    /* Close audio stream. */
+    for (int i = 0; i < inputs_count; i++)
+        close_input(&inputs[i]);
+    close_mixer(&mixer);
+    free(inputs);
+    return streamed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
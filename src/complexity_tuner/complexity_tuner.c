@@ -0,0 +1,127 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+
+#include "complexity_tuner.h"
+
+/* Starts at the highest complexity, the first slow encodes bring it down within a window. */
+void init_complexity_tuner(ComplexityTuner *tuner, int min_complexity, int max_complexity, int64_t interval) {
+    tuner->min_complexity = min_complexity;
+    tuner->max_complexity = max_complexity;
+    tuner->interval = interval;
+    tuner->window_frames = (int) (COMPLEXITY_TUNER_WINDOW / interval);
+    if (tuner->window_frames < COMPLEXITY_TUNER_OUTLIERS)
+        tuner->window_frames = COMPLEXITY_TUNER_OUTLIERS;
+    tuner->raise_windows = COMPLEXITY_TUNER_RAISE_WINDOWS;
+
+    tuner->frames = 0;
+    tuner->slow_frames = 0;
+    tuner->busy_frames = 0;
+    tuner->calm_windows = 0;
+    tuner->just_raised = false;
+
+    atomic_init(&tuner->complexity, max_complexity);
+    atomic_init(&tuner->lowered, 0);
+    atomic_init(&tuner->raised, 0);
+    for (int i = 0; i <= MAX_COMPLEXITY; i++)
+        atomic_init(&tuner->frames_at[i], 0);
+}
+
+static int lower_complexity(ComplexityTuner *tuner, int complexity, int steps) {
+    complexity = complexity - steps > tuner->min_complexity ? complexity - steps : tuner->min_complexity;
+    atomic_fetch_add_explicit(&tuner->lowered, 1, memory_order_relaxed);
+
+    /* The step that was just taken is too much for this host, it waits longer before it tries again. */
+    if (tuner->just_raised && tuner->raise_windows < COMPLEXITY_TUNER_MAX_RAISE_WINDOWS)
+        tuner->raise_windows *= 2;
+    tuner->just_raised = false;
+    tuner->calm_windows = 0;
+    return complexity;
+}
+
+/*
+ * Takes the encode time of a frame, returns the complexity for the next one. Only the encoder's thread calls it,
+ * the complexity and the counters may be read from any.
+ */
+int tune_complexity(ComplexityTuner *tuner, int64_t encode_time) {
+    int complexity = atomic_load_explicit(&tuner->complexity, memory_order_relaxed);
+    atomic_fetch_add_explicit(&tuner->frames_at[complexity], 1, memory_order_relaxed);
+    if (tuner->min_complexity == tuner->max_complexity)
+        return complexity;
+
+    const double load = (double) encode_time / (double) tuner->interval;
+    tuner->frames++;
+    tuner->slow_frames += load > COMPLEXITY_TUNER_HIGH;
+    tuner->busy_frames += load > COMPLEXITY_TUNER_LOW;
+
+    int next = complexity;
+    if (load > COMPLEXITY_TUNER_PANIC && complexity > tuner->min_complexity) {
+        next = lower_complexity(tuner, complexity, 2);
+        tuner->frames = tuner->slow_frames = tuner->busy_frames = 0; // The window saw the old complexity.
+    } else if (tuner->frames == tuner->window_frames) {
+        const int outliers = tuner->window_frames / COMPLEXITY_TUNER_OUTLIERS;
+        if (tuner->slow_frames > outliers && complexity > tuner->min_complexity)
+            next = lower_complexity(tuner, complexity, 1);
+        else if (tuner->busy_frames > outliers) {
+            tuner->calm_windows = 0;
+            tuner->just_raised = false;
+        } else if (++tuner->calm_windows >= tuner->raise_windows && complexity < tuner->max_complexity) {
+            next = complexity + 1;
+            atomic_fetch_add_explicit(&tuner->raised, 1, memory_order_relaxed);
+            tuner->calm_windows = 0;
+            tuner->just_raised = true;
+        } else {
+            if (tuner->just_raised) // The raise held for a whole window, the next one may come as soon.
+                tuner->raise_windows = COMPLEXITY_TUNER_RAISE_WINDOWS;
+            tuner->just_raised = false;
+        }
+        tuner->frames = tuner->slow_frames = tuner->busy_frames = 0;
+    }
+
+    if (next != complexity)
+        atomic_store_explicit(&tuner->complexity, next, memory_order_relaxed);
+    return next;
+}
+
+/* Like "Encoder complexity: 3-10, lowered 2 times, raised 1 times, frames at 10: 92.0% 9: 8.0%". */
+void print_complexity_tuner(ComplexityTuner *tuner) {
+    if (tuner->min_complexity == tuner->max_complexity) {
+        printf("\nEncoder complexity: %d\n", tuner->max_complexity);
+        fflush(stdout);
+        return;
+    }
+
+    unsigned long total = 0;
+    for (int i = 0; i <= MAX_COMPLEXITY; i++)
+        total += atomic_load(&tuner->frames_at[i]);
+    printf("\nEncoder complexity: %d-%d, lowered %lu times, raised %lu times", tuner->min_complexity,
+           tuner->max_complexity, atomic_load(&tuner->lowered), atomic_load(&tuner->raised));
+    if (total > 0) {
+        printf(", frames at");
+        for (int i = MAX_COMPLEXITY; i >= 0; i--) {
+            unsigned long frames = atomic_load(&tuner->frames_at[i]);
+            if (frames > 0)
+                printf(" %d: %.1f%%", i, (double) frames * 100 / (double) total);
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+}
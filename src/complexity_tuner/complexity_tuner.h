@@ -0,0 +1,66 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAPLAYER_COMPLEXITY_TUNER_H
+#define RAPLAYER_COMPLEXITY_TUNER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define MAX_COMPLEXITY 10 // Of opus.
+#define COMPLEXITY_TUNER_WINDOW 500000000L // Nanoseconds of encodes judged together.
+#define COMPLEXITY_TUNER_HIGH 0.4 // Share of the frame interval an encode may take before the complexity goes down.
+#define COMPLEXITY_TUNER_PANIC 0.75 // A single encode this slow lowers it two steps at once, ahead of a missed tick.
+#define COMPLEXITY_TUNER_LOW 0.15 // Encodes below this share leave headroom to raise it.
+#define COMPLEXITY_TUNER_OUTLIERS 16 // One in this many encodes of a window may be slow, a preemption isn't a trend.
+#define COMPLEXITY_TUNER_RAISE_WINDOWS 4 // Windows with headroom in a row before the complexity goes up a step.
+#define COMPLEXITY_TUNER_MAX_RAISE_WINDOWS 64 // Doubled from the above by every raise that had to be taken back.
+
+/*
+ * Keeps the encode time of one encoder well inside the frame interval by trading its complexity for speed. It goes
+ * down as soon as encodes get slow, and up only after seconds of headroom, so a busy host doesn't make it flap.
+ */
+typedef struct {
+    int min_complexity;
+    int max_complexity;
+    int64_t interval; // Nanoseconds between frames.
+    int window_frames;
+    int raise_windows;
+
+    int frames; // Of the current window.
+    int slow_frames; // Above the high share.
+    int busy_frames; // Above the low share.
+    int calm_windows;
+    bool just_raised; // In the previous window, a lowering now takes the raise back.
+
+    _Atomic int complexity;
+    atomic_ulong lowered;
+    atomic_ulong raised;
+    atomic_ulong frames_at[MAX_COMPLEXITY + 1]; // Encoded at each complexity.
+} ComplexityTuner;
+
+void init_complexity_tuner(ComplexityTuner *tuner, int min_complexity, int max_complexity, int64_t interval);
+
+int tune_complexity(ComplexityTuner *tuner, int64_t encode_time);
+
+void print_complexity_tuner(ComplexityTuner *tuner);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <string.h>
+#include <math.h>
+
+#include "drift.h"
+
+void init_drift_compensator(DriftCompensator *drift) {
+    memset(drift, 0, sizeof(DriftCompensator));
+    drift->start_time = -1;
+    drift->ratio = 1;
+}
+
+/*
+ * Takes a delay sample in microseconds at now, returns the resampling ratio.
+ * A PI controller: the delay error corrects at once, its integral takes over the steady drift.
+ */
+double update_drift_compensator(DriftCompensator *drift, int64_t now, double delay) {
+    if (drift->start_time < 0) {
+        drift->start_time = drift->last_time = now;
+        drift->delay = delay;
+        return drift->ratio;
+    }
+
+    double elapsed = (double) (now - drift->last_time) / 1000000;
+    drift->last_time = now;
+    drift->delay += (delay - drift->delay) * fmin(1, elapsed * 1000000 / DRIFT_SMOOTHING);
+
+    if (!drift->locked) {
+        if (now - drift->start_time < DRIFT_WARMUP)
+            return drift->ratio;
+        drift->target = drift->delay;
+        drift->locked = true;
+    }
+
+    double error = (drift->delay - drift->target) / 1000000;
+    double correction = DRIFT_GAIN * error + DRIFT_INTEGRAL_GAIN * (drift->integral + error * elapsed);
+    const double max_correction = DRIFT_MAX_PPM / 1000000.0;
+    if (fabs(correction) < max_correction)
+        drift->integral += error * elapsed; // Held while saturated, it would wind up.
+    correction = fmin(fmax(correction, -max_correction), max_correction);
+
+    drift->ratio = 1 - correction;
+    return drift->ratio;
+}
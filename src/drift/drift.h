@@ -0,0 +1,52 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAPLAYER_DRIFT_H
+#define RAPLAYER_DRIFT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DRIFT_MAX_PPM 1000 // Widest correction, twice the drift of a poor crystal leaves room to pull the delay back.
+#define DRIFT_WARMUP 5000000 // Microseconds of delay measured before the target is taken.
+#define DRIFT_SMOOTHING 2000000 // Time constant of the delay filter in microseconds, evens out network jitter.
+#define DRIFT_GAIN 0.05 // Correction per second of delay error.
+#define DRIFT_INTEGRAL_GAIN 0.0006 // Per second of delay error and second, critically damped with DRIFT_GAIN.
+
+/*
+ * Estimates how fast the sound card plays against the server's clock from the end-to-end delay, from a frame's
+ * place in the server's stream to the time it's heard. A card slower than the server makes the delay creep up and
+ * a faster one drains the device, the ratio resamples the audio to hold it steady.
+ */
+typedef struct {
+    int64_t start_time;
+    int64_t last_time;
+    double delay; // Smoothed, in microseconds.
+    double target;
+    bool locked; // The target is taken.
+    double integral;
+    double ratio; // Output frames per input frame.
+} DriftCompensator;
+
+void init_drift_compensator(DriftCompensator *drift);
+
+double update_drift_compensator(DriftCompensator *drift, int64_t now, double delay);
+
+#endif
@@ -0,0 +1,705 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <pthread.h>
+
+#include "dsp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DSP_X86
+#define DSP_SSE2 __attribute__((target("sse2")))
+#define DSP_AVX2 __attribute__((target("avx2")))
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DSP_NEON
+#endif
+
+#define SAMPLE_SCALE 32768.0f
+#define ROUNDING_BIAS 12582912.0f // 1.5 * 2^23, floats around it have no fraction bits left.
+
+/*
+ * The vectorized routines behind the public functions, picked once for the CPU.
+ * The gain of a frame is gain + step * (frame + 1), so a volume change ramps over one buffer instead of clicking.
+ */
+struct dsp_kernels {
+    const char *name;
+    int lanes; // Samples per vector, a ramp needs the channels to divide it.
+    bool (*supported)(void);
+    void (*samples_to_float)(const int16_t *samples, float *out, int count);
+    void (*float_to_samples)(const float *samples, int16_t *out, int count);
+    void (*scale_samples)(int16_t *samples, int count, int channels, float gain, float step);
+    void (*scale_floats)(float *samples, int count, int channels, float gain, float step);
+    void (*mix_samples)(const int16_t *samples, float *mix, int count, int channels, float gain, float step);
+    void (*interleave_stereo)(const int16_t *left, const int16_t *right, int16_t *samples, int frames);
+    void (*deinterleave_stereo)(const int16_t *samples, int16_t *left, int16_t *right, int frames);
+    float (*dot_product)(const float *a, const float *b, int count);
+};
+
+/*
+ * Clips and rounds to the nearest sample, ties to even as the vector conversions do.
+ * The comparisons turn NaN into the lower bound like maxps, and adding 1.5 * 2^23 rounds without a call to lrintf.
+ */
+static inline int16_t saturate_sample(float value) {
+    value = value > -SAMPLE_SCALE ? value : -SAMPLE_SCALE;
+    value = value < SAMPLE_SCALE - 1 ? value : SAMPLE_SCALE - 1;
+    return (int16_t) (int32_t) (value + ROUNDING_BIAS - ROUNDING_BIAS);
+}
+
+static bool always_supported(void) {
+    return true;
+}
+
+static void samples_to_float_scalar(const int16_t *samples, float *out, int count) {
+    for (int i = 0; i < count; i++)
+        out[i] = samples[i] * (1 / SAMPLE_SCALE);
+}
+
+static void float_to_samples_scalar(const float *samples, int16_t *out, int count) {
+    for (int i = 0; i < count; i++)
+        out[i] = saturate_sample(samples[i] * SAMPLE_SCALE);
+}
+
+/* Scales samples from first to count, the vector routines finish their tails with it. */
+static void scale_tail(int16_t *samples, int first, int count, int channels, float gain, float step) {
+    for (int i = first, frame = first / channels; i < count; frame++) {
+        const float frame_gain = gain + step * (float) (frame + 1);
+        for (int frame_end = (frame + 1) * channels < count ? (frame + 1) * channels : count; i < frame_end; i++)
+            samples[i] = saturate_sample(samples[i] * frame_gain);
+    }
+}
+
+static void scale_samples_scalar(int16_t *samples, int count, int channels, float gain, float step) {
+    scale_tail(samples, 0, count, channels, gain, step);
+}
+
+/* Floats are left unclipped, they are clipped once they become samples. */
+static void scale_floats_tail(float *samples, int first, int count, int channels, float gain, float step) {
+    for (int i = first, frame = first / channels; i < count; frame++) {
+        const float frame_gain = gain + step * (float) (frame + 1);
+        for (int frame_end = (frame + 1) * channels < count ? (frame + 1) * channels : count; i < frame_end; i++)
+            samples[i] *= frame_gain;
+    }
+}
+
+static void scale_floats_scalar(float *samples, int count, int channels, float gain, float step) {
+    scale_floats_tail(samples, 0, count, channels, gain, step);
+}
+
+/* Adds the samples from first to count to the mix, the vector routines finish their tails with it. */
+static void mix_tail(const int16_t *samples, float *mix, int first, int count, int channels, float gain, float step) {
+    for (int i = first, frame = first / channels; i < count; frame++) {
+        const float frame_gain = gain + step * (float) (frame + 1);
+        for (int frame_end = (frame + 1) * channels < count ? (frame + 1) * channels : count; i < frame_end; i++)
+            mix[i] += samples[i] * frame_gain;
+    }
+}
+
+static void mix_samples_scalar(const int16_t *samples, float *mix, int count, int channels, float gain, float step) {
+    mix_tail(samples, mix, 0, count, channels, gain, step);
+}
+
+static void interleave_stereo_scalar(const int16_t *left, const int16_t *right, int16_t *samples, int frames) {
+    for (int i = 0; i < frames; i++) {
+        samples[2 * i] = left[i];
+        samples[2 * i + 1] = right[i];
+    }
+}
+
+static void deinterleave_stereo_scalar(const int16_t *samples, int16_t *left, int16_t *right, int frames) {
+    for (int i = 0; i < frames; i++) {
+        left[i] = samples[2 * i];
+        right[i] = samples[2 * i + 1];
+    }
+}
+
+static float dot_product_scalar(const float *a, const float *b, int count) {
+    float sum = 0;
+    for (int i = 0; i < count; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+static const struct dsp_kernels scalar_kernels = {
+        "scalar", 1, always_supported, samples_to_float_scalar, float_to_samples_scalar, scale_samples_scalar,
+        scale_floats_scalar, mix_samples_scalar, interleave_stereo_scalar, deinterleave_stereo_scalar, dot_product_scalar
+};
+
+#ifdef DSP_X86
+
+static bool sse2_supported(void) {
+#ifdef __x86_64__
+    return true;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool avx2_supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+/* Frame numbers plus one of the lanes starting at sample first, only meaningful if channels divides the lanes. */
+static void lane_frames(float *frames, int lanes, int first, int channels) {
+    for (int lane = 0; lane < lanes; lane++)
+        frames[lane] = (float) ((first + lane) / channels + 1);
+}
+
+DSP_SSE2 static inline __m128i pack_samples_sse2(__m128 low, __m128 high) {
+    const __m128 min = _mm_set1_ps(-SAMPLE_SCALE), max = _mm_set1_ps(SAMPLE_SCALE - 1);
+    low = _mm_min_ps(_mm_max_ps(low, min), max);
+    high = _mm_min_ps(_mm_max_ps(high, min), max);
+    return _mm_packs_epi32(_mm_cvtps_epi32(low), _mm_cvtps_epi32(high));
+}
+
+DSP_SSE2 static void samples_to_float_sse2(const int16_t *samples, float *out, int count) {
+    const __m128 scale = _mm_set1_ps(1 / SAMPLE_SCALE);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (samples + i));
+        __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+    }
+    samples_to_float_scalar(samples + i, out + i, count - i);
+}
+
+DSP_SSE2 static void float_to_samples_sse2(const float *samples, int16_t *out, int count) {
+    const __m128 scale = _mm_set1_ps(SAMPLE_SCALE);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128 low = _mm_mul_ps(_mm_loadu_ps(samples + i), scale);
+        __m128 high = _mm_mul_ps(_mm_loadu_ps(samples + i + 4), scale);
+        _mm_storeu_si128((__m128i *) (out + i), pack_samples_sse2(low, high));
+    }
+    float_to_samples_scalar(samples + i, out + i, count - i);
+}
+
+DSP_SSE2 static void scale_samples_sse2(int16_t *samples, int count, int channels, float gain, float step) {
+    float frames[8];
+    lane_frames(frames, 8, 0, channels);
+    __m128 frames_low = _mm_loadu_ps(frames), frames_high = _mm_loadu_ps(frames + 4);
+    const __m128 advance = _mm_set1_ps((float) (8 / channels));
+    const __m128 gains = _mm_set1_ps(gain), steps = _mm_set1_ps(step);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (samples + i));
+        __m128 low = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+        __m128 high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+        low = _mm_mul_ps(low, _mm_add_ps(gains, _mm_mul_ps(steps, frames_low)));
+        high = _mm_mul_ps(high, _mm_add_ps(gains, _mm_mul_ps(steps, frames_high)));
+        _mm_storeu_si128((__m128i *) (samples + i), pack_samples_sse2(low, high));
+        frames_low = _mm_add_ps(frames_low, advance);
+        frames_high = _mm_add_ps(frames_high, advance);
+    }
+    scale_tail(samples, i, count, channels, gain, step);
+}
+
+DSP_SSE2 static void scale_floats_sse2(float *samples, int count, int channels, float gain, float step) {
+    float frames[8];
+    lane_frames(frames, 8, 0, channels);
+    __m128 frames_low = _mm_loadu_ps(frames), frames_high = _mm_loadu_ps(frames + 4);
+    const __m128 advance = _mm_set1_ps((float) (8 / channels));
+    const __m128 gains = _mm_set1_ps(gain), steps = _mm_set1_ps(step);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128 low = _mm_mul_ps(_mm_loadu_ps(samples + i), _mm_add_ps(gains, _mm_mul_ps(steps, frames_low)));
+        __m128 high = _mm_mul_ps(_mm_loadu_ps(samples + i + 4), _mm_add_ps(gains, _mm_mul_ps(steps, frames_high)));
+        _mm_storeu_ps(samples + i, low);
+        _mm_storeu_ps(samples + i + 4, high);
+        frames_low = _mm_add_ps(frames_low, advance);
+        frames_high = _mm_add_ps(frames_high, advance);
+    }
+    scale_floats_tail(samples, i, count, channels, gain, step);
+}
+
+DSP_SSE2 static void mix_samples_sse2(const int16_t *samples, float *mix, int count, int channels, float gain,
+                                      float step) {
+    float frames[8];
+    lane_frames(frames, 8, 0, channels);
+    __m128 frames_low = _mm_loadu_ps(frames), frames_high = _mm_loadu_ps(frames + 4);
+    const __m128 advance = _mm_set1_ps((float) (8 / channels));
+    const __m128 gains = _mm_set1_ps(gain), steps = _mm_set1_ps(step);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (samples + i));
+        __m128 low = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+        __m128 high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+        low = _mm_mul_ps(low, _mm_add_ps(gains, _mm_mul_ps(steps, frames_low)));
+        high = _mm_mul_ps(high, _mm_add_ps(gains, _mm_mul_ps(steps, frames_high)));
+        _mm_storeu_ps(mix + i, _mm_add_ps(_mm_loadu_ps(mix + i), low));
+        _mm_storeu_ps(mix + i + 4, _mm_add_ps(_mm_loadu_ps(mix + i + 4), high));
+        frames_low = _mm_add_ps(frames_low, advance);
+        frames_high = _mm_add_ps(frames_high, advance);
+    }
+    mix_tail(samples, mix, i, count, channels, gain, step);
+}
+
+DSP_SSE2 static void interleave_stereo_sse2(const int16_t *left, const int16_t *right, int16_t *samples, int frames) {
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i l = _mm_loadu_si128((const __m128i *) (left + i));
+        __m128i r = _mm_loadu_si128((const __m128i *) (right + i));
+        _mm_storeu_si128((__m128i *) (samples + 2 * i), _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128((__m128i *) (samples + 2 * i + 8), _mm_unpackhi_epi16(l, r));
+    }
+    interleave_stereo_scalar(left + i, right + i, samples + 2 * i, frames - i);
+}
+
+/* Splits every 32 bits into its sign-extended halves, which pack back without saturating. */
+DSP_SSE2 static void deinterleave_stereo_sse2(const int16_t *samples, int16_t *left, int16_t *right, int frames) {
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (samples + 2 * i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (samples + 2 * i + 8));
+        __m128i l = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+                                    _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+        __m128i r = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+        _mm_storeu_si128((__m128i *) (left + i), l);
+        _mm_storeu_si128((__m128i *) (right + i), r);
+    }
+    deinterleave_stereo_scalar(samples + 2 * i, left + i, right + i, frames - i);
+}
+
+/* Two accumulators hide the latency of the additions. */
+DSP_SSE2 static float dot_product_sse2(const float *a, const float *b, int count) {
+    __m128 sum_a = _mm_setzero_ps(), sum_b = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        sum_a = _mm_add_ps(sum_a, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        sum_b = _mm_add_ps(sum_b, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float sums[4];
+    _mm_storeu_ps(sums, _mm_add_ps(sum_a, sum_b));
+    return sums[0] + sums[1] + sums[2] + sums[3] + dot_product_scalar(a + i, b + i, count - i);
+}
+
+/* The 256 bit pack works on each 128 bit half, the permutation puts the samples back in order. */
+DSP_AVX2 static inline __m256i pack_samples_avx2(__m256 low, __m256 high) {
+    const __m256 min = _mm256_set1_ps(-SAMPLE_SCALE), max = _mm256_set1_ps(SAMPLE_SCALE - 1);
+    low = _mm256_min_ps(_mm256_max_ps(low, min), max);
+    high = _mm256_min_ps(_mm256_max_ps(high, min), max);
+    __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(low), _mm256_cvtps_epi32(high));
+    return _mm256_permute4x64_epi64(packed, 0xD8);
+}
+
+DSP_AVX2 static void samples_to_float_avx2(const int16_t *samples, float *out, int count) {
+    const __m256 scale = _mm256_set1_ps(1 / SAMPLE_SCALE);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i low = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (samples + i)));
+        __m256i high = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (samples + i + 8)));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(low), scale));
+        _mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(high), scale));
+    }
+    samples_to_float_scalar(samples + i, out + i, count - i);
+}
+
+DSP_AVX2 static void float_to_samples_avx2(const float *samples, int16_t *out, int count) {
+    const __m256 scale = _mm256_set1_ps(SAMPLE_SCALE);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 low = _mm256_mul_ps(_mm256_loadu_ps(samples + i), scale);
+        __m256 high = _mm256_mul_ps(_mm256_loadu_ps(samples + i + 8), scale);
+        _mm256_storeu_si256((__m256i *) (out + i), pack_samples_avx2(low, high));
+    }
+    float_to_samples_scalar(samples + i, out + i, count - i);
+}
+
+DSP_AVX2 static void scale_samples_avx2(int16_t *samples, int count, int channels, float gain, float step) {
+    float frames[16];
+    lane_frames(frames, 16, 0, channels);
+    __m256 frames_low = _mm256_loadu_ps(frames), frames_high = _mm256_loadu_ps(frames + 8);
+    const __m256 advance = _mm256_set1_ps((float) (16 / channels));
+    const __m256 gains = _mm256_set1_ps(gain), steps = _mm256_set1_ps(step);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 low = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (samples + i))));
+        __m256 high = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (samples + i + 8))));
+        low = _mm256_mul_ps(low, _mm256_add_ps(gains, _mm256_mul_ps(steps, frames_low)));
+        high = _mm256_mul_ps(high, _mm256_add_ps(gains, _mm256_mul_ps(steps, frames_high)));
+        _mm256_storeu_si256((__m256i *) (samples + i), pack_samples_avx2(low, high));
+        frames_low = _mm256_add_ps(frames_low, advance);
+        frames_high = _mm256_add_ps(frames_high, advance);
+    }
+    scale_tail(samples, i, count, channels, gain, step);
+}
+
+DSP_AVX2 static void scale_floats_avx2(float *samples, int count, int channels, float gain, float step) {
+    float frames[16];
+    lane_frames(frames, 16, 0, channels);
+    __m256 frames_low = _mm256_loadu_ps(frames), frames_high = _mm256_loadu_ps(frames + 8);
+    const __m256 advance = _mm256_set1_ps((float) (16 / channels));
+    const __m256 gains = _mm256_set1_ps(gain), steps = _mm256_set1_ps(step);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 low = _mm256_loadu_ps(samples + i), high = _mm256_loadu_ps(samples + i + 8);
+        low = _mm256_mul_ps(low, _mm256_add_ps(gains, _mm256_mul_ps(steps, frames_low)));
+        high = _mm256_mul_ps(high, _mm256_add_ps(gains, _mm256_mul_ps(steps, frames_high)));
+        _mm256_storeu_ps(samples + i, low);
+        _mm256_storeu_ps(samples + i + 8, high);
+        frames_low = _mm256_add_ps(frames_low, advance);
+        frames_high = _mm256_add_ps(frames_high, advance);
+    }
+    scale_floats_tail(samples, i, count, channels, gain, step);
+}
+
+DSP_AVX2 static void mix_samples_avx2(const int16_t *samples, float *mix, int count, int channels, float gain,
+                                      float step) {
+    float frames[16];
+    lane_frames(frames, 16, 0, channels);
+    __m256 frames_low = _mm256_loadu_ps(frames), frames_high = _mm256_loadu_ps(frames + 8);
+    const __m256 advance = _mm256_set1_ps((float) (16 / channels));
+    const __m256 gains = _mm256_set1_ps(gain), steps = _mm256_set1_ps(step);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 low = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (samples + i))));
+        __m256 high = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (samples + i + 8))));
+        low = _mm256_mul_ps(low, _mm256_add_ps(gains, _mm256_mul_ps(steps, frames_low)));
+        high = _mm256_mul_ps(high, _mm256_add_ps(gains, _mm256_mul_ps(steps, frames_high)));
+        _mm256_storeu_ps(mix + i, _mm256_add_ps(_mm256_loadu_ps(mix + i), low));
+        _mm256_storeu_ps(mix + i + 8, _mm256_add_ps(_mm256_loadu_ps(mix + i + 8), high));
+        frames_low = _mm256_add_ps(frames_low, advance);
+        frames_high = _mm256_add_ps(frames_high, advance);
+    }
+    mix_tail(samples, mix, i, count, channels, gain, step);
+}
+
+DSP_AVX2 static float dot_product_avx2(const float *a, const float *b, int count) {
+    __m256 sum_a = _mm256_setzero_ps(), sum_b = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        sum_a = _mm256_add_ps(sum_a, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        sum_b = _mm256_add_ps(sum_b, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+    }
+    __m256 sum = _mm256_add_ps(sum_a, sum_b);
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    float sums[4];
+    _mm_storeu_ps(sums, half);
+    return sums[0] + sums[1] + sums[2] + sums[3] + dot_product_scalar(a + i, b + i, count - i);
+}
+
+/* Interleaving is bound by memory, the SSE2 routines are as fast as AVX2 ones would be. */
+static const struct dsp_kernels avx2_kernels = {
+        "avx2", 16, avx2_supported, samples_to_float_avx2, float_to_samples_avx2, scale_samples_avx2,
+        scale_floats_avx2, mix_samples_avx2, interleave_stereo_sse2, deinterleave_stereo_sse2, dot_product_avx2
+};
+
+static const struct dsp_kernels sse2_kernels = {
+        "sse2", 8, sse2_supported, samples_to_float_sse2, float_to_samples_sse2, scale_samples_sse2,
+        scale_floats_sse2, mix_samples_sse2, interleave_stereo_sse2, deinterleave_stereo_sse2, dot_product_sse2
+};
+
+#endif
+
+#ifdef DSP_NEON
+
+/* maxnm and minnm turn NaN into the bound, as the scalar comparisons do. */
+static inline int16x8_t pack_samples_neon(float32x4_t low, float32x4_t high) {
+    const float32x4_t min = vdupq_n_f32(-SAMPLE_SCALE), max = vdupq_n_f32(SAMPLE_SCALE - 1);
+    low = vminnmq_f32(vmaxnmq_f32(low, min), max);
+    high = vminnmq_f32(vmaxnmq_f32(high, min), max);
+    return vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(low)), vqmovn_s32(vcvtnq_s32_f32(high)));
+}
+
+static void samples_to_float_neon(const int16_t *samples, float *out, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t x = vld1q_s16(samples + i);
+        vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), 1 / SAMPLE_SCALE));
+        vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), 1 / SAMPLE_SCALE));
+    }
+    samples_to_float_scalar(samples + i, out + i, count - i);
+}
+
+static void float_to_samples_neon(const float *samples, int16_t *out, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        float32x4_t low = vmulq_n_f32(vld1q_f32(samples + i), SAMPLE_SCALE);
+        float32x4_t high = vmulq_n_f32(vld1q_f32(samples + i + 4), SAMPLE_SCALE);
+        vst1q_s16(out + i, pack_samples_neon(low, high));
+    }
+    float_to_samples_scalar(samples + i, out + i, count - i);
+}
+
+static void scale_samples_neon(int16_t *samples, int count, int channels, float gain, float step) {
+    float frames[8];
+    for (int lane = 0; lane < 8; lane++)
+        frames[lane] = (float) (lane / channels + 1);
+    float32x4_t frames_low = vld1q_f32(frames), frames_high = vld1q_f32(frames + 4);
+    const float32x4_t advance = vdupq_n_f32((float) (8 / channels));
+    const float32x4_t gains = vdupq_n_f32(gain);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t x = vld1q_s16(samples + i);
+        float32x4_t low = vcvtq_f32_s32(vmovl_s16(vget_low_s16(x)));
+        float32x4_t high = vcvtq_f32_s32(vmovl_s16(vget_high_s16(x)));
+        low = vmulq_f32(low, vaddq_f32(gains, vmulq_n_f32(frames_low, step)));
+        high = vmulq_f32(high, vaddq_f32(gains, vmulq_n_f32(frames_high, step)));
+        vst1q_s16(samples + i, pack_samples_neon(low, high));
+        frames_low = vaddq_f32(frames_low, advance);
+        frames_high = vaddq_f32(frames_high, advance);
+    }
+    scale_tail(samples, i, count, channels, gain, step);
+}
+
+static void scale_floats_neon(float *samples, int count, int channels, float gain, float step) {
+    float frames[8];
+    for (int lane = 0; lane < 8; lane++)
+        frames[lane] = (float) (lane / channels + 1);
+    float32x4_t frames_low = vld1q_f32(frames), frames_high = vld1q_f32(frames + 4);
+    const float32x4_t advance = vdupq_n_f32((float) (8 / channels));
+    const float32x4_t gains = vdupq_n_f32(gain);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        vst1q_f32(samples + i, vmulq_f32(vld1q_f32(samples + i), vaddq_f32(gains, vmulq_n_f32(frames_low, step))));
+        vst1q_f32(samples + i + 4,
+                  vmulq_f32(vld1q_f32(samples + i + 4), vaddq_f32(gains, vmulq_n_f32(frames_high, step))));
+        frames_low = vaddq_f32(frames_low, advance);
+        frames_high = vaddq_f32(frames_high, advance);
+    }
+    scale_floats_tail(samples, i, count, channels, gain, step);
+}
+
+static void mix_samples_neon(const int16_t *samples, float *mix, int count, int channels, float gain, float step) {
+    float frames[8];
+    for (int lane = 0; lane < 8; lane++)
+        frames[lane] = (float) (lane / channels + 1);
+    float32x4_t frames_low = vld1q_f32(frames), frames_high = vld1q_f32(frames + 4);
+    const float32x4_t advance = vdupq_n_f32((float) (8 / channels));
+    const float32x4_t gains = vdupq_n_f32(gain);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t x = vld1q_s16(samples + i);
+        float32x4_t low = vcvtq_f32_s32(vmovl_s16(vget_low_s16(x)));
+        float32x4_t high = vcvtq_f32_s32(vmovl_s16(vget_high_s16(x)));
+        vst1q_f32(mix + i, vmlaq_f32(vld1q_f32(mix + i), low, vaddq_f32(gains, vmulq_n_f32(frames_low, step))));
+        vst1q_f32(mix + i + 4,
+                  vmlaq_f32(vld1q_f32(mix + i + 4), high, vaddq_f32(gains, vmulq_n_f32(frames_high, step))));
+        frames_low = vaddq_f32(frames_low, advance);
+        frames_high = vaddq_f32(frames_high, advance);
+    }
+    mix_tail(samples, mix, i, count, channels, gain, step);
+}
+
+static void interleave_stereo_neon(const int16_t *left, const int16_t *right, int16_t *samples, int frames) {
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        int16x8x2_t x = {{vld1q_s16(left + i), vld1q_s16(right + i)}};
+        vst2q_s16(samples + 2 * i, x);
+    }
+    interleave_stereo_scalar(left + i, right + i, samples + 2 * i, frames - i);
+}
+
+static void deinterleave_stereo_neon(const int16_t *samples, int16_t *left, int16_t *right, int frames) {
+    int i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        int16x8x2_t x = vld2q_s16(samples + 2 * i);
+        vst1q_s16(left + i, x.val[0]);
+        vst1q_s16(right + i, x.val[1]);
+    }
+    deinterleave_stereo_scalar(samples + 2 * i, left + i, right + i, frames - i);
+}
+
+static float dot_product_neon(const float *a, const float *b, int count) {
+    float32x4_t sum_a = vdupq_n_f32(0), sum_b = vdupq_n_f32(0);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        sum_a = vmlaq_f32(sum_a, vld1q_f32(a + i), vld1q_f32(b + i));
+        sum_b = vmlaq_f32(sum_b, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    return vaddvq_f32(vaddq_f32(sum_a, sum_b)) + dot_product_scalar(a + i, b + i, count - i);
+}
+
+static const struct dsp_kernels neon_kernels = {
+        "neon", 8, always_supported, samples_to_float_neon, float_to_samples_neon, scale_samples_neon,
+        scale_floats_neon, mix_samples_neon, interleave_stereo_neon, deinterleave_stereo_neon, dot_product_neon
+};
+
+#endif
+
+/* The best first. */
+static const struct dsp_kernels *const all_kernels[] = {
+#ifdef DSP_X86
+        &avx2_kernels, &sse2_kernels,
+#endif
+#ifdef DSP_NEON
+        &neon_kernels,
+#endif
+        &scalar_kernels
+};
+
+static const struct dsp_kernels *kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void select_kernels(void) {
+    for (size_t i = 0; kernels == NULL; i++)
+        if (all_kernels[i]->supported())
+            kernels = all_kernels[i];
+}
+
+static const struct dsp_kernels *get_kernels(void) {
+    pthread_once(&kernels_once, select_kernels);
+    return kernels;
+}
+
+/* Converts little-endian samples in place, nothing to do on little-endian CPUs. */
+void s16le_to_native(int16_t *samples, int count) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for (int i = 0; i < count; i++)
+        samples[i] = (int16_t) __builtin_bswap16((uint16_t) samples[i]);
+#else
+    (void) samples;
+    (void) count;
+#endif
+}
+
+void native_to_s16le(int16_t *samples, int count) {
+    s16le_to_native(samples, count); // Swapping is its own inverse.
+}
+
+/* Converts to floats in [-1, 1), count is in samples of all channels. */
+void samples_to_float(const int16_t *samples, float *out, int count) {
+    get_kernels()->samples_to_float(samples, out, count);
+}
+
+/* Converts from floats in [-1, 1), rounding to the nearest sample and clipping what lies outside. */
+void float_to_samples(const float *samples, int16_t *out, int count) {
+    get_kernels()->float_to_samples(samples, out, count);
+}
+
+/*
+ * Scales the samples by a gain that moves evenly from *gain to target_gain over the frames, and keeps target_gain in
+ * *gain for the next buffer. The result is rounded to the nearest sample and clipped.
+ */
+void apply_gain(int16_t *samples, int frames, int channels, float *gain, float target_gain) {
+    if (frames <= 0 || (target_gain == *gain && *gain == 1))
+        return;
+
+    const float step = (target_gain - *gain) / (float) frames;
+    const struct dsp_kernels *selected_kernels = get_kernels();
+    if (step != 0 && selected_kernels->lanes % channels != 0)
+        selected_kernels = &scalar_kernels; // The lanes would straddle frames of different gains.
+    selected_kernels->scale_samples(samples, frames * channels, channels, *gain, step);
+    *gain = target_gain;
+}
+
+/* Like apply_gain(), for floats in [-1, 1) which are neither rounded nor clipped. */
+void apply_float_gain(float *samples, int frames, int channels, float *gain, float target_gain) {
+    if (frames <= 0 || (target_gain == *gain && *gain == 1))
+        return;
+
+    const float step = (target_gain - *gain) / (float) frames;
+    const struct dsp_kernels *selected_kernels = get_kernels();
+    if (step != 0 && selected_kernels->lanes % channels != 0)
+        selected_kernels = &scalar_kernels;
+    selected_kernels->scale_floats(samples, frames * channels, channels, *gain, step);
+    *gain = target_gain;
+}
+
+/*
+ * Saturates floats to [-1, 1] for an output that takes them as they are, the decoder, the gain and the resampler may
+ * overshoot. NaN becomes -1 like in saturate_sample(), the loop vectorizes to min and max.
+ */
+void clip_floats(float *samples, int count) {
+    for (int i = 0; i < count; i++) {
+        const float value = samples[i] > -1.0f ? samples[i] : -1.0f;
+        samples[i] = value < 1.0f ? value : 1.0f;
+    }
+}
+
+/*
+ * Adds the samples to mix, floats in [-1, 1), with a gain ramped like apply_gain()'s. The sum is neither rounded nor
+ * clipped, float_to_samples() saturates it once every input is in.
+ */
+void mix_samples(const int16_t *samples, float *mix, int frames, int channels, float *gain, float target_gain) {
+    if (frames <= 0 || (target_gain == 0 && *gain == 0))
+        return;
+
+    const float step = (target_gain - *gain) / (float) frames;
+    const struct dsp_kernels *selected_kernels = get_kernels();
+    if (step != 0 && selected_kernels->lanes % channels != 0)
+        selected_kernels = &scalar_kernels;
+    selected_kernels->mix_samples(samples, mix, frames * channels, channels, *gain / SAMPLE_SCALE, step / SAMPLE_SCALE);
+    *gain = target_gain;
+}
+
+/* Interleaves planes[channel][frame] into samples[frame * channels + channel]. */
+void interleave_samples(const int16_t *const *planes, int16_t *samples, int channels, int frames) {
+    if (channels == 2) {
+        get_kernels()->interleave_stereo(planes[0], planes[1], samples, frames);
+        return;
+    }
+    for (int channel = 0; channel < channels; channel++)
+        for (int i = 0; i < frames; i++)
+            samples[i * channels + channel] = planes[channel][i];
+}
+
+void deinterleave_samples(const int16_t *samples, int16_t *const *planes, int channels, int frames) {
+    if (channels == 2) {
+        get_kernels()->deinterleave_stereo(samples, planes[0], planes[1], frames);
+        return;
+    }
+    for (int channel = 0; channel < channels; channel++)
+        for (int i = 0; i < frames; i++)
+            planes[channel][i] = samples[i * channels + channel];
+}
+
+/* The vector routines sum in another order than the scalar one, results may differ in the last bits. */
+float dot_product(const float *a, const float *b, int count) {
+    return get_kernels()->dot_product(a, b, count);
+}
+
+/* The name of the routines in use, like "avx2". */
+const char *dsp_kernels(void) {
+    return get_kernels()->name;
+}
+
+/* Fills names with the routines this CPU supports, the best first, and returns how many there are. */
+int list_dsp_kernels(const char **names) {
+    int count = 0;
+    for (size_t i = 0; i < sizeof(all_kernels) / sizeof(all_kernels[0]); i++)
+        if (all_kernels[i]->supported())
+            names[count++] = all_kernels[i]->name;
+    return count;
+}
+
+/* Switches to other routines, for benchmarks before any thread uses them. */
+bool use_dsp_kernels(const char *name) {
+    get_kernels();
+    for (size_t i = 0; i < sizeof(all_kernels) / sizeof(all_kernels[0]); i++) {
+        if (!strcmp(all_kernels[i]->name, name) && all_kernels[i]->supported()) {
+            kernels = all_kernels[i];
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,57 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAPLAYER_DSP_H
+#define RAPLAYER_DSP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DSP_MAX_KERNELS 4
+
+void s16le_to_native(int16_t *samples, int count);
+
+void native_to_s16le(int16_t *samples, int count);
+
+void samples_to_float(const int16_t *samples, float *out, int count);
+
+void float_to_samples(const float *samples, int16_t *out, int count);
+
+void apply_gain(int16_t *samples, int frames, int channels, float *gain, float target_gain);
+
+void apply_float_gain(float *samples, int frames, int channels, float *gain, float target_gain);
+
+void clip_floats(float *samples, int count);
+
+void mix_samples(const int16_t *samples, float *mix, int frames, int channels, float *gain, float target_gain);
+
+void interleave_samples(const int16_t *const *planes, int16_t *samples, int channels, int frames);
+
+void deinterleave_samples(const int16_t *samples, int16_t *const *planes, int channels, int frames);
+
+float dot_product(const float *a, const float *b, int count);
+
+const char *dsp_kernels(void);
+
+int list_dsp_kernels(const char **names);
+
+bool use_dsp_kernels(const char *name);
+
+#endif
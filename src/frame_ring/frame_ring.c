@@ -0,0 +1,164 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "frame_ring.h"
+
+void init_frame_ring(FrameRing *ring) {
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->closed, false);
+    pthread_mutex_init(&ring->wait_mutex, NULL);
+    pthread_cond_init(&ring->wait_cond, NULL);
+
+    for (int i = 0; i < FRAME_RING_SIZE; i++) {
+        atomic_init(&ring->slots[i].epoch, 0);
+        ring->slots[i].frame.buffer_len = 0;
+    }
+}
+
+void destroy_frame_ring(FrameRing *ring) {
+    pthread_mutex_destroy(&ring->wait_mutex);
+    pthread_cond_destroy(&ring->wait_cond);
+}
+
+static void wake_readers(FrameRing *ring) {
+    pthread_mutex_lock(&ring->wait_mutex);
+    pthread_cond_broadcast(&ring->wait_cond);
+    pthread_mutex_unlock(&ring->wait_mutex);
+}
+
+static bool is_valid_frame_len(ssize_t buffer_len) {
+    return buffer_len >= 0 && buffer_len <= MAX_DATA_SIZE;
+}
+
+/*
+ * Single writer only: the builder thread owns publishing.
+ * A frame of invalid length still takes its epoch, so sequences stay contiguous, but readers skip it.
+ */
+void publish_frame(FrameRing *ring, const char *buffer, ssize_t buffer_len) {
+    uint64_t k = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    FrameSlot *slot = &ring->slots[k & (FRAME_RING_SIZE - 1)];
+
+    atomic_store_explicit(&slot->epoch, 2 * k + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    if (is_valid_frame_len(buffer_len)) {
+        memcpy(slot->frame.buffer, buffer, buffer_len);
+        slot->frame.buffer_len = buffer_len;
+    } else
+        slot->frame.buffer_len = -1;
+
+    atomic_store_explicit(&slot->epoch, 2 * k + 2, memory_order_release);
+    atomic_store_explicit(&ring->head, k + 1, memory_order_release);
+
+    wake_readers(ring);
+}
+
+void close_frame_ring(FrameRing *ring) {
+    atomic_store_explicit(&ring->closed, true, memory_order_release);
+    wake_readers(ring);
+}
+
+void init_frame_cursor(FrameRing *ring, FrameCursor *cursor) {
+    cursor->next = atomic_load_explicit(&ring->head, memory_order_acquire);
+    cursor->skipped = 0;
+}
+
+/* Blocks until the frame at the cursor is published. Returns false once the ring is closed. */
+bool wait_frame(FrameRing *ring, const FrameCursor *cursor) {
+    if (atomic_load_explicit(&ring->head, memory_order_acquire) > cursor->next)
+        return true;
+
+    pthread_mutex_lock(&ring->wait_mutex);
+    while (atomic_load_explicit(&ring->head, memory_order_acquire) <= cursor->next &&
+           !atomic_load_explicit(&ring->closed, memory_order_acquire))
+        pthread_cond_wait(&ring->wait_cond, &ring->wait_mutex);
+    pthread_mutex_unlock(&ring->wait_mutex);
+
+    return atomic_load_explicit(&ring->head, memory_order_acquire) > cursor->next;
+}
+
+/* Copies an already published frame, returns false if it was never published or has been overwritten. */
+bool read_frame_at(FrameRing *ring, uint64_t epoch, Task *frame) {
+    if (atomic_load_explicit(&ring->head, memory_order_acquire) <= epoch)
+        return false;
+
+    FrameSlot *slot = &ring->slots[epoch & (FRAME_RING_SIZE - 1)];
+    uint64_t expected = 2 * epoch + 2;
+
+    if (atomic_load_explicit(&slot->epoch, memory_order_acquire) != expected)
+        return false;
+
+    ssize_t buffer_len = slot->frame.buffer_len;
+    if (!is_valid_frame_len(buffer_len))
+        return false;
+    memcpy(frame->buffer, slot->frame.buffer, buffer_len);
+    frame->buffer_len = buffer_len;
+
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&slot->epoch, memory_order_relaxed) == expected;
+}
+
+/* Maps a 32-bit packet sequence back to the most recent frame epoch carrying it. */
+uint64_t find_frame_epoch(FrameRing *ring, uint32_t sequence) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t distance = (uint32_t) head - sequence;
+    return distance <= head ? head - distance : UINT64_MAX;
+}
+
+/*
+ * Copies the frame at the cursor and advances it.
+ * If the writer lapped this reader, the cursor jumps to the newest frame and the gap is counted as skipped.
+ * A frame of invalid length is counted as skipped too, rather than handed out with stale data.
+ * Returns false if no published frame is available yet.
+ */
+bool read_frame(FrameRing *ring, FrameCursor *cursor, Task *frame) {
+    while (true) {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (head <= cursor->next)
+            return false;
+
+        FrameSlot *slot = &ring->slots[cursor->next & (FRAME_RING_SIZE - 1)];
+        uint64_t expected = 2 * cursor->next + 2;
+
+        if (atomic_load_explicit(&slot->epoch, memory_order_acquire) == expected) {
+            ssize_t buffer_len = slot->frame.buffer_len;
+            bool valid = is_valid_frame_len(buffer_len);
+            if (valid) {
+                memcpy(frame->buffer, slot->frame.buffer, buffer_len);
+                frame->buffer_len = buffer_len;
+            }
+
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&slot->epoch, memory_order_relaxed) == expected) {
+                cursor->next++;
+                if (valid)
+                    return true;
+
+                cursor->skipped++;
+                continue;
+            }
+        }
+
+        /* The slot was reused while we were behind: resume from the newest published frame. */
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        cursor->skipped += head - 1 - cursor->next;
+        cursor->next = head - 1;
+    }
+}
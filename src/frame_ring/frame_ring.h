@@ -0,0 +1,78 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "../ra_server.h"
+
+#ifndef RAPLAYER_FRAME_RING_H
+#define RAPLAYER_FRAME_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "../task_scheduler/task_queue/task/task.h"
+
+#define FRAME_RING_SIZE 256 // Must be a power of two, also bounds the history kept for retransmissions.
+
+/*
+ * A slot holds one immutable published frame.
+ * epoch is odd (2k + 1) while frame k is being written and even (2k + 2) once it is published,
+ * so readers can detect both an overwritten slot and a torn copy.
+ */
+typedef struct {
+    atomic_uint_fast64_t epoch;
+    Task frame;
+} FrameSlot;
+
+typedef struct {
+    atomic_uint_fast64_t head; // Number of frames published so far.
+    atomic_bool closed;
+
+    pthread_mutex_t wait_mutex; // Only guards sleeping on wait_cond, never held while sending.
+    pthread_cond_t wait_cond;
+
+    FrameSlot slots[FRAME_RING_SIZE];
+} FrameRing;
+
+typedef struct {
+    uint64_t next; // Epoch of the next frame to be read.
+    uint64_t skipped; // Frames overwritten before this reader got to them.
+} FrameCursor;
+
+void init_frame_ring(FrameRing *ring);
+
+void destroy_frame_ring(FrameRing *ring);
+
+void publish_frame(FrameRing *ring, const char *buffer, ssize_t buffer_len);
+
+void close_frame_ring(FrameRing *ring);
+
+void init_frame_cursor(FrameRing *ring, FrameCursor *cursor);
+
+bool wait_frame(FrameRing *ring, const FrameCursor *cursor);
+
+bool read_frame(FrameRing *ring, FrameCursor *cursor, Task *frame);
+
+bool read_frame_at(FrameRing *ring, uint64_t epoch, Task *frame);
+
+uint64_t find_frame_epoch(FrameRing *ring, uint32_t sequence);
+
+#endif
@@ -18,8 +18,13 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
-#include "ra_client.h"
-#include "ra_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include "cli/cli.h"
 
 void print_usage(char **argv) {
     puts("");
@@ -29,21 +34,19 @@ void print_usage(char **argv) {
     puts("");
 }
 
+/* The sound card is only initialized by the client, when it opens the output. */
 int main(int argc, char **argv) {
-    fclose(stderr); // Close stderr to avoid showing logging in the alsa-lib.
-    int err = Pa_Initialize();
-
-    if (err != paNoError) {
-        printf("PortAudio error: %s\n", Pa_GetErrorText(err));
-        return EXIT_FAILURE;
-    }
+    char command[PATH_MAX + 16];
 
     if (argc < 2 ? true : !strcmp(argv[1], "--client") ? false : !strcmp(argv[1], "--server") ? false : true)
         print_usage(argv);
-    else if (!strcmp(argv[1], "--client"))
-        ra_client(argc, argv);
-    else if (!strcmp(argv[1], "--server"))
-        ra_server(argc, argv);
+    else if (!strcmp(argv[1], "--client")) {
+        snprintf(command, sizeof(command), "%s --client", argv[0]);
+        return ra_client(command, argc - 2, argv + 2);
+    } else if (!strcmp(argv[1], "--server")) {
+        snprintf(command, sizeof(command), "%s --server", argv[0]);
+        return ra_server(command, argc - 2, argv + 2);
+    }
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,331 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <sys/un.h>
+
+#include "metrics.h"
+
+/* Listens on a loopback TCP port, or on a UNIX socket given as "unix:/path". Returns -1 on failure. */
+int open_metrics_socket(const char *address) {
+    int listen_fd;
+
+    if (!strncmp(address, METRICS_UNIX_PREFIX, strlen(METRICS_UNIX_PREFIX))) {
+        struct sockaddr_un unix_addr = {0};
+        const char *path = address + strlen(METRICS_UNIX_PREFIX);
+        if (strlen(path) == 0 || strlen(path) >= sizeof(unix_addr.sun_path)) {
+            printf("Error: Invalid metrics socket path \"%s\".\n", path);
+            return -1;
+        }
+        unix_addr.sun_family = AF_UNIX;
+        strcpy(unix_addr.sun_path, path);
+
+        if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+            printf("Error: metrics socket creation failed: %s\n", strerror(errno));
+            return -1;
+        }
+        unlink(path); // A stale socket of a previous run.
+        if (bind(listen_fd, (const struct sockaddr *) &unix_addr, sizeof(unix_addr)) < 0) {
+            printf("Error: metrics bind failed: %s\n", strerror(errno));
+            close(listen_fd);
+            return -1;
+        }
+    } else {
+        long port = strtol(address, NULL, 10);
+        if (port < 1 || port > 65535) {
+            printf("Error: Invalid metrics port \"%s\".\n", address);
+            return -1;
+        }
+
+        struct sockaddr_in loopback_addr = {0};
+        loopback_addr.sin_family = AF_INET;
+        loopback_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        loopback_addr.sin_port = htons((uint16_t) port);
+
+        if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+            printf("Error: metrics socket creation failed: %s\n", strerror(errno));
+            return -1;
+        }
+        int reuse_addr = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse_addr, sizeof(reuse_addr));
+        if (bind(listen_fd, (const struct sockaddr *) &loopback_addr, sizeof(loopback_addr)) < 0) {
+            printf("Error: metrics bind failed: %s\n", strerror(errno));
+            close(listen_fd);
+            return -1;
+        }
+    }
+
+    if (listen(listen_fd, 8) < 0) {
+        printf("Error: metrics listen failed: %s\n", strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+    return listen_fd;
+}
+
+static void write_metric_header(FILE *out, const char *name, const char *type, const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void write_counter(FILE *out, const char *name, const char *help, unsigned long value) {
+    write_metric_header(out, name, "counter", help);
+    fprintf(out, "%s %lu\n", name, value);
+}
+
+static void write_gauge(FILE *out, const char *name, const char *help, long value) {
+    write_metric_header(out, name, "gauge", help);
+    fprintf(out, "%s %ld\n", name, value);
+}
+
+static void write_seconds(FILE *out, const char *name, const char *type, const char *help, int64_t nanoseconds) {
+    write_metric_header(out, name, type, help);
+    fprintf(out, "%s %.9f\n", name, (double) nanoseconds / 1000000000.0);
+}
+
+/* Buckets are read one by one while the owner keeps recording, the count is summed from them to stay consistent. */
+static void write_histogram(FILE *out, const char *name, const char *help, const LatenessHistogram *histogram) {
+    write_metric_header(out, name, "histogram", help);
+
+    unsigned long cumulative = 0;
+    for (int i = 0; i < LATENESS_BUCKETS; i++) {
+        cumulative += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        int64_t bound = lateness_bucket_bound(i);
+        if (bound >= 0)
+            fprintf(out, "%s_bucket{le=\"%g\"} %lu\n", name, (double) bound / 1000000.0, cumulative);
+        else
+            fprintf(out, "%s_bucket{le=\"+Inf\"} %lu\n", name, cumulative);
+    }
+    fprintf(out, "%s_sum %.9f\n", name,
+            (double) atomic_load_explicit(&histogram->sum, memory_order_relaxed) / 1000000000.0);
+    fprintf(out, "%s_count %lu\n", name, cumulative);
+}
+
+enum client_metric {
+    CLIENT_CONNECTED,
+    CLIENT_SENT_DATAGRAMS,
+    CLIENT_SENT_BYTES,
+    CLIENT_LAST_SEEN,
+    CLIENT_LOST_FRAMES,
+    CLIENT_CONCEALED_FRAMES,
+    CLIENT_LATE_FRAMES,
+    CLIENT_JITTER,
+    CLIENT_RETRANSMITTED_FRAMES,
+    CLIENT_RATE_LIMITED_FRAMES,
+    CLIENT_QUEUE_DEPTH,
+    CLIENT_MEMORY,
+    CLIENT_METRICS
+};
+
+static const struct {
+    const char *name;
+    const char *type;
+    const char *help;
+} client_metrics[CLIENT_METRICS] = {
+        {"raplayer_client_connected", "gauge", "Whether the client is still sending heartbeats."},
+        {"raplayer_client_sent_datagrams_total", "counter", "Datagrams sent to the client, retransmissions included."},
+        {"raplayer_client_sent_bytes_total", "counter", "Payload bytes sent to the client, retransmissions included."},
+        {"raplayer_client_last_seen_seconds", "gauge", "Seconds since the last datagram from the client."},
+        {"raplayer_client_lost_frames", "gauge", "Frames the client reported as never received."},
+        {"raplayer_client_concealed_frames", "gauge", "Frames the client reported as concealed."},
+        {"raplayer_client_late_frames", "gauge", "Frames the client reported as arrived after their playout."},
+        {"raplayer_client_jitter_seconds", "gauge", "Interarrival jitter the client reported."},
+        {"raplayer_client_retransmitted_frames_total", "counter", "Frames retransmitted on the client's NACKs."},
+        {"raplayer_client_rate_limited_frames_total", "counter", "NACKed frames over the client's retransmission budget."},
+        {"raplayer_client_queue_depth", "gauge", "Datagrams waiting in the client's receive queue."},
+        {"raplayer_client_memory_bytes", "gauge", "Memory held by the client's queue and state."},
+};
+
+static double client_metric_value(const TaskQueue *recv_queue, enum client_metric metric, int64_t now) {
+    const TaskQueueInfo *queue_info = recv_queue->queue_info;
+
+    switch (metric) {
+        case CLIENT_CONNECTED:
+            return atomic_load_explicit(&queue_info->heartbeat_status, memory_order_relaxed) == -1 ? 0 : 1;
+        case CLIENT_SENT_DATAGRAMS:
+            return (double) atomic_load_explicit(&queue_info->sent_datagrams, memory_order_relaxed);
+        case CLIENT_SENT_BYTES:
+            return (double) atomic_load_explicit(&queue_info->sent_bytes, memory_order_relaxed);
+        case CLIENT_LAST_SEEN:
+            return (double) (now - atomic_load_explicit(&queue_info->last_seen, memory_order_relaxed)) / 1000000000.0;
+        case CLIENT_LOST_FRAMES:
+            return (double) atomic_load_explicit(&queue_info->reported_lost_frames, memory_order_relaxed);
+        case CLIENT_CONCEALED_FRAMES:
+            return (double) atomic_load_explicit(&queue_info->reported_concealed_frames, memory_order_relaxed);
+        case CLIENT_LATE_FRAMES:
+            return (double) atomic_load_explicit(&queue_info->reported_late_frames, memory_order_relaxed);
+        case CLIENT_JITTER:
+            return (double) atomic_load_explicit(&queue_info->reported_jitter, memory_order_relaxed) / 1000000.0;
+        case CLIENT_RETRANSMITTED_FRAMES:
+            return (double) atomic_load_explicit(&queue_info->retransmitted_frames, memory_order_relaxed);
+        case CLIENT_RATE_LIMITED_FRAMES:
+            return (double) atomic_load_explicit(&queue_info->rate_limited_frames, memory_order_relaxed);
+        case CLIENT_QUEUE_DEPTH:
+            return queue_depth(recv_queue);
+        case CLIENT_MEMORY:
+            return (double) (sizeof(TaskQueue) + sizeof(TaskQueueInfo) + sizeof(Client) +
+                             (size_t) queue_depth(recv_queue) * sizeof(Task));
+        default:
+            return 0;
+    }
+}
+
+void write_metrics(FILE *out, struct metrics_args *metrics_args) {
+    struct opus_builder_args *opus_builder_args = metrics_args->opus_builder_args;
+    struct opus_sender_args *opus_sender_args = metrics_args->opus_sender_args;
+    NetSender *sender = &opus_sender_args->sender;
+
+    write_counter(out, "raplayer_frames_encoded_total", "Frames encoded by the opus builder.",
+                  atomic_load_explicit(&opus_builder_args->encoded_frames, memory_order_relaxed));
+    write_counter(out, "raplayer_dtx_frames_total", "Frames suppressed with DTX.",
+                  atomic_load_explicit(&opus_builder_args->dtx_frames, memory_order_relaxed));
+    if (opus_builder_args->input.stats != NULL) {
+        RaInputStats input_stats;
+        opus_builder_args->input.stats(opus_builder_args->input.user_data, &input_stats);
+        write_counter(out, "raplayer_input_underruns_total", "Frames the input hadn't delivered in time.",
+                      input_stats.underruns);
+        write_counter(out, "raplayer_input_overruns_total", "Input frames dropped on a full input buffer.",
+                      input_stats.overruns);
+        write_counter(out, "raplayer_input_stretched_frames_total", "Frames time-stretched to ride out an under- or overrun.",
+                      input_stats.stretched_frames);
+    }
+    write_gauge(out, "raplayer_encoder_complexity", "The opus complexity the encoder runs at.",
+                atomic_load_explicit(&opus_builder_args->tuner.complexity, memory_order_relaxed));
+    write_counter(out, "raplayer_complexity_lowered_total", "Times the complexity went down for slow encodes.",
+                  atomic_load_explicit(&opus_builder_args->tuner.lowered, memory_order_relaxed));
+    write_counter(out, "raplayer_complexity_raised_total", "Times the complexity went up with headroom.",
+                  atomic_load_explicit(&opus_builder_args->tuner.raised, memory_order_relaxed));
+    write_counter(out, "raplayer_frames_sent_total", "Frames fanned out to the clients.",
+                  atomic_load_explicit(&opus_sender_args->sent_frames, memory_order_relaxed));
+    write_counter(out, "raplayer_frames_skipped_total", "Frames overwritten in the ring before they were sent.",
+                  atomic_load_explicit(&opus_sender_args->skipped_frames, memory_order_relaxed));
+    write_counter(out, "raplayer_datagrams_sent_total", "Datagrams sent by the fan-out.",
+                  atomic_load_explicit(&sender->sent_datagrams, memory_order_relaxed));
+    write_counter(out, "raplayer_send_syscalls_total", "System calls made by the fan-out to send.",
+                  atomic_load_explicit(&sender->syscalls, memory_order_relaxed));
+    write_counter(out, "raplayer_send_errors_total", "Datagrams the fan-out failed to send.",
+                  atomic_load_explicit(&sender->send_errors, memory_order_relaxed));
+    write_counter(out, "raplayer_send_would_block_total", "Datagrams refused with EAGAIN on a full socket buffer.",
+                  atomic_load_explicit(&sender->would_block, memory_order_relaxed));
+
+    /* The gap summary has no quantiles, the extremes are gauges next to it. */
+    Pacer *pacer = &opus_sender_args->pacer;
+    unsigned long gaps = atomic_load_explicit(&pacer->gaps, memory_order_relaxed);
+    write_seconds(out, "raplayer_pacing_slice_seconds", "gauge", "Part of the frame interval a fan-out is spread across.",
+                  pacer->mode != PACING_OFF ? pacer->slice : 0);
+    write_counter(out, "raplayer_pacing_fanouts_total", "Fan-outs sent through the pacer.",
+                  atomic_load_explicit(&pacer->fanouts, memory_order_relaxed));
+    write_counter(out, "raplayer_pacing_bursts_total", "Groups of datagrams the pacer sent at once.",
+                  atomic_load_explicit(&pacer->bursts, memory_order_relaxed));
+    write_counter(out, "raplayer_pacing_burst_datagrams_total", "Datagrams sent in the pacer's bursts.",
+                  atomic_load_explicit(&pacer->burst_datagrams, memory_order_relaxed));
+    write_gauge(out, "raplayer_pacing_max_burst_datagrams", "Datagrams in the largest burst.",
+                (long) atomic_load_explicit(&pacer->max_burst, memory_order_relaxed));
+    write_metric_header(out, "raplayer_pacing_gap_seconds", "summary", "Gaps between the bursts of a fan-out.");
+    fprintf(out, "raplayer_pacing_gap_seconds_sum %.9f\nraplayer_pacing_gap_seconds_count %lu\n",
+            (double) atomic_load_explicit(&pacer->gap_sum, memory_order_relaxed) / 1000000000.0, gaps);
+    write_seconds(out, "raplayer_pacing_min_gap_seconds", "gauge", "Shortest gap between the bursts of a fan-out.",
+                  gaps > 0 ? atomic_load_explicit(&pacer->min_gap, memory_order_relaxed) : 0);
+    write_seconds(out, "raplayer_pacing_max_gap_seconds", "gauge", "Longest gap between the bursts of a fan-out.",
+                  atomic_load_explicit(&pacer->max_gap, memory_order_relaxed));
+
+    write_metric_header(out, "raplayer_ingress_datagrams_total", "counter", "Datagrams received by an ingress shard.");
+    for (int i = 0; i < metrics_args->shards; i++)
+        fprintf(out, "raplayer_ingress_datagrams_total{shard=\"%d\"} %lu\n", i,
+                atomic_load_explicit(&metrics_args->task_scheduler_args[i].received_datagrams, memory_order_relaxed));
+    write_metric_header(out, "raplayer_ingress_dropped_total", "counter",
+                        "Datagrams dropped by the kernel on a full socket buffer of an ingress shard.");
+    for (int i = 0; i < metrics_args->shards; i++)
+        fprintf(out, "raplayer_ingress_dropped_total{shard=\"%d\"} %lu\n", i,
+                atomic_load_explicit(&metrics_args->task_scheduler_args[i].dropped_datagrams, memory_order_relaxed));
+
+    /* The list only grows, and only under the lock, the queues in it live until the server exits. */
+    pthread_mutex_lock(metrics_args->complete_init_queue_mutex);
+    const int64_t now = get_monotonic_time();
+    for (int metric = 0; metric < CLIENT_METRICS; metric++) {
+        write_metric_header(out, client_metrics[metric].name, client_metrics[metric].type, client_metrics[metric].help);
+        for (int i = 0; i < *metrics_args->current_clients_count; i++) {
+            const TaskQueue *recv_queue = (*metrics_args->recv_queues)[i];
+            const Client *client = recv_queue->queue_info->client;
+            char address[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &client->client_addr.sin_addr, address, sizeof(address));
+
+            fprintf(out, "%s{client=\"%d\",address=\"%s:%d\"} %.9g\n", client_metrics[metric].name, client->client_id,
+                    address, ntohs(client->client_addr.sin_port), client_metric_value(recv_queue, metric, now));
+        }
+    }
+    pthread_mutex_unlock(metrics_args->complete_init_queue_mutex);
+
+    write_histogram(out, "raplayer_encode_seconds", "Time spent in opus_encode per frame.",
+                    &opus_builder_args->encode_time);
+    write_histogram(out, "raplayer_timer_lateness_seconds", "How late the opus timer woke up.",
+                    &metrics_args->opus_timer_args->wakeup_lateness);
+    write_histogram(out, "raplayer_publish_lateness_seconds", "How late frames were published to the ring.",
+                    &opus_builder_args->publish_lateness);
+}
+
+static void send_all(int conn_fd, const char *buffer, size_t buffer_len) {
+    while (buffer_len > 0) {
+        ssize_t sent = send(conn_fd, buffer, buffer_len, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return;
+        buffer += sent;
+        buffer_len -= (size_t) sent;
+    }
+}
+
+/* Answers every connection with the metrics, whatever was requested. Scrapes are rare, so one at a time. */
+_Noreturn void *serve_metrics(void *p_metrics_args) {
+    struct metrics_args *metrics_args = (struct metrics_args *) p_metrics_args;
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+    while (1) {
+        int conn_fd = accept(metrics_args->listen_fd, NULL, NULL);
+        if (conn_fd < 0)
+            continue;
+
+        int cancel_state;
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+
+        /* The request is drained but not parsed, a slow scraper can't hold the thread for long. */
+        struct timeval timeout = {.tv_sec = 1, .tv_usec = 0};
+        setsockopt(conn_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(conn_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        char request[1024];
+        recv(conn_fd, request, sizeof(request), 0);
+
+        char *body = NULL;
+        size_t body_len = 0;
+        FILE *out = open_memstream(&body, &body_len);
+        if (out != NULL) {
+            write_metrics(out, metrics_args);
+            fclose(out);
+
+            char header[256];
+            int header_len = snprintf(header, sizeof(header),
+                                      "HTTP/1.0 200 OK\r\nContent-Type: " METRICS_CONTENT_TYPE
+                                      "\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+            send_all(conn_fd, header, (size_t) header_len);
+            send_all(conn_fd, body, body_len);
+            free(body);
+        }
+        close(conn_fd);
+
+        pthread_setcancelstate(cancel_state, NULL);
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "../ra_server.h"
+
+#ifndef RAPLAYER_METRICS_H
+#define RAPLAYER_METRICS_H
+
+#include <stdio.h>
+
+#define METRICS_UNIX_PREFIX "unix:"
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4"
+
+/* Everything the metrics are read from, the counters themselves are owned and written by their threads. */
+struct metrics_args {
+    int listen_fd;
+
+    struct task_scheduler_info *task_scheduler_args;
+    int shards;
+
+    int *current_clients_count;
+    TaskQueue ***recv_queues;
+    pthread_mutex_t *complete_init_queue_mutex;
+
+    struct opus_builder_args *opus_builder_args;
+    struct opus_timer_args *opus_timer_args;
+    struct opus_sender_args *opus_sender_args;
+};
+
+int open_metrics_socket(const char *address);
+
+void write_metrics(FILE *out, struct metrics_args *metrics_args);
+
+_Noreturn void *serve_metrics(void *p_metrics_args);
+
+#endif
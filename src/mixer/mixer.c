@@ -0,0 +1,151 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mixer.h"
+#include "../dsp/dsp.h"
+
+void init_mixer(Mixer *mixer, int channels, int sample_rate) {
+    memset(mixer, 0, sizeof(Mixer));
+    mixer->channels = channels;
+    mixer->sample_rate = sample_rate;
+    mixer->duck_gain = 1;
+}
+
+/* gain_db is added to the input, duck_db is taken from the inputs without a ducking rule while it's active. */
+bool add_mixer_input(Mixer *mixer, RaInput input, double gain_db, double duck_db) {
+    if (mixer->count == MIXER_MAX_INPUTS) {
+        printf("Error: The mixer takes at most %d inputs.\n", MIXER_MAX_INPUTS);
+        return false;
+    }
+
+    MixerInput *mixer_input = &mixer->inputs[mixer->count++];
+    memset(mixer_input, 0, sizeof(MixerInput));
+    mixer_input->input = input;
+    mixer_input->gain = (float) pow(10, gain_db / 20);
+    mixer_input->duck = duck_db > 0 ? (float) pow(10, -duck_db / 20) : 1;
+    mixer_input->applied_gain = mixer_input->gain;
+    return true;
+}
+
+/* RMS of the samples in dBFS. */
+static double frame_level(const int16_t *samples, int count) {
+    int64_t sum = 0;
+    for (int i = 0; i < count; i++)
+        sum += samples[i] * samples[i];
+    return 10 * log10((double) sum / count / (32768.0 * 32768.0) + 1e-12);
+}
+
+/* Reads the input's frame into the mixer's samples, false once it has ended. */
+static bool read_input(Mixer *mixer, MixerInput *mixer_input, int frames) {
+    if (!mixer_input->ended && !mixer_input->input.read(mixer_input->input.user_data, mixer->samples, frames))
+        mixer_input->ended = true; // Plays on as silence, the other inputs keep the clock.
+    return !mixer_input->ended;
+}
+
+/*
+ * Mixes a frame of every input, saturated to samples. The inputs are expected not to wait for their sources, a late
+ * one only misses its part of the frame. False once every input has ended.
+ */
+bool read_mixer(Mixer *mixer, int16_t *out, int frames) {
+    const int count = frames * mixer->channels;
+    if (mixer->buffer_frames < frames) {
+        free(mixer->samples);
+        free(mixer->mix);
+        mixer->samples = malloc((size_t) count * sizeof(int16_t));
+        mixer->mix = malloc((size_t) count * sizeof(float));
+        mixer->buffer_frames = frames;
+        if (mixer->samples == NULL || mixer->mix == NULL) {
+            printf("Error: Failed to allocate the mixer buffers.\n");
+            mixer->buffer_frames = 0;
+            return false;
+        }
+    }
+    memset(mixer->mix, 0, (size_t) count * sizeof(float));
+
+    /* The ducking inputs first, the gain of the others depends on them. */
+    bool playing = false;
+    float duck_target = 1;
+    for (int i = 0; i < mixer->count; i++) {
+        MixerInput *mixer_input = &mixer->inputs[i];
+        if (mixer_input->duck == 1 || !read_input(mixer, mixer_input, frames))
+            continue;
+        playing = true;
+
+        if (frame_level(mixer->samples, count) >= MIXER_DUCK_THRESHOLD)
+            mixer_input->hold = (int) ((int64_t) mixer->sample_rate * MIXER_DUCK_HOLD / 1000);
+        else if (mixer_input->hold > 0)
+            mixer_input->hold -= frames;
+        if (mixer_input->hold > 0 && mixer_input->duck < duck_target)
+            duck_target = mixer_input->duck;
+        mix_samples(mixer->samples, mixer->mix, frames, mixer->channels, &mixer_input->applied_gain,
+                    mixer_input->gain);
+    }
+
+    /* Ducks within a frame, and comes back at a steady pace. */
+    if (duck_target < mixer->duck_gain)
+        mixer->duck_gain = duck_target;
+    else {
+        mixer->duck_gain += (float) frames * 1000 / ((float) mixer->sample_rate * MIXER_DUCK_RELEASE);
+        if (mixer->duck_gain > duck_target)
+            mixer->duck_gain = duck_target;
+    }
+
+    for (int i = 0; i < mixer->count; i++) {
+        MixerInput *mixer_input = &mixer->inputs[i];
+        if (mixer_input->duck != 1 || !read_input(mixer, mixer_input, frames))
+            continue;
+        playing = true;
+        mix_samples(mixer->samples, mixer->mix, frames, mixer->channels, &mixer_input->applied_gain,
+                    mixer_input->gain * mixer->duck_gain);
+    }
+
+    if (!playing) // End Of Stream.
+        return false;
+    float_to_samples(mixer->mix, out, count);
+    return true;
+}
+
+/* The sums of the inputs' counters. */
+void get_mixer_stats(Mixer *mixer, RaInputStats *stats) {
+    memset(stats, 0, sizeof(RaInputStats));
+    for (int i = 0; i < mixer->count; i++) {
+        if (mixer->inputs[i].input.stats == NULL)
+            continue;
+        RaInputStats input_stats;
+        mixer->inputs[i].input.stats(mixer->inputs[i].input.user_data, &input_stats);
+        stats->underruns += input_stats.underruns;
+        stats->overruns += input_stats.overruns;
+        stats->stretched_frames += input_stats.stretched_frames;
+    }
+}
+
+/* The inputs belong to the caller. */
+void close_mixer(Mixer *mixer) {
+    free(mixer->samples);
+    free(mixer->mix);
+    mixer->samples = NULL;
+    mixer->mix = NULL;
+    mixer->buffer_frames = 0;
+}
@@ -0,0 +1,70 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAPLAYER_MIXER_H
+#define RAPLAYER_MIXER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../raplayer.h"
+
+#define MIXER_MAX_INPUTS 32
+#define MIXER_DUCK_THRESHOLD (-40.0) // dBFS of a frame's RMS from which a ducking input counts as active.
+#define MIXER_DUCK_HOLD 300 // Milliseconds the others stay ducked after the ducking input went quiet, rides out pauses.
+#define MIXER_DUCK_RELEASE 500 // Milliseconds the ducked inputs take to come back from silence to their full gain.
+
+typedef struct {
+    RaInput input;
+    float gain; // Linear.
+    float duck; // Linear gain of the inputs without a ducking rule while this one is active, 1 for none.
+    bool ended; // Silent from its end on.
+    float applied_gain; // Where the last frame's ramp ended.
+    int hold; // Frames left until the ducking ends.
+} MixerInput;
+
+/*
+ * Sums several inputs into one, each with its own gain. Whenever an input with a ducking rule is active, like
+ * announcements over music, the inputs without one are lowered by the deepest active rule. The mixer is an input
+ * itself and ends once all of its inputs have.
+ */
+typedef struct {
+    int channels;
+    int sample_rate;
+    MixerInput inputs[MIXER_MAX_INPUTS];
+    int count;
+    float duck_gain; // The gain the inputs without a ducking rule get, ramped towards the deepest active rule.
+
+    int16_t *samples; // One input's frame.
+    float *mix;
+    int buffer_frames;
+} Mixer;
+
+void init_mixer(Mixer *mixer, int channels, int sample_rate);
+
+bool add_mixer_input(Mixer *mixer, RaInput input, double gain_db, double duck_db);
+
+bool read_mixer(Mixer *mixer, int16_t *out, int frames);
+
+void get_mixer_stats(Mixer *mixer, RaInputStats *stats);
+
+void close_mixer(Mixer *mixer);
+
+#endif
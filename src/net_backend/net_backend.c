@@ -0,0 +1,194 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE // recvmmsg, sendmmsg
+
+#include "net_backend.h"
+
+#ifdef SCM_TXTIME
+/* Attaches the launch time as a SCM_TXTIME control message, the socket must have SO_TXTIME enabled. */
+void set_launch_time(struct msghdr *msg, void *control, size_t control_len, int64_t launch_time) {
+    uint64_t txtime = (uint64_t) launch_time;
+
+    msg->msg_control = control;
+    msg->msg_controllen = control_len;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TXTIME;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(txtime));
+    memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+}
+#endif
+
+#ifndef RAPLAYER_IO_URING
+
+const char *net_backend_name(void) {
+#ifdef __linux__
+    return "recvmmsg/sendmmsg";
+#else
+    return "recvfrom/sendto";
+#endif
+}
+
+bool init_net_receiver(NetReceiver *receiver, int sock_fd) {
+    receiver->sock_fd = sock_fd;
+    receiver->dropped_datagrams = 0;
+    return true;
+}
+
+void destroy_net_receiver(NetReceiver *receiver) {
+    (void) receiver;
+}
+
+/* Waits up to timeout milliseconds, then receives a batch without blocking. Returns the number of datagrams. */
+int receive_datagrams(NetReceiver *receiver, Task **tasks, struct sockaddr_in *addrs, socklen_t *addr_lens,
+                      int timeout) {
+    struct pollfd poll_fd;
+    poll_fd.fd = receiver->sock_fd;
+    poll_fd.events = POLLIN;
+    if (poll(&poll_fd, 1, timeout) <= 0)
+        return 0;
+
+#ifdef __linux__
+    struct mmsghdr messages[NET_RECEIVE_BATCH_SIZE];
+    struct iovec iovecs[NET_RECEIVE_BATCH_SIZE];
+    union {
+        char buffer[CMSG_SPACE(sizeof(uint32_t))];
+        struct cmsghdr align;
+    } controls[NET_RECEIVE_BATCH_SIZE];
+
+    memset(messages, 0, sizeof(messages));
+    for (int i = 0; i < NET_RECEIVE_BATCH_SIZE; i++) {
+        iovecs[i].iov_base = tasks[i]->buffer;
+        iovecs[i].iov_len = MAX_DATA_SIZE;
+
+        messages[i].msg_hdr.msg_name = &addrs[i];
+        messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_control = controls[i].buffer;
+        messages[i].msg_hdr.msg_controllen = sizeof(controls[i].buffer);
+    }
+
+    int count = recvmmsg(receiver->sock_fd, messages, NET_RECEIVE_BATCH_SIZE, MSG_DONTWAIT, NULL);
+    for (int i = 0; i < count; i++) {
+        tasks[i]->buffer_len = messages[i].msg_len;
+        addr_lens[i] = messages[i].msg_hdr.msg_namelen;
+
+#ifdef SO_RXQ_OVFL
+        /* The kernel reports the total of datagrams it dropped on this socket so far. */
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&messages[i].msg_hdr); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&messages[i].msg_hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+                memcpy(&receiver->dropped_datagrams, CMSG_DATA(cmsg), sizeof(receiver->dropped_datagrams));
+        }
+#endif
+    }
+    return count;
+#else
+    addr_lens[0] = sizeof(struct sockaddr_in);
+    tasks[0]->buffer_len = recvfrom(receiver->sock_fd, tasks[0]->buffer, MAX_DATA_SIZE, MSG_DONTWAIT,
+                                    (struct sockaddr *) &addrs[0], &addr_lens[0]);
+    return tasks[0]->buffer_len < 0 ? -1 : 1;
+#endif
+}
+
+bool init_net_sender(NetSender *sender) {
+    atomic_init(&sender->sent_datagrams, 0);
+    atomic_init(&sender->syscalls, 0);
+    atomic_init(&sender->send_errors, 0);
+    atomic_init(&sender->would_block, 0);
+    return true;
+}
+
+static void count_send_error(NetSender *sender, int err) {
+    if (err == EAGAIN || err == EWOULDBLOCK)
+        atomic_fetch_add_explicit(&sender->would_block, 1, memory_order_relaxed);
+    else
+        atomic_fetch_add_explicit(&sender->send_errors, 1, memory_order_relaxed);
+}
+
+void destroy_net_sender(NetSender *sender) {
+    (void) sender;
+}
+
+/* Sends the messages, one sendmmsg call for each run of messages on the same socket. Returns the number sent. */
+int send_datagrams(NetSender *sender, const NetMessage *messages, int count) {
+    int sent = 0;
+
+#ifdef __linux__
+    struct mmsghdr headers[NET_SEND_BATCH_SIZE];
+    struct iovec iovecs[NET_SEND_BATCH_SIZE];
+    union {
+        char buffer[CMSG_SPACE(sizeof(uint64_t))];
+        struct cmsghdr align;
+    } controls[NET_SEND_BATCH_SIZE];
+
+    for (int i = 0; i < count;) {
+        int batch = 0;
+        memset(headers, 0, sizeof(headers));
+        for (; i + batch < count && batch < NET_SEND_BATCH_SIZE &&
+               messages[i + batch].sock_fd == messages[i].sock_fd; batch++) {
+            iovecs[batch].iov_base = (void *) messages[i + batch].buffer;
+            iovecs[batch].iov_len = messages[i + batch].buffer_len;
+
+            headers[batch].msg_hdr.msg_name = (void *) messages[i + batch].addr;
+            headers[batch].msg_hdr.msg_namelen = messages[i + batch].addr_len;
+            headers[batch].msg_hdr.msg_iov = &iovecs[batch];
+            headers[batch].msg_hdr.msg_iovlen = 1;
+
+#ifdef SCM_TXTIME
+            if (messages[i + batch].launch_time != 0)
+                set_launch_time(&headers[batch].msg_hdr, controls[batch].buffer, sizeof(controls[batch].buffer),
+                                messages[i + batch].launch_time);
+#endif
+        }
+
+        /* A datagram the kernel refused is skipped, not retried. */
+        for (int offset = 0; offset < batch;) {
+            int result = sendmmsg(messages[i].sock_fd, headers + offset, (unsigned int) (batch - offset), 0);
+            atomic_fetch_add_explicit(&sender->syscalls, 1, memory_order_relaxed);
+            if (result <= 0) {
+                count_send_error(sender, errno);
+                offset++;
+                continue;
+            }
+            sent += result;
+            offset += result;
+        }
+        i += batch;
+    }
+#else
+    for (int i = 0; i < count; i++) {
+        if (sendto(messages[i].sock_fd, messages[i].buffer, messages[i].buffer_len, 0,
+                   (const struct sockaddr *) messages[i].addr, messages[i].addr_len) >= 0)
+            sent++;
+        else
+            count_send_error(sender, errno);
+        atomic_fetch_add_explicit(&sender->syscalls, 1, memory_order_relaxed);
+    }
+#endif
+
+    atomic_fetch_add_explicit(&sender->sent_datagrams, (unsigned long) sent, memory_order_relaxed);
+    return sent;
+}
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "../ra_server.h"
+
+#ifndef RAPLAYER_NET_BACKEND_H
+#define RAPLAYER_NET_BACKEND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+
+#ifdef RAPLAYER_IO_URING
+#include <liburing.h>
+#endif
+
+#include "../task_scheduler/task_queue/task/task.h"
+
+#define NET_RECEIVE_BATCH_SIZE 16 // Datagrams handed to the scheduler at once.
+#define NET_SEND_BATCH_SIZE 256 // Datagrams submitted by one system call.
+
+#ifdef RAPLAYER_IO_URING
+#define NET_RECEIVER_BUFFERS 64 // Provided buffers kept posted for the multishot receive, a power of two.
+#define NET_RECEIVER_BUFFER_GROUP 0
+#endif
+
+typedef struct {
+    int sock_fd;
+    const void *buffer;
+    size_t buffer_len;
+    const struct sockaddr_in *addr;
+    socklen_t addr_len;
+    int64_t launch_time; // SO_TXTIME launch time on CLOCK_MONOTONIC, 0 to send right away.
+} NetMessage;
+
+typedef struct {
+    int sock_fd;
+    uint32_t dropped_datagrams; // Reported by the kernel through SO_RXQ_OVFL.
+
+#ifdef RAPLAYER_IO_URING
+    struct io_uring ring;
+    struct io_uring_buf_ring *buffer_ring;
+    unsigned char *buffers;
+    size_t buffer_size;
+    struct msghdr msg; // Layout of the name and control data in every received buffer.
+    bool armed; // A multishot receive is posted.
+#endif
+} NetReceiver;
+
+/* Counters are written by the sending thread only, and read by the metrics. */
+typedef struct {
+    atomic_ulong sent_datagrams;
+    atomic_ulong syscalls;
+    atomic_ulong send_errors;
+    atomic_ulong would_block; // Datagrams refused with EAGAIN as the socket buffer was full.
+
+#ifdef RAPLAYER_IO_URING
+    struct io_uring ring;
+#endif
+} NetSender;
+
+const char *net_backend_name(void);
+
+#ifdef SCM_TXTIME
+void set_launch_time(struct msghdr *msg, void *control, size_t control_len, int64_t launch_time);
+#endif
+
+bool init_net_receiver(NetReceiver *receiver, int sock_fd);
+
+void destroy_net_receiver(NetReceiver *receiver);
+
+int receive_datagrams(NetReceiver *receiver, Task **tasks, struct sockaddr_in *addrs, socklen_t *addr_lens,
+                      int timeout);
+
+bool init_net_sender(NetSender *sender);
+
+void destroy_net_sender(NetSender *sender);
+
+int send_datagrams(NetSender *sender, const NetMessage *messages, int count);
+
+#endif
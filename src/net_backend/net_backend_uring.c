@@ -0,0 +1,208 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "net_backend.h"
+
+#ifdef RAPLAYER_IO_URING
+
+const char *net_backend_name(void) {
+    return "io_uring";
+}
+
+bool init_net_receiver(NetReceiver *receiver, int sock_fd) {
+    int err;
+
+    receiver->sock_fd = sock_fd;
+    receiver->dropped_datagrams = 0;
+    receiver->armed = false;
+
+    if (io_uring_queue_init(NET_RECEIVER_BUFFERS, &receiver->ring, 0) < 0)
+        return false;
+
+    receiver->buffer_ring = io_uring_setup_buf_ring(&receiver->ring, NET_RECEIVER_BUFFERS, NET_RECEIVER_BUFFER_GROUP,
+                                                    0, &err);
+    if (receiver->buffer_ring == NULL) {
+        io_uring_queue_exit(&receiver->ring);
+        return false;
+    }
+
+    /* Every received buffer starts with the recvmsg header, the peer address and the control data. */
+    memset(&receiver->msg, 0, sizeof(receiver->msg));
+    receiver->msg.msg_namelen = sizeof(struct sockaddr_in);
+    receiver->msg.msg_controllen = CMSG_SPACE(sizeof(uint32_t));
+    receiver->buffer_size = sizeof(struct io_uring_recvmsg_out) + receiver->msg.msg_namelen +
+                            receiver->msg.msg_controllen + MAX_DATA_SIZE;
+
+    receiver->buffers = malloc(receiver->buffer_size * NET_RECEIVER_BUFFERS);
+    for (int i = 0; i < NET_RECEIVER_BUFFERS; i++)
+        io_uring_buf_ring_add(receiver->buffer_ring, receiver->buffers + receiver->buffer_size * i,
+                              (unsigned int) receiver->buffer_size, (unsigned short) i,
+                              io_uring_buf_ring_mask(NET_RECEIVER_BUFFERS), i);
+    io_uring_buf_ring_advance(receiver->buffer_ring, NET_RECEIVER_BUFFERS);
+    return true;
+}
+
+/* Tearing the ring down cancels the posted receive, the buffers are only freed after it. */
+void destroy_net_receiver(NetReceiver *receiver) {
+    io_uring_free_buf_ring(&receiver->ring, receiver->buffer_ring, NET_RECEIVER_BUFFERS, NET_RECEIVER_BUFFER_GROUP);
+    io_uring_queue_exit(&receiver->ring);
+    free(receiver->buffers);
+}
+
+static void arm_receiver(NetReceiver *receiver) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&receiver->ring);
+    io_uring_prep_recvmsg_multishot(sqe, receiver->sock_fd, &receiver->msg, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = NET_RECEIVER_BUFFER_GROUP;
+
+    io_uring_submit(&receiver->ring);
+    receiver->armed = true;
+}
+
+/* Waits up to timeout milliseconds for the multishot receive to complete, then drains the completions. */
+int receive_datagrams(NetReceiver *receiver, Task **tasks, struct sockaddr_in *addrs, socklen_t *addr_lens,
+                      int timeout) {
+    struct io_uring_cqe *cqe;
+    struct __kernel_timespec timespec;
+    timespec.tv_sec = timeout / 1000;
+    timespec.tv_nsec = (timeout % 1000) * 1000000L;
+
+    /* The receive stays posted until the kernel runs out of buffers or fails it, so it rarely needs a submission. */
+    if (!receiver->armed)
+        arm_receiver(receiver);
+
+    if (io_uring_wait_cqe_timeout(&receiver->ring, &cqe, &timespec) < 0)
+        return 0;
+
+    int count = 0;
+    while (count < NET_RECEIVE_BATCH_SIZE && io_uring_peek_cqe(&receiver->ring, &cqe) == 0) {
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            receiver->armed = false;
+
+        if (cqe->res < 0 || !(cqe->flags & IORING_CQE_F_BUFFER)) {
+            io_uring_cqe_seen(&receiver->ring, cqe);
+            continue;
+        }
+
+        unsigned short buffer_id = (unsigned short) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        unsigned char *buffer = receiver->buffers + receiver->buffer_size * buffer_id;
+
+        struct io_uring_recvmsg_out *out = io_uring_recvmsg_validate(buffer, cqe->res, &receiver->msg);
+        if (out != NULL && !(out->flags & MSG_TRUNC)) {
+            unsigned int payload_len = io_uring_recvmsg_payload_length(out, cqe->res, &receiver->msg);
+            memcpy(tasks[count]->buffer, io_uring_recvmsg_payload(out, &receiver->msg), payload_len);
+            tasks[count]->buffer_len = payload_len;
+
+            addr_lens[count] = out->namelen < sizeof(struct sockaddr_in) ? out->namelen : sizeof(struct sockaddr_in);
+            memcpy(&addrs[count], io_uring_recvmsg_name(out), addr_lens[count]);
+
+#ifdef SO_RXQ_OVFL
+            for (struct cmsghdr *cmsg = io_uring_recvmsg_cmsg_firsthdr(out, &receiver->msg); cmsg != NULL;
+                 cmsg = io_uring_recvmsg_cmsg_nexthdr(out, &receiver->msg, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+                    memcpy(&receiver->dropped_datagrams, CMSG_DATA(cmsg), sizeof(receiver->dropped_datagrams));
+            }
+#endif
+            count++;
+        }
+
+        /* Hand the buffer back to the kernel right away. */
+        io_uring_buf_ring_add(receiver->buffer_ring, buffer, (unsigned int) receiver->buffer_size, buffer_id,
+                              io_uring_buf_ring_mask(NET_RECEIVER_BUFFERS), 0);
+        io_uring_buf_ring_advance(receiver->buffer_ring, 1);
+        io_uring_cqe_seen(&receiver->ring, cqe);
+    }
+    return count;
+}
+
+bool init_net_sender(NetSender *sender) {
+    atomic_init(&sender->sent_datagrams, 0);
+    atomic_init(&sender->syscalls, 0);
+    atomic_init(&sender->send_errors, 0);
+    atomic_init(&sender->would_block, 0);
+    return io_uring_queue_init(NET_SEND_BATCH_SIZE, &sender->ring, 0) == 0;
+}
+
+void destroy_net_sender(NetSender *sender) {
+    io_uring_queue_exit(&sender->ring);
+}
+
+/*
+ * Queues a send for every message and submits them with a single io_uring_enter per batch.
+ * Messages with a launch time need a control message, so they go through sendmsg instead.
+ */
+int send_datagrams(NetSender *sender, const NetMessage *messages, int count) {
+    struct msghdr headers[NET_SEND_BATCH_SIZE];
+    struct iovec iovecs[NET_SEND_BATCH_SIZE];
+    union {
+        char buffer[CMSG_SPACE(sizeof(uint64_t))];
+        struct cmsghdr align;
+    } controls[NET_SEND_BATCH_SIZE];
+    int sent = 0;
+
+    for (int i = 0; i < count;) {
+        int batch = 0;
+        for (; i < count && batch < NET_SEND_BATCH_SIZE; i++, batch++) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&sender->ring);
+
+#ifdef SCM_TXTIME
+            if (messages[i].launch_time != 0) {
+                iovecs[batch].iov_base = (void *) messages[i].buffer;
+                iovecs[batch].iov_len = messages[i].buffer_len;
+
+                memset(&headers[batch], 0, sizeof(struct msghdr));
+                headers[batch].msg_name = (void *) messages[i].addr;
+                headers[batch].msg_namelen = messages[i].addr_len;
+                headers[batch].msg_iov = &iovecs[batch];
+                headers[batch].msg_iovlen = 1;
+                set_launch_time(&headers[batch], controls[batch].buffer, sizeof(controls[batch].buffer),
+                                messages[i].launch_time);
+
+                io_uring_prep_sendmsg(sqe, messages[i].sock_fd, &headers[batch], 0);
+                continue;
+            }
+#endif
+            io_uring_prep_send(sqe, messages[i].sock_fd, messages[i].buffer, messages[i].buffer_len, 0);
+            io_uring_prep_send_set_addr(sqe, (const struct sockaddr *) messages[i].addr,
+                                        (__u16) messages[i].addr_len);
+        }
+
+        io_uring_submit_and_wait(&sender->ring, (unsigned int) batch);
+        atomic_fetch_add_explicit(&sender->syscalls, 1, memory_order_relaxed);
+
+        struct io_uring_cqe *cqe;
+        for (int completed = 0; completed < batch; completed++) {
+            if (io_uring_wait_cqe(&sender->ring, &cqe) < 0)
+                break;
+            if (cqe->res >= 0)
+                sent++;
+            else if (cqe->res == -EAGAIN)
+                atomic_fetch_add_explicit(&sender->would_block, 1, memory_order_relaxed);
+            else
+                atomic_fetch_add_explicit(&sender->send_errors, 1, memory_order_relaxed);
+            io_uring_cqe_seen(&sender->ring, cqe);
+        }
+    }
+
+    atomic_fetch_add_explicit(&sender->sent_datagrams, (unsigned long) sent, memory_order_relaxed);
+    return sent;
+}
+
+#endif
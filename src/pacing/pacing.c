@@ -0,0 +1,137 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifdef __linux__
+#include <linux/net_tstamp.h>
+#endif
+
+#include "pacing.h"
+
+/* Asks the kernel to honour launch times on the socket, fq or etf queueing disciplines then pace the datagrams. */
+bool enable_txtime(int sock_fd) {
+#ifdef SO_TXTIME
+    struct sock_txtime sock_txtime;
+    sock_txtime.clockid = CLOCK_MONOTONIC;
+    sock_txtime.flags = 0;
+    return setsockopt(sock_fd, SOL_SOCKET, SO_TXTIME, &sock_txtime, sizeof(sock_txtime)) == 0;
+#else
+    (void) sock_fd;
+    return false;
+#endif
+}
+
+void init_pacer(Pacer *pacer, PacingMode mode, int64_t slice) {
+    pacer->mode = slice > 0 ? mode : PACING_OFF;
+    pacer->slice = slice;
+    atomic_init(&pacer->fanouts, 0);
+    atomic_init(&pacer->bursts, 0);
+    atomic_init(&pacer->burst_datagrams, 0);
+    atomic_init(&pacer->max_burst, 0);
+    atomic_init(&pacer->gaps, 0);
+    atomic_init(&pacer->gap_sum, 0);
+    atomic_init(&pacer->min_gap, INT64_MAX);
+    atomic_init(&pacer->max_gap, 0);
+}
+
+/* The sender is the only writer, so the extremes don't need a compare-and-swap. */
+static void record_burst(Pacer *pacer, unsigned long datagrams, int64_t gap) {
+    atomic_fetch_add_explicit(&pacer->bursts, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pacer->burst_datagrams, datagrams, memory_order_relaxed);
+    if (datagrams > atomic_load_explicit(&pacer->max_burst, memory_order_relaxed))
+        atomic_store_explicit(&pacer->max_burst, datagrams, memory_order_relaxed);
+
+    if (gap >= 0) {
+        atomic_fetch_add_explicit(&pacer->gaps, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&pacer->gap_sum, gap, memory_order_relaxed);
+        if (gap < atomic_load_explicit(&pacer->min_gap, memory_order_relaxed))
+            atomic_store_explicit(&pacer->min_gap, gap, memory_order_relaxed);
+        if (gap > atomic_load_explicit(&pacer->max_gap, memory_order_relaxed))
+            atomic_store_explicit(&pacer->max_gap, gap, memory_order_relaxed);
+    }
+}
+
+/* Spreads the datagrams of one fan-out evenly over the pacing slice, starting now. */
+void send_paced(Pacer *pacer, NetSender *sender, NetMessage *messages, int count) {
+    if (count == 0)
+        return;
+    atomic_fetch_add_explicit(&pacer->fanouts, 1, memory_order_relaxed);
+
+    const int64_t start_time = get_monotonic_time();
+    switch (pacer->mode) {
+        case PACING_OFF:
+            send_datagrams(sender, messages, count);
+            record_burst(pacer, (unsigned long) count, -1);
+            break;
+
+        case PACING_TXTIME:
+            /* The gaps are the scheduled ones, the kernel keeps them. */
+            for (int i = 0; i < count; i++) {
+                messages[i].launch_time = start_time + pacer->slice * i / count;
+                record_burst(pacer, 1, i > 0 ? messages[i].launch_time - messages[i - 1].launch_time : -1);
+            }
+            send_datagrams(sender, messages, count);
+            break;
+
+        case PACING_USER: {
+            /* Slots can't be shorter than the sleep granularity, so large fan-outs are sent a few at a time. */
+            int slots = (int) (pacer->slice / PACING_SLOT_TIME);
+            if (slots > count)
+                slots = count;
+            if (slots < 1)
+                slots = 1;
+
+            int64_t last_send_time = -1;
+            for (int slot = 0, sent = 0; slot < slots; slot++) {
+                int64_t launch_time = start_time + pacer->slice * slot / slots;
+                struct timespec timespec;
+                timespec.tv_sec = launch_time / 1000000000L;
+                timespec.tv_nsec = launch_time % 1000000000L;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &timespec, NULL);
+
+                int slot_count = (count - sent) / (slots - slot);
+                int64_t send_time = get_monotonic_time();
+                send_datagrams(sender, messages + sent, slot_count);
+                sent += slot_count;
+
+                record_burst(pacer, (unsigned long) slot_count, last_send_time >= 0 ? send_time - last_send_time : -1);
+                last_send_time = send_time;
+            }
+            break;
+        }
+    }
+}
+
+void print_pacer_stats(Pacer *pacer) {
+    static const char *mode_names[] = {"off", "SO_TXTIME", "user-space"};
+
+    unsigned long fanouts = atomic_load(&pacer->fanouts), gaps = atomic_load(&pacer->gaps);
+    if (fanouts == 0)
+        return;
+
+    printf("\nPacing %s: %lu fan-outs, bursts of %.1f datagrams on average (max %lu)", mode_names[pacer->mode],
+           fanouts, (double) atomic_load(&pacer->burst_datagrams) / (double) atomic_load(&pacer->bursts),
+           atomic_load(&pacer->max_burst));
+    if (gaps > 0)
+        printf(", gaps %.3f/%.3f/%.3fms (min/avg/max)", (double) atomic_load(&pacer->min_gap) / 1000000.0,
+               (double) atomic_load(&pacer->gap_sum) / (double) gaps / 1000000.0,
+               (double) atomic_load(&pacer->max_gap) / 1000000.0);
+    printf(".\n");
+    fflush(stdout);
+}
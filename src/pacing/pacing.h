@@ -0,0 +1,64 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "../ra_server.h"
+
+#ifndef RAPLAYER_PACING_H
+#define RAPLAYER_PACING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "../net_backend/net_backend.h"
+
+#define PACING_SLOT_TIME 250000L // Shortest gap between user-space paced sends, in nanoseconds.
+
+typedef enum {
+    PACING_OFF,
+    PACING_TXTIME, // The kernel sends every datagram at its SO_TXTIME launch time.
+    PACING_USER // The sender sleeps between slots of datagrams.
+} PacingMode;
+
+/* Only the sender thread sends through a pacer, the statistics are atomic for the metrics scrapes. */
+typedef struct {
+    PacingMode mode;
+    int64_t slice; // Part of the frame interval a fan-out is spread across, in nanoseconds.
+
+    atomic_ulong fanouts;
+    atomic_ulong bursts;
+    atomic_ulong burst_datagrams;
+    atomic_ulong max_burst;
+
+    atomic_ulong gaps;
+    _Atomic int64_t gap_sum;
+    _Atomic int64_t min_gap;
+    _Atomic int64_t max_gap;
+} Pacer;
+
+bool enable_txtime(int sock_fd);
+
+void init_pacer(Pacer *pacer, PacingMode mode, int64_t slice);
+
+void send_paced(Pacer *pacer, NetSender *sender, NetMessage *messages, int count);
+
+void print_pacer_stats(Pacer *pacer);
+
+#endif
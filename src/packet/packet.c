@@ -0,0 +1,109 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "packet.h"
+
+static void put_le16(unsigned char *buffer, uint16_t value) {
+    buffer[0] = value & 0xFF;
+    buffer[1] = (value >> 8) & 0xFF;
+}
+
+static void put_le32(unsigned char *buffer, uint32_t value) {
+    put_le16(buffer, value & 0xFFFF);
+    put_le16(buffer + 2, (value >> 16) & 0xFFFF);
+}
+
+static uint16_t get_le16(const unsigned char *buffer) {
+    return (uint16_t) (buffer[0] | buffer[1] << 8);
+}
+
+static uint32_t get_le32(const unsigned char *buffer) {
+    return get_le16(buffer) | (uint32_t) get_le16(buffer + 2) << 16;
+}
+
+size_t opus_packet_size(const struct opus_packet *packet) {
+    size_t size = PACKET_HEADER_SIZE + 2 * packet->frame_count;
+    for (int i = 0; i < packet->frame_count; i++)
+        size += packet->frame_len[i];
+    return size;
+}
+
+/* Returns the packet length, or 0 if it does not fit into the buffer. */
+size_t build_opus_packet(const struct opus_packet *packet, unsigned char *buffer, size_t buffer_size) {
+    if (packet->frame_count == 0 || packet->frame_count > MAX_AGGREGATED_FRAMES ||
+        opus_packet_size(packet) > buffer_size)
+        return 0;
+
+    memcpy(buffer, OPUS_FLAG, OPUS_FLAG_SIZE);
+    buffer[OPUS_FLAG_SIZE] = packet->flags;
+    buffer[OPUS_FLAG_SIZE + 1] = packet->frame_count;
+    put_le32(buffer + OPUS_FLAG_SIZE + 2, packet->sequence);
+
+    unsigned char *p_frame = buffer + PACKET_HEADER_SIZE + 2 * packet->frame_count;
+    for (int i = 0; i < packet->frame_count; i++) {
+        put_le16(buffer + PACKET_HEADER_SIZE + 2 * i, packet->frame_len[i]);
+        memcpy(p_frame, packet->frames[i], packet->frame_len[i]);
+        p_frame += packet->frame_len[i];
+    }
+    return p_frame - buffer;
+}
+
+/* The parsed frames point into the given buffer. */
+bool parse_opus_packet(struct opus_packet *packet, const unsigned char *buffer, size_t buffer_len) {
+    if (buffer_len < PACKET_HEADER_SIZE || memcmp(buffer, OPUS_FLAG, OPUS_FLAG_SIZE) != 0)
+        return false;
+
+    packet->flags = buffer[OPUS_FLAG_SIZE];
+    packet->frame_count = buffer[OPUS_FLAG_SIZE + 1];
+    packet->sequence = get_le32(buffer + OPUS_FLAG_SIZE + 2);
+
+    if (packet->frame_count == 0 || packet->frame_count > MAX_AGGREGATED_FRAMES ||
+        buffer_len < PACKET_HEADER_SIZE + 2 * (size_t) packet->frame_count)
+        return false;
+
+    size_t offset = PACKET_HEADER_SIZE + 2 * packet->frame_count;
+    for (int i = 0; i < packet->frame_count; i++) {
+        packet->frame_len[i] = get_le16(buffer + PACKET_HEADER_SIZE + 2 * i);
+        packet->frames[i] = buffer + offset;
+        offset += packet->frame_len[i];
+    }
+    return offset <= buffer_len;
+}
+
+size_t build_nack_packet(const struct nack_packet *nack, unsigned char *buffer, size_t buffer_size) {
+    if (buffer_size < NACK_PACKET_SIZE)
+        return 0;
+
+    memcpy(buffer, NACK_FLAG, OPUS_FLAG_SIZE);
+    put_le32(buffer + OPUS_FLAG_SIZE, nack->sequence);
+    put_le32(buffer + OPUS_FLAG_SIZE + 4, nack->bitmap);
+    return NACK_PACKET_SIZE;
+}
+
+bool parse_nack_packet(struct nack_packet *nack, const unsigned char *buffer, size_t buffer_len) {
+    if (buffer_len < NACK_PACKET_SIZE || memcmp(buffer, NACK_FLAG, OPUS_FLAG_SIZE) != 0)
+        return false;
+
+    nack->sequence = get_le32(buffer + OPUS_FLAG_SIZE);
+    nack->bitmap = get_le32(buffer + OPUS_FLAG_SIZE + 4);
+    return true;
+}
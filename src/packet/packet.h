@@ -0,0 +1,82 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAPLAYER_PACKET_H
+#define RAPLAYER_PACKET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define OPUS_FLAG "OPUS"
+#define OPUS_FLAG_SIZE 4
+
+#define NACK_FLAG "NACK"
+
+#define MAX_PACKET_SIZE 4000 // The largest opus frame we encode.
+#define MAX_AGGREGATED_FRAMES 3
+
+#define PACKET_FLAG_RETRANSMIT 0x01
+
+/*
+ * Opus packet layout, all integers are little-endian.
+ *
+ * | "OPUS" (4) | flags (1) | frame count (1) | sequence (4) | frame length (2) * frame count | frames... |
+ *
+ * sequence is the number of the first frame, the others follow consecutively.
+ * A frame length of 0 marks a frame the encoder suppressed with DTX, it is not a loss.
+ */
+#define PACKET_HEADER_SIZE (OPUS_FLAG_SIZE + 1 + 1 + 4)
+
+/*
+ * Negative acknowledgement sent by clients for missing frames.
+ *
+ * | "NACK" (4) | sequence (4) | bitmap (4) |
+ *
+ * sequence is missing, and bit i of bitmap marks sequence + 1 + i as missing too.
+ */
+#define NACK_PACKET_SIZE (OPUS_FLAG_SIZE + 4 + 4)
+#define NACK_BITMAP_FRAMES 32
+
+struct opus_packet {
+    uint8_t flags;
+    uint8_t frame_count;
+    uint32_t sequence;
+
+    uint16_t frame_len[MAX_AGGREGATED_FRAMES];
+    const unsigned char *frames[MAX_AGGREGATED_FRAMES];
+};
+
+struct nack_packet {
+    uint32_t sequence;
+    uint32_t bitmap;
+};
+
+size_t opus_packet_size(const struct opus_packet *packet);
+
+size_t build_opus_packet(const struct opus_packet *packet, unsigned char *buffer, size_t buffer_size);
+
+bool parse_opus_packet(struct opus_packet *packet, const unsigned char *buffer, size_t buffer_len);
+
+size_t build_nack_packet(const struct nack_packet *nack, unsigned char *buffer, size_t buffer_size);
+
+bool parse_nack_packet(struct nack_packet *nack, const unsigned char *buffer, size_t buffer_len);
+
+#endif
@@ -0,0 +1,248 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "pcm_ingest.h"
+#include "../dsp/dsp.h"
+#include "../tracer/tracer.h"
+
+/* Bytes waiting in the pipe, up to a chunk, or a whole chunk if it can't tell. */
+static size_t pending_bytes(int fd) {
+    int pending;
+    if (ioctl(fd, FIONREAD, &pending) < 0 || pending <= 0 || pending > PCM_INGEST_CHUNK)
+        return PCM_INGEST_CHUNK;
+    return (size_t) pending;
+}
+
+static size_t ring_space(const PcmIngest *ingest) {
+    return ingest->capacity - (size_t) (ingest->write_pos - ingest->read_pos);
+}
+
+/* Drops the oldest whole frames until wanted bytes fit, or the ring is empty. */
+static size_t drop_oldest(PcmIngest *ingest, size_t wanted) {
+    size_t space = ring_space(ingest);
+    if (space >= wanted)
+        return space;
+
+    size_t buffered = (size_t) (ingest->write_pos - ingest->read_pos) / ingest->frame_bytes * ingest->frame_bytes;
+    size_t drop = (wanted - space + ingest->frame_bytes - 1) / ingest->frame_bytes * ingest->frame_bytes;
+    if (drop > buffered)
+        drop = buffered;
+    ingest->read_pos += drop;
+    atomic_fetch_add_explicit(&ingest->overruns, drop / ingest->frame_bytes, memory_order_relaxed);
+    return space + drop;
+}
+
+/* Moves the pipe into the ring until it's closed. Only the read itself runs unlocked, into space nobody else touches. */
+static void *read_pipe(void *p_ingest) {
+    PcmIngest *ingest = (PcmIngest *) p_ingest;
+    struct pollfd pollfd = {ingest->fd, POLLIN, 0};
+
+    trace_thread("ingest");
+
+    pthread_mutex_lock(&ingest->mutex);
+    while (!ingest->stopping) {
+        pthread_mutex_unlock(&ingest->mutex);
+        int ready = poll(&pollfd, 1, PCM_INGEST_POLL_INTERVAL);
+        const int poll_errno = errno;
+        pthread_mutex_lock(&ingest->mutex);
+        if (ready < 0 && poll_errno != EINTR) { // It would fail again right away, end the stream like a failed read.
+            printf("Error: Failed to poll the input: %s\n", strerror(poll_errno));
+            ingest->eof = true;
+            break;
+        }
+        if (ready <= 0)
+            continue;
+
+        size_t wanted = pending_bytes(ingest->fd);
+        size_t space = ingest->overflow == INGEST_OVERFLOW_BLOCK ? ring_space(ingest) : drop_oldest(ingest, wanted);
+        while (space == 0 && !ingest->stopping) {
+            pthread_cond_wait(&ingest->cond, &ingest->mutex);
+            space = ring_space(ingest);
+        }
+        if (ingest->stopping)
+            break;
+
+        size_t offset = (size_t) (ingest->write_pos % ingest->capacity);
+        size_t len = wanted < space ? wanted : space;
+        if (len > ingest->capacity - offset)
+            len = ingest->capacity - offset;
+
+        pthread_mutex_unlock(&ingest->mutex);
+        ssize_t read_len = read(ingest->fd, ingest->ring + offset, len);
+        pthread_mutex_lock(&ingest->mutex);
+
+        if (read_len > 0)
+            ingest->write_pos += (uint64_t) read_len;
+        else if (read_len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            if (read_len < 0)
+                printf("Error: Failed to read the input: %s\n", strerror(errno));
+            ingest->eof = true; // A partial frame left at the end is dropped.
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ingest->mutex);
+    return NULL;
+}
+
+bool start_pcm_ingest(PcmIngest *ingest, int fd, int channels, int capacity_frames, IngestOverflowPolicy overflow,
+                      IngestUnderflowPolicy underflow) {
+    memset(ingest, 0, sizeof(PcmIngest));
+    ingest->fd = fd;
+    ingest->channels = channels;
+    ingest->frame_bytes = (size_t) channels * sizeof(int16_t);
+    ingest->overflow = overflow;
+    ingest->underflow = underflow;
+    ingest->capacity = (size_t) capacity_frames * ingest->frame_bytes;
+    atomic_init(&ingest->underruns, 0);
+    atomic_init(&ingest->overruns, 0);
+    atomic_init(&ingest->stretched_frames, 0);
+
+    if (capacity_frames <= 0 || (ingest->ring = malloc(ingest->capacity)) == NULL) {
+        printf("Error: Failed to allocate the input buffer.\n");
+        return false;
+    }
+
+    /* The reader polls, so it can see a stop while the pipe is quiet. */
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    pthread_mutex_init(&ingest->mutex, NULL);
+    pthread_cond_init(&ingest->cond, NULL);
+    if (pthread_create(&ingest->reader, NULL, read_pipe, ingest) != 0) {
+        printf("Error: Failed to start the input reader.\n");
+        pthread_cond_destroy(&ingest->cond);
+        pthread_mutex_destroy(&ingest->mutex);
+        free(ingest->ring);
+        return false;
+    }
+    return true;
+}
+
+/* Takes frames from the ring, in native byte order. */
+static void take_frames(PcmIngest *ingest, int16_t *out, int frames) {
+    size_t bytes = (size_t) frames * ingest->frame_bytes;
+    size_t offset = (size_t) (ingest->read_pos % ingest->capacity);
+    size_t first = bytes < ingest->capacity - offset ? bytes : ingest->capacity - offset;
+
+    memcpy(out, ingest->ring + offset, first);
+    memcpy((unsigned char *) out + first, ingest->ring, bytes - first);
+    ingest->read_pos += bytes;
+    s16le_to_native(out, frames * ingest->channels);
+}
+
+/* Spreads in_frames over out_frames with linear interpolation, which shifts the pitch by their ratio. */
+static void stretch_frames(const int16_t *in, int in_frames, int16_t *out, int out_frames, int channels) {
+    for (int i = 0; i < out_frames; i++) {
+        double position = out_frames > 1 ? (double) i * (in_frames - 1) / (out_frames - 1) : 0;
+        int index = (int) position;
+        int next = index + 1 < in_frames ? index + 1 : index;
+        double fraction = position - index;
+        for (int c = 0; c < channels; c++) {
+            const int16_t sample = in[index * channels + c];
+            out[i * channels + c] = (int16_t) lrint(sample + (in[next * channels + c] - sample) * fraction);
+        }
+    }
+}
+
+/*
+ * Reads exactly frames interleaved native samples without waiting for the pipe, what it couldn't deliver in time is
+ * filled by the underflow policy. False only once the pipe is closed and the ring is drained.
+ */
+bool read_pcm_ingest(PcmIngest *ingest, int16_t *out, int frames) {
+    pthread_mutex_lock(&ingest->mutex);
+    const int buffered = (int) ((ingest->write_pos - ingest->read_pos) / ingest->frame_bytes);
+    if (buffered == 0 && ingest->eof) { // End Of Stream.
+        pthread_mutex_unlock(&ingest->mutex);
+        return false;
+    }
+
+    int in_frames = frames;
+    if (buffered < frames) {
+        if (!ingest->eof)
+            atomic_fetch_add_explicit(&ingest->underruns, 1, memory_order_relaxed);
+        if (ingest->underflow == INGEST_UNDERFLOW_STRETCH && !ingest->eof &&
+            buffered >= frames - frames / PCM_INGEST_STRETCH_LIMIT)
+            in_frames = buffered;
+        else {
+            take_frames(ingest, out, buffered);
+            memset(out + buffered * ingest->channels, 0, (size_t) (frames - buffered) * ingest->frame_bytes);
+            in_frames = 0;
+        }
+    } else if (ingest->overflow == INGEST_OVERFLOW_STRETCH &&
+               (size_t) buffered * ingest->frame_bytes > ingest->capacity / 4 * 3) {
+        /* Above three quarters the ring is drained a little faster than the stream plays. */
+        in_frames = frames + frames / PCM_INGEST_STRETCH_LIMIT;
+        if (in_frames > buffered)
+            in_frames = buffered;
+    }
+
+    if (in_frames == frames)
+        take_frames(ingest, out, frames);
+    else if (in_frames > 0) {
+        if (ingest->scratch_frames < in_frames) {
+            free(ingest->scratch);
+            ingest->scratch = malloc((size_t) in_frames * ingest->frame_bytes);
+            ingest->scratch_frames = ingest->scratch == NULL ? 0 : in_frames;
+        }
+        if (ingest->scratch != NULL) {
+            take_frames(ingest, ingest->scratch, in_frames);
+            stretch_frames(ingest->scratch, in_frames, out, frames, ingest->channels);
+            atomic_fetch_add_explicit(&ingest->stretched_frames, 1, memory_order_relaxed);
+        } else { // Plays the frame unstretched rather than not at all.
+            in_frames = in_frames < frames ? in_frames : frames;
+            take_frames(ingest, out, in_frames);
+            memset(out + in_frames * ingest->channels, 0, (size_t) (frames - in_frames) * ingest->frame_bytes);
+        }
+    }
+
+    pthread_cond_signal(&ingest->cond);
+    pthread_mutex_unlock(&ingest->mutex);
+    return true;
+}
+
+void get_pcm_ingest_stats(PcmIngest *ingest, RaInputStats *stats) {
+    stats->underruns = atomic_load_explicit(&ingest->underruns, memory_order_relaxed);
+    stats->overruns = atomic_load_explicit(&ingest->overruns, memory_order_relaxed);
+    stats->stretched_frames = atomic_load_explicit(&ingest->stretched_frames, memory_order_relaxed);
+}
+
+/* Stops the reader, the descriptor is left open, it belongs to the caller. */
+void close_pcm_ingest(PcmIngest *ingest) {
+    pthread_mutex_lock(&ingest->mutex);
+    ingest->stopping = true;
+    pthread_cond_broadcast(&ingest->cond);
+    pthread_mutex_unlock(&ingest->mutex);
+    pthread_join(ingest->reader, NULL);
+
+    pthread_cond_destroy(&ingest->cond);
+    pthread_mutex_destroy(&ingest->mutex);
+    free(ingest->ring);
+    free(ingest->scratch);
+}
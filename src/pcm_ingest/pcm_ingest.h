@@ -0,0 +1,84 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAPLAYER_PCM_INGEST_H
+#define RAPLAYER_PCM_INGEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "../raplayer.h"
+
+#define PCM_INGEST_CHUNK 65536 // Most bytes taken from the pipe at once.
+#define PCM_INGEST_DEFAULT_BUFFER 200 // Milliseconds of audio the ring holds.
+#define PCM_INGEST_POLL_INTERVAL 100 // Milliseconds the reader waits for the pipe before it checks for a stop.
+#define PCM_INGEST_STRETCH_LIMIT 16 // A stretched frame plays at most 1/16 more or less input than its length.
+
+typedef enum {
+    INGEST_OVERFLOW_BLOCK, // Stops reading, the pipe holds the writer back.
+    INGEST_OVERFLOW_DROP_OLDEST, // Drops the oldest audio to make room, nothing waits for the stream.
+    INGEST_OVERFLOW_STRETCH // Plays faster while the buffer runs full, drops the oldest if it fills up anyway.
+} IngestOverflowPolicy;
+
+typedef enum {
+    INGEST_UNDERFLOW_SILENCE, // Fills the missing part of the frame with silence.
+    INGEST_UNDERFLOW_STRETCH // Stretches a frame that's mostly there over the whole frame, silence otherwise.
+} IngestUnderflowPolicy;
+
+/*
+ * Reads raw 16 bits PCM from a pipe on a thread of its own into a bounded ring, so the frame clock never waits on
+ * the pipe. An empty ring is an underflow until the pipe is closed, only then the stream ends.
+ */
+typedef struct {
+    int fd;
+    int channels;
+    size_t frame_bytes;
+    IngestOverflowPolicy overflow;
+    IngestUnderflowPolicy underflow;
+
+    pthread_t reader;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // Signalled when the reader may go on after a full ring, or on a stop.
+    unsigned char *ring;
+    size_t capacity; // Bytes, whole frames.
+    uint64_t read_pos, write_pos; // Bytes taken and put since the start, read_pos is always at a frame.
+    bool eof;
+    bool stopping;
+
+    int16_t *scratch; // Input of a stretched frame.
+    int scratch_frames;
+
+    atomic_ulong underruns; // Frames read before the pipe delivered them.
+    atomic_ulong overruns; // Input frames dropped on a full ring.
+    atomic_ulong stretched_frames;
+} PcmIngest;
+
+bool start_pcm_ingest(PcmIngest *ingest, int fd, int channels, int capacity_frames, IngestOverflowPolicy overflow,
+                      IngestUnderflowPolicy underflow);
+
+bool read_pcm_ingest(PcmIngest *ingest, int16_t *out, int frames);
+
+void get_pcm_ingest_stats(PcmIngest *ingest, RaInputStats *stats);
+
+void close_pcm_ingest(PcmIngest *ingest);
+
+#endif
@@ -0,0 +1,303 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcm_source.h"
+#include "../dsp/dsp.h"
+
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+#define WAVE_FMT_SIZE 40 // Of an extensible fmt chunk, the plain one is 16 bytes.
+#define WAVE_UNKNOWN_SIZE 0xFFFFFFFF // Written by encoders which can't seek back into a pipe.
+
+static uint16_t get_le16(const unsigned char *buffer) {
+    return (uint16_t) (buffer[0] | buffer[1] << 8);
+}
+
+static uint32_t get_le32(const unsigned char *buffer) {
+    return get_le16(buffer) | (uint32_t) get_le16(buffer + 2) << 16;
+}
+
+static bool wav_error(const char *reason) {
+    printf("Error: Failed to open input file: %s\n", reason);
+    return false;
+}
+
+void open_raw_source(PcmSource *source, FILE *fin, int channels, uint32_t sample_rate) {
+    memset(source, 0, sizeof(PcmSource));
+    source->fin = fin;
+    source->format = PCM_FORMAT_S16;
+    source->channels = source->out_channels = channels;
+    source->sample_rate = source->out_rate = sample_rate;
+    source->bits_per_sample = 16;
+    source->block_align = channels * 2;
+    source->remaining = UINT64_MAX;
+    source->passthrough = true;
+}
+
+/* Walks the RIFF chunks up to the data one, fin is left at the first sample. */
+static bool parse_wav_header(PcmSource *source, uint16_t *audio_format) {
+    unsigned char header[12];
+    if (fread(header, 1, sizeof(header), source->fin) != sizeof(header) || memcmp(header, "RIFF", 4) != 0 ||
+        memcmp(header + 8, "WAVE", 4) != 0)
+        return wav_error("It is not a wav file.");
+
+    bool has_format = false;
+    while (1) {
+        unsigned char chunk[8];
+        if (fread(chunk, 1, sizeof(chunk), source->fin) != sizeof(chunk))
+            return wav_error("The data chunk of the file not found.");
+        uint32_t chunk_size = get_le32(chunk + 4);
+        long skip = (long) chunk_size + (chunk_size & 1); // Chunks are padded to an even size.
+
+        if (!memcmp(chunk, "fmt ", 4)) {
+            unsigned char fmt[WAVE_FMT_SIZE] = {0};
+            size_t fmt_size = chunk_size < WAVE_FMT_SIZE ? chunk_size : WAVE_FMT_SIZE;
+            if (chunk_size < 16 || fread(fmt, 1, fmt_size, source->fin) != fmt_size)
+                return wav_error("The fmt chunk of the file is broken.");
+            *audio_format = get_le16(fmt);
+            source->channels = get_le16(fmt + 2);
+            source->sample_rate = get_le32(fmt + 4);
+            source->block_align = get_le16(fmt + 12);
+            source->bits_per_sample = get_le16(fmt + 14);
+            if (*audio_format == WAVE_FORMAT_EXTENSIBLE && chunk_size >= WAVE_FMT_SIZE)
+                *audio_format = get_le16(fmt + 24); // The first bytes of the sub format GUID.
+            has_format = true;
+            skip -= (long) fmt_size;
+        } else if (!memcmp(chunk, "data", 4)) {
+            if (!has_format)
+                return wav_error("The fmt chunk must come before the data chunk.");
+            source->remaining = chunk_size == WAVE_UNKNOWN_SIZE || chunk_size == 0 ? UINT64_MAX : chunk_size;
+            return true;
+        }
+
+        if (skip > 0 && fseek(source->fin, skip, SEEK_CUR) != 0)
+            return wav_error("The data chunk of the file not found.");
+    }
+}
+
+static bool set_pcm_format(PcmSource *source, uint16_t audio_format) {
+    if (audio_format == WAVE_FORMAT_PCM && source->bits_per_sample == 16)
+        source->format = PCM_FORMAT_S16;
+    else if (audio_format == WAVE_FORMAT_PCM && source->bits_per_sample == 24)
+        source->format = PCM_FORMAT_S24;
+    else if (audio_format == WAVE_FORMAT_PCM && source->bits_per_sample == 32)
+        source->format = PCM_FORMAT_S32;
+    else if (audio_format == WAVE_FORMAT_IEEE_FLOAT && source->bits_per_sample == 32)
+        source->format = PCM_FORMAT_FLOAT;
+    else
+        return wav_error("It must be a pcm_s16le, pcm_s24le, pcm_s32le or pcm_f32le wav file.");
+
+    if (source->channels < 1 || source->channels > RESAMPLER_MAX_CHANNELS)
+        return wav_error("It must be a mono or stereo wav file.");
+    if (source->block_align != source->channels * source->bits_per_sample / 8)
+        return wav_error("The block align of the file doesn't match its format.");
+    return true;
+}
+
+/* The most frames a converted block holds, the resampler's flush included. */
+static int block_output_frames(const PcmSource *source) {
+    if (!source->resampling)
+        return PCM_SOURCE_BLOCK;
+    int block_frames = max_resampled_frames(&source->resampler, PCM_SOURCE_BLOCK);
+    int flush_frames = max_resampled_frames(&source->resampler, source->resampler.taps / 2);
+    return block_frames > flush_frames ? block_frames : flush_frames;
+}
+
+bool open_wav_source(PcmSource *source, FILE *fin, int out_channels, uint32_t out_rate) {
+    memset(source, 0, sizeof(PcmSource));
+    source->fin = fin;
+    source->out_channels = out_channels;
+    source->out_rate = out_rate;
+
+    uint16_t audio_format = 0;
+    if (!parse_wav_header(source, &audio_format) || !set_pcm_format(source, audio_format))
+        return false;
+
+    source->passthrough = source->format == PCM_FORMAT_S16 && source->channels == out_channels &&
+                          source->sample_rate == out_rate;
+    if (source->passthrough)
+        return true;
+
+    source->resampling = source->sample_rate != out_rate;
+    if (source->resampling &&
+        !init_resampler(&source->resampler, source->sample_rate, out_rate, source->channels, PCM_SOURCE_BLOCK)) {
+        printf("Error: Failed to open input file: Resampling from %uHz to %uHz is not supported.\n",
+               source->sample_rate, out_rate);
+        return false;
+    }
+
+    int block_frames = block_output_frames(source);
+    source->bytes = malloc((size_t) PCM_SOURCE_BLOCK * source->block_align);
+    source->samples = malloc((size_t) PCM_SOURCE_BLOCK * source->channels * sizeof(float));
+    source->resampled = malloc((size_t) block_frames * source->channels * sizeof(float));
+    source->mapped = malloc((size_t) block_frames * out_channels * sizeof(float));
+    if (source->bytes == NULL || source->samples == NULL || source->resampled == NULL || source->mapped == NULL) {
+        close_pcm_source(source);
+        return wav_error("Out of memory.");
+    }
+    return true;
+}
+
+const char *pcm_format_name(PcmFormat format) {
+    switch (format) {
+        case PCM_FORMAT_S16:
+            return "pcm_s16le";
+        case PCM_FORMAT_S24:
+            return "pcm_s24le";
+        case PCM_FORMAT_S32:
+            return "pcm_s32le";
+        case PCM_FORMAT_FLOAT:
+            return "pcm_f32le";
+    }
+    return "unknown";
+}
+
+/* Frames the source yields in the stream format, 0 if the length is unknown. */
+uint64_t pcm_source_frames(const PcmSource *source) {
+    if (source->remaining == UINT64_MAX)
+        return 0;
+    return source->remaining / (uint64_t) source->block_align * source->out_rate / source->sample_rate;
+}
+
+/* Samples to floats in [-1, 1), 24 and 32 bits ones are shifted into the top of an int32_t first. */
+static void convert_block(PcmSource *source, int frames) {
+    const int count = frames * source->channels;
+    const unsigned char *bytes = source->bytes;
+    float *samples = source->samples;
+
+    switch (source->format) {
+        case PCM_FORMAT_S16:
+            s16le_to_native((int16_t *) source->bytes, count);
+            samples_to_float((const int16_t *) source->bytes, samples, count);
+            break;
+        case PCM_FORMAT_S24:
+            for (int i = 0; i < count; i++, bytes += 3)
+                samples[i] = (float) (int32_t) ((uint32_t) bytes[0] << 8 | (uint32_t) bytes[1] << 16 |
+                                                (uint32_t) bytes[2] << 24) * (1.0f / 2147483648.0f);
+            break;
+        case PCM_FORMAT_S32:
+            for (int i = 0; i < count; i++, bytes += 4)
+                samples[i] = (float) (int32_t) get_le32(bytes) * (1.0f / 2147483648.0f);
+            break;
+        case PCM_FORMAT_FLOAT:
+            for (int i = 0; i < count; i++, bytes += 4) {
+                uint32_t bits = get_le32(bytes);
+                memcpy(&samples[i], &bits, sizeof(float));
+            }
+            break;
+    }
+}
+
+/* Mono is copied to both channels, stereo is averaged down to mono. */
+static const float *map_channels(PcmSource *source, const float *samples, int frames) {
+    if (source->channels == source->out_channels)
+        return samples;
+    if (source->channels == 1) {
+        for (int i = 0; i < frames; i++)
+            for (int channel = 0; channel < source->out_channels; channel++)
+                source->mapped[i * source->out_channels + channel] = samples[i];
+    } else {
+        for (int i = 0; i < frames; i++)
+            source->mapped[i] = (samples[i * 2] + samples[i * 2 + 1]) * 0.5f;
+    }
+    return source->mapped;
+}
+
+/* Converts the next block into the FIFO, false at the end of the data. */
+static bool fill_block(PcmSource *source) {
+    int frames = PCM_SOURCE_BLOCK;
+    if (source->remaining / (uint64_t) source->block_align < (uint64_t) frames)
+        frames = (int) (source->remaining / (uint64_t) source->block_align);
+    if (frames > 0)
+        frames = (int) fread(source->bytes, (size_t) source->block_align, (size_t) frames, source->fin);
+
+    const float *samples = source->samples;
+    if (frames > 0) {
+        if (source->remaining != UINT64_MAX)
+            source->remaining -= (uint64_t) frames * source->block_align;
+        convert_block(source, frames);
+        if (source->resampling) {
+            frames = resample(&source->resampler, source->samples, frames, source->resampled);
+            samples = source->resampled;
+        }
+    } else if (source->resampling && !source->flushed) {
+        source->flushed = true;
+        frames = flush_resampler(&source->resampler, source->resampled);
+        samples = source->resampled;
+    } else
+        return false;
+
+    samples = map_channels(source, samples, frames);
+    float_to_samples(samples, source->fifo + source->fifo_frames * source->out_channels,
+                     frames * source->out_channels);
+    source->fifo_frames += frames;
+    return true;
+}
+
+/* Reads exactly frames interleaved native samples, false at the end of the stream. */
+bool read_pcm_frames(PcmSource *source, int16_t *out, int frames) {
+    const int channels = source->out_channels;
+    if (source->passthrough) {
+        if (source->remaining != UINT64_MAX) {
+            if (source->remaining < (uint64_t) frames * source->block_align)
+                return false;
+            source->remaining -= (uint64_t) frames * source->block_align;
+        }
+        fread(out, (size_t) source->block_align, (size_t) frames, source->fin);
+        if (feof(source->fin)) // End Of Stream.
+            return false;
+        s16le_to_native(out, channels * frames);
+        return true;
+    }
+
+    /* Room for the frames still missing plus a whole converted block. */
+    int block_frames = block_output_frames(source);
+    if (source->fifo_capacity < frames + block_frames) {
+        int16_t *fifo = realloc(source->fifo, (size_t) (frames + block_frames) * channels * sizeof(int16_t));
+        if (fifo == NULL)
+            return false;
+        source->fifo = fifo;
+        source->fifo_capacity = frames + block_frames;
+    }
+
+    while (source->fifo_frames < frames)
+        if (!fill_block(source))
+            return false;
+
+    memcpy(out, source->fifo, (size_t) frames * channels * sizeof(int16_t));
+    source->fifo_frames -= frames;
+    memmove(source->fifo, source->fifo + frames * channels, (size_t) source->fifo_frames * channels * sizeof(int16_t));
+    return true;
+}
+
+/* Leaves fin open, it belongs to the caller. */
+void close_pcm_source(PcmSource *source) {
+    if (source->resampling)
+        destroy_resampler(&source->resampler);
+    free(source->bytes);
+    free(source->samples);
+    free(source->resampled);
+    free(source->mapped);
+    free(source->fifo);
+    memset(source, 0, sizeof(PcmSource));
+}
@@ -0,0 +1,80 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAPLAYER_PCM_SOURCE_H
+#define RAPLAYER_PCM_SOURCE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../resampler/resampler.h"
+
+#define PCM_SOURCE_BLOCK 1024 // Input frames converted at once.
+
+typedef enum {
+    PCM_FORMAT_S16,
+    PCM_FORMAT_S24,
+    PCM_FORMAT_S32,
+    PCM_FORMAT_FLOAT
+} PcmFormat;
+
+/*
+ * Reads a wav file or a raw pipe as 16 bits samples at the stream rate and channels.
+ * Other formats, rates and mono are converted block by block, so memory stays bounded for any length.
+ */
+typedef struct {
+    FILE *fin;
+    PcmFormat format;
+    int channels;
+    uint32_t sample_rate;
+    int bits_per_sample;
+    int block_align;
+    uint64_t remaining; // Bytes left in the data chunk, UINT64_MAX if unknown.
+
+    int out_channels;
+    uint32_t out_rate;
+    bool passthrough; // Already in the stream format, read as is.
+    bool resampling;
+    bool flushed;
+    Resampler resampler;
+
+    unsigned char *bytes;
+    float *samples;
+    float *resampled;
+    float *mapped;
+    int16_t *fifo; // Converted frames not read yet.
+    int fifo_frames;
+    int fifo_capacity;
+} PcmSource;
+
+void open_raw_source(PcmSource *source, FILE *fin, int channels, uint32_t sample_rate);
+
+bool open_wav_source(PcmSource *source, FILE *fin, int out_channels, uint32_t out_rate);
+
+const char *pcm_format_name(PcmFormat format);
+
+uint64_t pcm_source_frames(const PcmSource *source);
+
+bool read_pcm_frames(PcmSource *source, int16_t *out, int frames);
+
+void close_pcm_source(PcmSource *source);
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "playout_buffer.h"
+
+void init_playout_buffer(PlayoutBuffer *buffer, int delay) {
+    memset(buffer, 0, sizeof(PlayoutBuffer));
+    buffer->delay = delay < PLAYOUT_BUFFER_SIZE / 2 ? delay : PLAYOUT_BUFFER_SIZE / 2;
+}
+
+/*
+ * Stores a frame for playout.
+ * Returns how many frames right before it are newly missing, so the caller can request them again.
+ */
+uint32_t insert_frame(PlayoutBuffer *buffer, uint32_t sequence, const unsigned char *frame, uint16_t frame_len,
+                      bool retransmitted) {
+    if (!buffer->started || (int32_t) (sequence - buffer->next) >= PLAYOUT_BUFFER_SIZE) {
+        /* First frame, or too far ahead to keep the frames in between: start over from here. */
+        for (int i = 0; i < PLAYOUT_BUFFER_SIZE; i++)
+            buffer->slots[i].filled = false;
+        buffer->started = true;
+        buffer->next = sequence;
+        buffer->highest = sequence;
+    }
+
+    if ((int32_t) (sequence - buffer->next) < 0 || frame_len > MAX_PACKET_SIZE) {
+        buffer->late_frames++;
+        return 0;
+    }
+
+    PlayoutSlot *slot = &buffer->slots[sequence & (PLAYOUT_BUFFER_SIZE - 1)];
+    if (slot->filled)
+        return 0; // Duplicate.
+
+    slot->filled = true;
+    slot->retransmitted = retransmitted;
+    slot->frame_len = frame_len;
+    memcpy(slot->frame, frame, frame_len);
+    buffer->received_frames++;
+
+    uint32_t missing = 0;
+    if ((int32_t) (sequence - buffer->highest) >= 0) {
+        missing = sequence - buffer->highest;
+        buffer->highest = sequence + 1;
+    }
+    return missing;
+}
+
+/*
+ * Takes the next frame once more than delay frames are queued behind it, or whenever flush is set.
+ * *slot is NULL when the frame never arrived and has to be concealed.
+ * The returned slot stays valid until the next insert_frame.
+ */
+bool pop_frame(PlayoutBuffer *buffer, bool flush, PlayoutSlot **slot) {
+    int32_t queued = (int32_t) (buffer->highest - buffer->next);
+    if (!buffer->started || queued <= 0 || (!flush && queued <= buffer->delay))
+        return false;
+
+    PlayoutSlot *current_slot = &buffer->slots[buffer->next & (PLAYOUT_BUFFER_SIZE - 1)];
+    buffer->next++;
+
+    if (current_slot->filled) {
+        current_slot->filled = false;
+        if (current_slot->retransmitted)
+            buffer->recovered_frames++;
+        if (current_slot->frame_len == 0)
+            buffer->dtx_frames++;
+        *slot = current_slot;
+    } else {
+        buffer->concealed_frames++;
+        *slot = NULL;
+    }
+    return true;
+}
@@ -0,0 +1,64 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAPLAYER_PLAYOUT_BUFFER_H
+#define RAPLAYER_PLAYOUT_BUFFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../packet/packet.h"
+
+#define PLAYOUT_BUFFER_SIZE 256 // Must be a power of two.
+
+typedef struct {
+    bool filled;
+    bool retransmitted;
+    uint16_t frame_len;
+    unsigned char frame[MAX_PACKET_SIZE];
+} PlayoutSlot;
+
+/*
+ * Reorders received frames by sequence number and holds back delay frames,
+ * so retransmissions of missing frames can still arrive before their turn to play.
+ */
+typedef struct {
+    bool started;
+    uint32_t next; // Sequence of the next frame to play.
+    uint32_t highest; // One past the highest sequence received.
+    int delay;
+
+    unsigned long received_frames;
+    unsigned long recovered_frames; // Missing frames filled by a retransmission in time.
+    unsigned long concealed_frames; // Missing frames played with packet loss concealment.
+    unsigned long late_frames; // Frames arrived after their turn to play.
+    unsigned long dtx_frames; // Silent frames the server suppressed with DTX.
+
+    PlayoutSlot slots[PLAYOUT_BUFFER_SIZE];
+} PlayoutBuffer;
+
+void init_playout_buffer(PlayoutBuffer *buffer, int delay);
+
+uint32_t insert_frame(PlayoutBuffer *buffer, uint32_t sequence, const unsigned char *frame, uint16_t frame_len,
+                      bool retransmitted);
+
+bool pop_frame(PlayoutBuffer *buffer, bool flush, PlayoutSlot **slot);
+
+#endif
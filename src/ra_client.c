@@ -20,11 +20,18 @@
 
 #include "ra_client.h"
 #include "chacha20/chacha20.h"
+#include "tracer/tracer.h"
+#include "dsp/dsp.h"
+#include "capture/capture.h"
+#include "resampler/resampler.h"
+#include "drift/drift.h"
+#include "ticker/ticker.h"
 
 struct stream_info {
     int16_t channels;
     int32_t sample_rate;
     int16_t bits_per_sample;
+    int32_t frame_duration;
 };
 
 struct server_socket_info {
@@ -33,454 +40,768 @@ struct server_socket_info {
     int *socket_len;
 };
 
-int client_init_socket(char *str_server_addr, int server_port, struct sockaddr_in *p_server_addr) {
-    struct sockaddr_in server_addr = *p_server_addr;
+int client_init_socket(const char *str_server_addr, int server_port, struct sockaddr_in *p_server_addr) {
+    struct sockaddr_in server_addr;
     int sock_fd;
 
     // Creating socket file descriptor.
     if ((sock_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
         fprintf(stdout, "Error: Socket Creation Failed.\n");
-        exit(EXIT_FAILURE);
+        return -1;
     }
 
     memset((char *) &server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET; // IPv4
     server_addr.sin_port = htons((uint16_t) server_port);
 
-    struct hostent *hostent;
-    struct in_addr **addr_list;
+    /* Reentrant, other clients in the process may be resolving at the same time. */
+    struct addrinfo hints, *addr_info;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
 
-    if ((hostent = gethostbyname(str_server_addr)) == NULL) {
+    if (getaddrinfo(str_server_addr, NULL, &hints, &addr_info) != 0) {
         printf("Error: Connection Cannot resolved to %s.\n", str_server_addr);
-        exit(EXIT_FAILURE);
-    } else {
-        addr_list = (struct in_addr **) hostent->h_addr_list;
-        strcpy(str_server_addr, inet_ntoa(*addr_list[0]));
-    }
-
-    if (!inet_pton(AF_INET, str_server_addr, &server_addr.sin_addr)) {
-        puts("Error: Convert Internet host address Failed.");
-        exit(EXIT_FAILURE);
+        close(sock_fd);
+        return -1;
     }
+    server_addr.sin_addr = ((struct sockaddr_in *) addr_info->ai_addr)->sin_addr;
+    freeaddrinfo(addr_info);
 
     *p_server_addr = server_addr;
     return sock_fd;
 }
 
-uint32_t ready_sock_client_seq1(struct stream_info *streamInfo, const struct server_socket_info *p_server_socket_info) {
+/* Bounds every receive, so neither a silent server nor a stop can block the client for longer. */
+void set_receive_timeout(int sock_fd, long timeout) {
+    struct timeval timeval = {timeout / 1000000, timeout % 1000000};
+    setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeval, sizeof(timeval));
+}
+
+bool ready_sock_client_seq1(struct stream_info *streamInfo, const struct server_socket_info *p_server_socket_info,
+                            int aggregated_frames, uint32_t *orig_pcm_size) {
     struct sockaddr_in server_addr = *p_server_socket_info->server_addr;
     const int buffer_size = 6;
     char *buffer = calloc(buffer_size, BYTE);
 
-    sendto(p_server_socket_info->sock_fd, HELLO, sizeof(HELLO), 0, (struct sockaddr *) &server_addr,
+    /* Client options follow the HELLO string. */
+    char hello[sizeof(HELLO) + 32] = HELLO;
+    int hello_len = (int) sizeof(HELLO);
+    hello_len += sprintf(hello + sizeof(HELLO), "aggregate=%d", aggregated_frames);
+
+    sendto(p_server_socket_info->sock_fd, hello, hello_len, 0, (struct sockaddr *) &server_addr,
            *p_server_socket_info->socket_len);
 
     // Receive PCM info from server.
-    recvfrom(p_server_socket_info->sock_fd, buffer, buffer_size, 0, NULL, NULL);
-    int info_len = (int) strtol(buffer, NULL, 10);
+    int info_len;
+    if (recvfrom(p_server_socket_info->sock_fd, buffer, buffer_size - 1, 0, NULL, NULL) <= 0 ||
+        (info_len = (int) strtol(buffer, NULL, 10)) < WORD * 2 + DWORD) {
+        free(buffer);
+        return false;
+    }
     buffer = realloc(buffer, info_len);
 
     sendto(p_server_socket_info->sock_fd, OK, sizeof(OK), 0, (struct sockaddr *) &server_addr,
            *p_server_socket_info->socket_len);
-    recvfrom(p_server_socket_info->sock_fd, buffer, info_len, 0, NULL, NULL);
+    if (recvfrom(p_server_socket_info->sock_fd, buffer, info_len, 0, NULL, NULL) <= 0) {
+        free(buffer);
+        return false;
+    }
 
     memcpy(&streamInfo->channels, buffer, WORD);
     memcpy(&streamInfo->sample_rate, buffer + WORD, DWORD);
     memcpy(&streamInfo->bits_per_sample, buffer + WORD + DWORD, WORD);
 
+    streamInfo->frame_duration = DEFAULT_FRAME_DURATION;
+    if (info_len >= WORD * 2 + DWORD * 2) // Older servers don't announce the frame duration.
+        memcpy(&streamInfo->frame_duration, buffer + WORD * 2 + DWORD, DWORD);
+
     buffer = realloc(buffer, DWORD);
     sprintf(buffer, "%d", info_len);
 
     if (sendto(p_server_socket_info->sock_fd, buffer, strlen(buffer), 0, (struct sockaddr *) &server_addr,
                *p_server_socket_info->socket_len) > 0) {
         memset(buffer, 0, DWORD);
-        recvfrom(p_server_socket_info->sock_fd, buffer, DWORD, 0, NULL, NULL);
+        if (recvfrom(p_server_socket_info->sock_fd, buffer, DWORD, 0, NULL, NULL) <= 0) {
+            free(buffer);
+            return false;
+        }
 
-        uint32_t orig_pcm_size = 0;
-        memcpy(&orig_pcm_size, buffer, DWORD);
+        *orig_pcm_size = 0;
+        memcpy(orig_pcm_size, buffer, DWORD);
 
         sendto(p_server_socket_info->sock_fd, OK, sizeof(OK), 0, (struct sockaddr *) &server_addr,
                *p_server_socket_info->socket_len);
         free(buffer);
-        return orig_pcm_size;
+        return true;
     }
     free(buffer);
-    return 0;
+    return false;
 }
 
-unsigned char *ready_sock_client_seq2(const struct server_socket_info *p_server_socket_info) {
+bool ready_sock_client_seq2(const struct server_socket_info *p_server_socket_info, unsigned char *crypto_payload) {
     struct sockaddr_in server_addr = *p_server_socket_info->server_addr;
     const int crypto_payload_size = CHACHA20_NONCEBYTES + CHACHA20_KEYBYTES;
-    static unsigned char crypto_payload[CHACHA20_NONCEBYTES + CHACHA20_KEYBYTES];
 
     if (crypto_payload_size ==
         recvfrom(p_server_socket_info->sock_fd, crypto_payload, crypto_payload_size, 0, NULL, NULL)) {
         sendto(p_server_socket_info->sock_fd, OK, sizeof(OK), 0, (struct sockaddr *) &server_addr,
                (socklen_t) *p_server_socket_info->socket_len);
-        return crypto_payload;
+        return true;
     }
-    return NULL;
+    return false;
 }
 
-int EOS = -1;
-pthread_cond_t print_volume_cond = PTHREAD_COND_INITIALIZER;
-pthread_mutex_t print_volume_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Playback counters, written by the receiving thread only. The heartbeats report some of them to the server. */
+struct playback_stats {
+    atomic_ulong played_frames;
+    atomic_ulong received_bytes;
+    atomic_ulong lost_frames;
+    atomic_ulong recovered_frames;
+    atomic_ulong concealed_frames;
+    atomic_ulong late_frames;
+    atomic_ulong dtx_frames;
+    atomic_ulong jitter; // Microseconds.
+    _Atomic double drift; // Output frames per input frame.
+};
 
-__attribute__((noreturn)) void client_signal_timer(int signal) {
-    if (signal == SIGALRM) {
-        if (EOS == -1)
-            write(STDOUT_FILENO, "Error: Connection timed out.\n", 29);
-        else {
-            pthread_cond_signal(&print_volume_cond);
-            write(STDOUT_FILENO, "\nServer has been interrupted raplayer. Program now Exit.\n\r", 58);
-        }
-    }
-    exit(signal);
+int64_t client_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
 }
 
-struct termios orig_termios;
+struct opus_player {
+    OpusDecoder *decoder;
+    RaOutput output;
+    bool float_output; // The output takes floats.
+    Resampler *resampler; // To the output's rate and against its clock drift, NULL if neither is needed.
+    unsigned char *crypto_payload;
+
+    int channels;
+    int max_frame_size;
+    int last_frame_size;
+    const _Atomic double *volume;
+    float gain; // Where the last frame's volume ramp ended.
+    struct playback_stats *stats;
+};
 
-void reset_terminal_mode() {
-    tcsetattr(0, TCSANOW, &orig_termios);
+/* The volume is the part taken away, 0 keeps the samples and 1 mutes them. */
+float volume_gain(double volume) {
+    return (float) fmin(fmax(1 - volume, 0), 1);
 }
 
-void set_conio_terminal_mode() {
-    struct termios new_termios;
-
-    /* take two copies - one for now, one for later */
-    tcgetattr(0, &orig_termios);
-    memcpy(&new_termios, &orig_termios, sizeof(new_termios));
-
-    /* register cleanup handler, and set the new terminal mode */
-    atexit(&reset_terminal_mode);
-    cfmakeraw(&new_termios);
-    tcsetattr(0, TCSANOW, &new_termios);
+/* Decodes to floats when they are resampled or played as they are, so no samples are converted back and forth. */
+int decode_frame(struct opus_player *opus_player, const unsigned char *data, opus_int32 len, opus_int16 *out,
+                 float *floats, int frame_size) {
+    if (opus_player->float_output || opus_player->resampler != NULL)
+        return opus_decode_float(opus_player->decoder, data, len, floats, frame_size, 0);
+    return opus_decode(opus_player->decoder, data, len, out, frame_size, 0);
 }
 
+/* Decrypts, decodes and plays one frame, or conceals it when slot is NULL or holds an empty DTX frame. */
+int play_frame(struct opus_player *opus_player, PlayoutSlot *slot, uint32_t sequence) {
+    struct chacha20_context ctx;
+    const bool float_path = opus_player->float_output || opus_player->resampler != NULL;
+    opus_int16 out[opus_player->max_frame_size * opus_player->channels];
+    float floats[float_path ? opus_player->max_frame_size * opus_player->channels : 1];
 
-int kbhit() {
-    struct timeval timeval = {0, 0};
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(STDIN_FILENO, &fds);
-    return select(1, &fds, NULL, NULL, &timeval);
-}
+    int frame_size;
+    if (slot != NULL && slot->frame_len > 0) {
+        /* Decrypt the frame. */
+        int64_t trace_start = trace_begin();
+        chacha20_init_context(&ctx, opus_player->crypto_payload, opus_player->crypto_payload + CHACHA20_NONCEBYTES, 0);
+        chacha20_xor(&ctx, slot->frame, slot->frame_len);
+        trace_end(TRACE_DECRYPT, sequence, trace_start);
 
-int getch() {
-    int result;
-    unsigned char ch;
-    if ((result = (int) read(STDIN_FILENO, &ch, sizeof(ch))) < 0) {
-        return result;
+        /* Decode the frame. */
+        trace_start = trace_begin();
+        frame_size = decode_frame(opus_player, slot->frame, slot->frame_len, out, floats,
+                                  opus_player->max_frame_size);
+        trace_end(TRACE_DECODE, sequence, trace_start);
+        atomic_fetch_add_explicit(&opus_player->stats->received_bytes, slot->frame_len, memory_order_relaxed);
     } else {
-        return ch;
+        /* Conceal the missing frame with the length of the previous one, the decoder fades DTX gaps into comfort noise. */
+        int64_t trace_start = trace_begin();
+        frame_size = decode_frame(opus_player, NULL, 0, out, floats, opus_player->last_frame_size);
+        trace_end(TRACE_DECODE, sequence, trace_start);
     }
-}
 
-struct pthread_signal_args {
-    pthread_cond_t *cond;
-    pthread_mutex_t *mutex;
+    if (frame_size < 0) {
+        printf("Error: Opus decoder failed - %s\n", opus_strerror(frame_size));
+        return frame_size;
+    }
+    opus_player->last_frame_size = frame_size;
+
+    /*
+     * Apply the volume, then bring the frame to the output's rate and stretch it by the output's clock drift,
+     * a frame may come out a sample longer or shorter. Floats become samples once, unless the output takes them.
+     */
+    const float target_gain = volume_gain(atomic_load_explicit(opus_player->volume, memory_order_relaxed));
+    opus_int16 *samples = out;
+    float *float_samples = floats;
+    int out_frames = frame_size;
+    int max_out_frames = opus_player->resampler != NULL
+                         ? max_resampled_frames(opus_player->resampler, opus_player->max_frame_size) : 1;
+    float resampled[max_out_frames * opus_player->channels];
+    opus_int16 converted[opus_player->resampler != NULL && !opus_player->float_output
+                         ? max_out_frames * opus_player->channels : 1];
+    if (float_path) {
+        apply_float_gain(floats, frame_size, opus_player->channels, &opus_player->gain, target_gain);
+        if (opus_player->resampler != NULL) {
+            out_frames = resample(opus_player->resampler, floats, frame_size, resampled);
+            float_samples = resampled;
+        }
+        if (!opus_player->float_output) {
+            samples = opus_player->resampler != NULL ? converted : out;
+            float_to_samples(float_samples, samples, out_frames * opus_player->channels);
+        } else
+            clip_floats(float_samples, out_frames * opus_player->channels);
+    } else
+        apply_gain(out, frame_size, opus_player->channels, &opus_player->gain, target_gain);
+
+    int64_t trace_start = trace_begin();
+    if (!opus_player->output.write(opus_player->output.user_data,
+                                   opus_player->float_output ? (void *) float_samples : (void *) samples, out_frames))
+        return -1;
+    trace_end(TRACE_WRITE, sequence, trace_start);
+
+    atomic_fetch_add_explicit(&opus_player->stats->played_frames, 1, memory_order_relaxed);
+    return frame_size;
+}
 
-    int *status;
-};
+/* Microseconds of audio written to the output and not played yet. */
+double queued_output(struct opus_player *opus_player, int output_rate) {
+    return (double) opus_player->output.queued(opus_player->output.user_data) * 1000000 / output_rate;
+}
 
-void *pthread_receive_signal(void *p_pthread_signal_args) {
-    pthread_cond_t *p_cond = ((struct pthread_signal_args *) p_pthread_signal_args)->cond;
-    pthread_mutex_t *p_mutex = ((struct pthread_signal_args *) p_pthread_signal_args)->mutex;
-    int *status = ((struct pthread_signal_args *) p_pthread_signal_args)->status;
+/* Opus decodes at any of its own rates for as little as at the stream's, which spares a resampler. */
+int decoder_rate(int output_rate, int stream_rate) {
+    switch (output_rate) {
+        case 8000:
+        case 12000:
+        case 16000:
+        case 24000:
+        case 48000:
+            return output_rate;
+        default:
+            return stream_rate;
+    }
+}
 
-    while (!EOS) {
-        pthread_mutex_lock(p_mutex);
-        pthread_cond_wait(p_cond, p_mutex);
-        *status = 1;
+/* Interarrival jitter as in RFC 3550, the transit time is taken against the frame's place in the stream. */
+void update_jitter(double *jitter, int64_t *previous_transit, int32_t frame_duration, uint32_t sequence,
+                   int64_t arrival_time) {
+    int64_t transit = arrival_time - (int64_t) sequence * frame_duration;
 
-        pthread_mutex_unlock(p_mutex);
+    if (*previous_transit != INT64_MIN) {
+        int64_t difference = transit - *previous_transit;
+        *jitter += ((double) llabs(difference) - *jitter) / 16;
     }
-    return NULL;
+    *previous_transit = transit;
 }
 
-long sum_frame_cnt = 0;
-long sum_frame_size = 0;
+/* Where the datagrams come from: the server, recorded to a capture if one is open, or a capture being replayed. */
+struct datagram_source {
+    int sock_fd;
+    Capture *capture;
+    Capture *replay;
+    bool fast; // Replays without waiting for the original arrival times.
+    int64_t replay_start;
+    int64_t replay_time; // Microseconds the replay took, once it ended.
+    unsigned long datagrams;
+};
 
-void *change_symbol(void *p_symbol) {
-    int symbol_cnt = 0;
-    char symbols[] = {'-', '\\', '|', '/'};
-    while (!EOS) {
-        *((char *) p_symbol) = symbols[symbol_cnt++ % DWORD];
+/*
+ * Receives the next datagram and its arrival time in microseconds. Returns 0 at the end of a replay,
+ * and -1 when the server sent nothing within the receive timeout.
+ */
+ssize_t receive_datagram(struct datagram_source *source, unsigned char *buffer, size_t buffer_size,
+                         int64_t *arrival_time) {
+    if (source->replay != NULL) {
+        int buffer_len = read_capture(source->replay, buffer, buffer_size, arrival_time);
+        if (buffer_len < 0)
+            printf("Error: The capture is cut off or broken, stopping the replay.\n");
+        if (buffer_len <= 0)
+            return 0;
+
+        *arrival_time += source->replay_start;
+        int64_t wait_time;
+        while (!source->fast && (wait_time = *arrival_time - client_time()) > 0) {
+            struct timespec timespec = {wait_time / 1000000, (wait_time % 1000000) * 1000};
+            nanosleep(&timespec, NULL);
+        }
+        source->datagrams++;
+        return buffer_len;
+    }
 
-        struct timespec timespec;
-        timespec.tv_sec = 0;
-        timespec.tv_nsec = 250000000;
-        nanosleep(&timespec, NULL);
+    ssize_t buffer_len = recvfrom(source->sock_fd, buffer, buffer_size, 0, NULL, NULL);
+    *arrival_time = client_time();
+    if (buffer_len < 0)
+        return -1;
+    if (buffer_len > 0 && source->capture != NULL &&
+        !write_capture(source->capture, buffer, (uint16_t) buffer_len, *arrival_time)) {
+        printf("Error: Failed to write the capture: %s\n", strerror(errno));
+        close_capture(source->capture);
+        source->capture = NULL;
     }
-    return NULL;
+    source->datagrams++;
+    return buffer_len;
 }
 
-void *print_info(void *p_volume) {
-    int print_volume_remain_cnt = 0;
-    int volume_status = 0;
-    const double *volume = (double *) p_volume;
-    char symbol;
-
-    set_conio_terminal_mode();
-
-    struct pthread_signal_args pthread_signal_args;
-    pthread_signal_args.cond = &print_volume_cond;
-    pthread_signal_args.mutex = &print_volume_mutex;
-    pthread_signal_args.status = &volume_status;
-
-    pthread_t pthread_signal_receiver;
-    pthread_t symbol_changer;
-    pthread_create(&pthread_signal_receiver, NULL, pthread_receive_signal, (void *) &pthread_signal_args);
-    pthread_create(&symbol_changer, NULL, change_symbol, (void *) &symbol);
-    puts("");
-
-    while (!EOS) {
-        if (volume_status) {
-            volume_status = 0;
-            print_volume_remain_cnt = 20;
-        }
+/* Asks the server again for count frames starting at sequence. */
+void request_retransmission(const struct server_socket_info *p_server_socket_info, uint32_t sequence, uint32_t count) {
+    unsigned char buffer[NACK_PACKET_SIZE];
 
-        if (print_volume_remain_cnt > 0) {
-            if (*volume >= 1)
-                printf("[%c] Elapsed time: %.2lfs, Received frame size: %.2lfKB, Muted%*c\r", symbol,
-                       (double) (sum_frame_cnt * 20) / 1000, (double) (sum_frame_size) / 1000, 8, ' ');
-            else
-                printf("[%c] Elapsed time: %.2lfs, Received frame size: %.2lfKB, %0.f%%%*c\r", symbol,
-                       (double) (sum_frame_cnt * 20) / 1000, (double) (sum_frame_size) / 1000, ((1 - *volume) * 100),
-                       8, ' ');
-            print_volume_remain_cnt--;
-        } else
-            printf("[%c] Elapsed time: %.2lfs, Received frame size: %.2lfKB%*c\r", symbol,
-                   (double) (sum_frame_cnt * 20) / 1000, (double) (sum_frame_size) / 1000, 8, ' ');
+    while (count > 0) {
+        struct nack_packet nack = {sequence, 0};
+        uint32_t nack_frames = count > NACK_BITMAP_FRAMES + 1 ? NACK_BITMAP_FRAMES + 1 : count;
+        for (uint32_t i = 1; i < nack_frames; i++)
+            nack.bitmap |= 1u << (i - 1);
 
-        fflush(stdout);
+        size_t buffer_len = build_nack_packet(&nack, buffer, sizeof(buffer));
+        sendto(p_server_socket_info->sock_fd, buffer, buffer_len, 0,
+               (struct sockaddr *) p_server_socket_info->server_addr, *p_server_socket_info->socket_len);
 
-        struct timespec timespec;
-        timespec.tv_sec = 0;
-        timespec.tv_nsec = 50000000;
-        nanosleep(&timespec, NULL);
+        sequence += nack_frames;
+        count -= nack_frames;
     }
+}
 
-    pthread_cond_signal(pthread_signal_args.cond);
-    pthread_join(pthread_signal_receiver, NULL);
-    pthread_join(symbol_changer, NULL);
+/* A client engine, the receiving thread owns everything but the counters, the volume and the stopping flag. */
+struct ra_client {
+    RaClientConfig config;
+    struct stream_info stream_info;
+    uint32_t pcm_size;
+    unsigned char crypto_payload[CHACHA20_NONCEBYTES + CHACHA20_KEYBYTES];
+    double retransmit_delay;
 
-    printf("[*] Elapsed time: %.2lfs, Received frame size: %.2lfKB%*c\r\n",
-           (double) (sum_frame_cnt * 20) / 1000, (double) (sum_frame_size) / 1000, 8, ' ');
-    return EXIT_SUCCESS;
-}
+    int sock_fd;
+    int socket_len;
+    struct sockaddr_in server_addr;
+    struct server_socket_info server_socket_info;
 
-void *send_heartbeat(void *p_server_socket_info) {
-    while (!EOS) {
-        sendto(((struct server_socket_info *) p_server_socket_info)->sock_fd, HEARTBEAT, sizeof(HEARTBEAT), 0,
-               (struct sockaddr *) ((struct server_socket_info *) p_server_socket_info)->server_addr,
-               *((struct server_socket_info *) p_server_socket_info)->socket_len);
+    Capture capture, replay;
+    struct datagram_source source;
+
+    bool output_open;
+    int output_rate;
+    OpusDecoder *decoder;
+    struct opus_player opus_player;
+    Resampler resampler;
+    DriftCompensator drift;
+    bool drift_compensation;
+    PlayoutBuffer *playout_buffer;
+
+    _Atomic double volume;
+    struct playback_stats stats;
+
+    Ticker *ticker;
+    bool own_ticker;
+    TickerJob heartbeat_job;
+
+    atomic_bool stopping;
+    pthread_t receiver;
+    bool started;
+    bool joined;
+    bool failed;
+};
 
-        struct timespec timespec;
-        timespec.tv_sec = 0;
-        timespec.tv_nsec = 250000000;
-        nanosleep(&timespec, NULL);
-    }
-    return EXIT_SUCCESS;
+/* Sends a heartbeat with the playback quality, on the ticker's thread. */
+static void send_heartbeat(void *p_client, uint64_t tick, int64_t scheduled_time) {
+    struct ra_client *client = (struct ra_client *) p_client;
+    char heartbeat[sizeof(HEARTBEAT) + HEARTBEAT_REPORT_SIZE];
+    memcpy(heartbeat, HEARTBEAT, sizeof(HEARTBEAT));
+
+    int report_len = snprintf(heartbeat + sizeof(HEARTBEAT), HEARTBEAT_REPORT_SIZE,
+                              "lost=%lu concealed=%lu late=%lu jitter=%lu",
+                              atomic_load_explicit(&client->stats.lost_frames, memory_order_relaxed),
+                              atomic_load_explicit(&client->stats.concealed_frames, memory_order_relaxed),
+                              atomic_load_explicit(&client->stats.late_frames, memory_order_relaxed),
+                              atomic_load_explicit(&client->stats.jitter, memory_order_relaxed));
+    sendto(client->sock_fd, heartbeat, sizeof(HEARTBEAT) + (size_t) report_len, 0,
+           (struct sockaddr *) &client->server_addr, (socklen_t) client->socket_len);
+}
+
+/* Publishes the playout buffer's counters, for the heartbeats and the engine's stats. */
+static void store_playout_stats(struct playback_stats *stats, const PlayoutBuffer *playout_buffer) {
+    atomic_store_explicit(&stats->lost_frames,
+                          playout_buffer->recovered_frames + playout_buffer->concealed_frames, memory_order_relaxed);
+    atomic_store_explicit(&stats->recovered_frames, playout_buffer->recovered_frames, memory_order_relaxed);
+    atomic_store_explicit(&stats->concealed_frames, playout_buffer->concealed_frames, memory_order_relaxed);
+    atomic_store_explicit(&stats->late_frames, playout_buffer->late_frames, memory_order_relaxed);
+    atomic_store_explicit(&stats->dtx_frames, playout_buffer->dtx_frames, memory_order_relaxed);
 }
 
-void *control_volume(void *p_volume) {
-    double *volume = (double *) p_volume;
-
-    while (!EOS) {
-        if (kbhit()) {
-            switch (getch()) {
-                case '\033':
-                    getch(); /* skip the '[' */
-                    switch (getch()) { /* the real value */
-                        case 'A':
-                            *volume = ((*volume - 0.01 < -0.01) ? *volume : *volume - 0.01); /* Increase volume. */
-                            pthread_cond_signal(&print_volume_cond);
-                            break;
-                        case 'B':
-                            *volume = ((*volume + 0.01 > 1.01) ? *volume : *volume + 0.01); /* Decrease volume. */
-                            pthread_cond_signal(&print_volume_cond);
-                            break;
-                        default:
-                            break;
-                    }
-                    break;
-
-                case 0x03:
-                    raise(SIGINT);
-                    break;
-
-                case 0x1A:
-                    raise(SIGSTOP);
-                    break;
-
-                default:
-                    break;
+void *receive_stream(void *p_client) {
+    struct ra_client *client = (struct ra_client *) p_client;
+    struct opus_player *opus_player = &client->opus_player;
+    PlayoutBuffer *playout_buffer = client->playout_buffer;
+    const int32_t frame_duration = client->stream_info.frame_duration;
+    const bool replaying = client->source.replay != NULL;
+
+    trace_thread("receiver");
+
+    double jitter = 0;
+    int64_t previous_transit = INT64_MIN;
+    int64_t last_arrival_time = client_time();
+
+    client->source.replay_start = client_time();
+    while (!atomic_load(&client->stopping)) {
+        unsigned char c_bits[MAX_DATA_SIZE];
+
+        int64_t arrival_time;
+        ssize_t c_bits_len = receive_datagram(&client->source, c_bits, sizeof(c_bits), &arrival_time);
+        if (c_bits_len < 0) {
+            if (arrival_time - last_arrival_time < SERVER_TIMEOUT)
+                continue;
+            printf("\nServer has been interrupted raplayer. Program now Exit.\n\r");
+            client->failed = true;
+            break;
+        }
+        last_arrival_time = arrival_time;
+
+        int64_t trace_start = trace_begin();
+        if ((replaying && c_bits_len == 0) ||
+            (c_bits_len >= (ssize_t) strlen(EOS) && !memcmp(c_bits, EOS, strlen(EOS)))) // Detect End of Stream.
+            break;
+
+        struct opus_packet packet;
+        if (!parse_opus_packet(&packet, c_bits, c_bits_len))
+            continue;
+
+        /* Retransmissions are late on purpose, they would only inflate the jitter. */
+        if (!(packet.flags & PACKET_FLAG_RETRANSMIT)) {
+            update_jitter(&jitter, &previous_transit, frame_duration, packet.sequence, arrival_time);
+            atomic_store_explicit(&client->stats.jitter, (unsigned long) jitter, memory_order_relaxed);
+        }
+
+        for (int n = 0; n < packet.frame_count; n++) {
+            uint32_t missing = insert_frame(playout_buffer, packet.sequence + n, packet.frames[n],
+                                            packet.frame_len[n], packet.flags & PACKET_FLAG_RETRANSMIT);
+
+            /* Only frames that can still arrive before their turn to play are worth requesting. */
+            if (missing > (uint32_t) playout_buffer->delay)
+                missing = (uint32_t) playout_buffer->delay;
+            if (missing > 0 && !replaying)
+                request_retransmission(&client->server_socket_info, packet.sequence + n - missing, missing);
+            trace_end(TRACE_RECEIVE, packet.sequence + n, trace_start);
+        }
+
+        PlayoutSlot *slot;
+        bool played = false;
+        while (pop_frame(playout_buffer, false, &slot)) {
+            if (play_frame(opus_player, slot, playout_buffer->next - 1) < 0) {
+                client->failed = true;
+                break;
             }
+            played = true;
         }
-    }
-    return NULL;
-}
+        if (client->failed)
+            break;
 
-int ra_client(int argc, char **argv) {
-    signal(SIGALRM, &client_signal_timer);
-    struct stream_info pStreamInfo;
-    struct sockaddr_in server_addr;
-    int port;
-
-    if (argc < 3 || (strcmp(argv[2], "help") == 0)) {
-        puts("");
-        printf("Usage: %s --client <Server Address> [Port]\n\n", argv[0]);
-        puts("<Server Address>: The IP or address of the server to which you want to connect.");
-        puts("[Port]: The port on the server to which you want to connect.");
-        puts("");
-        return 0;
+        /*
+         * When the last frame will be heard against its place in the server's stream. Taken after the write,
+         * so the time a full output blocked it counts too. It creeps when the clocks drift apart.
+         */
+        if (client->drift_compensation && played) {
+            int64_t now = client_time();
+            double delay = (double) (now - (int64_t) (playout_buffer->next - 1) * frame_duration) +
+                           queued_output(opus_player, client->output_rate);
+            set_resample_ratio(&client->resampler, update_drift_compensator(&client->drift, now, delay));
+            atomic_store_explicit(&client->stats.drift, client->drift.ratio, memory_order_relaxed);
+        }
+
+        store_playout_stats(&client->stats, playout_buffer);
     }
 
-    if (argc < 4)
-        port = 3845;
-    else
-        port = (int) strtol(argv[3], NULL, 10);
+    /* Play the frames still held back. */
+    PlayoutSlot *slot;
+    while (!client->failed && pop_frame(playout_buffer, true, &slot))
+        if (play_frame(opus_player, slot, playout_buffer->next - 1) < 0)
+            break;
 
-    alarm(2); // Start time-out alarm.
-    int sock_fd = client_init_socket(argv[2], port, &server_addr);
-    int socket_len = sizeof(server_addr);
+    store_playout_stats(&client->stats, playout_buffer);
+    if (replaying)
+        client->source.replay_time = client_time() - client->source.replay_start;
 
-    struct server_socket_info server_socket_info;
-    server_socket_info.sock_fd = sock_fd;
-    server_socket_info.server_addr = &server_addr;
-    server_socket_info.socket_len = &socket_len;
+    client->config.output.close(client->config.output.user_data);
+    client->output_open = false;
+    return NULL;
+}
 
-    uint32_t orig_pcm_size = ready_sock_client_seq1(&pStreamInfo, &server_socket_info);
+void init_ra_client_config(RaClientConfig *config) {
+    memset(config, 0, sizeof(RaClientConfig));
+    config->port = RA_DEFAULT_PORT;
+    config->aggregated_frames = 1;
+    config->retransmit_delay = -1;
+    config->drift_compensation = true;
+}
 
-    struct chacha20_context ctx;
-    unsigned char *crypto_payload = ready_sock_client_seq2(&server_socket_info);
+/* Nothing is connected or opened until the client is started. */
+RaClient *create_ra_client(const RaClientConfig *config) {
+    if (config->address == NULL && config->replay_path == NULL) {
+        printf("Error: The client has neither a server nor a capture to play.\n");
+        return NULL;
+    }
+    if (config->output.open == NULL || config->output.write == NULL || config->output.close == NULL) {
+        printf("Error: The client has no output.\n");
+        return NULL;
+    }
+    if (config->aggregated_frames < 1 || config->aggregated_frames > MAX_AGGREGATED_FRAMES) {
+        printf("Invalid argument: Aggregated frames must be between 1 and %d.\n", MAX_AGGREGATED_FRAMES);
+        return NULL;
+    }
+
+    struct ra_client *client = calloc(1, sizeof(struct ra_client));
+    client->config = *config;
+    client->sock_fd = -1;
+    client->socket_len = sizeof(client->server_addr);
+    client->source.sock_fd = -1;
+    client->source.fast = config->fast_replay;
+    atomic_init(&client->volume, config->volume);
+    atomic_init(&client->stats.drift, 1.0);
+    atomic_init(&client->stopping, false);
+    return client;
+}
+
+/* Receives the stream's format from the server or the capture, and opens the capture to record to. */
+static bool prepare_stream(struct ra_client *client) {
+    struct stream_info *stream_info = &client->stream_info;
+    CaptureHeader capture_header;
+    client->retransmit_delay = client->config.retransmit_delay;
+
+    if (client->config.replay_path != NULL) {
+        /* The capture stands in for the server, there is nobody to answer a heartbeat or a retransmission request. */
+        if (!open_replay(&client->replay, client->config.replay_path, &capture_header)) {
+            printf("Error: Failed to open the capture %s.\n", client->config.replay_path);
+            return false;
+        }
+        client->source.replay = &client->replay;
+        stream_info->channels = (int16_t) capture_header.channels;
+        stream_info->sample_rate = (int32_t) capture_header.sample_rate;
+        stream_info->bits_per_sample = (int16_t) capture_header.bits_per_sample;
+        stream_info->frame_duration = (int32_t) capture_header.frame_duration;
+        client->pcm_size = capture_header.pcm_size;
+        memcpy(client->crypto_payload, capture_header.crypto_payload, sizeof(client->crypto_payload));
+        if (client->retransmit_delay < 0)
+            client->retransmit_delay = capture_header.retransmit_delay / 1000.0;
+    } else {
+        if ((client->sock_fd = client_init_socket(client->config.address, client->config.port,
+                                                  &client->server_addr)) < 0)
+            return false;
+        set_receive_timeout(client->sock_fd, HANDSHAKE_TIMEOUT);
+
+        client->server_socket_info.sock_fd = client->sock_fd;
+        client->server_socket_info.server_addr = &client->server_addr;
+        client->server_socket_info.socket_len = &client->socket_len;
+
+        if (!ready_sock_client_seq1(stream_info, &client->server_socket_info, client->config.aggregated_frames,
+                                    &client->pcm_size) ||
+            !ready_sock_client_seq2(&client->server_socket_info, client->crypto_payload)) {
+            printf("Error: Connection timed out.\n");
+            return false;
+        }
+        set_receive_timeout(client->sock_fd, RECEIVE_TIMEOUT);
+    }
+    if (client->retransmit_delay < 0)
+        client->retransmit_delay = 0;
+
+    client->source.sock_fd = client->sock_fd;
+    if (client->config.capture_path != NULL) {
+        capture_header.channels = (uint16_t) stream_info->channels;
+        capture_header.sample_rate = (uint32_t) stream_info->sample_rate;
+        capture_header.bits_per_sample = (uint16_t) stream_info->bits_per_sample;
+        capture_header.frame_duration = (uint32_t) stream_info->frame_duration;
+        capture_header.pcm_size = client->pcm_size;
+        capture_header.retransmit_delay = (uint32_t) (client->retransmit_delay * 1000);
+        memcpy(capture_header.crypto_payload, client->crypto_payload, sizeof(capture_header.crypto_payload));
+        if (!open_capture(&client->capture, client->config.capture_path, &capture_header)) {
+            printf("Error: Failed to open the capture %s: %s\n", client->config.capture_path, strerror(errno));
+            return false;
+        }
+        client->source.capture = &client->capture;
+    }
 
     printf("Received audio info: \n");
-    printf("Channels: %hd\n", pStreamInfo.channels);
-    printf("Sample rate: %d\n", pStreamInfo.sample_rate);
-    printf("Bit per sample: %hd\n", pStreamInfo.bits_per_sample);
-    if (orig_pcm_size == 0)
+    printf("Channels: %hd\n", stream_info->channels);
+    printf("Sample rate: %d\n", stream_info->sample_rate);
+    printf("Bit per sample: %hd\n", stream_info->bits_per_sample);
+    printf("Frame duration: %.1fms, Packets per second: %.0f\n", stream_info->frame_duration / 1000.0,
+           1000000.0 / stream_info->frame_duration);
+    if (client->pcm_size == 0)
         printf("PCM data length: STDIN\n\n");
     else
-        printf("PCM data length: %u\n\n", orig_pcm_size);
+        printf("PCM data length: %u\n\n", client->pcm_size);
     fflush(stdout);
+    return true;
+}
 
-    PaStreamParameters outputParameters;
-    PaStream *stream;
+/* Opens the output, and the decoder and the resampler which bring the stream to it. */
+static bool prepare_playback(struct ra_client *client) {
+    const struct stream_info *stream_info = &client->stream_info;
+    RaOutput *output = &client->config.output;
     int err;
 
-    outputParameters.device = Pa_GetDefaultOutputDevice(); /* Get default output device */
-    if (outputParameters.device == paNoDevice) {
-        printf("Error: No default output device.\n");
-        return EXIT_FAILURE;
-    }
-
-    outputParameters.channelCount = pStreamInfo.channels;
-    outputParameters.sampleFormat = paInt16; /* 16 bit integer output */
-    outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
-    outputParameters.hostApiSpecificStreamInfo = NULL;
-
-    Pa_OpenStream(
-            &stream,
-            NULL, /* no input */
-            &outputParameters,
-            (double) pStreamInfo.sample_rate,
-            paFramesPerBufferUnspecified,
-            paClipOff, /* we won't output out of range samples so don't bother clipping them */
-            NULL, /* no callback, use blocking I/O */
-            NULL);
-
-    OpusDecoder *decoder; /* Create a new decoder state */
-    decoder = opus_decoder_create(pStreamInfo.sample_rate, pStreamInfo.channels, &err);
+    bool float_output = false;
+    client->output_rate = stream_info->sample_rate;
+    if (!output->open(output->user_data, stream_info->channels, stream_info->sample_rate, &client->output_rate,
+                      &float_output))
+        return false;
+    client->output_open = true;
+
+    const int decode_rate = decoder_rate(client->output_rate, stream_info->sample_rate);
+    if (decode_rate != stream_info->sample_rate)
+        printf("Decoding at %dHz\n", decode_rate);
+    client->decoder = opus_decoder_create(decode_rate, stream_info->channels, &err); /* Create a new decoder state */
     if (err < 0) {
         printf("Error: failed to create an decoder - %s\n", opus_strerror(err));
-        return EXIT_FAILURE;
+        client->decoder = NULL;
+        return false;
     }
 
-    printf("Preparing socket sequence has been Successfully Completed.");
-    printf("\nStarted Playing Opus Packets...\n");
-    fflush(stdout);
-
-    EOS = 0;
-    double volume = 0.5;
-
-    pthread_t info_printer;
-    pthread_t heartbeat_sender;
-    pthread_t volume_controller;
-
-    pthread_create(&info_printer, NULL, print_info, (void *) &volume); // Activate info printer.
-    pthread_create(&heartbeat_sender, NULL, send_heartbeat, (void *) &server_socket_info); // Activate heartbeat sender.
-    pthread_create(&volume_controller, NULL, control_volume, (void *) &volume); // Activate volume controller.
+    const int max_frame_size = (int) ((int64_t) decode_rate * MAX_FRAME_DURATION / 1000000);
+    struct opus_player *opus_player = &client->opus_player;
+    opus_player->decoder = client->decoder;
+    opus_player->output = *output;
+    opus_player->float_output = float_output;
+    opus_player->resampler = NULL;
+    opus_player->crypto_payload = client->crypto_payload;
+    opus_player->channels = stream_info->channels;
+    opus_player->max_frame_size = max_frame_size;
+    opus_player->last_frame_size = (int) ((int64_t) decode_rate * stream_info->frame_duration / 1000000);
+    opus_player->volume = &client->volume;
+    opus_player->gain = volume_gain(atomic_load(&client->volume));
+    opus_player->stats = &client->stats;
+
+    /* Only an output with a clock of its own, a sound card or a simulated one, can drift from the server's. */
+    init_drift_compensator(&client->drift);
+    client->drift_compensation = client->config.drift_compensation && output->queued != NULL;
+    if (client->drift_compensation || decode_rate != client->output_rate) {
+        if (!init_variable_resampler(&client->resampler, (uint32_t) decode_rate, (uint32_t) client->output_rate,
+                                     stream_info->channels, max_frame_size)) {
+            printf("Error: failed to create the resampler to %dHz.\n", client->output_rate);
+            return false;
+        }
+        opus_player->resampler = &client->resampler;
+    }
 
-    Pa_StartStream(stream);
-    while (1) {
-        alarm(1); // reset alarm every second.
-        unsigned char c_bits[DWORD + sizeof(OPUS_FLAG) + FRAME_SIZE];
+    /* Hold back enough frames to cover the retransmission delay. */
+    client->playout_buffer = malloc(sizeof(PlayoutBuffer));
+    init_playout_buffer(client->playout_buffer, (int) ceil(client->retransmit_delay * 1000 / stream_info->frame_duration));
+    return true;
+}
 
-        opus_int16 out[FRAME_SIZE * pStreamInfo.channels];
-        unsigned char pcm_bytes[FRAME_SIZE * pStreamInfo.channels * WORD];
+/* Connects to the server, or opens the capture, and starts playing. Returns false if the stream can't be played. */
+bool start_ra_client(RaClient *client) {
+    if (client->started || !prepare_stream(client) || !prepare_playback(client))
+        return false;
 
-        recvfrom(sock_fd, c_bits, sizeof(c_bits), 0, NULL, NULL);
-        if (EOS || (c_bits[0] == 'E' && c_bits[1] == 'O' && c_bits[2] == 'S')) { // Detect End of Stream.
-            EOS = 1;
-            break;
-        }
+    printf("Preparing socket sequence has been Successfully Completed.");
+    printf("\nStarted Playing Opus Packets...\n");
+    fflush(stdout);
 
-        // Calculate opus frame offset.
-        long unsigned int idx = 0;
-        for (long unsigned int i = 0; i < sizeof(c_bits); i++) { // 'OPUS' indicates for Start of opus stream.
-            if (c_bits[i] == 'O' && c_bits[i + 1] == 'P' && c_bits[i + 2] == 'U' && c_bits[i + 3] == 'S') {
-                idx = i - 1;
-                break;
+    if (client->config.replay_path == NULL) {
+        if (client->config.ticker != NULL)
+            client->ticker = client->config.ticker;
+        else {
+            struct realtime_config realtime = {0};
+            client->ticker = malloc(sizeof(Ticker));
+            if (!start_ticker(client->ticker, &realtime)) {
+                printf("Error: Failed to start the heartbeat sender.\n");
+                free(client->ticker);
+                client->ticker = NULL;
+                return false;
             }
+            client->own_ticker = true;
         }
 
-        char str_nbBytes[idx + 2];
-        for (long unsigned int i = 0; i <= idx + 1; i++) {
-            if (i == (idx + 1))
-                str_nbBytes[i] = '\0';
-            else
-                str_nbBytes[i] = (char) c_bits[i];
-        }
-        long nbBytes = strtol(str_nbBytes, NULL, 10);
-
-        /* Decrypt the frame. */
-        chacha20_init_context(&ctx, crypto_payload, crypto_payload + CHACHA20_NONCEBYTES, 0);
-        chacha20_xor(&ctx, c_bits + idx + 5, nbBytes);
+        // Activate heartbeat sender.
+        send_heartbeat(client, 0, 0);
+        add_ticker_job(client->ticker, &client->heartbeat_job, HEARTBEAT_INTERVAL, send_heartbeat, client);
+    }
 
-        /* Decode the frame. */
-        int frame_size = opus_decode(decoder, (unsigned char *) c_bits + idx + 5, (opus_int32) nbBytes, out,
-                                     FRAME_SIZE, 0);
-        if (frame_size < 0) {
-            printf("Error: Opus decoder failed - %s\n", opus_strerror(frame_size));
-            return EXIT_FAILURE;
-        }
+    pthread_create(&client->receiver, NULL, receive_stream, client);
+    client->started = true;
+    return true;
+}
 
-        /* Convert to little-endian ordering. */
-        for (int i = 0; i < pStreamInfo.channels * frame_size; i++) {
-            out[i] = (opus_int16) round(out[i] - (out[i] * volume));
+/* Ends playback within a receive timeout, from any thread. */
+void stop_ra_client(RaClient *client) {
+    atomic_store(&client->stopping, true);
+}
 
-            pcm_bytes[2 * i] = out[i] & 0xFF;
-            pcm_bytes[2 * i + 1] = (out[i] >> 8) & 0xFF;
+/* Waits for the end of the stream, returns false if it ended on an error or the server went silent. */
+bool wait_ra_client(RaClient *client) {
+    if (!client->started || client->joined)
+        return !client->failed;
+
+    pthread_join(client->receiver, NULL);
+    if (client->ticker != NULL) {
+        remove_ticker_job(client->ticker, &client->heartbeat_job);
+        if (client->own_ticker) {
+            stop_ticker(client->ticker);
+            free(client->ticker);
+            client->own_ticker = false;
         }
-        Pa_WriteStream(stream, pcm_bytes, frame_size);
+        client->ticker = NULL;
+    }
+
+    client->joined = true;
+    return !client->failed;
+}
 
-        sum_frame_cnt++;
-        sum_frame_size += nbBytes;
+/* Stops the client first if it still plays. */
+void destroy_ra_client(RaClient *client) {
+    if (client == NULL)
+        return;
+    if (client->started && !client->joined) {
+        stop_ra_client(client);
+        wait_ra_client(client);
+    }
+    if (client->own_ticker) { // Started, but not the receiving thread.
+        stop_ticker(client->ticker);
+        free(client->ticker);
     }
-    Pa_StopStream(stream);
 
-    /* Wait for joining threads. */
-    pthread_join(info_printer, NULL);
-    pthread_join(heartbeat_sender, NULL);
-    pthread_join(volume_controller, NULL);
+    if (client->output_open)
+        client->config.output.close(client->config.output.user_data);
+    if (client->opus_player.resampler != NULL)
+        destroy_resampler(&client->resampler);
+    free(client->playout_buffer);
 
     /* Destroy the decoder state */
-    opus_decoder_destroy(decoder);
+    if (client->decoder != NULL)
+        opus_decoder_destroy(client->decoder);
+
+    if (client->source.replay != NULL)
+        close_capture(client->source.replay);
+    if (client->source.capture != NULL)
+        close_capture(client->source.capture);
+    if (client->sock_fd >= 0)
+        close(client->sock_fd);
+    free(client);
+}
+
+/* The volume is the part taken away, 0 keeps the samples and 1 mutes them. It ramps in over the next frame. */
+void set_ra_client_volume(RaClient *client, double volume) {
+    atomic_store_explicit(&client->volume, volume, memory_order_relaxed);
+}
 
-    /* Don't forget to clean up! */
-    Pa_CloseStream(stream);
-    Pa_Terminate();
-    return 0;
+void get_ra_client_stats(RaClient *client, RaClientStats *stats) {
+    stats->frame_duration = (uint32_t) client->stream_info.frame_duration;
+    stats->played_frames = atomic_load_explicit(&client->stats.played_frames, memory_order_relaxed);
+    stats->received_bytes = atomic_load_explicit(&client->stats.received_bytes, memory_order_relaxed);
+    stats->lost_frames = atomic_load_explicit(&client->stats.lost_frames, memory_order_relaxed);
+    stats->recovered_frames = atomic_load_explicit(&client->stats.recovered_frames, memory_order_relaxed);
+    stats->concealed_frames = atomic_load_explicit(&client->stats.concealed_frames, memory_order_relaxed);
+    stats->late_frames = atomic_load_explicit(&client->stats.late_frames, memory_order_relaxed);
+    stats->dtx_frames = atomic_load_explicit(&client->stats.dtx_frames, memory_order_relaxed);
+
+    stats->drift_compensated = client->drift_compensation;
+    stats->drift = (atomic_load_explicit(&client->stats.drift, memory_order_relaxed) - 1) * 1000000;
+
+    /* The replay's progress belongs to the receiving thread, it's only complete once the client was waited for. */
+    stats->replayed_datagrams = client->source.replay != NULL ? client->source.datagrams : 0;
+    stats->replay_time = (double) client->source.replay_time / 1000000;
 }
@@ -21,17 +21,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <string.h>
 #include <math.h>
-#include <termios.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <netdb.h>
-#include <signal.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <opus/opus.h>
-#include <portaudio.h>
+
+#include "raplayer.h"
+#include "packet/packet.h"
+#include "playout_buffer/playout_buffer.h"
 
 #ifndef RAPLAYER_RA_CLIENT_H
 #define RAPLAYER_RA_CLIENT_H
@@ -43,11 +47,20 @@
 #define HELLO "HELLO"
 #define OK "OK"
 
-#define OPUS_FLAG "OPUS"
 #define HEARTBEAT "HEARTBEAT"
+#define HEARTBEAT_REPORT_SIZE 128 // Quality report following the heartbeat.
+#define HEARTBEAT_INTERVAL 250000000 // Nanoseconds.
+
+#define EOS "EOS"
+
+#define HANDSHAKE_TIMEOUT 2000000 // Microseconds the server has to answer each step of the handshake.
+#define RECEIVE_TIMEOUT 100000 // Microseconds a receive waits, which bounds how long a stop takes.
+#define SERVER_TIMEOUT 1000000 // Microseconds of silence after which the server is taken as gone.
 
-#define FRAME_SIZE 960
+#define DEFAULT_FRAME_DURATION 20000 // Opus frame duration in microseconds.
+#define MAX_FRAME_DURATION 60000
+#define MAX_DATA_SIZE 4096
 
-int ra_client(int argc, char **argv);
+int64_t client_time(void);
 
 #endif
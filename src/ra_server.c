@@ -21,8 +21,15 @@
 #include "chacha20/chacha20.h"
 #include "task_scheduler/task_scheduler.h"
 #include "task_dispatcher/task_dispatcher.h"
+#include "metrics/metrics.h"
+#include "tracer/tracer.h"
+#include "dsp/dsp.h"
 
-bool is_EOS = false;
+static const struct stream_profile stream_profiles[] = {
+        {"low-latency",     5000,                   OPUS_APPLICATION_RESTRICTED_LOWDELAY},
+        {"default",         DEFAULT_FRAME_DURATION, OPUS_APPLICATION_AUDIO},
+        {"bandwidth-saver", MAX_FRAME_DURATION,     OPUS_APPLICATION_AUDIO},
+};
 
 void cleanup(int argc, ...) {
     va_list args;
@@ -33,69 +40,60 @@ void cleanup(int argc, ...) {
 
 }
 
-void init_pcm_structure(FILE *fin, struct pcm *pPcm, fpos_t *before_data_pos) {
-    fread(pPcm->pcmHeader.chunk_id, DWORD, 1, fin);
-    fread(&pPcm->pcmHeader.chunk_size, DWORD, 1, fin);
-    fread(pPcm->pcmHeader.format, DWORD, 1, fin);
-
-    fread(pPcm->pcmFmtChunk.chunk_id, DWORD, 1, fin);
-    fread(&pPcm->pcmFmtChunk.chunk_size, DWORD, 1, fin);
-    fread(&pPcm->pcmFmtChunk.audio_format, WORD, 1, fin);
-    fread(&pPcm->pcmFmtChunk.channels, WORD, 1, fin);
-    fread(&pPcm->pcmFmtChunk.sample_rate, DWORD, 1, fin);
-    fread(&pPcm->pcmFmtChunk.byte_rate, DWORD, 1, fin);
-    fread(&pPcm->pcmFmtChunk.block_align, WORD, 1, fin);
-    fread(&pPcm->pcmFmtChunk.bits_per_sample, WORD, 1, fin);
-
-    char tmpBytes[BYTE] = {};
-    while (1) {
-        if (feof(fin)) { // End Of File.
-            printf("Error: The data chunk of the file not found.\n");
-            exit(EXIT_FAILURE);
-        }
-
-        if (fread(tmpBytes, BYTE, 1, fin) && tmpBytes[0] == 'd')
-            if (fread(tmpBytes, BYTE, 1, fin) && tmpBytes[0] == 'a')
-                if (fread(tmpBytes, BYTE, 1, fin) && tmpBytes[0] == 't')
-                    if (fread(tmpBytes, BYTE, 1, fin) && tmpBytes[0] == 'a')  // A PCM *d a t a* signature.
-                        break;
-    }
-
-    strcpy(pPcm->pcmDataChunk.chunk_id, tmpBytes);
-    fread(&pPcm->pcmDataChunk.chunk_size, DWORD, 1, fin);
-
-    fgetpos(fin, before_data_pos); // Save begin of pcm data position.
-
-    long pcm_data_size = pPcm->pcmDataChunk.chunk_size;
-    pPcm->pcmDataChunk.data = malloc(pcm_data_size);
-    fread(pPcm->pcmDataChunk.data, pcm_data_size, 1, fin);
+const struct stream_profile *find_stream_profile(const char *name) {
+    for (size_t i = 0; i < sizeof(stream_profiles) / sizeof(stream_profiles[0]); i++)
+        if (!strcmp(stream_profiles[i].name, name))
+            return &stream_profiles[i];
+    return NULL;
 }
 
-void *consume_until_connection(void *p_stream_consumer_args) {
-    void **stream_consumer_args = p_stream_consumer_args;
-    unsigned char unused_buffer[WORD * WORD * FRAME_SIZE];
-
-    while (!(*(bool *) (stream_consumer_args[1]))) {
-        pthread_mutex_lock((pthread_mutex_t *) (stream_consumer_args[2]));
-        pthread_cond_wait((pthread_cond_t *) (stream_consumer_args[3]), (pthread_mutex_t *) (stream_consumer_args[2]));
-        pthread_mutex_unlock((pthread_mutex_t *) (stream_consumer_args[2]));
-
-        fread(&unused_buffer, DWORD, FRAME_SIZE, stream_consumer_args[0]);
+/* Opus only encodes frames of these durations, in microseconds. */
+bool supported_frame_duration(uint32_t frame_duration) {
+    switch (frame_duration) {
+        case 2500:
+        case 5000:
+        case 10000:
+        case 20000:
+        case 40000:
+        case 60000:
+            return true;
+        default:
+            return false;
     }
-    free(stream_consumer_args);
-    return NULL;
 }
 
-int server_init_socket(const struct sockaddr_in *p_server_addr, int port) {
+int server_init_socket(const struct sockaddr_in *p_server_addr, int port, bool reuse_port) {
     struct sockaddr_in server_addr = *p_server_addr;
     int sock_fd;
 
     // Creating socket file descriptor.
     if ((sock_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
         printf("Error: Socket Creation Failed.\n");
-        exit(EXIT_FAILURE);
+        return -1;
     }
 
+    /* Every ingress shard binds its own socket to the port, the kernel keeps each client flow on one of them. */
+    if (reuse_port) {
+#ifdef SO_REUSEPORT
+        int enable = 1;
+        if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+            printf("Error: Failed to set SO_REUSEPORT on the socket.\n");
+            close(sock_fd);
+            return -1;
+        }
+#else
+        printf("Error: Multiple ingress shards are not supported on this platform.\n");
+        close(sock_fd);
+        return -1;
+#endif
+    }
+
+#ifdef SO_RXQ_OVFL
+    /* Have the kernel report the datagrams dropped on a full receive buffer. */
+    int enable_overflow = 1;
+    setsockopt(sock_fd, SOL_SOCKET, SO_RXQ_OVFL, &enable_overflow, sizeof(enable_overflow));
+#endif
+
     memset((char *) &server_addr, 0, sizeof(server_addr));
 
     server_addr.sin_family = AF_INET; // IPv4
@@ -105,29 +103,49 @@ int server_init_socket(const struct sockaddr_in *p_server_addr, int port) {
     /* Bind the socket with the server address. */
     if (bind(sock_fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
         printf("Error: Socket Bind Failed.\n");
-        exit(EXIT_FAILURE);
+        close(sock_fd);
+        return -1;
     }
 
     return sock_fd;
 }
 
+/* Client options follow the HELLO string as "key=value" pairs separated by spaces. */
+void parse_hello_options(Client *client, const char *options, size_t options_len) {
+    char str_options[options_len + 1];
+    memcpy(str_options, options, options_len);
+    str_options[options_len] = '\0';
+
+    for (char *option = strtok(str_options, " "); option != NULL; option = strtok(NULL, " ")) {
+        if (!strncmp(option, "aggregate=", strlen("aggregate="))) {
+            long aggregated_frames = strtol(option + strlen("aggregate="), NULL, 10);
+            client->aggregated_frames = (unsigned int) (aggregated_frames < 1 ? 1 :
+                                                        aggregated_frames > MAX_AGGREGATED_FRAMES ? MAX_AGGREGATED_FRAMES :
+                                                        aggregated_frames);
+        }
+    }
+}
+
 bool ready_sock_server_seq1(TaskQueue *recv_queue) {
     Task task = recvfrom_queue(recv_queue);
-    if (strncmp(task.buffer, "HELLO", task.buffer_len) == 0)
-        return true;
-    else
+    if (task.buffer_len < (ssize_t) sizeof(HELLO) || strncmp(task.buffer, HELLO, sizeof(HELLO)) != 0)
         return false;
+
+    parse_hello_options(recv_queue->queue_info->client, task.buffer + sizeof(HELLO),
+                        task.buffer_len - sizeof(HELLO));
+    return true;
 }
 
-bool ready_sock_server_seq2(TaskQueue *recv_queue, struct pcm pcm_struct) {
+bool ready_sock_server_seq2(TaskQueue *recv_queue, struct pcm pcm_struct, uint32_t frame_duration) {
 
-    int stream_info_size = DWORD + WORD * 2;
+    int stream_info_size = DWORD + WORD * 2 + DWORD;
     int buffer_size = 5;
 
     char stream_info[stream_info_size];
     memcpy(stream_info, &pcm_struct.pcmFmtChunk.channels, WORD);
     memcpy((stream_info + WORD), &pcm_struct.pcmFmtChunk.sample_rate, DWORD);
     memcpy((stream_info + WORD + DWORD), &pcm_struct.pcmFmtChunk.bits_per_sample, WORD);
+    memcpy((stream_info + WORD * 2 + DWORD), &frame_duration, DWORD);
 
     char *buffer = calloc(buffer_size, BYTE);
 
@@ -177,426 +195,851 @@ ready_sock_server_seq3(TaskQueue *recv_queue, const unsigned char *crypto_payloa
 }
 
 
+/* Waits for a tick of the frame clock, returns at once for a tick that came while the frame was being built. */
+static void wait_tick(struct opus_builder_args *opus_builder_args) {
+    pthread_mutex_lock(opus_builder_args->opus_builder_mutex);
+    while (*opus_builder_args->pending_ticks == 0)
+        pthread_cond_wait(opus_builder_args->opus_builder_cond, opus_builder_args->opus_builder_mutex);
+    (*opus_builder_args->pending_ticks)--;
+    pthread_mutex_unlock(opus_builder_args->opus_builder_mutex);
+}
+
+/* Returns false if the server stops before its first client. */
+static bool wait_first_client(struct opus_builder_args *opus_builder_args) {
+    pthread_mutex_lock(opus_builder_args->complete_init_client_mutex);
+    while (!atomic_load(opus_builder_args->listening) && !atomic_load(opus_builder_args->stopping))
+        pthread_cond_wait(opus_builder_args->complete_init_client_cond, opus_builder_args->complete_init_client_mutex);
+    pthread_mutex_unlock(opus_builder_args->complete_init_client_mutex);
+
+    /* The clock ran without anyone to stream to, the first frame waits for the next tick. */
+    pthread_mutex_lock(opus_builder_args->opus_builder_mutex);
+    *opus_builder_args->pending_ticks = 0;
+    pthread_mutex_unlock(opus_builder_args->opus_builder_mutex);
+    return !atomic_load(opus_builder_args->stopping);
+}
+
 void *provide_20ms_opus_builder(void *p_opus_builder_args) {
     struct opus_builder_args *opus_builder_args = (struct opus_builder_args *) p_opus_builder_args;
 
-    opus_int16 in[FRAME_SIZE * opus_builder_args->pcm_struct->pcmFmtChunk.channels];
-    unsigned char c_bits[FRAME_SIZE];
+    const int frame_size = opus_builder_args->frame_size;
+    opus_int16 in[frame_size * opus_builder_args->pcm_struct->pcmFmtChunk.channels];
+    unsigned char c_bits[MAX_PACKET_SIZE];
+    unsigned char buffer[MAX_DATA_SIZE];
+    uint32_t sequence = 0;
     struct chacha20_context ctx;
+    int64_t first_publish_time = 0;
 
-    while (1) {
-        unsigned char pcm_bytes[FRAME_SIZE * opus_builder_args->pcm_struct->pcmFmtChunk.channels * WORD];
+    enter_realtime(opus_builder_args->realtime, "opus builder", 1, REALTIME_PRIORITY);
+    trace_thread("opus builder");
 
-        /* Read a 16 bits/sample audio frame. */
-        fread(pcm_bytes, WORD * opus_builder_args->pcm_struct->pcmFmtChunk.channels, FRAME_SIZE,
-              opus_builder_args->fin);
-        if (feof(opus_builder_args->fin)) // End Of Stream.
+    bool streaming = wait_first_client(opus_builder_args);
+    while (streaming && !atomic_load(opus_builder_args->stopping)) {
+        /* Read a 16 bits/sample audio frame in the stream format. */
+        int64_t trace_start = trace_begin();
+        if (!opus_builder_args->input.read(opus_builder_args->input.user_data, in, frame_size)) // End Of Stream.
             break;
-
-        /* Convert from little-endian ordering. */
-        for (int i = 0; i < opus_builder_args->pcm_struct->pcmFmtChunk.channels * FRAME_SIZE; i++)
-            in[i] = (opus_int16) (pcm_bytes[2 * i + 1] << 8 | pcm_bytes[2 * i]);
+        trace_end(TRACE_READ, sequence, trace_start);
 
         /* Encode the frame. */
-        int nbBytes = opus_encode(opus_builder_args->encoder, in, FRAME_SIZE, c_bits, FRAME_SIZE);
+        int64_t encode_start_time = get_monotonic_time();
+        int nbBytes = opus_encode(opus_builder_args->encoder, in, frame_size, c_bits, MAX_PACKET_SIZE);
         if (nbBytes < 0) {
             printf("Error: opus encode failed - %s\n", opus_strerror(nbBytes));
-            exit(EXIT_FAILURE);
+            opus_builder_args->failed = true;
+            break;
+        }
+        int64_t encode_time = get_monotonic_time() - encode_start_time;
+        record_lateness(&opus_builder_args->encode_time, encode_time);
+        atomic_fetch_add_explicit(&opus_builder_args->encoded_frames, 1, memory_order_relaxed);
+        trace_end(TRACE_ENCODE, sequence, encode_start_time);
+
+        /* Trade the complexity for speed before the encodes get close to the frame interval. */
+        const int complexity = atomic_load_explicit(&opus_builder_args->tuner.complexity, memory_order_relaxed);
+        const int next_complexity = tune_complexity(&opus_builder_args->tuner, encode_time);
+        if (next_complexity != complexity)
+            opus_encoder_ctl(opus_builder_args->encoder, OPUS_SET_COMPLEXITY(next_complexity));
+        if (next_complexity != complexity || sequence == 0)
+            trace_counter(TRACE_COMPLEXITY, sequence, next_complexity);
+
+        /* Packets of 2 bytes or less don't need to be transmitted, send an empty DTX frame instead. */
+        if (opus_builder_args->dtx && nbBytes <= 2) {
+            nbBytes = 0;
+            atomic_fetch_add_explicit(&opus_builder_args->dtx_frames, 1, memory_order_relaxed);
         }
 
         /* Encrypt the frame. */
+        trace_start = trace_begin();
         chacha20_init_context(&ctx, opus_builder_args->crypto_payload,
                               opus_builder_args->crypto_payload + CHACHA20_NONCEBYTES, 0);
         chacha20_xor(&ctx, c_bits, nbBytes);
+        trace_end(TRACE_ENCRYPT, sequence, trace_start);
 
         /* Create payload. */
-        const unsigned int nbBytes_len = (int) floor(log10(nbBytes) + 1);
-        char *buffer = calloc(nbBytes_len + sizeof(OPUS_FLAG) + nbBytes, WORD);
+        struct opus_packet packet = {0};
+        packet.frame_count = 1;
+        packet.sequence = sequence++;
+        packet.frame_len[0] = (uint16_t) nbBytes;
+        packet.frames[0] = c_bits;
+        size_t buffer_len = build_opus_packet(&packet, buffer, sizeof(buffer));
+
+        /* Waiting for the frame clock's tick. */
+        wait_tick(opus_builder_args);
+
+        /* Publish the frame, senders pick it up from the ring without blocking the builder. */
+        trace_start = trace_begin();
+        publish_frame(opus_builder_args->frame_ring, (char *) buffer, (ssize_t) buffer_len);
+        trace_end(TRACE_PUBLISH, packet.sequence, trace_start);
+
+        /* Measured against the first frame, ticks dropped after a stall show up as whole intervals late. */
+        int64_t publish_time = get_monotonic_time();
+        if (sequence == 1)
+            first_publish_time = publish_time;
+        record_lateness(&opus_builder_args->publish_lateness,
+                        publish_time - (first_publish_time + (int64_t) (sequence - 1) * opus_builder_args->interval));
+    }
+    close_frame_ring(opus_builder_args->frame_ring);
 
-        sprintf(buffer, "%d", nbBytes);
-        strcat(buffer, OPUS_FLAG);
-        memcpy(buffer + nbBytes_len + sizeof(OPUS_FLAG) - 1, c_bits, nbBytes);
+    if (opus_builder_args->dtx) {
+        printf("\nSuppressed %lu of %u frames with DTX.\n", atomic_load(&opus_builder_args->dtx_frames), sequence);
+        fflush(stdout);
+    }
+    return NULL;
+}
 
-        /* Waiting for opus timer's signal & Send audio frames. */
-        pthread_mutex_lock(opus_builder_args->opus_builder_mutex);
-        pthread_cond_wait(opus_builder_args->opus_builder_cond, opus_builder_args->opus_builder_mutex);
-        pthread_mutex_lock(opus_builder_args->opus_sender_mutex);
+/* Bundles consecutive single frame packets into one datagram, returns its length or 0 if they don't fit. */
+size_t bundle_opus_frames(const Task *const *opus_frames, int frame_count, unsigned char *buffer, size_t buffer_size) {
+    struct opus_packet packet = {0}, frame_packet;
+    packet.frame_count = (uint8_t) frame_count;
+
+    for (int i = 0; i < frame_count; i++) {
+        parse_opus_packet(&frame_packet, (const unsigned char *) opus_frames[i]->buffer, opus_frames[i]->buffer_len);
+        if (i == 0)
+            packet.sequence = frame_packet.sequence;
+        packet.frame_len[i] = frame_packet.frame_len[0];
+        packet.frames[i] = frame_packet.frames[0];
+    }
+    return build_opus_packet(&packet, buffer, buffer_size);
+}
 
-        memcpy(opus_builder_args->opus_frame->buffer, buffer, nbBytes_len + sizeof(OPUS_FLAG) + nbBytes);
-        cleanup(1, buffer);
-        opus_builder_args->opus_frame->buffer_len = (ssize_t) (nbBytes_len + sizeof(OPUS_FLAG) + nbBytes);
+struct opus_fanout {
+    FrameRing *frame_ring;
+
+    Task window[MAX_AGGREGATED_FRAMES]; // Latest frames of the current run of consecutive frames.
+    uint64_t run_end;
+    int run_len;
+
+    unsigned char bundles[MAX_AGGREGATED_FRAMES + 1][MAX_DATA_SIZE]; // Indexed by the number of bundled frames.
+    size_t bundle_lens[MAX_AGGREGATED_FRAMES + 1];
+    bool bundle_built[MAX_AGGREGATED_FRAMES + 1];
+
+    struct fanout_client {
+        TaskQueue *recv_queue; // Held until the client times out or the stream ends.
+        TaskQueueInfo *queue_info;
+        int pending_frames; // Frames of the current run not sent to this client yet.
+    } *clients;
+    int clients_count;
+
+    NetMessage *messages;
+    int messages_count;
+};
+
+static void queue_datagram(struct opus_fanout *fanout, TaskQueueInfo *queue_info, const void *buffer,
+                           size_t buffer_len) {
+    NetMessage *message = &fanout->messages[fanout->messages_count++];
+    message->sock_fd = queue_info->sock_fd;
+    message->buffer = buffer;
+    message->buffer_len = buffer_len;
+    message->addr = &queue_info->client->client_addr;
+    message->addr_len = queue_info->client->socket_len;
+    message->launch_time = 0;
+
+    atomic_fetch_add_explicit(&queue_info->sent_datagrams, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&queue_info->sent_bytes, buffer_len, memory_order_relaxed);
+}
+
+/* Queues the client's pending frames, bundles are built once per frame count and shared by every client. */
+static void queue_pending_frames(struct opus_fanout *fanout, struct fanout_client *client) {
+    const int frame_count = client->pending_frames;
+    const Task *opus_frames[MAX_AGGREGATED_FRAMES];
+    client->pending_frames = 0;
+
+    for (int i = 0; i < frame_count; i++)
+        opus_frames[i] = &fanout->window[(fanout->run_end - (uint64_t) (frame_count - 1 - i)) % MAX_AGGREGATED_FRAMES];
 
-        pthread_mutex_unlock(opus_builder_args->opus_sender_mutex);
-        pthread_cond_broadcast(opus_builder_args->opus_sender_cond);
-        pthread_mutex_unlock(opus_builder_args->opus_builder_mutex);
+    if (frame_count > 1 && !fanout->bundle_built[frame_count]) {
+        fanout->bundle_lens[frame_count] = bundle_opus_frames(opus_frames, frame_count, fanout->bundles[frame_count],
+                                                              sizeof(fanout->bundles[frame_count]));
+        fanout->bundle_built[frame_count] = true;
     }
-    is_EOS = true;
-    return NULL;
+
+    if (frame_count > 1 && fanout->bundle_lens[frame_count] > 0)
+        queue_datagram(fanout, client->queue_info, fanout->bundles[frame_count], fanout->bundle_lens[frame_count]);
+    else
+        for (int i = 0; i < frame_count; i++)
+            queue_datagram(fanout, client->queue_info, opus_frames[i]->buffer, (size_t) opus_frames[i]->buffer_len);
 }
 
-void *provide_20ms_opus_sender(void *p_opus_sender_args) {
-    struct opus_sender_args *opus_sender_args = (struct opus_sender_args *) p_opus_sender_args;
+static void send_fanout(struct opus_fanout *fanout, Pacer *pacer, NetSender *sender) {
+    send_paced(pacer, sender, fanout->messages, fanout->messages_count);
+    fanout->messages_count = 0;
+    memset(fanout->bundle_built, 0, sizeof(fanout->bundle_built));
+}
 
-    while ((!is_EOS) && opus_sender_args->recv_queue->queue_info->heartbeat_status != -1) {
-        pthread_mutex_lock(opus_sender_args->opus_sender_mutex);
-        pthread_cond_wait(opus_sender_args->opus_sender_cond, opus_sender_args->opus_sender_mutex);
-        sendto(opus_sender_args->recv_queue->queue_info->sock_fd, opus_sender_args->opus_frame->buffer,
-               opus_sender_args->opus_frame->buffer_len, 0,
-               (struct sockaddr *) &opus_sender_args->recv_queue->queue_info->client->client_addr,
-               opus_sender_args->recv_queue->queue_info->client->socket_len);
-        pthread_mutex_unlock(opus_sender_args->opus_sender_mutex);
+static void flush_fanout(struct opus_fanout *fanout, Pacer *pacer, NetSender *sender) {
+    for (int i = 0; i < fanout->clients_count; i++) {
+        if (fanout->clients[i].pending_frames > 0)
+            queue_pending_frames(fanout, &fanout->clients[i]);
     }
-    return NULL;
+    send_fanout(fanout, pacer, sender);
 }
 
-void *provide_20ms_opus_timer(void *p_opus_builder_cond) {
-    struct timespec start_timespec;
-    clock_gettime(CLOCK_MONOTONIC, &start_timespec);
-    time_t start_time = (start_timespec.tv_sec * 1000000000L) + start_timespec.tv_nsec, time, offset = 0L, average = 0L;
+static void print_client_stats(const TaskQueueInfo *queue_info) {
+    unsigned long retransmitted_frames = atomic_load(&queue_info->retransmitted_frames);
+    unsigned long rate_limited_frames = atomic_load(&queue_info->rate_limited_frames);
+    if (retransmitted_frames > 0 || rate_limited_frames > 0) {
+        printf("\n%d: Retransmitted %lu frames, %lu requests over the retransmission budget\n",
+               queue_info->client->client_id, retransmitted_frames, rate_limited_frames);
+        fflush(stdout);
+    }
+}
 
-    while (!is_EOS) {
-        offset += 20000000L;
-        time = start_time + offset;
+/* Picks up the clients which completed the handshake, and drops the ones which timed out. */
+static void update_fanout_clients(struct opus_fanout *fanout, struct opus_sender_args *opus_sender_args) {
+    pthread_mutex_lock(&opus_sender_args->clients_mutex);
+    if (opus_sender_args->new_clients_count > 0) {
+        fanout->clients = realloc(fanout->clients, sizeof(struct fanout_client) *
+                                                   (fanout->clients_count + opus_sender_args->new_clients_count));
+        fanout->messages = realloc(fanout->messages, sizeof(NetMessage) * MAX_AGGREGATED_FRAMES *
+                                                     (fanout->clients_count + opus_sender_args->new_clients_count));
+
+        /* Kept in socket order, so the datagrams of each ingress shard are sent in one run. */
+        for (int i = 0; i < opus_sender_args->new_clients_count; i++) {
+            TaskQueue *recv_queue = opus_sender_args->new_clients[i];
+            TaskQueueInfo *queue_info = recv_queue->queue_info;
+            int position = fanout->clients_count++;
+            while (position > 0 && fanout->clients[position - 1].queue_info->sock_fd > queue_info->sock_fd) {
+                fanout->clients[position] = fanout->clients[position - 1];
+                position--;
+            }
+            fanout->clients[position].recv_queue = recv_queue;
+            fanout->clients[position].queue_info = queue_info;
+            fanout->clients[position].pending_frames = 0;
+        }
+        opus_sender_args->new_clients_count = 0;
+    }
+    pthread_mutex_unlock(&opus_sender_args->clients_mutex);
+
+    int alive_clients_count = 0;
+    for (int i = 0; i < fanout->clients_count; i++) {
+        if (atomic_load(&fanout->clients[i].queue_info->heartbeat_status) == -1) {
+            print_client_stats(fanout->clients[i].queue_info);
+            release_queue(fanout->clients[i].recv_queue);
+        } else
+            fanout->clients[alive_clients_count++] = fanout->clients[i];
+    }
+    fanout->clients_count = alive_clients_count;
+}
 
-        struct timespec current_time, calculated_delay;
-        clock_gettime(CLOCK_MONOTONIC, &current_time);
-        time -= ((current_time.tv_sec * 1000000000L) + current_time.tv_nsec);
+/* Sends every frame to all clients as one batch through the network backend. */
+void *provide_20ms_opus_sender(void *p_opus_sender_args) {
+    struct opus_sender_args *opus_sender_args = (struct opus_sender_args *) p_opus_sender_args;
+    struct opus_fanout *fanout = calloc(1, sizeof(struct opus_fanout));
+    fanout->frame_ring = opus_sender_args->frame_ring;
+    Pacer *pacer = &opus_sender_args->pacer;
+    NetSender *sender = &opus_sender_args->sender;
+    trace_thread("opus sender");
+
+    FrameCursor cursor;
+    Task opus_frame;
+    init_frame_cursor(fanout->frame_ring, &cursor);
+
+    while (wait_frame(fanout->frame_ring, &cursor)) {
+        update_fanout_clients(fanout, opus_sender_args);
+
+        while (read_frame(fanout->frame_ring, &cursor, &opus_frame)) {
+            const uint64_t frame_number = cursor.next - 1;
+
+            /* Only consecutive frames can share a datagram. */
+            if (fanout->run_len > 0 && frame_number != fanout->run_end + 1) {
+                flush_fanout(fanout, pacer, sender);
+                fanout->run_len = 0;
+            }
 
-        calculated_delay.tv_sec = ((time / 1000000000L) > 0 ? (time / 1000000000L) : 0);
-        calculated_delay.tv_nsec = ((time % 1000000000L) > 0 ? (time % 1000000000L) : average);
+            fanout->window[frame_number % MAX_AGGREGATED_FRAMES] = opus_frame;
+            fanout->run_end = frame_number;
+            if (fanout->run_len < MAX_AGGREGATED_FRAMES)
+                fanout->run_len++;
 
-        /* Calculates the time average value for when the current time exceeds the calculated time. */
-        average = (average == 0L ? ((time % 1000000000L) > 0 ? (time % 1000000000L) : average)
-                : ((time % 1000000000L) > 0 ? ((time % 1000000000L) + average) / 2 : average));
+            int64_t trace_start = trace_begin();
+            for (int i = 0; i < fanout->clients_count; i++) {
+                if (++fanout->clients[i].pending_frames == (int) fanout->clients[i].queue_info->client->aggregated_frames)
+                    queue_pending_frames(fanout, &fanout->clients[i]);
+            }
+            send_fanout(fanout, pacer, sender);
+            if (tracing) {
+                struct opus_packet packet;
+                if (parse_opus_packet(&packet, (const unsigned char *) opus_frame.buffer, opus_frame.buffer_len))
+                    trace_end(TRACE_SEND, packet.sequence, trace_start);
+            }
+            atomic_fetch_add_explicit(&opus_sender_args->sent_frames, 1, memory_order_relaxed);
+        }
+        atomic_store_explicit(&opus_sender_args->skipped_frames, (unsigned long) cursor.skipped, memory_order_relaxed);
+    }
 
-        nanosleep(&calculated_delay, NULL);
-        pthread_cond_signal((pthread_cond_t *) p_opus_builder_cond);
+    flush_fanout(fanout, pacer, sender); // Incomplete bundles at the end of stream.
 
-        /* Adjusts the 20ms interval if the average value was used instead. */
-        if(calculated_delay.tv_nsec == average)
-            average -= 250000L;
+    for (int i = 0; i < fanout->clients_count; i++) {
+        print_client_stats(fanout->clients[i].queue_info);
+        release_queue(fanout->clients[i].recv_queue);
     }
+
+    if (cursor.skipped > 0)
+        printf("\nSkipped %llu frames while sending.", (unsigned long long) cursor.skipped);
+    unsigned long frames = atomic_load(&opus_sender_args->sent_frames);
+    unsigned long syscalls = atomic_load(&sender->syscalls);
+    printf("\nSent %lu datagrams in %lu system calls with %s, %.2f per frame.\n", atomic_load(&sender->sent_datagrams),
+           syscalls, net_backend_name(), frames > 0 ? (double) syscalls / (double) frames : 0.0);
+    fflush(stdout);
+    print_pacer_stats(pacer);
+
+    free(fanout->clients);
+    free(fanout->messages);
+    free(fanout);
     return NULL;
 }
 
-void *check_heartbeat(void *p_heartbeat_receiver_args) {
-    TaskQueue *recv_queue = (TaskQueue *) p_heartbeat_receiver_args;
-
-    struct timespec timespec;
-    timespec.tv_sec = 1;
-    timespec.tv_nsec = 0;
-
-    while (!is_EOS) {
-        recv_queue->queue_info->heartbeat_status = false;
-        nanosleep(&timespec, NULL);
-        if (!recv_queue->queue_info->heartbeat_status) {
-            printf("\n%d: Connection closed by %s:%d",
-                   recv_queue->queue_info->client->client_id, inet_ntoa(recv_queue->queue_info->client->client_addr.sin_addr),
-                   ntohs(recv_queue->queue_info->client->client_addr.sin_port));
-            printf("\nReceiving client heartbeat timed out.\n");
-            fflush(stdout);
-            recv_queue->queue_info->heartbeat_status = -1;
-            break;
+/* Ticks the frame clock on the ticker's thread, the builder publishes a frame on every tick. */
+static void tick_opus_timer(void *p_opus_timer_args, uint64_t tick, int64_t scheduled_time) {
+    struct opus_timer_args *opus_timer_args = (struct opus_timer_args *) p_opus_timer_args;
+
+    record_lateness(&opus_timer_args->wakeup_lateness, get_monotonic_time() - scheduled_time);
+    trace_end(TRACE_TICK, (uint32_t) tick, scheduled_time); // Spans from the scheduled to the actual wake-up.
+    pthread_mutex_lock(opus_timer_args->opus_builder_mutex);
+    if (*opus_timer_args->pending_ticks < MAX_PENDING_TICKS)
+        (*opus_timer_args->pending_ticks)++;
+    pthread_cond_signal(opus_timer_args->opus_builder_cond);
+    pthread_mutex_unlock(opus_timer_args->opus_builder_mutex);
+}
+
+/* Takes a hold on the oldest client nobody handled yet, with the client list locked. */
+static TaskQueue *claim_new_client(TaskQueue **recv_queues, int current_clients_count) {
+    for (int i = 0; i < current_clients_count; i++) {
+        if (!recv_queues[i]->queue_info->handled) {
+            recv_queues[i]->queue_info->handled = true;
+            retain_queue(recv_queues[i]);
+            return recv_queues[i];
         }
     }
     return NULL;
 }
 
-_Noreturn void *handle_client(void *p_client_handler_args) {
+void *handle_client(void *p_client_handler_args) {
     const int *current_clients_count = ((struct client_handler_info *) p_client_handler_args)->current_clients_count;
     const struct pcm *pcm_struct = ((struct client_handler_info *) p_client_handler_args)->pcm_struct;
+    const uint32_t frame_duration = ((struct client_handler_info *) p_client_handler_args)->frame_duration;
     const unsigned char *crypto_payload = ((struct client_handler_info *) p_client_handler_args)->crypto_payload;
+    const atomic_bool *stopping = ((struct client_handler_info *) p_client_handler_args)->stopping;
 
     pthread_mutex_t *complete_init_queue_mutex = ((struct client_handler_info *) p_client_handler_args)->complete_init_mutex[0];
     pthread_cond_t *complete_init_queue_cond = ((struct client_handler_info *) p_client_handler_args)->complete_init_cond[0];
     pthread_mutex_t *complete_init_client_mutex = ((struct client_handler_info *) p_client_handler_args)->complete_init_mutex[1];
     pthread_cond_t *complete_init_client_cond = ((struct client_handler_info *) p_client_handler_args)->complete_init_cond[1];
 
+    TaskQueue ***recv_queues = ((struct client_handler_info *) p_client_handler_args)->recv_queues;
     while (true) {
+        /* Clients connecting at once are all handled in order, not only the latest one. */
+        TaskQueue *recv_queue = NULL;
         pthread_mutex_lock(complete_init_queue_mutex);
-        pthread_cond_wait(complete_init_queue_cond, complete_init_queue_mutex);
+        while (!atomic_load(stopping) && (recv_queue = claim_new_client(*recv_queues, *current_clients_count)) == NULL)
+            pthread_cond_wait(complete_init_queue_cond, complete_init_queue_mutex);
         pthread_mutex_unlock(complete_init_queue_mutex);
+        if (atomic_load(stopping)) {
+            if (recv_queue != NULL)
+                release_queue(recv_queue);
+            return NULL;
+        }
 
-        TaskQueue **recv_queues = *((struct client_handler_info *) p_client_handler_args)->recv_queues;
-        if (ready_sock_server_seq1(recv_queues[(*current_clients_count) - 1])) {
-            if (ready_sock_server_seq2(recv_queues[(*current_clients_count) - 1], *pcm_struct)) {
-                if (ready_sock_server_seq3(recv_queues[(*current_clients_count) - 1], crypto_payload))
+        if (ready_sock_server_seq1(recv_queue)) {
+            if (ready_sock_server_seq2(recv_queue, *pcm_struct, frame_duration)) {
+                if (ready_sock_server_seq3(recv_queue, crypto_payload))
                     printf("Preparing socket sequence has been Successfully Completed.");
                 else {
                     printf("Error: A crypto preparation sequence Failed.");
+                    release_queue(recv_queue);
                     continue;
                 }
             } else {
                 printf("Error: A server socket preparation sequence Failed.");
+                release_queue(recv_queue);
                 continue;
             }
         } else {
             printf("Error: A client socket preparation sequence Failed.");
+            release_queue(recv_queue);
             continue;
         }
 
-        if (((struct client_handler_info *) p_client_handler_args)->stream_consumer != NULL)
-            *((struct client_handler_info *) p_client_handler_args)->stop_consumer = true;
-
         printf("\nStarted Sending Opus Packets...\n");
         fflush(stdout);
 
         pthread_mutex_lock(complete_init_client_mutex);
-        pthread_cond_signal(complete_init_client_cond);
+        atomic_store(((struct client_handler_info *) p_client_handler_args)->listening, true);
+        pthread_cond_broadcast(complete_init_client_cond);
         pthread_mutex_unlock(complete_init_client_mutex);
 
-        pthread_t opus_sender;
-        pthread_t heartbeat_checker;
-
-        struct opus_sender_args *p_opus_sender_args = malloc(sizeof(struct opus_sender_args));
-        p_opus_sender_args->recv_queue = recv_queues[(*current_clients_count) - 1];
-        p_opus_sender_args->opus_frame = ((struct client_handler_info *) p_client_handler_args)->opus_frame;
-        p_opus_sender_args->opus_sender_mutex = ((struct client_handler_info *) p_client_handler_args)->opus_sender_mutex;
-        p_opus_sender_args->opus_sender_cond = ((struct client_handler_info *) p_client_handler_args)->opus_sender_cond;
-
-        // Activate opus sender per client.
-        pthread_create(&opus_sender, NULL, provide_20ms_opus_sender, (void *) p_opus_sender_args);
-        pthread_create(&heartbeat_checker, NULL, check_heartbeat, (void *) recv_queues[(*current_clients_count) - 1]);
+        // Hand the client over to the opus sender, along with the hold on its queue.
+        struct opus_sender_args *opus_sender_args = ((struct client_handler_info *) p_client_handler_args)->opus_sender_args;
+        pthread_mutex_lock(&opus_sender_args->clients_mutex);
+        opus_sender_args->new_clients = realloc(opus_sender_args->new_clients,
+                                                sizeof(TaskQueue *) * (opus_sender_args->new_clients_count + 1));
+        opus_sender_args->new_clients[opus_sender_args->new_clients_count++] = recv_queue;
+        pthread_mutex_unlock(&opus_sender_args->clients_mutex);
     }
 }
 
-__attribute__((noreturn)) void server_signal_timer(int signal) {
-    if (signal == SIGALRM) {
-        write(STDOUT_FILENO, "\nAll of client has been interrupted raplayer. Program now Exit.\n", 64);
-    }
-    exit(signal);
+void init_ra_server_config(RaServerConfig *config) {
+    memset(config, 0, sizeof(RaServerConfig));
+    config->port = RA_DEFAULT_PORT;
+    config->profile = "default";
+    config->min_complexity = RA_DEFAULT_MIN_COMPLEXITY;
+    config->max_complexity = RA_DEFAULT_MAX_COMPLEXITY;
+    config->nack_budget = 25;
+    config->shards = 1;
+    config->pacing_mode = RA_PACING_TXTIME;
 }
 
-int ra_server(int argc, char **argv) {
-    signal(SIGALRM, &server_signal_timer);
-
-    bool pipe_mode = false;
-    bool stream_mode = false;
-
-    if (argc < 3 || (strcmp(argv[2], "help") == 0)) {
-        puts("");
-        printf("Usage: %s --server [--stream] <FILE> [Port]\n\n", argv[0]);
-        puts("<FILE>: The name of the wav file to play. (\"-\" to receive from STDIN)");
-
-        puts("[--stream]: Allows flushing STDIN pipe when client connected. (prevent stacking buffer)");
-        puts("[Port]: The port on the server to which you want to open.");
-        puts("");
-        return 0;
+/* Returns false, with the reason printed, if the settings can't be streamed with. */
+static bool check_server_config(const RaServerConfig *config) {
+    if (config->input.read == NULL) {
+        printf("Error: The server has no input.\n");
+        return false;
     }
-    int port;
-    if (argc < 5) {
-        if (!strcmp(argv[2], "--stream"))
-            stream_mode = true;
-        port = 3845;
-    } else if (strtol(argv[3], NULL, 10) != EINVAL && strtol(argv[3], NULL, 10)) {
-        if (!strcmp(argv[2], "--stream"))
-            stream_mode = true;
-        port = (int) strtol(argv[3], NULL, 10);
-    } else {
-        if (!strcmp(argv[2], "--stream"))
-            stream_mode = true;
-        port = (int) strtol(argv[4], NULL, 10);
+    if (config->profile != NULL && find_stream_profile(config->profile) == NULL) {
+        printf("Invalid argument: Unknown profile \"%s\".\n", config->profile);
+        return false;
     }
-
-    struct pcm *pcm_struct = calloc(sizeof(struct pcm), BYTE);
-
-    char *fin_name = stream_mode ? argv[3] : argv[2];
-    if (fin_name[0] == '-' && fin_name[1] != '-') {
-        pcm_struct->pcmFmtChunk.channels = 2;
-        pcm_struct->pcmFmtChunk.sample_rate = 48000;
-        pcm_struct->pcmFmtChunk.bits_per_sample = 16;
-        pcm_struct->pcmDataChunk.chunk_size = 0;
-
-        fin_name = "STDIN";
-        pipe_mode = true;
+    if (config->frame_duration != 0 && !supported_frame_duration(config->frame_duration)) {
+        printf("Invalid argument: Frame duration must be one of 2.5, 5, 10, 20, 40, 60.\n");
+        return false;
     }
-
-    if (!pipe_mode && stream_mode) {
-        cleanup(1, pcm_struct);
-        fprintf(stdout, "Invalid argument: --stream argument cannot run without <file> argument \"-\".\n");
-        return EXIT_FAILURE;
+    if (config->min_complexity < 0 || config->min_complexity > config->max_complexity ||
+        config->max_complexity > MAX_COMPLEXITY) {
+        printf("Invalid argument: Complexity must be between 0 and %d, the lower bound first.\n", MAX_COMPLEXITY);
+        return false;
     }
-
-    FILE *fin;
-    fin = (pipe_mode ? stdin : fopen(fin_name, "rb"));
-
-    if (fin == NULL) {
-        cleanup(1, pcm_struct);
-        fprintf(stdout, "Error: Failed to open input file: %s\n", strerror(errno));
-        return EXIT_FAILURE;
+    if (config->nack_budget < 0 || config->nack_budget > 100) {
+        printf("Invalid argument: NACK budget must be between 0 and 100 percent.\n");
+        return false;
+    }
+    if (config->shards < 1 || config->shards > MAX_INGRESS_SHARDS) {
+        printf("Invalid argument: Shards must be between 1 and %d.\n", MAX_INGRESS_SHARDS);
+        return false;
     }
+    if (config->pacing < 0 || config->pacing > 100) {
+        printf("Invalid argument: Pacing must be between 0 and 100 percent.\n");
+        return false;
+    }
+    return true;
+}
 
-    fpos_t before_data_pos;
-    if (!pipe_mode)
-        init_pcm_structure(fin, pcm_struct, &before_data_pos);
+/* Creates the encoder for the stream format and the profile, NULL if opus refuses it. */
+static OpusEncoder *create_encoder(const struct pcm *pcm_struct, const struct stream_profile *profile, bool dtx,
+                                   int complexity) {
+    int err;
+    OpusEncoder *encoder = opus_encoder_create((opus_int32) pcm_struct->pcmFmtChunk.sample_rate,
+                                               pcm_struct->pcmFmtChunk.channels, profile->application, &err);
+    if (err < 0) {
+        printf("Error: failed to create an encoder - %s\n", opus_strerror(err));
+        return NULL;
+    }
 
-    if (!pipe_mode && (pcm_struct->pcmFmtChunk.channels != 2 ||
-                        pcm_struct->pcmFmtChunk.sample_rate != 48000 ||
-                        pcm_struct->pcmFmtChunk.bits_per_sample != 16)) {
-        cleanup(1, pcm_struct);
-        fprintf(stdout, "Error: Failed to open input file: It must be a pcm_s16le 48000hz 2 channels wav file.\n");
-        return EXIT_FAILURE;
+    if ((err = opus_encoder_ctl(encoder, OPUS_SET_BITRATE(
+            pcm_struct->pcmFmtChunk.sample_rate * pcm_struct->pcmFmtChunk.channels))) < 0) {
+        printf("Error: failed to set bitrate - %s\n", opus_strerror(err));
+        opus_encoder_destroy(encoder);
+        return NULL;
     }
 
-    printf("\nFile %s info: \n", fin_name);
-    printf("Channels: %hd\n", pcm_struct->pcmFmtChunk.channels);
-    printf("Sample rate: %u\n", pcm_struct->pcmFmtChunk.sample_rate);
-    printf("Bit per sample: %hd\n", pcm_struct->pcmFmtChunk.bits_per_sample);
-    if (pipe_mode)
-        printf("PCM data length: STDIN\n\n");
-    else
-        printf("PCM data length: %u\n\n", pcm_struct->pcmDataChunk.chunk_size);
+    if (dtx && opus_encoder_ctl(encoder, OPUS_SET_DTX(1)) < 0) {
+        printf("Error: failed to enable DTX.\n");
+        opus_encoder_destroy(encoder);
+        return NULL;
+    }
 
-    puts("Waiting for Client... ");
-    fflush(stdout);
+    if ((err = opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(complexity))) < 0) {
+        printf("Error: failed to set complexity - %s\n", opus_strerror(err));
+        opus_encoder_destroy(encoder);
+        return NULL;
+    }
+    return encoder;
+}
 
-    if (!pipe_mode)
-        fsetpos(fin, &before_data_pos); // Re-read pcm data bytes from stream.
+/* Binds the sockets and prepares everything the threads share, nothing runs until the server is started. */
+RaServer *create_ra_server(const RaServerConfig *config) {
+    if (!check_server_config(config))
+        return NULL;
+
+    struct ra_server *server = calloc(1, sizeof(struct ra_server));
+    server->config = *config;
+    server->profile = *find_stream_profile(config->profile != NULL ? config->profile : "default");
+    if (config->frame_duration != 0) // An explicit frame duration overrides the profile's one.
+        server->profile.frame_duration = config->frame_duration;
+    server->pacing_mode = config->pacing_mode == RA_PACING_USER ? PACING_USER : PACING_TXTIME;
+    server->shards = config->shards;
+
+    atomic_init(&server->listening, false);
+    atomic_init(&server->stopping, false);
+    atomic_init(&server->ingress_stopping, false);
+    pthread_mutex_init(&server->complete_init_queue_mutex, NULL);
+    pthread_cond_init(&server->complete_init_queue_cond, NULL);
+    pthread_mutex_init(&server->complete_init_client_mutex, NULL);
+    pthread_cond_init(&server->complete_init_client_cond, NULL);
+    pthread_mutex_init(&server->opus_builder_mutex, NULL);
+    pthread_cond_init(&server->opus_builder_cond, NULL);
+    pthread_mutex_init(&server->opus_sender_args.clients_mutex, NULL);
+    for (int i = 0; i < server->shards; i++)
+        server->sock_fds[i] = -1;
+
+    server->realtime.enabled = config->realtime;
+    if (config->cpus != NULL && !parse_cpu_list(config->cpus, &server->realtime)) {
+        printf("Invalid argument: CPUs must be a list of up to %d CPU numbers, like \"2,3\".\n", REALTIME_MAX_CPUS);
+        destroy_ra_server(server);
+        return NULL;
+    }
 
-    bool stop_consumer = false;
+    struct pcm *pcm_struct = &server->pcm_struct;
+    pcm_struct->pcmFmtChunk.channels = STREAM_CHANNELS;
+    pcm_struct->pcmFmtChunk.sample_rate = STREAM_SAMPLE_RATE;
+    pcm_struct->pcmFmtChunk.bits_per_sample = 16;
+    pcm_struct->pcmDataChunk.chunk_size = config->pcm_size;
 
-    pthread_t opus_timer;
-    pthread_t stream_consumer;
-    pthread_t *p_stream_consumer = &stream_consumer;
-    pthread_mutex_t stream_consumer_mutex = PTHREAD_MUTEX_INITIALIZER;
-    pthread_cond_t stream_consumer_cond = PTHREAD_COND_INITIALIZER;
+    struct sockaddr_in server_addr;
+    for (int i = 0; i < server->shards; i++) {
+        if ((server->sock_fds[i] = server_init_socket(&server_addr, config->port, server->shards > 1)) < 0) {
+            destroy_ra_server(server);
+            return NULL;
+        }
+    }
 
-    if (stream_mode) {
-        void **p_stream_consumer_args = calloc(sizeof(void *), DWORD);
+    if (config->pacing > 0) {
+        for (int i = 0; i < server->shards && server->pacing_mode == PACING_TXTIME; i++) {
+            if (!enable_txtime(server->sock_fds[i])) {
+                printf("SO_TXTIME is not available, falling back to user-space pacing.\n");
+                server->pacing_mode = PACING_USER;
+            }
+        }
+        printf("Pacing: %.2fms of every frame, %s\n", server->profile.frame_duration * config->pacing / 100 / 1000,
+               server->pacing_mode == PACING_TXTIME ? "kernel launch times" : "user-space");
+        fflush(stdout);
+    }
 
-        p_stream_consumer_args[0] = fin;
-        p_stream_consumer_args[1] = &stop_consumer;
-        p_stream_consumer_args[2] = &stream_consumer_mutex;
-        p_stream_consumer_args[3] = &stream_consumer_cond;
+    if ((server->encoder = create_encoder(pcm_struct, &server->profile, config->dtx,
+                                          config->max_complexity)) == NULL) {
+        destroy_ra_server(server);
+        return NULL;
+    }
 
-        // Activate opus timer for consuming stream.
-        pthread_create(&opus_timer, NULL, provide_20ms_opus_timer, (void *) &stream_consumer_cond);
-        pthread_create(p_stream_consumer, NULL, consume_until_connection, (void *) p_stream_consumer_args);
-    } else
-        p_stream_consumer = NULL;
+    opus_int32 lookahead = 0;
+    opus_encoder_ctl(server->encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+    printf("Algorithmic delay: %.1fms, Packets per second: %.0f per client\n",
+           (server->profile.frame_duration / 1000.0) + (lookahead * 1000.0 / pcm_struct->pcmFmtChunk.sample_rate),
+           1000000.0 / server->profile.frame_duration);
+    fflush(stdout);
 
-    struct sockaddr_in server_addr;
-    int sock_fd = server_init_socket(&server_addr, port);
+    server->crypto_payload = generate_random_bytestream(CHACHA20_NONCEBYTES + CHACHA20_KEYBYTES);
+    const long interval = (long) server->profile.frame_duration * 1000L;
+
+    server->frame_ring = malloc(sizeof(FrameRing));
+    if (server->realtime.enabled)
+        prefault_memory(server->frame_ring, sizeof(FrameRing));
+    init_frame_ring(server->frame_ring);
+
+    server->recv_queues = malloc(sizeof(TaskQueue *));
+    server->task_scheduler_args = calloc((size_t) server->shards, sizeof(struct task_scheduler_info));
+    for (int i = 0; i < server->shards; i++) {
+        struct task_scheduler_info *task_scheduler_args = &server->task_scheduler_args[i];
+        task_scheduler_args->shard_id = i;
+        task_scheduler_args->sock_fd = server->sock_fds[i];
+        task_scheduler_args->stopping = &server->ingress_stopping;
+        task_scheduler_args->current_clients_count = &server->current_clients_count;
+        task_scheduler_args->recv_queues = &server->recv_queues;
+        task_scheduler_args->last_client_id = &server->last_client_id;
+        task_scheduler_args->frame_ring = server->frame_ring;
+        task_scheduler_args->retransmit_rate = 1000000.0 / server->profile.frame_duration * config->nack_budget / 100;
+        atomic_init(&task_scheduler_args->received_datagrams, 0);
+        atomic_init(&task_scheduler_args->dropped_datagrams, 0);
+
+        task_scheduler_args->complete_init_queue_mutex = &server->complete_init_queue_mutex;
+        task_scheduler_args->complete_init_queue_cond = &server->complete_init_queue_cond;
+    }
 
-    //Set fd to non-blocking mode.
-    int flags = fcntl(fileno(fin), F_GETFL, 0);
-    fcntl(fileno(fin), F_SETFL, flags | O_NONBLOCK);
+    struct client_handler_info *client_handler_args = &server->client_handler_args;
+    client_handler_args->current_clients_count = &server->current_clients_count;
+    client_handler_args->recv_queues = &server->recv_queues;
+    client_handler_args->pcm_struct = pcm_struct;
+    client_handler_args->frame_duration = server->profile.frame_duration;
+    client_handler_args->crypto_payload = server->crypto_payload;
+    client_handler_args->listening = &server->listening;
+    client_handler_args->stopping = &server->stopping;
+    client_handler_args->complete_init_mutex[0] = &server->complete_init_queue_mutex;
+    client_handler_args->complete_init_cond[0] = &server->complete_init_queue_cond;
+    client_handler_args->complete_init_mutex[1] = &server->complete_init_client_mutex;
+    client_handler_args->complete_init_cond[1] = &server->complete_init_client_cond;
+    client_handler_args->opus_sender_args = &server->opus_sender_args;
+
+    struct opus_timer_args *opus_timer_args = &server->opus_timer_args;
+    opus_timer_args->opus_builder_mutex = &server->opus_builder_mutex;
+    opus_timer_args->opus_builder_cond = &server->opus_builder_cond;
+    opus_timer_args->pending_ticks = &server->pending_ticks;
+    opus_timer_args->interval = interval;
+    init_lateness_histogram(&opus_timer_args->wakeup_lateness);
+
+    struct opus_builder_args *opus_builder_args = &server->opus_builder_args;
+    opus_builder_args->pcm_struct = pcm_struct;
+    opus_builder_args->input = config->input;
+    opus_builder_args->encoder = server->encoder;
+    opus_builder_args->frame_size = (int) ((uint64_t) pcm_struct->pcmFmtChunk.sample_rate *
+                                           server->profile.frame_duration / 1000000);
+    opus_builder_args->dtx = config->dtx;
+    opus_builder_args->crypto_payload = server->crypto_payload;
+    opus_builder_args->opus_builder_mutex = &server->opus_builder_mutex;
+    opus_builder_args->opus_builder_cond = &server->opus_builder_cond;
+    opus_builder_args->pending_ticks = &server->pending_ticks;
+    opus_builder_args->listening = &server->listening;
+    opus_builder_args->stopping = &server->stopping;
+    opus_builder_args->complete_init_client_mutex = &server->complete_init_client_mutex;
+    opus_builder_args->complete_init_client_cond = &server->complete_init_client_cond;
+    opus_builder_args->frame_ring = server->frame_ring;
+    opus_builder_args->realtime = &server->realtime;
+    opus_builder_args->interval = interval;
+    init_lateness_histogram(&opus_builder_args->publish_lateness);
+    init_lateness_histogram(&opus_builder_args->encode_time);
+    init_complexity_tuner(&opus_builder_args->tuner, config->min_complexity, config->max_complexity, interval);
+    atomic_init(&opus_builder_args->encoded_frames, 0);
+    atomic_init(&opus_builder_args->dtx_frames, 0);
+
+    struct opus_sender_args *opus_sender_args = &server->opus_sender_args;
+    opus_sender_args->frame_ring = server->frame_ring;
+    init_pacer(&opus_sender_args->pacer, server->pacing_mode,
+               (int64_t) (server->profile.frame_duration * config->pacing / 100 * 1000));
+    atomic_init(&opus_sender_args->sent_frames, 0);
+    atomic_init(&opus_sender_args->skipped_frames, 0);
+    if (!(server->sender_ready = init_net_sender(&opus_sender_args->sender))) {
+        printf("Error: Failed to initialize the %s sender.\n", net_backend_name());
+        destroy_ra_server(server);
+        return NULL;
+    }
 
-    int current_clients_count = 0;
-    unsigned char *crypto_payload = generate_random_bytestream(CHACHA20_NONCEBYTES + CHACHA20_KEYBYTES);
-    pthread_mutex_t complete_init_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
-    pthread_mutex_t complete_init_client_mutex = PTHREAD_MUTEX_INITIALIZER;
-    pthread_mutex_t opus_builder_mutex = PTHREAD_MUTEX_INITIALIZER;
-    pthread_mutex_t opus_sender_mutex = PTHREAD_MUTEX_INITIALIZER;
+    if (config->metrics_address != NULL) {
+        struct metrics_args *metrics_args = calloc(1, sizeof(struct metrics_args));
+        if ((metrics_args->listen_fd = open_metrics_socket(config->metrics_address)) < 0) {
+            free(metrics_args);
+            destroy_ra_server(server);
+            return NULL;
+        }
+        metrics_args->task_scheduler_args = server->task_scheduler_args;
+        metrics_args->shards = server->shards;
+        metrics_args->current_clients_count = &server->current_clients_count;
+        metrics_args->recv_queues = &server->recv_queues;
+        metrics_args->complete_init_queue_mutex = &server->complete_init_queue_mutex;
+        metrics_args->opus_builder_args = opus_builder_args;
+        metrics_args->opus_timer_args = opus_timer_args;
+        metrics_args->opus_sender_args = opus_sender_args;
+        server->metrics_args = metrics_args;
+    }
+    return server;
+}
 
-    pthread_cond_t complete_init_queue_cond = PTHREAD_COND_INITIALIZER;
-    pthread_cond_t complete_init_client_cond = PTHREAD_COND_INITIALIZER;
-    pthread_cond_t opus_builder_cond = PTHREAD_COND_INITIALIZER;
-    pthread_cond_t opus_sender_cond = PTHREAD_COND_INITIALIZER;
+/* Starts streaming to the clients as they connect, the server runs until its input ends or it's stopped. */
+bool start_ra_server(RaServer *server) {
+    if (server->started)
+        return false;
 
-    struct task_scheduler_info task_scheduler_args;
-    struct client_handler_info client_handler_args;
+    for (int i = 0; i < server->shards; i++) {
+        if (!init_net_receiver(&server->task_scheduler_args[i].receiver, server->sock_fds[i])) {
+            printf("Error: Failed to initialize the %s receiver.\n", net_backend_name());
+            while (i-- > 0)
+                destroy_net_receiver(&server->task_scheduler_args[i].receiver);
+            return false;
+        }
+    }
 
-    task_scheduler_args.sock_fd = sock_fd;
-    task_scheduler_args.current_clients_count = &current_clients_count;
-    task_scheduler_args.recv_queues = malloc(sizeof(TaskQueue *));
+    /* Without a shared ticker, the frame clock gets a thread of its own, pinned and prioritized like the builder. */
+    if (server->config.ticker != NULL)
+        server->ticker = server->config.ticker;
+    else {
+        server->ticker = malloc(sizeof(Ticker));
+        if (!start_ticker(server->ticker, &server->realtime)) {
+            printf("Error: Failed to start the frame clock.\n");
+            free(server->ticker);
+            server->ticker = NULL;
+            for (int i = 0; i < server->shards; i++)
+                destroy_net_receiver(&server->task_scheduler_args[i].receiver);
+            return false;
+        }
+        server->own_ticker = true;
+    }
 
-    task_scheduler_args.complete_init_queue_mutex = &complete_init_queue_mutex;
-    task_scheduler_args.complete_init_queue_cond = &complete_init_queue_cond;
+    /* Lock the encoder, the ring and everything else the hot path touches before it starts. */
+    if (server->realtime.enabled)
+        lock_memory();
 
-    client_handler_args.current_clients_count = &current_clients_count;
-    client_handler_args.recv_queues = &task_scheduler_args.recv_queues;
-    client_handler_args.pcm_struct = pcm_struct;
-    client_handler_args.crypto_payload = crypto_payload;
+    // Activate the opus sender, it fans every frame out to all clients.
+    pthread_create(&server->opus_sender, NULL, provide_20ms_opus_sender, (void *) &server->opus_sender_args);
 
-    client_handler_args.stream_consumer = p_stream_consumer;
-    client_handler_args.stop_consumer = &stop_consumer;
+    if (server->metrics_args != NULL) {
+        // Activate the metrics server.
+        pthread_create(&server->metrics_server, NULL, serve_metrics, (void *) server->metrics_args);
+        printf("Serving metrics on %s\n", server->config.metrics_address);
+        fflush(stdout);
+    }
 
-    client_handler_args.complete_init_mutex[0] = &complete_init_queue_mutex;
-    client_handler_args.complete_init_cond[0] = &complete_init_queue_cond;
-    client_handler_args.complete_init_mutex[1] = &complete_init_client_mutex;
-    client_handler_args.complete_init_cond[1] = &complete_init_client_cond;
+    for (int i = 0; i < server->shards; i++)
+        pthread_create(&server->task_schedulers[i], NULL, schedule_task, &server->task_scheduler_args[i]);
+    pthread_create(&server->client_handler, NULL, handle_client, &server->client_handler_args);
 
-    client_handler_args.opus_frame = malloc(sizeof(Task));
-    client_handler_args.opus_sender_mutex = &opus_sender_mutex;
-    client_handler_args.opus_sender_cond = &opus_sender_cond;
+    // Activate opus builder, it waits for the first client.
+    pthread_create(&server->opus_builder, NULL, provide_20ms_opus_builder, (void *) &server->opus_builder_args);
 
-    pthread_t task_scheduler;
-    pthread_attr_t task_scheduler_attr;
-    pthread_attr_init(&task_scheduler_attr);
-    pthread_attr_setdetachstate(&task_scheduler_attr, PTHREAD_CREATE_DETACHED);
+    // Activate the frame clock.
+    add_ticker_job(server->ticker, &server->opus_timer_args.job, server->opus_timer_args.interval, tick_opus_timer,
+                   &server->opus_timer_args);
 
-    pthread_t client_handler;
-    pthread_attr_t client_handler_attr;
-    pthread_attr_init(&client_handler_attr);
-    pthread_attr_setdetachstate(&client_handler_attr, PTHREAD_CREATE_DETACHED);
+    server->started = true;
+    return true;
+}
 
-    pthread_create(&task_scheduler, &task_scheduler_attr, schedule_task, &task_scheduler_args);
-    pthread_create(&client_handler, &client_handler_attr, handle_client, &client_handler_args);
+/* Ends the stream at the next frame, from any thread. */
+void stop_ra_server(RaServer *server) {
+    pthread_mutex_lock(&server->complete_init_client_mutex);
+    atomic_store(&server->stopping, true);
+    pthread_cond_broadcast(&server->complete_init_client_cond);
+    pthread_mutex_unlock(&server->complete_init_client_mutex);
 
-    pthread_mutex_lock(&complete_init_client_mutex);
-    pthread_cond_wait(&complete_init_client_cond, &complete_init_client_mutex);
-    pthread_mutex_unlock(&complete_init_client_mutex);
+    pthread_mutex_lock(&server->complete_init_queue_mutex);
+    pthread_cond_broadcast(&server->complete_init_queue_cond);
+    pthread_mutex_unlock(&server->complete_init_queue_mutex);
+}
 
-    int err;
+/* Waits for the end of the stream and tells the clients, returns false if it ended on an error. */
+bool wait_ra_server(RaServer *server) {
+    if (!server->started || server->joined)
+        return !server->failed;
 
-    /* Create a new encoder state */
-    OpusEncoder *encoder;
-    encoder = opus_encoder_create((opus_int32) pcm_struct->pcmFmtChunk.sample_rate, pcm_struct->pcmFmtChunk.channels,
-                                  APPLICATION,
-                                  &err);
-    if (err < 0) {
-        printf("Error: failed to create an encoder - %s\n", opus_strerror(err));
-        exit(EXIT_FAILURE);
+    /* Wait for joining threads. */
+    pthread_join(server->opus_builder, NULL);
+    remove_ticker_job(server->ticker, &server->opus_timer_args.job);
+    pthread_join(server->opus_sender, NULL);
+
+    /* The client handler may be in a handshake, it gives up once the shards expire the client. */
+    stop_ra_server(server);
+    pthread_join(server->client_handler, NULL);
+    atomic_store(&server->ingress_stopping, true);
+    for (int i = 0; i < server->shards; i++) {
+        pthread_join(server->task_schedulers[i], NULL);
+        destroy_net_receiver(&server->task_scheduler_args[i].receiver);
     }
 
-    if (opus_encoder_ctl(encoder,
-                         OPUS_SET_BITRATE(pcm_struct->pcmFmtChunk.sample_rate * pcm_struct->pcmFmtChunk.channels)) <
-        0) {
-        printf("Error: failed to set bitrate - %s\n", opus_strerror(err));
-        exit(EXIT_FAILURE);
+    /* Joined, it must not be reading the queues freed later. */
+    if (server->metrics_args != NULL) {
+        pthread_cancel(server->metrics_server);
+        pthread_join(server->metrics_server, NULL);
     }
 
-    pthread_t opus_builder;
-    /* Create opus builder arguments struct. */
-    struct opus_builder_args *p_opus_builder_args = malloc(sizeof(struct opus_builder_args));
-    p_opus_builder_args->pcm_struct = pcm_struct;
-    p_opus_builder_args->fin = fin;
-    p_opus_builder_args->encoder = encoder;
-    p_opus_builder_args->crypto_payload = crypto_payload;
-    p_opus_builder_args->opus_frame = client_handler_args.opus_frame;
-    p_opus_builder_args->opus_builder_mutex = stream_mode ? &stream_consumer_mutex : &opus_builder_mutex;
-    p_opus_builder_args->opus_sender_mutex = &opus_sender_mutex;
-    p_opus_builder_args->opus_builder_cond = stream_mode ? &stream_consumer_cond : &opus_builder_cond;
-    p_opus_builder_args->opus_sender_cond = &opus_sender_cond;
+    if (server->own_ticker) {
+        stop_ticker(server->ticker);
+        free(server->ticker);
+        server->own_ticker = false;
+    }
+    server->ticker = NULL;
+
+    /* Send EOS Packet to clients, the ones which timed out are gone. */
+    const int current_clients_count = server->current_clients_count;
+    NetSender eos_sender;
+    if (init_net_sender(&eos_sender)) {
+        NetMessage *eos_messages = malloc(sizeof(NetMessage) * (current_clients_count + 1));
+        int eos_count = 0;
+        for (int i = 0; i < current_clients_count; i++) {
+            const TaskQueueInfo *queue_info = server->recv_queues[i]->queue_info;
+            if (atomic_load(&queue_info->heartbeat_status) == -1)
+                continue;
+            eos_messages[eos_count].sock_fd = queue_info->sock_fd;
+            eos_messages[eos_count].buffer = EOS;
+            eos_messages[eos_count].buffer_len = strlen(EOS);
+            eos_messages[eos_count].addr = &queue_info->client->client_addr;
+            eos_messages[eos_count].addr_len = queue_info->client->socket_len;
+            eos_messages[eos_count++].launch_time = 0;
+        }
+        send_datagrams(&eos_sender, eos_messages, eos_count);
+        destroy_net_sender(&eos_sender);
+        free(eos_messages);
+    }
 
-    // Activate opus builder.
-    pthread_create(&opus_builder, NULL, provide_20ms_opus_builder, (void *) p_opus_builder_args);
+    for (int i = 0; i < server->shards; i++) {
+        printf("\nIngress shard %d: Received %lu datagrams, %lu dropped by the kernel", i,
+               atomic_load(&server->task_scheduler_args[i].received_datagrams),
+               atomic_load(&server->task_scheduler_args[i].dropped_datagrams));
+    }
+    printf("\n");
+    fflush(stdout);
 
-    if (!stream_mode)
-        // Activate opus timer.
-        pthread_create(&opus_timer, NULL, provide_20ms_opus_timer, (void *) &opus_builder_cond);
+    print_lateness_histogram(&server->opus_timer_args.wakeup_lateness, "Timer wake-up");
+    print_lateness_histogram(&server->opus_builder_args.publish_lateness, "Frame publish");
+    print_complexity_tuner(&server->opus_builder_args.tuner);
 
-    /* Wait for joining threads. */
-    pthread_join(opus_builder, NULL);
-    pthread_join(opus_timer, NULL);
+    server->joined = true;
+    server->failed = server->opus_builder_args.failed;
+    return !server->failed;
+}
 
-    /* Cancel unending threads. */
-    pthread_cancel(task_scheduler);
+/* Stops the server first if it still runs. */
+void destroy_ra_server(RaServer *server) {
+    if (server == NULL)
+        return;
+    if (server->started && !server->joined) {
+        stop_ra_server(server);
+        wait_ra_server(server);
+    }
 
-    /* Send EOS Packet to clients && Clean up. */
-    for (int i = 0; i < current_clients_count; i++) {
-        sendto(task_scheduler_args.sock_fd, EOS, strlen(EOS), 0,
-               (const struct sockaddr *) &task_scheduler_args.recv_queues[i]->queue_info->client->client_addr,
-               task_scheduler_args.recv_queues[i]->queue_info->client->socket_len);
-        cleanup(2, task_scheduler_args.recv_queues[i]->queue_info, task_scheduler_args.recv_queues[i]);
+    /* Clients handed over after the sender stopped, then the client list's holds. */
+    for (int i = 0; i < server->opus_sender_args.new_clients_count; i++)
+        release_queue(server->opus_sender_args.new_clients[i]);
+    for (int i = 0; i < server->current_clients_count; i++)
+        release_queue(server->recv_queues[i]);
+    free(server->recv_queues);
+    free(server->task_scheduler_args);
+    free(server->opus_sender_args.new_clients);
+
+    if (server->metrics_args != NULL) {
+        close(server->metrics_args->listen_fd);
+        const char *metrics_address = server->config.metrics_address;
+        if (!strncmp(metrics_address, METRICS_UNIX_PREFIX, strlen(METRICS_UNIX_PREFIX)))
+            unlink(metrics_address + strlen(METRICS_UNIX_PREFIX));
+        free(server->metrics_args);
+    }
+    if (server->sender_ready)
+        destroy_net_sender(&server->opus_sender_args.sender);
+    if (server->frame_ring != NULL) {
+        destroy_frame_ring(server->frame_ring);
+        free(server->frame_ring);
     }
 
     /* Destroy the encoder state */
-    opus_encoder_destroy(encoder);
+    if (server->encoder != NULL)
+        opus_encoder_destroy(server->encoder);
+    free(server->crypto_payload);
 
-    /* Close audio stream. */
-    fclose(fin);
+    for (int i = 0; i < server->shards; i++) {
+        if (server->sock_fds[i] >= 0)
+            close(server->sock_fds[i]);
+    }
 
-    exit(EXIT_SUCCESS);
+    pthread_mutex_destroy(&server->complete_init_queue_mutex);
+    pthread_cond_destroy(&server->complete_init_queue_cond);
+    pthread_mutex_destroy(&server->complete_init_client_mutex);
+    pthread_cond_destroy(&server->complete_init_client_cond);
+    pthread_mutex_destroy(&server->opus_builder_mutex);
+    pthread_cond_destroy(&server->opus_builder_cond);
+    pthread_mutex_destroy(&server->opus_sender_args.clients_mutex);
+    free(server);
 }
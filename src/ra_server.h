@@ -37,22 +37,39 @@
 #ifndef RAPLAYER_RA_SERVER_H
 #define RAPLAYER_RA_SERVER_H
 
+#include "raplayer.h"
+
 #define BYTE 1
 #define WORD 2
 #define DWORD 4
 
+#define HELLO "HELLO"
 #define OK "OK"
-#define OPUS_FLAG "OPUS"
 #define HEARTBEAT "HEARTBEAT"
+#define HEARTBEAT_TIMEOUT 1000000000L // Nanoseconds of silence before a client is dropped.
+#define HEARTBEAT_TICK 10000000L // Resolution of the heartbeat timer wheel.
+#define MAX_PENDING_TICKS 3 // Frame clock ticks a late builder catches up on, older ones are dropped after a stall.
 
-#define FRAME_SIZE 960
+#define DEFAULT_FRAME_DURATION 20000 // Opus frame duration in microseconds.
+#define MAX_FRAME_DURATION 60000
+#define MAX_FRAME_SIZE 2880 // 60ms at 48kHz.
 #define MAX_DATA_SIZE 4096
-#define APPLICATION OPUS_APPLICATION_AUDIO
+
+#define STREAM_CHANNELS RA_STREAM_CHANNELS // Every file is streamed in this format, converted if it isn't.
+#define STREAM_SAMPLE_RATE RA_STREAM_SAMPLE_RATE
 
 #define EOS "EOS" // End of Stream FLAG.
 
+#include "packet/packet.h"
+#include "frame_ring/frame_ring.h"
+#include "timer_wheel/timer_wheel.h"
 #include "task_scheduler/task_scheduler.h"
 #include "task_scheduler/task_queue/task_queue.h"
+#include "pacing/pacing.h"
+#include "realtime/realtime.h"
+#include "pcm_source/pcm_source.h"
+#include "ticker/ticker.h"
+#include "complexity_tuner/complexity_tuner.h"
 
 struct pcm_header {
     char chunk_id[4];
@@ -76,7 +93,6 @@ struct pcm_fmt_chunk {
 struct pcm_data_chunk {
     char chunk_id[4];
     uint32_t chunk_size;
-    char *data;
 };
 
 struct pcm {
@@ -85,28 +101,116 @@ struct pcm {
     struct pcm_data_chunk pcmDataChunk;
 };
 
+struct stream_profile {
+    const char *name;
+    uint32_t frame_duration;
+    int application;
+};
+
 struct opus_builder_args {
     struct pcm *pcm_struct;
-    FILE *fin;
+    RaInput input;
     OpusEncoder *encoder;
+    int frame_size;
+    bool dtx;
     unsigned char *crypto_payload;
 
     pthread_mutex_t *opus_builder_mutex;
-    pthread_mutex_t *opus_sender_mutex;
+    pthread_cond_t *opus_builder_cond;
+    int *pending_ticks;
+
+    const atomic_bool *listening; // The first client completed the handshake.
+    const atomic_bool *stopping;
+    pthread_mutex_t *complete_init_client_mutex;
+    pthread_cond_t *complete_init_client_cond;
+
+    FrameRing *frame_ring;
+    bool failed;
+
+    const struct realtime_config *realtime;
+    long interval; // Nanoseconds between frames.
+    LatenessHistogram publish_lateness;
+
+    atomic_ulong encoded_frames;
+    atomic_ulong dtx_frames;
+    LatenessHistogram encode_time;
+    ComplexityTuner tuner;
+};
 
+struct opus_timer_args {
+    pthread_mutex_t *opus_builder_mutex;
     pthread_cond_t *opus_builder_cond;
-    pthread_cond_t *opus_sender_cond;
-    Task *opus_frame;
+    int *pending_ticks;
+    long interval; // Nanoseconds between frames.
+
+    TickerJob job;
+    LatenessHistogram wakeup_lateness;
 };
 
 struct opus_sender_args {
-    TaskQueue *recv_queue;
-    Task *opus_frame;
+    FrameRing *frame_ring;
+    Pacer pacer; // Spreads each fan-out across part of the frame interval, or sends it at once.
+
+    pthread_mutex_t clients_mutex;
+    TaskQueue **new_clients; // Clients which completed the handshake, not picked up by the sender yet.
+    int new_clients_count;
 
-    pthread_mutex_t *opus_sender_mutex;
-    pthread_cond_t *opus_sender_cond;
+    NetSender sender;
+    atomic_ulong sent_frames;
+    atomic_ulong skipped_frames; // Frames overwritten in the ring before the sender got to them.
 };
 
-int ra_server(int argc, char **argv);
+/* A server engine, everything its threads share lives here. */
+struct ra_server {
+    RaServerConfig config;
+    struct stream_profile profile;
+    struct realtime_config realtime;
+    PacingMode pacing_mode;
+    struct pcm pcm_struct;
+    unsigned char *crypto_payload;
+    OpusEncoder *encoder;
+
+    int shards;
+    int sock_fds[MAX_INGRESS_SHARDS];
+    FrameRing *frame_ring;
+    TaskQueue **recv_queues; // Clients not timed out yet, each entry holds its queue.
+    int current_clients_count;
+    int last_client_id;
+
+    Ticker *ticker;
+    bool own_ticker;
+
+    atomic_bool listening;
+    atomic_bool stopping;
+    atomic_bool ingress_stopping; // Set once nothing waits for the received datagrams anymore.
+    pthread_mutex_t complete_init_queue_mutex;
+    pthread_cond_t complete_init_queue_cond;
+    pthread_mutex_t complete_init_client_mutex;
+    pthread_cond_t complete_init_client_cond;
+    pthread_mutex_t opus_builder_mutex;
+    pthread_cond_t opus_builder_cond;
+    int pending_ticks; // Ticks of the frame clock the builder hasn't published a frame for, guarded by opus_builder_mutex.
+
+    struct opus_timer_args opus_timer_args;
+    struct opus_builder_args opus_builder_args;
+    struct opus_sender_args opus_sender_args;
+    struct task_scheduler_info *task_scheduler_args;
+    struct client_handler_info client_handler_args;
+    struct metrics_args *metrics_args; // NULL without metrics.
+    bool sender_ready;
+
+    pthread_t opus_builder;
+    pthread_t opus_sender;
+    pthread_t client_handler;
+    pthread_t metrics_server;
+    pthread_t task_schedulers[MAX_INGRESS_SHARDS];
+    bool started;
+    bool joined;
+    bool failed;
+};
+
+const struct stream_profile *find_stream_profile(const char *name);
+
+bool supported_frame_duration(uint32_t frame_duration);
 
 #endif
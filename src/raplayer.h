@@ -0,0 +1,173 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * The embeddable raplayer engines. A server streams the PCM its input callback gives, a client plays a stream
+ * through its output callbacks. Every engine keeps its state to itself, so one process can host many of them,
+ * and their periodic work can share the thread of one ticker.
+ */
+
+#ifndef RAPLAYER_H
+#define RAPLAYER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RA_DEFAULT_PORT 3845
+#define RA_STREAM_CHANNELS 2 // Servers take their input in this format.
+#define RA_STREAM_SAMPLE_RATE 48000
+#define RA_DEFAULT_MIN_COMPLEXITY 3 // Of opus, the encoder trades it for speed down to this on a busy host.
+#define RA_DEFAULT_MAX_COMPLEXITY 10
+
+typedef struct ra_ticker RaTicker;
+typedef struct ra_server RaServer;
+typedef struct ra_client RaClient;
+
+typedef enum {
+    RA_PACING_TXTIME, // Kernel launch times, needs the fq or etf qdisc.
+    RA_PACING_USER // Sleeps between packets.
+} RaPacingMode;
+
+/* Counters of an input that buffers a source running on its own clock, like a pipe. */
+typedef struct {
+    unsigned long underruns; // Frames the source hadn't delivered in time.
+    unsigned long overruns; // Source frames dropped on a full buffer.
+    unsigned long stretched_frames; // Frames played slower or faster to ride out an underrun or an overrun.
+} RaInputStats;
+
+typedef struct {
+    /*
+     * Fills frames of interleaved 16 bits samples in the stream format, returns false at the end of the stream.
+     * It's called on the frame clock, so it should fill in what's missing rather than wait for it.
+     */
+    bool (*read)(void *user_data, int16_t *pcm, int frames);
+
+    /* Optional, the counters are exported with the metrics. */
+    void (*stats)(void *user_data, RaInputStats *stats);
+    void *user_data;
+} RaInput;
+
+typedef struct {
+    RaInput input;
+    uint32_t pcm_size; // Bytes of PCM announced to the clients, 0 if unknown. The input is read from the first client on.
+
+    int port;
+    const char *profile; // low-latency, default or bandwidth-saver.
+    uint32_t frame_duration; // Microseconds, overrides the profile's one, 0 to keep it.
+    bool dtx;
+    int min_complexity; // Bounds of the opus complexity, tuned to how long the frames take to encode. Equal to fix it.
+    int max_complexity;
+    double nack_budget; // Retransmitted frames allowed per client, in percent of the frame rate.
+    int shards; // Sockets sharing the port, each received by its own thread.
+    double pacing; // Percent of the frame interval the packets of each frame are spread across.
+    RaPacingMode pacing_mode;
+
+    bool realtime; // Runs the builder and its own frame clock with SCHED_FIFO, if permitted.
+    const char *cpus; // CPUs to pin them to in realtime mode, like "2,3", NULL to leave them unpinned.
+    const char *metrics_address; // Loopback port or "unix:/path" to serve Prometheus metrics on, NULL for none.
+
+    RaTicker *ticker; // Runs the frame clock, NULL to run one for this server only.
+} RaServerConfig;
+
+typedef struct {
+    /*
+     * Opens the output for the stream's channels. Sets the rate it plays at, which may differ from the stream's,
+     * and whether it takes floats instead of 16 bits samples.
+     */
+    bool (*open)(void *user_data, int channels, int stream_rate, int *output_rate, bool *float_output);
+
+    /* Plays frames of interleaved samples, blocking while the output is full. The samples may be changed in place. */
+    bool (*write)(void *user_data, void *samples, int frames);
+
+    /* Frames written and not played yet. NULL for an output without a clock of its own, it isn't drift compensated. */
+    long (*queued)(void *user_data);
+
+    void (*close)(void *user_data);
+    void *user_data;
+} RaOutput;
+
+typedef struct {
+    RaOutput output;
+
+    const char *address; // Of the server.
+    int port;
+    const char *replay_path; // Plays a capture instead of connecting to a server.
+    bool fast_replay; // Without waiting for the original arrival times.
+    const char *capture_path; // Records every received datagram with its arrival time, NULL for none.
+
+    int aggregated_frames; // Frames the server may bundle into one datagram.
+    double retransmit_delay; // Milliseconds playback waits for retransmissions, negative for none or the captured one.
+    bool drift_compensation; // Resamples for the output's clock drift, if it has a clock of its own.
+    double volume; // The part taken away, 0 keeps the samples and 1 mutes them.
+
+    RaTicker *ticker; // Sends the heartbeats, NULL to run one for this client only.
+} RaClientConfig;
+
+/* Counters of a running client, readable from any thread. */
+typedef struct {
+    uint32_t frame_duration; // Microseconds.
+    unsigned long played_frames;
+    unsigned long received_bytes;
+    unsigned long lost_frames;
+    unsigned long recovered_frames; // Lost frames which came back with a retransmission.
+    unsigned long concealed_frames;
+    unsigned long late_frames;
+    unsigned long dtx_frames;
+
+    bool drift_compensated;
+    double drift; // Compensated clock drift in ppm.
+
+    unsigned long replayed_datagrams;
+    double replay_time; // Seconds.
+} RaClientStats;
+
+RaTicker *create_ra_ticker(bool realtime, const char *cpus);
+
+void destroy_ra_ticker(RaTicker *ticker);
+
+void init_ra_server_config(RaServerConfig *config);
+
+RaServer *create_ra_server(const RaServerConfig *config);
+
+bool start_ra_server(RaServer *server);
+
+void stop_ra_server(RaServer *server);
+
+bool wait_ra_server(RaServer *server);
+
+void destroy_ra_server(RaServer *server);
+
+void init_ra_client_config(RaClientConfig *config);
+
+RaClient *create_ra_client(const RaClientConfig *config);
+
+bool start_ra_client(RaClient *client);
+
+void stop_ra_client(RaClient *client);
+
+bool wait_ra_client(RaClient *client);
+
+void destroy_ra_client(RaClient *client);
+
+void set_ra_client_volume(RaClient *client, double volume);
+
+void get_ra_client_stats(RaClient *client, RaClientStats *stats);
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE // pthread_setaffinity_np, pthread_setname_np
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "realtime.h"
+
+/* Upper bounds of the lateness buckets in microseconds, the last bucket has none. */
+static const int64_t lateness_bounds[LATENESS_BUCKETS - 1] = {10, 50, 100, 250, 500, 1000, 2000, 5000, 10000};
+
+/* Parses a comma separated list like "2,3", the first CPU runs the timer and the second one the builder. */
+bool parse_cpu_list(const char *list, struct realtime_config *config) {
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    config->cpu_count = 0;
+
+    while (*list != '\0') {
+        char *end;
+        long cpu = strtol(list, &end, 10);
+        if (end == list || cpu < 0 || cpu >= cpus || config->cpu_count == REALTIME_MAX_CPUS)
+            return false;
+
+        config->cpus[config->cpu_count++] = (int) cpu;
+        list = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0')
+            return false;
+    }
+    return config->cpu_count > 0;
+}
+
+/* Locks the mapped memory, and the future mappings too if the limit allows it so allocations can't fail. */
+bool lock_memory(void) {
+    struct rlimit rlimit;
+    int flags = MCL_CURRENT;
+
+    if (getrlimit(RLIMIT_MEMLOCK, &rlimit) == 0 && rlimit.rlim_cur == RLIM_INFINITY)
+        flags |= MCL_FUTURE;
+
+    if (mlockall(flags) < 0) {
+        printf("Realtime: mlockall failed - %s, raise the memory lock limit (ulimit -l) to avoid page faults.\n",
+               strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/* Writes every page back to itself, so it is mapped before the hot path touches it. */
+void prefault_memory(void *memory, size_t size) {
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    for (size_t i = 0; i < size; i += (size_t) page_size)
+        ((volatile char *) memory)[i] = ((volatile char *) memory)[i];
+}
+
+/* Touches and locks the stack the calling thread will grow into. */
+static void prefault_stack(void) {
+    char stack[REALTIME_STACK_PREFAULT];
+
+    prefault_memory(stack, sizeof(stack));
+    mlock(stack, sizeof(stack));
+}
+
+/* Pins the calling thread and raises it to SCHED_FIFO, settling for less when the privileges are missing. */
+void enter_realtime(const struct realtime_config *config, const char *name, int cpu_index, int priority) {
+    if (!config->enabled)
+        return;
+
+    char pinned[32] = "";
+#ifdef __linux__
+    pthread_setname_np(pthread_self(), name);
+
+    if (config->cpu_count > 0) {
+        int cpu = config->cpus[cpu_index < config->cpu_count ? cpu_index : config->cpu_count - 1];
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpu, &cpu_set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0)
+            snprintf(pinned, sizeof(pinned), " on CPU %d", cpu);
+        else
+            printf("Realtime: Failed to pin %s to CPU %d.\n", name, cpu);
+    }
+#endif
+
+    prefault_stack();
+
+    /* Without CAP_SYS_NICE, the RLIMIT_RTPRIO limit rtkit or limits.conf hand out may still allow a lower priority. */
+    struct sched_param param;
+#ifdef RLIMIT_RTPRIO
+    struct rlimit rlimit;
+#endif
+    int policy = SCHED_FIFO;
+#ifdef SCHED_RESET_ON_FORK
+    policy |= SCHED_RESET_ON_FORK;
+#endif
+
+    param.sched_priority = priority;
+    int err = pthread_setschedparam(pthread_self(), policy, &param);
+#ifdef RLIMIT_RTPRIO
+    if (err == EPERM && getrlimit(RLIMIT_RTPRIO, &rlimit) == 0 && rlimit.rlim_cur > 0) {
+        param.sched_priority = rlimit.rlim_cur < (rlim_t) priority ? (int) rlimit.rlim_cur : priority;
+        err = pthread_setschedparam(pthread_self(), policy, &param);
+    }
+#endif
+
+    if (err == 0) {
+        printf("Realtime: %s runs%s with SCHED_FIFO priority %d.\n", name, pinned, param.sched_priority);
+    } else {
+#ifdef SYS_gettid
+        /* Fall back to the highest nice level RLIMIT_NICE permits, per thread on Linux. */
+        for (int nice = -10; nice < 0; nice++) {
+            if (setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), nice) == 0) {
+                printf("Realtime: %s runs%s at nice %d, SCHED_FIFO is not permitted - %s.\n", name, pinned, nice,
+                       strerror(err));
+                fflush(stdout);
+                return;
+            }
+        }
+#endif
+        printf("Realtime: %s runs%s with the normal priority, SCHED_FIFO is not permitted - %s.\n", name, pinned,
+               strerror(err));
+    }
+    fflush(stdout);
+}
+
+/* Upper bound of a bucket in microseconds, the last bucket has none and returns -1. */
+int64_t lateness_bucket_bound(int bucket) {
+    return bucket < LATENESS_BUCKETS - 1 ? lateness_bounds[bucket] : -1;
+}
+
+void init_lateness_histogram(LatenessHistogram *histogram) {
+    for (int i = 0; i < LATENESS_BUCKETS; i++)
+        atomic_init(&histogram->buckets[i], 0);
+    atomic_init(&histogram->count, 0);
+    atomic_init(&histogram->sum, 0);
+    atomic_init(&histogram->max, 0);
+}
+
+/* There is a single writer, so relaxed increments are enough and the maximum needs no compare and swap. */
+void record_lateness(LatenessHistogram *histogram, int64_t lateness) {
+    int bucket = 0;
+    while (bucket < LATENESS_BUCKETS - 1 && lateness >= lateness_bounds[bucket] * 1000)
+        bucket++;
+
+    atomic_fetch_add_explicit(&histogram->buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, lateness, memory_order_relaxed);
+    if (lateness > atomic_load_explicit(&histogram->max, memory_order_relaxed))
+        atomic_store_explicit(&histogram->max, lateness, memory_order_relaxed);
+}
+
+void print_lateness_histogram(const LatenessHistogram *histogram, const char *name) {
+    unsigned long count = atomic_load(&histogram->count);
+    if (count == 0)
+        return;
+
+    printf("\n%s lateness:", name);
+    for (int i = 0; i < LATENESS_BUCKETS; i++) {
+        unsigned long bucket = atomic_load(&histogram->buckets[i]);
+        if (bucket == 0)
+            continue;
+        if (i < LATENESS_BUCKETS - 1)
+            printf(" <%lldus %.1f%%", (long long) lateness_bounds[i], 100.0 * (double) bucket / (double) count);
+        else
+            printf(" >=%lldus %.1f%%", (long long) lateness_bounds[i - 1], 100.0 * (double) bucket / (double) count);
+    }
+    printf(", max %.3fms\n", (double) atomic_load(&histogram->max) / 1000000.0);
+    fflush(stdout);
+}
@@ -0,0 +1,66 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "../ra_server.h"
+
+#ifndef RAPLAYER_REALTIME_H
+#define RAPLAYER_REALTIME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define REALTIME_MAX_CPUS 2 // The opus timer and the opus builder.
+#define REALTIME_PRIORITY 50 // SCHED_FIFO priority of the builder, the timer runs one above it.
+#define REALTIME_STACK_PREFAULT (256 * 1024)
+
+#define LATENESS_BUCKETS 10
+
+struct realtime_config {
+    bool enabled;
+    int cpus[REALTIME_MAX_CPUS];
+    int cpu_count; // 0 to leave the threads unpinned.
+};
+
+/* Distribution of how late a periodic event happened, written by a single thread and readable from any. */
+typedef struct {
+    atomic_ulong buckets[LATENESS_BUCKETS];
+    atomic_ulong count;
+    _Atomic int64_t sum;
+    _Atomic int64_t max;
+} LatenessHistogram;
+
+bool parse_cpu_list(const char *list, struct realtime_config *config);
+
+bool lock_memory(void);
+
+void prefault_memory(void *memory, size_t size);
+
+void enter_realtime(const struct realtime_config *config, const char *name, int cpu_index, int priority);
+
+int64_t lateness_bucket_bound(int bucket);
+
+void init_lateness_histogram(LatenessHistogram *histogram);
+
+void record_lateness(LatenessHistogram *histogram, int64_t lateness);
+
+void print_lateness_histogram(const LatenessHistogram *histogram, const char *name);
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "resampler.h"
+#include "../dsp/dsp.h"
+
+#define RESAMPLER_CUTOFF 0.9 // Of the lower Nyquist frequency, the rest is the transition band.
+#define RESAMPLER_KAISER_BETA 8.6 // About 90dB of stopband rejection.
+
+static uint32_t greatest_common_divisor(uint32_t a, uint32_t b) {
+    while (b != 0) {
+        uint32_t remainder = a % b;
+        a = b;
+        b = remainder;
+    }
+    return a;
+}
+
+/* The zeroth order modified Bessel function of the first kind, its series converges quickly. */
+static double bessel_i0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 64 && term > sum * 1e-12; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+/*
+ * Designs the prototype filter at up times the input rate and splits it into up phases of taps each.
+ * Every phase is scaled to unity gain at DC, so a constant input stays exactly constant.
+ */
+static void design_filter(Resampler *resampler) {
+    const int length = resampler->taps * resampler->up;
+    const double cutoff = RESAMPLER_CUTOFF * 0.5 / (resampler->up > resampler->down ? resampler->up : resampler->down);
+    const double center = length / 2.0; // On a tap, an output at a whole input frame takes it unfiltered.
+    const double window_norm = bessel_i0(RESAMPLER_KAISER_BETA);
+
+    for (int phase = 0; phase < resampler->up; phase++) {
+        float *coefficients = resampler->coefficients + (size_t) phase * resampler->taps;
+        double sum = 0;
+        for (int tap = 0; tap < resampler->taps; tap++) {
+            double offset = phase + (double) tap * resampler->up - center;
+            double ratio = offset / center;
+            double window = bessel_i0(RESAMPLER_KAISER_BETA * sqrt(fmax(0, 1 - ratio * ratio))) / window_norm;
+            double sinc = offset == 0 ? 1 : sin(2 * M_PI * cutoff * offset) / (2 * M_PI * cutoff * offset);
+            double coefficient = 2 * cutoff * sinc * window;
+            coefficients[resampler->taps - 1 - tap] = (float) coefficient;
+            sum += coefficient;
+        }
+        for (int tap = 0; tap < resampler->taps; tap++)
+            coefficients[tap] = (float) (coefficients[tap] / sum);
+    }
+}
+
+/* Designs the filter for the up and down set by the caller and clears the history. */
+static bool allocate_resampler(Resampler *resampler, int channels, int max_input) {
+    resampler->channels = channels;
+
+    /* A lower cutoff needs a longer filter for the same transition band, rounded up to whole vectors. */
+    int taps = RESAMPLER_TAPS;
+    if (resampler->down > resampler->up)
+        taps = (int) ((int64_t) RESAMPLER_TAPS * resampler->down / resampler->up);
+    resampler->taps = (taps + 15) & ~15;
+    resampler->max_input = max_input > resampler->taps ? max_input : resampler->taps;
+
+    resampler->coefficients = malloc((size_t) resampler->up * resampler->taps * sizeof(float));
+    if (resampler->coefficients == NULL)
+        return false;
+    design_filter(resampler);
+
+    for (int channel = 0; channel < channels; channel++) {
+        resampler->history[channel] = calloc((size_t) (resampler->taps + resampler->max_input), sizeof(float));
+        if (resampler->history[channel] == NULL) {
+            destroy_resampler(resampler);
+            return false;
+        }
+    }
+
+    /* Silence before the first frame, the filter center lands on it. */
+    resampler->filled = resampler->taps - 1;
+    resampler->position = resampler->taps - 1 + resampler->taps / 2;
+    resampler->phase = 0;
+    return true;
+}
+
+bool init_resampler(Resampler *resampler, uint32_t in_rate, uint32_t out_rate, int channels, int max_input) {
+    memset(resampler, 0, sizeof(Resampler));
+    if (in_rate == 0 || out_rate == 0 || channels < 1 || channels > RESAMPLER_MAX_CHANNELS)
+        return false;
+
+    uint32_t divisor = greatest_common_divisor(in_rate, out_rate);
+    if (out_rate / divisor > RESAMPLER_MAX_PHASES || in_rate > (uint64_t) out_rate * 8)
+        return false;
+    resampler->up = (int) (out_rate / divisor);
+    resampler->down = (int) (in_rate / divisor);
+    return allocate_resampler(resampler, channels, max_input);
+}
+
+/*
+ * A resampler from in_rate to out_rate whose ratio is trimmed while it runs, like clock drift compensation.
+ * The filter is cut at the lower Nyquist frequency, the down of its phases only sets that cutoff and the taps.
+ */
+bool init_variable_resampler(Resampler *resampler, uint32_t in_rate, uint32_t out_rate, int channels, int max_input) {
+    memset(resampler, 0, sizeof(Resampler));
+    if (in_rate == 0 || out_rate == 0 || channels < 1 || channels > RESAMPLER_MAX_CHANNELS ||
+        in_rate > (uint64_t) out_rate * 8)
+        return false;
+
+    resampler->variable = true;
+    resampler->up = RESAMPLER_VARIABLE_PHASES;
+    resampler->down = (int) (((uint64_t) RESAMPLER_VARIABLE_PHASES * in_rate + out_rate / 2) / out_rate);
+    resampler->nominal_step = (double) in_rate / out_rate;
+    resampler->step = resampler->nominal_step;
+    return allocate_resampler(resampler, channels, max_input);
+}
+
+/* Output frames per input frame against the nominal ratio, clamped to RESAMPLER_MAX_VARIABLE_RATIO around 1. */
+void set_resample_ratio(Resampler *resampler, double ratio) {
+    ratio = fmin(fmax(ratio, 1 - RESAMPLER_MAX_VARIABLE_RATIO), 1 + RESAMPLER_MAX_VARIABLE_RATIO);
+    resampler->step = resampler->nominal_step / ratio;
+}
+
+/* An upper bound of the frames resample() writes for in_frames of input. */
+int max_resampled_frames(const Resampler *resampler, int in_frames) {
+    if (resampler->variable)
+        return (int) (in_frames / resampler->nominal_step * (1 + RESAMPLER_MAX_VARIABLE_RATIO)) + 2;
+    return (int) (((int64_t) in_frames * resampler->up + resampler->down - 1) / resampler->down) + 1;
+}
+
+/* Takes up to max_input frames, returns the frames written to out, interleaved like the input. */
+int resample(Resampler *resampler, const float *in, int in_frames, float *out) {
+    const int channels = resampler->channels;
+
+    for (int channel = 0; channel < channels; channel++) {
+        float *history = resampler->history[channel] + resampler->filled;
+        for (int i = 0; i < in_frames; i++)
+            history[i] = in[i * channels + channel];
+    }
+    resampler->filled += in_frames;
+
+    int out_frames = 0;
+    while (resampler->variable && resampler->position + 1 < resampler->filled) {
+        /* Between two phases, the one past the last phase is the first one a frame later. */
+        double exact_phase = resampler->fraction * resampler->up;
+        int phase = (int) exact_phase;
+        float weight = (float) (exact_phase - phase);
+        const float *coefficients = resampler->coefficients + (size_t) phase * resampler->taps;
+        const float *next_coefficients = phase + 1 < resampler->up ? coefficients + resampler->taps
+                                                                   : resampler->coefficients;
+        const int start = resampler->position - resampler->taps + 1;
+        const int next_start = phase + 1 < resampler->up ? start : start + 1;
+        for (int channel = 0; channel < channels; channel++) {
+            const float *history = resampler->history[channel];
+            float sample = dot_product(coefficients, history + start, resampler->taps);
+            float next_sample = dot_product(next_coefficients, history + next_start, resampler->taps);
+            out[out_frames * channels + channel] = sample + (next_sample - sample) * weight;
+        }
+        out_frames++;
+
+        resampler->fraction += resampler->step;
+        int frames = (int) resampler->fraction;
+        resampler->position += frames;
+        resampler->fraction -= frames;
+    }
+
+    while (!resampler->variable && resampler->position < resampler->filled) {
+        const float *coefficients = resampler->coefficients + (size_t) resampler->phase * resampler->taps;
+        const int start = resampler->position - resampler->taps + 1;
+        for (int channel = 0; channel < channels; channel++)
+            out[out_frames * channels + channel] = dot_product(coefficients, resampler->history[channel] + start,
+                                                               resampler->taps);
+        out_frames++;
+
+        resampler->phase += resampler->down;
+        resampler->position += resampler->phase / resampler->up;
+        resampler->phase %= resampler->up;
+    }
+
+    /* Keep the taps the next output still needs. */
+    int discard = resampler->position - resampler->taps + 1;
+    if (discard > resampler->filled)
+        discard = resampler->filled;
+    if (discard > 0) {
+        for (int channel = 0; channel < channels; channel++)
+            memmove(resampler->history[channel], resampler->history[channel] + discard,
+                    (size_t) (resampler->filled - discard) * sizeof(float));
+        resampler->filled -= discard;
+        resampler->position -= discard;
+    }
+    return out_frames;
+}
+
+/* Feeds half a filter of silence, out must hold max_resampled_frames() of taps / 2. */
+int flush_resampler(Resampler *resampler, float *out) {
+    float silence[resampler->taps / 2 * resampler->channels];
+    memset(silence, 0, sizeof(silence));
+    return resample(resampler, silence, resampler->taps / 2, out);
+}
+
+void destroy_resampler(Resampler *resampler) {
+    free(resampler->coefficients);
+    for (int channel = 0; channel < RESAMPLER_MAX_CHANNELS; channel++)
+        free(resampler->history[channel]);
+    memset(resampler, 0, sizeof(Resampler));
+}
@@ -0,0 +1,70 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAPLAYER_RESAMPLER_H
+#define RAPLAYER_RESAMPLER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RESAMPLER_TAPS 64 // Taps of every phase when upsampling, downsampling widens them by the ratio.
+#define RESAMPLER_MAX_PHASES 1024
+#define RESAMPLER_MAX_CHANNELS 2
+#define RESAMPLER_VARIABLE_PHASES 256 // Of a variable ratio filter, outputs between two phases are interpolated.
+#define RESAMPLER_MAX_VARIABLE_RATIO 0.01 // How far a variable ratio may stray from the nominal one.
+
+/*
+ * A polyphase FIR resampler by the rational ratio up / down, with a Kaiser windowed sinc filter.
+ * Input is fed in interleaved blocks of up to max_input frames. The filter delay is compensated,
+ * so the output lines up with the input, and flush_resampler() pushes out what the last taps held back.
+ */
+typedef struct {
+    int channels;
+    int up, down;
+    int taps;
+    int max_input;
+    float *coefficients; // taps of every phase, reversed so they line up with the history.
+
+    bool variable; // Any ratio close to the nominal one, set by set_resample_ratio() between blocks.
+    double nominal_step; // Input frames per output frame at the nominal ratio.
+    double step; // Input frames per output frame.
+    double fraction; // Of an input frame past the position.
+
+    float *history[RESAMPLER_MAX_CHANNELS];
+    int filled; // Samples in the history of every channel.
+    int position; // History sample under the newest tap for the next output.
+    int phase;
+} Resampler;
+
+bool init_resampler(Resampler *resampler, uint32_t in_rate, uint32_t out_rate, int channels, int max_input);
+
+bool init_variable_resampler(Resampler *resampler, uint32_t in_rate, uint32_t out_rate, int channels, int max_input);
+
+void set_resample_ratio(Resampler *resampler, double ratio);
+
+int max_resampled_frames(const Resampler *resampler, int in_frames);
+
+int resample(Resampler *resampler, const float *in, int in_frames, float *out);
+
+int flush_resampler(Resampler *resampler, float *out);
+
+void destroy_resampler(Resampler *resampler);
+
+#endif
@@ -29,5 +29,13 @@ Task recvfrom_queue(TaskQueue *recv_queue) {
             free(current_task);
             return return_task;
         }
+
+        /* Gives up on a client that timed out, the handshake will fail on the empty task. */
+        if (atomic_load(&recv_queue->queue_info->heartbeat_status) == -1) {
+            Task return_task;
+            return_task.buffer[0] = '\0';
+            return_task.buffer_len = -1;
+            return return_task;
+        }
     }
 }
@@ -0,0 +1,112 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "connection_table.h"
+
+#define CONNECTION_REMOVED ((TaskQueue *) -1)
+
+static size_t hash_address(in_addr_t address, in_port_t port, size_t capacity) {
+    uint64_t key = ((uint64_t) address << 16) | port;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (size_t) key & (capacity - 1);
+}
+
+static ConnectionEntry *probe(const ConnectionTable *table, in_addr_t address, in_port_t port, bool for_insert) {
+    ConnectionEntry *removed = NULL;
+
+    for (size_t i = hash_address(address, port, table->capacity);; i = (i + 1) & (table->capacity - 1)) {
+        ConnectionEntry *entry = &table->entries[i];
+
+        if (entry->queue == NULL) {
+            if (!for_insert)
+                return NULL;
+            return removed != NULL ? removed : entry; // Reuse the first removed slot on the probe path.
+        }
+        if (entry->queue == CONNECTION_REMOVED) {
+            if (removed == NULL)
+                removed = entry;
+        } else if (entry->address == address && entry->port == port)
+            return entry;
+    }
+}
+
+static void resize(ConnectionTable *table, size_t capacity) {
+    ConnectionEntry *entries = table->entries;
+    size_t old_capacity = table->capacity;
+
+    table->capacity = capacity;
+    table->used = table->count;
+    table->entries = calloc(capacity, sizeof(ConnectionEntry));
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (entries[i].queue != NULL && entries[i].queue != CONNECTION_REMOVED)
+            *probe(table, entries[i].address, entries[i].port, true) = entries[i];
+    }
+    free(entries);
+}
+
+void init_connection_table(ConnectionTable *table) {
+    table->capacity = CONNECTION_TABLE_MIN_CAPACITY;
+    table->used = 0;
+    table->count = 0;
+    table->entries = calloc(table->capacity, sizeof(ConnectionEntry));
+}
+
+void destroy_connection_table(ConnectionTable *table) {
+    free(table->entries);
+    table->entries = NULL;
+    table->capacity = table->used = table->count = 0;
+}
+
+TaskQueue *find_connection(const ConnectionTable *table, const struct sockaddr_in *addr) {
+    const ConnectionEntry *entry = probe(table, addr->sin_addr.s_addr, addr->sin_port, false);
+    return entry != NULL ? entry->queue : NULL;
+}
+
+void add_connection(ConnectionTable *table, const struct sockaddr_in *addr, TaskQueue *queue) {
+    /* Keep the load under a half, rehashing in place if removed slots make up most of it. */
+    if ((table->used + 1) * 2 > table->capacity)
+        resize(table, (table->count + 1) * 4 > table->capacity ? table->capacity * 2 : table->capacity);
+
+    ConnectionEntry *entry = probe(table, addr->sin_addr.s_addr, addr->sin_port, true);
+    if (entry->queue == NULL)
+        table->used++;
+    if (entry->queue == NULL || entry->queue == CONNECTION_REMOVED)
+        table->count++;
+
+    entry->address = addr->sin_addr.s_addr;
+    entry->port = addr->sin_port;
+    entry->queue = queue;
+}
+
+bool remove_connection(ConnectionTable *table, const struct sockaddr_in *addr) {
+    ConnectionEntry *entry = probe(table, addr->sin_addr.s_addr, addr->sin_port, false);
+    if (entry == NULL)
+        return false;
+
+    entry->queue = CONNECTION_REMOVED;
+    table->count--;
+    return true;
+}
@@ -0,0 +1,58 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "../../ra_server.h"
+
+#ifndef RAPLAYER_CONNECTION_TABLE_H
+#define RAPLAYER_CONNECTION_TABLE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#include "../task_queue/task_queue.h"
+
+#define CONNECTION_TABLE_MIN_CAPACITY 64 // Must be a power of two.
+
+typedef struct {
+    in_addr_t address;
+    in_port_t port;
+    TaskQueue *queue; // NULL if the slot is empty, CONNECTION_REMOVED if the connection was removed.
+} ConnectionEntry;
+
+/* Open addressing hash table from a client address to its queue, probed linearly. */
+typedef struct {
+    size_t capacity;
+    size_t used; // Occupied and removed slots, both of them lengthen the probes.
+    size_t count;
+    ConnectionEntry *entries;
+} ConnectionTable;
+
+void init_connection_table(ConnectionTable *table);
+
+void destroy_connection_table(ConnectionTable *table);
+
+TaskQueue *find_connection(const ConnectionTable *table, const struct sockaddr_in *addr);
+
+void add_connection(ConnectionTable *table, const struct sockaddr_in *addr, TaskQueue *queue);
+
+bool remove_connection(ConnectionTable *table, const struct sockaddr_in *addr);
+
+#endif
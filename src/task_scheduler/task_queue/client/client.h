@@ -27,6 +27,7 @@ typedef struct {
     unsigned int client_id;
     struct sockaddr_in client_addr;
     socklen_t socket_len;
+    unsigned int aggregated_frames; // Opus frames bundled into one datagram, requested in the handshake.
 } Client;
 
 #endif
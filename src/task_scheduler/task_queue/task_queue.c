@@ -21,31 +21,77 @@
 #include "../../ra_server.h"
 
 void init_queue(int sock_fd, Client *client, TaskQueue *q) {
-    q->rear = 0;
-    q->front = 0;
+    atomic_init(&q->rear, 0);
+    atomic_init(&q->front, 0);
 
     q->queue_info = malloc(sizeof(TaskQueueInfo));
     q->queue_info->sock_fd = sock_fd;
-    q->queue_info->heartbeat_status = false;
+    atomic_init(&q->queue_info->references, 1);
+    q->queue_info->handled = false;
+    atomic_init(&q->queue_info->heartbeat_status, 0);
+    atomic_init(&q->queue_info->last_seen, get_monotonic_time());
+    init_timer(&q->queue_info->heartbeat_timer, q);
     q->queue_info->client = client;
+
+    q->queue_info->retransmit_tokens = 0;
+    clock_gettime(CLOCK_MONOTONIC, &q->queue_info->retransmit_refill_time);
+    atomic_init(&q->queue_info->retransmitted_frames, 0);
+    atomic_init(&q->queue_info->rate_limited_frames, 0);
+
+    atomic_init(&q->queue_info->sent_datagrams, 0);
+    atomic_init(&q->queue_info->sent_bytes, 0);
+    atomic_init(&q->queue_info->reported_lost_frames, 0);
+    atomic_init(&q->queue_info->reported_concealed_frames, 0);
+    atomic_init(&q->queue_info->reported_late_frames, 0);
+    atomic_init(&q->queue_info->reported_jitter, 0);
 }
 
 int is_empty(const TaskQueue *q) {
-    return (q->front == q->rear);
+    return (atomic_load_explicit(&q->front, memory_order_relaxed) ==
+            atomic_load_explicit(&q->rear, memory_order_acquire));
 }
 
 int is_full(const TaskQueue *q) {
-    return ((q->rear + 1) % MAX_QUEUE_SIZE == q->front);
+    return ((atomic_load_explicit(&q->rear, memory_order_relaxed) + 1) % MAX_QUEUE_SIZE ==
+            atomic_load_explicit(&q->front, memory_order_acquire));
 }
 
+/* Single producer, the task is stored before the new rear is published to the consumer. */
 bool append_task(TaskQueue *q, Task *task) {
     if (is_full(q)) { return false; }
-    q->rear = (q->rear + 1) % MAX_QUEUE_SIZE;
-    q->tasks[q->rear] = task;
+    int rear = (atomic_load_explicit(&q->rear, memory_order_relaxed) + 1) % MAX_QUEUE_SIZE;
+    q->tasks[rear] = task;
+    atomic_store_explicit(&q->rear, rear, memory_order_release);
     return true;
 }
 
+/* Single consumer, must only be called on a non-empty queue. */
 Task *perf_task(TaskQueue *q) {
-    q->front = (q->front + 1) % MAX_QUEUE_SIZE;
-    return q->tasks[q->front];
+    int front = (atomic_load_explicit(&q->front, memory_order_relaxed) + 1) % MAX_QUEUE_SIZE;
+    Task *task = q->tasks[front];
+    atomic_store_explicit(&q->front, front, memory_order_release);
+    return task;
+}
+
+void retain_queue(TaskQueue *q) {
+    atomic_fetch_add_explicit(&q->queue_info->references, 1, memory_order_relaxed);
+}
+
+/* Frees the queue with its client and the tasks left in it once nobody holds it anymore. */
+void release_queue(TaskQueue *q) {
+    if (atomic_fetch_sub_explicit(&q->queue_info->references, 1, memory_order_acq_rel) != 1)
+        return;
+
+    while (!is_empty(q))
+        free(perf_task(q));
+    free(q->queue_info->client);
+    free(q->queue_info);
+    free(q);
+}
+
+/* Tasks waiting in the queue, may be momentarily stale when read outside the producer or consumer. */
+int queue_depth(const TaskQueue *q) {
+    int depth = atomic_load_explicit(&q->rear, memory_order_acquire) -
+                atomic_load_explicit(&q->front, memory_order_acquire);
+    return depth < 0 ? depth + MAX_QUEUE_SIZE : depth;
 }
@@ -21,21 +21,42 @@
 #ifndef OPUSSTREAMER_SERVER_TASK_QUEUE_H
 #define OPUSSTREAMER_SERVER_TASK_QUEUE_H
 
+#include <stdatomic.h>
+
 #include "client/client.h"
 #include "task/task.h"
+#include "../../timer_wheel/timer_wheel.h"
 
 #define MAX_QUEUE_SIZE 0x7fff
 
 typedef struct {
     int sock_fd;
-    int heartbeat_status;
+    atomic_int references; // The client list, the client handler and the sender, the last one frees the queue.
+    bool handled; // Claimed by the client handler, guarded by the client list lock.
+    atomic_int heartbeat_status; // -1 once the client timed out.
+    _Atomic int64_t last_seen; // Monotonic time of the last datagram from the client.
+    TimerEntry heartbeat_timer;
     Client *client;
 
+    double retransmit_tokens; // Token bucket limiting retransmissions to this client.
+    struct timespec retransmit_refill_time;
+    atomic_ulong retransmitted_frames;
+    atomic_ulong rate_limited_frames;
+
+    atomic_ulong sent_datagrams;
+    atomic_ulong sent_bytes;
+
+    // Latest playback quality the client reported in its heartbeat.
+    atomic_ulong reported_lost_frames;
+    atomic_ulong reported_concealed_frames;
+    atomic_ulong reported_late_frames;
+    atomic_ulong reported_jitter; // Microseconds.
+
 } TaskQueueInfo;
 
 typedef struct {
-    int front;
-    int rear;
+    atomic_int front;
+    atomic_int rear;
 
     TaskQueueInfo *queue_info;
     Task *tasks[MAX_QUEUE_SIZE];
@@ -52,4 +73,10 @@ bool append_task(TaskQueue *q, Task *task);
 
 Task *perf_task(TaskQueue *q);
 
+int queue_depth(const TaskQueue *q);
+
+void retain_queue(TaskQueue *q);
+
+void release_queue(TaskQueue *q);
+
 #endif
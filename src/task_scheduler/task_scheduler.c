@@ -20,67 +20,209 @@
 
 #include "task_scheduler.h"
 
-_Noreturn void *schedule_task(void *p_task_scheduler_args) {
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+/* Resends the requested frames from the ring history, within the client's retransmission budget. */
+void retransmit_frames(const struct task_scheduler_info *task_scheduler_args, TaskQueueInfo *queue_info,
+                       const struct nack_packet *nack) {
+    struct timespec current_time;
+    clock_gettime(CLOCK_MONOTONIC, &current_time);
+
+    /* Refill the token bucket, it holds at most a quarter second of budget. */
+    double elapsed = (double) (current_time.tv_sec - queue_info->retransmit_refill_time.tv_sec) +
+                     (double) (current_time.tv_nsec - queue_info->retransmit_refill_time.tv_nsec) / 1000000000.0;
+    double burst = task_scheduler_args->retransmit_rate / 4 > 1 ? task_scheduler_args->retransmit_rate / 4 : 1;
+    queue_info->retransmit_tokens += elapsed * task_scheduler_args->retransmit_rate;
+    if (queue_info->retransmit_tokens > burst)
+        queue_info->retransmit_tokens = burst;
+    queue_info->retransmit_refill_time = current_time;
+
+    Task frame;
+    for (int i = 0; i <= NACK_BITMAP_FRAMES; i++) {
+        if (i > 0 && !(nack->bitmap & (1u << (i - 1))))
+            continue;
+
+        /* Frames gone from the history can't be resent either way, they don't count against the budget. */
+        uint64_t epoch = find_frame_epoch(task_scheduler_args->frame_ring, nack->sequence + i);
+        if (!read_frame_at(task_scheduler_args->frame_ring, epoch, &frame))
+            continue;
+
+        if (queue_info->retransmit_tokens < 1) {
+            atomic_fetch_add_explicit(&queue_info->rate_limited_frames, 1, memory_order_relaxed);
+            continue;
+        }
+
+        frame.buffer[OPUS_FLAG_SIZE] |= PACKET_FLAG_RETRANSMIT;
+        if (sendto(queue_info->sock_fd, frame.buffer, frame.buffer_len, 0,
+                   (struct sockaddr *) &queue_info->client->client_addr, queue_info->client->socket_len) >= 0) {
+            atomic_fetch_add_explicit(&queue_info->sent_datagrams, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&queue_info->sent_bytes, (unsigned long) frame.buffer_len, memory_order_relaxed);
+        }
+
+        queue_info->retransmit_tokens -= 1;
+        atomic_fetch_add_explicit(&queue_info->retransmitted_frames, 1, memory_order_relaxed);
+    }
+}
 
+/* Heartbeats only stamp the client, its timer is re-armed lazily here when it fires. */
+static void expire_heartbeat(TimerWheel *timer_wheel, TimerEntry *timer, void *p_task_scheduler_args) {
     struct task_scheduler_info *task_scheduler_args = (struct task_scheduler_info *) p_task_scheduler_args;
-    int sock_fd = task_scheduler_args->sock_fd;
+    TaskQueueInfo *queue_info = ((TaskQueue *) timer->data)->queue_info;
+
+    int64_t last_seen = atomic_load_explicit(&queue_info->last_seen, memory_order_relaxed);
+    if (timer_wheel_time(timer_wheel) - last_seen < HEARTBEAT_TIMEOUT) {
+        add_timer(timer_wheel, timer, last_seen + HEARTBEAT_TIMEOUT);
+        return;
+    }
+
+    char str_client_addr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &queue_info->client->client_addr.sin_addr, str_client_addr, sizeof(str_client_addr));
+    printf("\n%d: Connection closed by %s:%d", queue_info->client->client_id, str_client_addr,
+           ntohs(queue_info->client->client_addr.sin_port));
+    printf("\nReceiving client heartbeat timed out.\n");
+    fflush(stdout);
+
+    /* Stops the sender, a later datagram from the same address starts a new connection. */
+    atomic_store(&queue_info->heartbeat_status, -1);
+    remove_connection(&task_scheduler_args->connection_table, &queue_info->client->client_addr);
+
+    /* Gives up the client list's hold, the client handler or the sender may still be letting go of the queue. */
+    TaskQueue *recv_queue = (TaskQueue *) timer->data;
+    pthread_mutex_lock(task_scheduler_args->complete_init_queue_mutex);
+    TaskQueue **recv_queues = *task_scheduler_args->recv_queues;
     int *current_clients_count = task_scheduler_args->current_clients_count;
+    for (int i = 0; i < *current_clients_count; i++) {
+        if (recv_queues[i] == recv_queue) {
+            memmove(recv_queues + i, recv_queues + i + 1, sizeof(TaskQueue *) * (*current_clients_count - i - 1));
+            (*current_clients_count)--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(task_scheduler_args->complete_init_queue_mutex);
+    release_queue(recv_queue);
+}
+
+/* Heartbeats may carry the client's playback quality as "lost=N concealed=N late=N jitter=US". */
+static void parse_heartbeat_report(TaskQueueInfo *queue_info, const char *report, size_t report_len) {
+    char str_report[report_len + 1];
+    memcpy(str_report, report, report_len);
+    str_report[report_len] = '\0';
+
+    char *save_ptr;
+    for (char *field = strtok_r(str_report, " ", &save_ptr); field != NULL; field = strtok_r(NULL, " ", &save_ptr)) {
+        char *value = strchr(field, '=');
+        if (value == NULL)
+            continue;
+        *value++ = '\0';
+
+        unsigned long number = strtoul(value, NULL, 10);
+        if (!strcmp(field, "lost"))
+            atomic_store_explicit(&queue_info->reported_lost_frames, number, memory_order_relaxed);
+        else if (!strcmp(field, "concealed"))
+            atomic_store_explicit(&queue_info->reported_concealed_frames, number, memory_order_relaxed);
+        else if (!strcmp(field, "late"))
+            atomic_store_explicit(&queue_info->reported_late_frames, number, memory_order_relaxed);
+        else if (!strcmp(field, "jitter"))
+            atomic_store_explicit(&queue_info->reported_jitter, number, memory_order_relaxed);
+    }
+}
 
-    while (true) {
-        Task *task = malloc(sizeof(Task));
-
-        const struct sockaddr_in *p_client_addr = malloc(sizeof(struct sockaddr));
-        struct sockaddr_in client_addr = *p_client_addr;
-
-        const socklen_t *p_sock_len = malloc(sizeof(socklen_t));
-        socklen_t sock_len = *p_sock_len;
-        sock_len = sizeof(client_addr);
-
-        task->buffer_len = recvfrom(sock_fd, task->buffer, MAX_DATA_SIZE, 0, (struct sockaddr *) &client_addr,
-                                    &sock_len);
-
-        int client_id = -1;
-        for (int i = 0; i < *current_clients_count; i++) {
-            if ((strcmp(inet_ntoa(
-                                ((TaskQueue **) task_scheduler_args->recv_queues)[i]->queue_info->client->client_addr.sin_addr),
-                        inet_ntoa(client_addr.sin_addr)) == 0) &&
-                ntohs(((TaskQueue **) task_scheduler_args->recv_queues)[i]->queue_info->client->client_addr.sin_port) ==
-                ntohs(client_addr.sin_port)) {
-                client_id = i;
-                break;
-            }
+/* Hands a datagram to its client, returns whether the task was taken over. */
+static bool dispatch_task(struct task_scheduler_info *task_scheduler_args, Task *task,
+                          const struct sockaddr_in *client_addr, socklen_t sock_len, int64_t current_time) {
+    TaskQueue *recv_queue = find_connection(&task_scheduler_args->connection_table, client_addr);
+
+    if (recv_queue == NULL) {
+        recv_queue = malloc(sizeof(TaskQueue));
+
+        Client *client = malloc(sizeof(Client));
+        client->client_addr = *client_addr;
+        client->socket_len = sock_len;
+        client->aggregated_frames = 1;
+
+        init_queue(task_scheduler_args->sock_fd, client, recv_queue);
+        append_task(recv_queue, task);
+
+        add_connection(&task_scheduler_args->connection_table, client_addr, recv_queue);
+        add_timer(&task_scheduler_args->timer_wheel, &recv_queue->queue_info->heartbeat_timer,
+                  current_time + HEARTBEAT_TIMEOUT);
+
+        /* Client ids are global, the client handler reads the queue list, so it only changes under the lock. */
+        int *current_clients_count = task_scheduler_args->current_clients_count;
+        pthread_mutex_lock(task_scheduler_args->complete_init_queue_mutex);
+        client->client_id = ++(*task_scheduler_args->last_client_id);
+        *task_scheduler_args->recv_queues = realloc(*task_scheduler_args->recv_queues,
+                                                    sizeof(TaskQueue *) * (*current_clients_count + 1));
+        (*task_scheduler_args->recv_queues)[*current_clients_count] = recv_queue;
+        (*current_clients_count) += 1;
+
+        char str_client_addr[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr->sin_addr, str_client_addr, sizeof(str_client_addr));
+        printf("\n%d: Connection from %s:%d\n", client->client_id, str_client_addr, ntohs(client_addr->sin_port));
+        fflush(stdout);
+
+        pthread_cond_signal(task_scheduler_args->complete_init_queue_cond);
+        pthread_mutex_unlock(task_scheduler_args->complete_init_queue_mutex);
+        return true;
+    }
+
+    atomic_store_explicit(&recv_queue->queue_info->last_seen, current_time, memory_order_relaxed);
+
+    /* Heartbeats and NACKs are consumed here, their task buffer is reused for the next datagram. */
+    struct nack_packet nack;
+    if (!strncmp(task->buffer, HEARTBEAT, sizeof(HEARTBEAT))) {
+        if (task->buffer_len > (ssize_t) sizeof(HEARTBEAT))
+            parse_heartbeat_report(recv_queue->queue_info, task->buffer + sizeof(HEARTBEAT),
+                                   task->buffer_len - sizeof(HEARTBEAT));
+        return false;
+    }
+    if (parse_nack_packet(&nack, (unsigned char *) task->buffer, task->buffer_len)) {
+        if (task_scheduler_args->retransmit_rate > 0)
+            retransmit_frames(task_scheduler_args, recv_queue->queue_info, &nack);
+        return false;
+    }
+    return append_task(recv_queue, task);
+}
+
+void *schedule_task(void *p_task_scheduler_args) {
+    struct task_scheduler_info *task_scheduler_args = (struct task_scheduler_info *) p_task_scheduler_args;
+    TimerWheel *timer_wheel = &task_scheduler_args->timer_wheel;
+    NetReceiver *receiver = &task_scheduler_args->receiver;
+
+    init_connection_table(&task_scheduler_args->connection_table);
+    init_timer_wheel(timer_wheel, get_monotonic_time(), HEARTBEAT_TICK);
+
+    Task *tasks[NET_RECEIVE_BATCH_SIZE] = {NULL};
+    struct sockaddr_in client_addrs[NET_RECEIVE_BATCH_SIZE];
+    socklen_t sock_lens[NET_RECEIVE_BATCH_SIZE];
+
+    while (!atomic_load(task_scheduler_args->stopping)) {
+        int64_t current_time = get_monotonic_time();
+        advance_timer_wheel(timer_wheel, current_time, expire_heartbeat, task_scheduler_args);
+
+        /* Wake up at least once a tick to expire the silent clients. */
+        int timeout = (int) ((next_tick_time(timer_wheel) - current_time + 999999L) / 1000000L);
+
+        for (int i = 0; i < NET_RECEIVE_BATCH_SIZE; i++) {
+            if (tasks[i] == NULL)
+                tasks[i] = malloc(sizeof(Task));
         }
 
-        if (client_id == -1) {
-            (*current_clients_count) += 1;
-
-            printf("\n%d: Connection from %s:%d\n", *current_clients_count, inet_ntoa(client_addr.sin_addr),
-                   ntohs(client_addr.sin_port));
-            fflush(stdout);
-
-            (task_scheduler_args->recv_queues) = realloc(((TaskQueue **) task_scheduler_args->recv_queues),
-                                                         sizeof(TaskQueue *) * (*current_clients_count));
-            ((TaskQueue **) task_scheduler_args->recv_queues)[(*current_clients_count) - 1] = malloc(sizeof(TaskQueue));
-
-            Client *client = malloc(sizeof(Client));
-            client->client_id = *current_clients_count;
-            client->client_addr = client_addr;
-            client->socket_len = sock_len;
-
-            init_queue(sock_fd, client,
-                       ((TaskQueue **) task_scheduler_args->recv_queues)[(*current_clients_count) - 1]);
-            append_task(((TaskQueue **) task_scheduler_args->recv_queues)[(*current_clients_count) - 1], task);
-
-            pthread_mutex_lock(((struct task_scheduler_info *) p_task_scheduler_args)->complete_init_queue_mutex);
-            pthread_cond_signal(((struct task_scheduler_info *) p_task_scheduler_args)->complete_init_queue_cond);
-            pthread_mutex_unlock(((struct task_scheduler_info *) p_task_scheduler_args)->complete_init_queue_mutex);
-        } else {
-            if (!strncmp(task->buffer, HEARTBEAT, sizeof(HEARTBEAT)))
-                ((TaskQueue **) task_scheduler_args->recv_queues)[client_id]->queue_info->heartbeat_status = true;
-            else
-                append_task(((TaskQueue **) task_scheduler_args->recv_queues)[client_id], task);
+        int count = receive_datagrams(receiver, tasks, client_addrs, sock_lens, timeout);
+        if (count <= 0)
+            continue;
+        atomic_fetch_add_explicit(&task_scheduler_args->received_datagrams, (unsigned long) count,
+                                  memory_order_relaxed);
+        atomic_store_explicit(&task_scheduler_args->dropped_datagrams, receiver->dropped_datagrams,
+                              memory_order_relaxed);
+
+        current_time = get_monotonic_time();
+        for (int i = 0; i < count; i++) {
+            if (dispatch_task(task_scheduler_args, tasks[i], &client_addrs[i], sock_lens[i], current_time))
+                tasks[i] = NULL;
         }
     }
+
+    for (int i = 0; i < NET_RECEIVE_BATCH_SIZE; i++)
+        free(tasks[i]);
+    destroy_connection_table(&task_scheduler_args->connection_table);
+    return NULL;
 }
@@ -18,16 +18,35 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include "../ra_server.h"
+
 #ifndef OPUSSTREAMER_SERVER_TASK_SCHEDULER_H
 #define OPUSSTREAMER_SERVER_TASK_SCHEDULER_H
-
-#include "../ra_server.h"
 #include "task_queue/task_queue.h"
+#include "connection_table/connection_table.h"
+#include "../timer_wheel/timer_wheel.h"
+#include "../net_backend/net_backend.h"
+
+#define MAX_INGRESS_SHARDS 64
 
+/* One ingress shard, a socket bound with SO_REUSEPORT and the thread draining it. */
 struct task_scheduler_info {
+    int shard_id;
     int sock_fd;
+    NetReceiver receiver;
+    const atomic_bool *stopping; // The client handler is done with the queues.
     int *current_clients_count;
-    TaskQueue **recv_queues;
+    TaskQueue ***recv_queues; // Shared by all shards, changes under complete_init_queue_mutex.
+    int *last_client_id; // Ids aren't reused, also under complete_init_queue_mutex.
+
+    FrameRing *frame_ring;
+    double retransmit_rate; // Retransmitted frames per second allowed for each client.
+
+    ConnectionTable connection_table; // Live clients by address, owned by the scheduler thread.
+    TimerWheel timer_wheel; // Heartbeat expiry of the live clients.
+
+    atomic_ulong received_datagrams;
+    atomic_ulong dropped_datagrams; // Dropped by the kernel on a full socket buffer, reported by SO_RXQ_OVFL.
 
     pthread_mutex_t *complete_init_queue_mutex;
     pthread_cond_t *complete_init_queue_cond;
@@ -37,20 +56,18 @@ struct client_handler_info {
     int *current_clients_count;
     TaskQueue ***recv_queues;
     struct pcm *pcm_struct;
+    uint32_t frame_duration;
     unsigned char *crypto_payload;
 
-    bool *stop_consumer;
-    pthread_t *stream_consumer;
+    atomic_bool *listening; // Set once the first client completed the handshake.
+    const atomic_bool *stopping;
 
     pthread_mutex_t *complete_init_mutex[2];
-    pthread_mutex_t *opus_sender_mutex;
-
     pthread_cond_t *complete_init_cond[2];
-    pthread_cond_t *opus_sender_cond;
 
-    Task *opus_frame;
+    struct opus_sender_args *opus_sender_args;
 };
 
-_Noreturn void *schedule_task(void *p_task_scheduler_args);
+void *schedule_task(void *p_task_scheduler_args);
 
 #endif
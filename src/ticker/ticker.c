@@ -0,0 +1,152 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ticker.h"
+#include "../timer_wheel/timer_wheel.h"
+#include "../tracer/tracer.h"
+
+/* Waits for the monotonic deadline, or for the jobs to change. */
+static void wait_until(Ticker *ticker, int64_t deadline) {
+    struct timespec timespec;
+#ifdef __linux__
+    timespec.tv_sec = deadline / 1000000000L;
+    timespec.tv_nsec = deadline % 1000000000L;
+#else
+    /* The condition waits on the wall clock here, the deadline is moved over to it. */
+    clock_gettime(CLOCK_REALTIME, &timespec);
+    int64_t time = (int64_t) timespec.tv_sec * 1000000000L + timespec.tv_nsec + deadline - get_monotonic_time();
+    timespec.tv_sec = time / 1000000000L;
+    timespec.tv_nsec = time % 1000000000L;
+#endif
+    pthread_cond_timedwait(&ticker->cond, &ticker->mutex, &timespec);
+}
+
+static void *run_ticker(void *p_ticker) {
+    Ticker *ticker = (Ticker *) p_ticker;
+
+    enter_realtime(&ticker->realtime, "ticker", 0, REALTIME_PRIORITY + 1);
+    trace_thread("ticker");
+
+    pthread_mutex_lock(&ticker->mutex);
+    while (!ticker->stopping) {
+        TickerJob *due_job = ticker->jobs;
+        for (TickerJob *job = ticker->jobs; job != NULL; job = job->next) {
+            if (job->next_time < due_job->next_time)
+                due_job = job;
+        }
+
+        if (due_job == NULL)
+            pthread_cond_wait(&ticker->cond, &ticker->mutex);
+        else if (due_job->next_time > get_monotonic_time())
+            wait_until(ticker, due_job->next_time);
+        else {
+            due_job->function(due_job->data, due_job->tick++, due_job->next_time);
+            due_job->next_time += due_job->interval;
+        }
+    }
+    pthread_mutex_unlock(&ticker->mutex);
+    return NULL;
+}
+
+bool start_ticker(Ticker *ticker, const struct realtime_config *realtime) {
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+#ifdef __linux__
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+#endif
+    pthread_cond_init(&ticker->cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    pthread_mutex_init(&ticker->mutex, NULL);
+
+    ticker->jobs = NULL;
+    ticker->stopping = false;
+    ticker->realtime = *realtime;
+
+    if (pthread_create(&ticker->thread, NULL, run_ticker, ticker) != 0) {
+        pthread_cond_destroy(&ticker->cond);
+        pthread_mutex_destroy(&ticker->mutex);
+        return false;
+    }
+    return true;
+}
+
+void stop_ticker(Ticker *ticker) {
+    pthread_mutex_lock(&ticker->mutex);
+    ticker->stopping = true;
+    pthread_cond_signal(&ticker->cond);
+    pthread_mutex_unlock(&ticker->mutex);
+
+    pthread_join(ticker->thread, NULL);
+    pthread_cond_destroy(&ticker->cond);
+    pthread_mutex_destroy(&ticker->mutex);
+}
+
+/* The first tick is due one interval from now. */
+void add_ticker_job(Ticker *ticker, TickerJob *job, int64_t interval, TickFunction function, void *data) {
+    job->function = function;
+    job->data = data;
+    job->interval = interval;
+    job->tick = 0;
+
+    pthread_mutex_lock(&ticker->mutex);
+    job->next_time = get_monotonic_time() + interval;
+    job->next = ticker->jobs;
+    ticker->jobs = job;
+    pthread_cond_signal(&ticker->cond);
+    pthread_mutex_unlock(&ticker->mutex);
+}
+
+/* Once it returns, the job's function is not running and won't be called again. */
+void remove_ticker_job(Ticker *ticker, TickerJob *job) {
+    pthread_mutex_lock(&ticker->mutex);
+    for (TickerJob **p_job = &ticker->jobs; *p_job != NULL; p_job = &(*p_job)->next) {
+        if (*p_job == job) {
+            *p_job = job->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ticker->mutex);
+}
+
+RaTicker *create_ra_ticker(bool realtime, const char *cpus) {
+    struct realtime_config realtime_config = {0};
+    realtime_config.enabled = realtime;
+    if (cpus != NULL && !parse_cpu_list(cpus, &realtime_config)) {
+        printf("Invalid argument: CPUs must be a list of up to %d CPU numbers, like \"2,3\".\n", REALTIME_MAX_CPUS);
+        return NULL;
+    }
+
+    Ticker *ticker = malloc(sizeof(Ticker));
+    if (ticker == NULL || !start_ticker(ticker, &realtime_config)) {
+        printf("Error: Failed to start the ticker.\n");
+        free(ticker);
+        return NULL;
+    }
+    return ticker;
+}
+
+/* Every engine using the ticker must be destroyed first. */
+void destroy_ra_ticker(RaTicker *ticker) {
+    stop_ticker(ticker);
+    free(ticker);
+}
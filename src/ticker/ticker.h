@@ -0,0 +1,65 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "../ra_server.h"
+
+#ifndef RAPLAYER_TICKER_H
+#define RAPLAYER_TICKER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "../realtime/realtime.h"
+
+/* Called on the ticker's thread with the ticker locked, it must return quickly and not touch the ticker. */
+typedef void (*TickFunction)(void *data, uint64_t tick, int64_t scheduled_time);
+
+typedef struct ticker_job {
+    TickFunction function;
+    void *data;
+    int64_t interval; // Nanoseconds.
+    int64_t next_time; // Monotonic time the next tick is due.
+    uint64_t tick;
+    struct ticker_job *next;
+} TickerJob;
+
+/*
+ * One thread running the periodic jobs of many engines, each on absolute deadlines so it never accumulates the
+ * time spent running the others. A late tick is still run, then the job carries on from its schedule.
+ */
+typedef struct ra_ticker {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // Waits on the monotonic clock where the platform allows it.
+    TickerJob *jobs;
+    bool stopping;
+    struct realtime_config realtime;
+} Ticker;
+
+bool start_ticker(Ticker *ticker, const struct realtime_config *realtime);
+
+void stop_ticker(Ticker *ticker);
+
+void add_ticker_job(Ticker *ticker, TickerJob *job, int64_t interval, TickFunction function, void *data);
+
+void remove_ticker_job(Ticker *ticker, TickerJob *job);
+
+#endif
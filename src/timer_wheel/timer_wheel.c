@@ -0,0 +1,145 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <time.h>
+
+#include "timer_wheel.h"
+
+int64_t get_monotonic_time(void) {
+    struct timespec timespec;
+    clock_gettime(CLOCK_MONOTONIC, &timespec);
+    return (int64_t) timespec.tv_sec * 1000000000L + timespec.tv_nsec;
+}
+
+void init_timer_wheel(TimerWheel *wheel, int64_t current_time, long tick) {
+    wheel->current_tick = 0;
+    wheel->start_time = current_time;
+    wheel->tick = tick;
+
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+            wheel->slots[level][slot].prev = wheel->slots[level][slot].next = &wheel->slots[level][slot];
+}
+
+void init_timer(TimerEntry *entry, void *data) {
+    entry->prev = entry->next = NULL;
+    entry->expires = 0;
+    entry->data = data;
+}
+
+bool timer_pending(const TimerEntry *entry) {
+    return entry->next != NULL;
+}
+
+static void link_timer(TimerWheel *wheel, TimerEntry *entry) {
+    uint64_t expires = entry->expires;
+    int level = 0;
+
+    /* A timer lives on the lowest level whose upper bits still match the current tick. */
+    while (level < TIMER_WHEEL_LEVELS &&
+           (expires >> (TIMER_WHEEL_BITS * (level + 1))) != (wheel->current_tick >> (TIMER_WHEEL_BITS * (level + 1))))
+        level++;
+
+    /* Timers beyond the last level wait in the farthest slot and get re-sorted when it is cascaded. */
+    if (level == TIMER_WHEEL_LEVELS) {
+        level = TIMER_WHEEL_LEVELS - 1;
+        expires = wheel->current_tick - (1ULL << (TIMER_WHEEL_BITS * level));
+    }
+
+    TimerEntry *head = &wheel->slots[level][(expires >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+    entry->next = head;
+    entry->prev = head->prev;
+    head->prev->next = entry;
+    head->prev = entry;
+}
+
+void add_timer(TimerWheel *wheel, TimerEntry *entry, int64_t expire_time) {
+    if (timer_pending(entry))
+        del_timer(entry);
+
+    int64_t ticks = (expire_time - wheel->start_time + wheel->tick - 1) / wheel->tick;
+    entry->expires = ticks > (int64_t) wheel->current_tick ? (uint64_t) ticks : wheel->current_tick + 1;
+    link_timer(wheel, entry);
+}
+
+void del_timer(TimerEntry *entry) {
+    if (!timer_pending(entry))
+        return;
+
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+int64_t timer_wheel_time(const TimerWheel *wheel) {
+    return wheel->start_time + (int64_t) wheel->current_tick * wheel->tick;
+}
+
+int64_t next_tick_time(const TimerWheel *wheel) {
+    return timer_wheel_time(wheel) + wheel->tick;
+}
+
+/* Detaches a whole slot, so callbacks may re-add timers while it is being processed. */
+static TimerEntry *take_slot(TimerEntry *head) {
+    if (head->next == head)
+        return NULL;
+
+    TimerEntry *first = head->next;
+    head->prev->next = NULL;
+    head->prev = head->next = head;
+    return first;
+}
+
+static void cascade(TimerWheel *wheel, int level) {
+    TimerEntry *entry = take_slot(
+            &wheel->slots[level][(wheel->current_tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)]);
+
+    while (entry != NULL) {
+        TimerEntry *next = entry->next;
+        link_timer(wheel, entry);
+        entry = next;
+    }
+}
+
+void advance_timer_wheel(TimerWheel *wheel, int64_t current_time, timer_callback callback, void *arg) {
+    while (timer_wheel_time(wheel) + wheel->tick <= current_time) {
+        wheel->current_tick++;
+
+        /* Pull the upper levels down, highest first, whenever the levels below wrap around. */
+        int top = 0;
+        while (top + 1 < TIMER_WHEEL_LEVELS &&
+               (wheel->current_tick & ((1ULL << (TIMER_WHEEL_BITS * (top + 1))) - 1)) == 0)
+            top++;
+        for (int level = top; level >= 1; level--)
+            cascade(wheel, level);
+
+        TimerEntry *entry = take_slot(&wheel->slots[0][wheel->current_tick & (TIMER_WHEEL_SLOTS - 1)]);
+        while (entry != NULL) {
+            TimerEntry *next = entry->next;
+            entry->prev = entry->next = NULL;
+
+            if (entry->expires <= wheel->current_tick)
+                callback(wheel, entry, arg);
+            else
+                link_timer(wheel, entry); // Parked beyond the last level, not due yet.
+            entry = next;
+        }
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAPLAYER_TIMER_WHEEL_H
+#define RAPLAYER_TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TIMER_WHEEL_BITS 8
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 3 // 2^24 ticks, about 46 hours with 10ms ticks.
+
+typedef struct timer_entry {
+    struct timer_entry *prev;
+    struct timer_entry *next;
+
+    uint64_t expires; // In ticks.
+    void *data;
+} TimerEntry;
+
+/*
+ * Hierarchical timer wheel: level 0 holds timers due within 256 ticks, every upper level covers 256 times more.
+ * Timers on an upper level are cascaded down when the lower level wraps around,
+ * so adding, deleting and expiring are O(1) regardless of the number of timers.
+ */
+typedef struct {
+    uint64_t current_tick;
+    int64_t start_time;
+    long tick; // Nanoseconds per tick.
+
+    TimerEntry slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // List heads.
+} TimerWheel;
+
+typedef void (*timer_callback)(TimerWheel *wheel, TimerEntry *entry, void *arg);
+
+int64_t get_monotonic_time(void);
+
+void init_timer_wheel(TimerWheel *wheel, int64_t current_time, long tick);
+
+void init_timer(TimerEntry *entry, void *data);
+
+bool timer_pending(const TimerEntry *entry);
+
+void add_timer(TimerWheel *wheel, TimerEntry *entry, int64_t expire_time);
+
+void del_timer(TimerEntry *entry);
+
+int64_t timer_wheel_time(const TimerWheel *wheel);
+
+int64_t next_tick_time(const TimerWheel *wheel);
+
+void advance_timer_wheel(TimerWheel *wheel, int64_t current_time, timer_callback callback, void *arg);
+
+#endif
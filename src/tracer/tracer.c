@@ -0,0 +1,204 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "tracer.h"
+
+bool tracing = false;
+
+static const char *trace_path;
+static const char *trace_process_name;
+static int64_t realtime_offset; // Added to monotonic times, so traces of different hosts line up on the wall clock.
+
+static _Atomic(TraceRing *) trace_rings = NULL;
+static atomic_int next_thread_id = 1;
+static _Thread_local TraceRing *thread_ring = NULL;
+static pthread_mutex_t dump_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int dump_pipe[2];
+
+static const char *const trace_event_names[TRACE_EVENTS] = {
+        "tick", "read", "encode", "encrypt", "publish", "send", "receive", "decrypt", "decode", "write", "complexity"
+};
+
+static int64_t clock_time(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (int64_t) now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/* Any thread may take the signal, the handler only wakes the dump thread up as nothing else is async-signal-safe. */
+static void request_dump(int signal) {
+    int saved_errno = errno;
+    char request = 1;
+    write(dump_pipe[1], &request, sizeof(request));
+    errno = saved_errno;
+}
+
+static void *wait_dump_request(void *unused) {
+    char request;
+    while (read(dump_pipe[0], &request, sizeof(request)) != 0) {
+        if (dump_trace())
+            printf("\nTrace written to %s\n", trace_path);
+        fflush(stdout);
+    }
+    return NULL;
+}
+
+bool init_tracer(const char *path, const char *process_name) {
+    trace_path = path;
+    trace_process_name = process_name;
+    realtime_offset = clock_time(CLOCK_REALTIME) - clock_time(CLOCK_MONOTONIC);
+
+    if (pipe(dump_pipe) < 0)
+        return false;
+
+    pthread_t dump_request_waiter;
+    pthread_attr_t dump_request_waiter_attr;
+    pthread_attr_init(&dump_request_waiter_attr);
+    pthread_attr_setdetachstate(&dump_request_waiter_attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&dump_request_waiter, &dump_request_waiter_attr, wait_dump_request, NULL) != 0)
+        return false;
+
+    struct sigaction action = {0};
+    action.sa_handler = request_dump;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(TRACE_DUMP_SIGNAL, &action, NULL);
+
+    tracing = true;
+    return true;
+}
+
+/* Gives the calling thread its own ring, rings are never freed so a dump can always read them. */
+void trace_thread(const char *name) {
+    if (!tracing || thread_ring != NULL)
+        return;
+
+    TraceRing *ring = calloc(1, sizeof(TraceRing));
+    if (ring == NULL)
+        return;
+    ring->name = name;
+    ring->thread_id = atomic_fetch_add(&next_thread_id, 1);
+    atomic_init(&ring->head, 0);
+
+    ring->next = atomic_load(&trace_rings);
+    while (!atomic_compare_exchange_weak(&trace_rings, &ring->next, ring));
+    thread_ring = ring;
+}
+
+static void append_record(TraceEvent event, uint32_t sequence, int64_t start, int64_t duration) {
+    if (thread_ring == NULL) {
+        trace_thread("thread");
+        if (thread_ring == NULL)
+            return;
+    }
+
+    uint64_t head = atomic_load_explicit(&thread_ring->head, memory_order_relaxed);
+    TraceRecord *record = &thread_ring->records[head & (TRACE_RING_SIZE - 1)];
+    record->start = start;
+    record->duration = duration;
+    record->sequence = sequence;
+    record->event = event;
+    atomic_store_explicit(&thread_ring->head, head + 1, memory_order_release);
+}
+
+void record_trace(TraceEvent event, uint32_t sequence, int64_t start) {
+    append_record(event, sequence, start, clock_time(CLOCK_MONOTONIC) - start);
+}
+
+void record_counter(TraceEvent event, uint32_t sequence, int64_t value) {
+    append_record(event, sequence, clock_time(CLOCK_MONOTONIC), value);
+}
+
+static void write_record(FILE *out, const TraceRecord *record, int pid, int thread_id) {
+    double timestamp = (double) (record->start + realtime_offset) / 1000.0;
+
+    if (record->event == TRACE_COMPLEXITY) {
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"encoder\",\"ph\":\"C\",\"pid\":%d,\"ts\":%.3f,"
+                     "\"args\":{\"value\":%lld}}", trace_event_names[record->event], pid, timestamp,
+                (long long) record->duration);
+        return;
+    }
+
+    fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                 "\"args\":{\"seq\":%u}}", trace_event_names[record->event], pid, thread_id, timestamp,
+            (double) record->duration / 1000.0, record->sequence);
+
+    /* Flows from the server's send to the client's receive of the same frame, once both traces are merged. */
+    if (record->event == TRACE_SEND)
+        fprintf(out, ",\n{\"name\":\"frame\",\"cat\":\"network\",\"ph\":\"s\",\"id\":%u,\"pid\":%d,\"tid\":%d,"
+                     "\"ts\":%.3f}", record->sequence, pid, thread_id, timestamp);
+    else if (record->event == TRACE_RECEIVE)
+        fprintf(out, ",\n{\"name\":\"frame\",\"cat\":\"network\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%u,\"pid\":%d,"
+                     "\"tid\":%d,\"ts\":%.3f}", record->sequence, pid, thread_id, timestamp);
+}
+
+/* Writes every ring as Chrome trace JSON, loadable in Perfetto. Threads keep recording meanwhile. */
+bool dump_trace(void) {
+    if (!tracing)
+        return false;
+
+    pthread_mutex_lock(&dump_mutex);
+    size_t temp_path_len = strlen(trace_path) + sizeof(".tmp");
+    char temp_path[temp_path_len];
+    snprintf(temp_path, temp_path_len, "%s.tmp", trace_path);
+
+    FILE *out = fopen(temp_path, "w");
+    if (out == NULL) {
+        printf("Error: Failed to write the trace: %s\n", strerror(errno));
+        pthread_mutex_unlock(&dump_mutex);
+        return false;
+    }
+
+    const int pid = getpid();
+    fprintf(out, "[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}", pid,
+            trace_process_name);
+
+    for (TraceRing *ring = atomic_load(&trace_rings); ring != NULL; ring = ring->next) {
+        fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                pid, ring->thread_id, ring->name);
+
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t tail = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        for (uint64_t i = tail; i < head; i++) {
+            TraceRecord record = ring->records[i & (TRACE_RING_SIZE - 1)];
+
+            /* The oldest records may have been overwritten while they were copied. */
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&ring->head, memory_order_relaxed) - i > TRACE_RING_SIZE - 1)
+                continue;
+            write_record(out, &record, pid, ring->thread_id);
+        }
+    }
+    fprintf(out, "\n]\n");
+
+    bool written = fclose(out) == 0 && rename(temp_path, trace_path) == 0;
+    if (!written)
+        printf("Error: Failed to write the trace: %s\n", strerror(errno));
+    pthread_mutex_unlock(&dump_mutex);
+    return written;
+}
@@ -0,0 +1,99 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAPLAYER_TRACER_H
+#define RAPLAYER_TRACER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <signal.h>
+
+#define TRACE_RING_SIZE 65536 // Events kept per thread, must be a power of two.
+#define TRACE_DUMP_SIGNAL SIGUSR1
+
+typedef enum {
+    TRACE_TICK, // The opus timer woke up.
+    TRACE_READ,
+    TRACE_ENCODE,
+    TRACE_ENCRYPT,
+    TRACE_PUBLISH,
+    TRACE_SEND,
+    TRACE_RECEIVE,
+    TRACE_DECRYPT,
+    TRACE_DECODE,
+    TRACE_WRITE, // Pa_WriteStream, blocks while the device buffer is full.
+    TRACE_COMPLEXITY, // A counter, the encoder complexity from this frame on.
+    TRACE_EVENTS
+} TraceEvent;
+
+typedef struct {
+    int64_t start; // Monotonic nanoseconds.
+    int64_t duration; // The value of a counter.
+    uint32_t sequence; // Frame sequence number, shared by the server and client traces.
+    TraceEvent event;
+} TraceRecord;
+
+/* Events of one thread, written by that thread only and read by the dump. */
+typedef struct TraceRing {
+    struct TraceRing *next;
+    const char *name;
+    int thread_id;
+
+    _Atomic uint64_t head; // Records written so far, the newest is at head - 1.
+    TraceRecord records[TRACE_RING_SIZE];
+} TraceRing;
+
+extern bool tracing; // Set once before any traced thread starts.
+
+/* Writes the trace to path on exit, or whenever TRACE_DUMP_SIGNAL arrives. */
+
+bool init_tracer(const char *path, const char *process_name);
+
+void trace_thread(const char *name);
+
+void record_trace(TraceEvent event, uint32_t sequence, int64_t start);
+
+void record_counter(TraceEvent event, uint32_t sequence, int64_t value);
+
+bool dump_trace(void);
+
+/* Start time of a traced section, 0 when tracing is off so the hot path only pays a branch. */
+static inline int64_t trace_begin(void) {
+    if (!tracing)
+        return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static inline void trace_end(TraceEvent event, uint32_t sequence, int64_t start) {
+    if (tracing)
+        record_trace(event, sequence, start);
+}
+
+/* Records a counter's value from now on, drawn as a track of its own. */
+static inline void trace_counter(TraceEvent event, uint32_t sequence, int64_t value) {
+    if (tracing)
+        record_counter(event, sequence, value);
+}
+
+#endif
@@ -0,0 +1,475 @@
+/*
+ raplayer is a cross-platform remote audio player, written from the scratch.
+ This file is part of raplayer.
+
+ Copyright (C) 2021 Rhnn Hur (hurrhnn)
+
+    raplayer is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * A UDP proxy that impairs the traffic between a raplayer server and its clients, for testing on loopback.
+ *
+ * Every client gets its own socket towards the server, so the server still sees one address per client, and its own
+ * link state: the Gilbert-Elliott loss state and the rate limited queue. Datagrams from the server are impaired,
+ * the ones from the clients only with --both. A fixed --seed makes the loss and delay pattern reproducible.
+ * With --arrivals it logs when each opus datagram of the server arrived, before it is impaired.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define IMPAIR_MAX_CLIENTS 256
+#define IMPAIR_MAX_DATAGRAM 65536
+#define IMPAIR_QUEUE_LIMIT 200000000L // Nanoseconds a rate limited link may queue before it drops.
+
+#define ARRIVAL_FLAG "OPUS"
+#define ARRIVAL_HEADER_SIZE 10 // "OPUS", flags, frame count and the little-endian sequence of the first frame.
+#define ARRIVAL_RETRANSMIT 0x01
+
+struct impairment {
+    double loss; // Random loss in percent.
+    bool gilbert; // Gilbert-Elliott bursty loss instead of random loss.
+    double gilbert_p, gilbert_r; // Chances per datagram to enter and leave the bad state.
+    double bad_loss, good_loss; // Loss in each state.
+    double delay, jitter; // Milliseconds, the jitter is spread evenly around the delay.
+    double reorder, reorder_delay; // Held datagrams in percent, and how long they are held.
+    double duplicate;
+    double rate; // Kilobits per second of each link, 0 for no limit.
+    bool both; // Impair the datagrams from the clients too.
+    unsigned long spare; // Datagrams each client exchanges unimpaired first, the handshake is not retried.
+};
+
+struct impair_link {
+    unsigned long datagrams;
+    bool bad_state;
+    int64_t free_time; // When the rate limited link has sent everything queued.
+};
+
+struct impair_client {
+    struct sockaddr_in addr;
+    int upstream_fd;
+    struct impair_link links[2]; // Indexed by the direction.
+};
+
+enum impair_direction {
+    UPSTREAM, // Client to server.
+    DOWNSTREAM
+};
+
+struct impair_stats {
+    unsigned long received, sent, lost, rate_dropped, duplicated, reordered;
+    unsigned long memory_dropped; // Couldn't be queued, out of memory.
+};
+
+struct impaired_datagram {
+    int64_t release_time;
+    uint64_t order; // Keeps datagrams released at the same time in order.
+    int client;
+    enum impair_direction direction;
+    size_t len;
+    unsigned char data[];
+};
+
+struct datagram_heap {
+    struct impaired_datagram **datagrams;
+    size_t count, capacity;
+    uint64_t next_order;
+};
+
+static volatile sig_atomic_t running = 1;
+static uint64_t random_state;
+
+static void stop_proxy(int signal) {
+    (void) signal;
+    running = 0;
+}
+
+static int64_t impair_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/* xorshift64*, the same sequence on every platform for a given seed. */
+static double random_percent(void) {
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return (double) ((random_state * 0x2545F4914F6CDD1DULL) >> 11) / (double) (1ULL << 53) * 100;
+}
+
+static bool heap_before(const struct impaired_datagram *a, const struct impaired_datagram *b) {
+    return a->release_time < b->release_time || (a->release_time == b->release_time && a->order < b->order);
+}
+
+/* Returns false if the heap can't grow, the datagram isn't queued then. */
+static bool heap_push(struct datagram_heap *heap, struct impaired_datagram *datagram) {
+    if (heap->count == heap->capacity) {
+        size_t capacity = heap->capacity ? heap->capacity * 2 : 1024;
+        struct impaired_datagram **datagrams = realloc(heap->datagrams, capacity * sizeof(*heap->datagrams));
+        if (datagrams == NULL)
+            return false;
+        heap->datagrams = datagrams;
+        heap->capacity = capacity;
+    }
+    datagram->order = heap->next_order++;
+
+    size_t i = heap->count++;
+    for (; i > 0 && heap_before(datagram, heap->datagrams[(i - 1) / 2]); i = (i - 1) / 2)
+        heap->datagrams[i] = heap->datagrams[(i - 1) / 2];
+    heap->datagrams[i] = datagram;
+    return true;
+}
+
+static struct impaired_datagram *heap_pop(struct datagram_heap *heap) {
+    struct impaired_datagram *top = heap->datagrams[0];
+    struct impaired_datagram *last = heap->datagrams[--heap->count];
+
+    size_t i = 0;
+    for (size_t child; (child = 2 * i + 1) < heap->count; i = child) {
+        if (child + 1 < heap->count && heap_before(heap->datagrams[child + 1], heap->datagrams[child]))
+            child++;
+        if (!heap_before(heap->datagrams[child], last))
+            break;
+        heap->datagrams[i] = heap->datagrams[child];
+    }
+    if (heap->count > 0)
+        heap->datagrams[i] = last;
+    return top;
+}
+
+static bool is_lost(const struct impairment *impairment, struct impair_link *link) {
+    if (!impairment->gilbert)
+        return impairment->loss > 0 && random_percent() < impairment->loss;
+
+    if (link->bad_state ? random_percent() < impairment->gilbert_r : random_percent() < impairment->gilbert_p)
+        link->bad_state = !link->bad_state;
+    return random_percent() < (link->bad_state ? impairment->bad_loss : impairment->good_loss);
+}
+
+/* Drops or schedules a received datagram, the release time includes the delay, jitter and the link rate. */
+static void impair_datagram(const struct impairment *impairment, struct impair_client *client, int client_index,
+                            enum impair_direction direction, const unsigned char *data, size_t len,
+                            struct datagram_heap *heap, struct impair_stats *stats) {
+    const int64_t now = impair_time();
+    struct impair_link *link = &client->links[direction];
+    const bool impaired = (direction == DOWNSTREAM || impairment->both) && ++link->datagrams > impairment->spare;
+    stats->received++;
+
+    int copies = 1;
+    if (impaired) {
+        if (is_lost(impairment, link)) {
+            stats->lost++;
+            return;
+        }
+        if (impairment->duplicate > 0 && random_percent() < impairment->duplicate) {
+            stats->duplicated++;
+            copies = 2;
+        }
+    }
+
+    for (int copy = 0; copy < copies; copy++) {
+        int64_t release_time = now;
+        if (impaired) {
+            double delay = impairment->delay + impairment->jitter * (random_percent() / 50 - 1);
+            if (impairment->reorder > 0 && random_percent() < impairment->reorder) {
+                delay += impairment->reorder_delay;
+                stats->reordered++;
+            }
+            release_time += (int64_t) (delay > 0 ? delay * 1000000 : 0);
+
+            /* The link sends one datagram after the other at its rate, a full queue drops the tail. */
+            if (impairment->rate > 0) {
+                if (link->free_time - now > IMPAIR_QUEUE_LIMIT) {
+                    stats->rate_dropped++;
+                    continue;
+                }
+                link->free_time = (link->free_time > now ? link->free_time : now) +
+                                  (int64_t) ((double) len * 8 * 1000000 / impairment->rate);
+                release_time += link->free_time - now;
+            }
+        }
+
+        struct impaired_datagram *datagram = malloc(sizeof(struct impaired_datagram) + len);
+        if (datagram == NULL) {
+            stats->memory_dropped++;
+            continue;
+        }
+        datagram->release_time = release_time;
+        datagram->client = client_index;
+        datagram->direction = direction;
+        datagram->len = len;
+        memcpy(datagram->data, data, len);
+        if (!heap_push(heap, datagram)) {
+            free(datagram);
+            stats->memory_dropped++;
+        }
+    }
+}
+
+/* Receives a datagram from the server, with the kernel's receive time where the socket has SO_TIMESTAMPNS. */
+static ssize_t receive_downstream(int upstream_fd, unsigned char *buffer, size_t buffer_size, int64_t *arrival_time) {
+    struct iovec iovec = {.iov_base = buffer, .iov_len = buffer_size};
+    union {
+        char buffer[CMSG_SPACE(sizeof(struct timespec))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {.msg_iov = &iovec, .msg_iovlen = 1, .msg_control = control.buffer,
+                         .msg_controllen = sizeof(control.buffer)};
+
+    ssize_t len = recvmsg(upstream_fd, &msg, 0);
+    *arrival_time = impair_time();
+#ifdef SO_TIMESTAMPNS
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec timestamp;
+            memcpy(&timestamp, CMSG_DATA(cmsg), sizeof(timestamp));
+            *arrival_time = (int64_t) timestamp.tv_sec * 1000000000L + timestamp.tv_nsec;
+        }
+    }
+#endif
+    return len;
+}
+
+/* One line per first transmission of an opus datagram: arrival time in ns, client and sequence. */
+static void log_arrival(FILE *arrivals, int client, const unsigned char *data, size_t len, int64_t arrival_time) {
+    if (len < ARRIVAL_HEADER_SIZE || memcmp(data, ARRIVAL_FLAG, strlen(ARRIVAL_FLAG)) != 0 ||
+        (data[4] & ARRIVAL_RETRANSMIT))
+        return;
+    uint32_t sequence = (uint32_t) data[6] | (uint32_t) data[7] << 8 | (uint32_t) data[8] << 16 |
+                        (uint32_t) data[9] << 24;
+    fprintf(arrivals, "%lld %d %u\n", (long long) arrival_time, client, sequence);
+}
+
+static int find_client(struct impair_client *clients, int clients_count, const struct sockaddr_in *addr) {
+    for (int i = 0; i < clients_count; i++)
+        if (clients[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr && clients[i].addr.sin_port == addr->sin_port)
+            return i;
+    return -1;
+}
+
+static bool parse_gilbert(const char *arg, struct impairment *impairment) {
+    impairment->bad_loss = 100;
+    impairment->good_loss = 0;
+    int parsed = sscanf(arg, "%lf,%lf,%lf,%lf", &impairment->gilbert_p, &impairment->gilbert_r,
+                        &impairment->bad_loss, &impairment->good_loss);
+    impairment->gilbert = true;
+    return parsed >= 2;
+}
+
+static void print_usage(char **argv) {
+    puts("");
+    printf("Usage: %s [--loss <%%>] [--gilbert <p,r[,bad,good]>] [--delay <ms>] [--jitter <ms>] [--reorder <%%>] [--reorder-delay <ms>] [--duplicate <%%>] [--rate <kbit/s>] [--both] [--spare <N>] [--seed <N>] [--arrivals <File>] <Listen Port> <Server Address> <Server Port>\n\n",
+           argv[0]);
+    puts("[--loss]: Drops this percent of the datagrams at random.");
+    puts("[--gilbert]: Bursty loss, p and r are the percent chances to enter and leave the bad state, which loses bad percent of the datagrams and the good state good percent. (default: 100, 0)");
+    puts("[--delay]: Delays every datagram by this many ms.");
+    puts("[--jitter]: Varies the delay evenly by up to this many ms in both directions, later datagrams may overtake.");
+    puts("[--reorder]: Holds this percent of the datagrams back by --reorder-delay, so the next ones overtake them.");
+    puts("[--reorder-delay]: The ms a reordered datagram is held. (default: 10)");
+    puts("[--duplicate]: Sends this percent of the datagrams twice.");
+    puts("[--rate]: Limits each client's link to this many kbit/s, with a 200ms queue.");
+    puts("[--both]: Impairs the datagrams from the clients too, not only the ones from the server.");
+    puts("[--spare]: Leaves the first N datagrams of each client unimpaired, 8 covers the handshake. (default: 0)");
+    puts("[--seed]: Seeds the random impairments, the same seed gives the same pattern. (default: 1)");
+    puts("[--arrivals]: Logs the kernel receive time and sequence of every opus datagram from the server to this file.");
+    puts("<Listen Port>: The loopback port the clients connect to.");
+    puts("");
+}
+
+int main(int argc, char **argv) {
+    struct impairment impairment = {.reorder_delay = 10};
+    const char *arrivals_path = NULL;
+    random_state = 1;
+
+    int i = 1;
+    for (; i < argc && !strncmp(argv[i], "--", 2); i++) {
+        if (!strcmp(argv[i], "--both")) {
+            impairment.both = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            print_usage(argv);
+            return EXIT_FAILURE;
+        }
+
+        const char *value = argv[++i];
+        if (!strcmp(argv[i - 1], "--loss"))
+            impairment.loss = strtod(value, NULL);
+        else if (!strcmp(argv[i - 1], "--gilbert")) {
+            if (!parse_gilbert(value, &impairment)) {
+                printf("Invalid argument: Gilbert-Elliott loss needs at least p and r, like \"5,30\".\n");
+                return EXIT_FAILURE;
+            }
+        } else if (!strcmp(argv[i - 1], "--delay"))
+            impairment.delay = strtod(value, NULL);
+        else if (!strcmp(argv[i - 1], "--jitter"))
+            impairment.jitter = strtod(value, NULL);
+        else if (!strcmp(argv[i - 1], "--reorder"))
+            impairment.reorder = strtod(value, NULL);
+        else if (!strcmp(argv[i - 1], "--reorder-delay"))
+            impairment.reorder_delay = strtod(value, NULL);
+        else if (!strcmp(argv[i - 1], "--duplicate"))
+            impairment.duplicate = strtod(value, NULL);
+        else if (!strcmp(argv[i - 1], "--rate"))
+            impairment.rate = strtod(value, NULL);
+        else if (!strcmp(argv[i - 1], "--spare"))
+            impairment.spare = strtoul(value, NULL, 10);
+        else if (!strcmp(argv[i - 1], "--seed"))
+            random_state = strtoull(value, NULL, 10) | 1; // xorshift never leaves zero.
+        else if (!strcmp(argv[i - 1], "--arrivals"))
+            arrivals_path = value;
+        else {
+            print_usage(argv);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - i != 3) {
+        print_usage(argv);
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_in listen_addr = {.sin_family = AF_INET, .sin_port = htons((uint16_t) atoi(argv[i]))};
+    listen_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM}, *server_info;
+    if (getaddrinfo(argv[i + 1], argv[i + 2], &hints, &server_info) != 0) {
+        printf("Error: Connection Cannot resolved to %s.\n", argv[i + 1]);
+        return EXIT_FAILURE;
+    }
+    struct sockaddr_in server_addr = *(struct sockaddr_in *) server_info->ai_addr;
+    freeaddrinfo(server_info);
+
+    int listen_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &listen_addr, sizeof(listen_addr)) < 0) {
+        printf("Error: Failed to bind port %s: %s\n", argv[i], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    FILE *arrivals = NULL;
+    if (arrivals_path != NULL && (arrivals = fopen(arrivals_path, "w")) == NULL) {
+        printf("Error: Failed to open %s: %s\n", arrivals_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction stop_action = {.sa_handler = stop_proxy};
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
+
+    struct impair_client clients[IMPAIR_MAX_CLIENTS];
+    int clients_count = 0;
+    struct datagram_heap heap = {0};
+    struct impair_stats stats[2] = {0};
+    struct pollfd poll_fds[IMPAIR_MAX_CLIENTS + 1];
+    unsigned char buffer[IMPAIR_MAX_DATAGRAM];
+
+    while (running) {
+        /* Sends what is due, then waits for more datagrams until the next one is. */
+        int64_t now = impair_time();
+        while (heap.count > 0 && heap.datagrams[0]->release_time <= now) {
+            struct impaired_datagram *datagram = heap_pop(&heap);
+            struct impair_client *client = &clients[datagram->client];
+            if (datagram->direction == UPSTREAM)
+                send(client->upstream_fd, datagram->data, datagram->len, 0);
+            else
+                sendto(listen_fd, datagram->data, datagram->len, 0, (struct sockaddr *) &client->addr,
+                       sizeof(client->addr));
+            stats[datagram->direction].sent++;
+            free(datagram);
+        }
+
+        int timeout = -1;
+        if (heap.count > 0)
+            timeout = (int) ((heap.datagrams[0]->release_time - now + 999999) / 1000000);
+
+        poll_fds[0] = (struct pollfd) {.fd = listen_fd, .events = POLLIN};
+        for (int client = 0; client < clients_count; client++)
+            poll_fds[client + 1] = (struct pollfd) {.fd = clients[client].upstream_fd, .events = POLLIN};
+        if (poll(poll_fds, (nfds_t) clients_count + 1, timeout) <= 0)
+            continue;
+
+        if (poll_fds[0].revents & POLLIN) {
+            struct sockaddr_in client_addr;
+            socklen_t client_addr_len = sizeof(client_addr);
+            ssize_t len = recvfrom(listen_fd, buffer, sizeof(buffer), 0, (struct sockaddr *) &client_addr,
+                                   &client_addr_len);
+            int client = len >= 0 ? find_client(clients, clients_count, &client_addr) : -1;
+            if (len >= 0 && client < 0) {
+                if (clients_count == IMPAIR_MAX_CLIENTS) {
+                    printf("Error: More than %d clients, ignoring the new one.\n", IMPAIR_MAX_CLIENTS);
+                    continue;
+                }
+
+                /* A connected socket per client, the server replies to it. */
+                int upstream_fd = socket(AF_INET, SOCK_DGRAM, 0);
+                if (upstream_fd < 0 || connect(upstream_fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
+                    printf("Error: Failed to connect to the server: %s\n", strerror(errno));
+                    return EXIT_FAILURE;
+                }
+#ifdef SO_TIMESTAMPNS
+                int timestamps = 1;
+                if (arrivals != NULL)
+                    setsockopt(upstream_fd, SOL_SOCKET, SO_TIMESTAMPNS, &timestamps, sizeof(timestamps));
+#endif
+                client = clients_count++;
+                clients[client] = (struct impair_client) {.addr = client_addr, .upstream_fd = upstream_fd};
+            }
+            if (len >= 0)
+                impair_datagram(&impairment, &clients[client], client, UPSTREAM, buffer, (size_t) len, &heap,
+                                &stats[UPSTREAM]);
+        }
+
+        for (int client = 0; client < clients_count; client++) {
+            if (!(poll_fds[client + 1].revents & POLLIN))
+                continue;
+            int64_t arrival_time;
+            ssize_t len = receive_downstream(clients[client].upstream_fd, buffer, sizeof(buffer), &arrival_time);
+            if (len >= 0 && arrivals != NULL)
+                log_arrival(arrivals, client, buffer, (size_t) len, arrival_time);
+            if (len >= 0)
+                impair_datagram(&impairment, &clients[client], client, DOWNSTREAM, buffer, (size_t) len, &heap,
+                                &stats[DOWNSTREAM]);
+        }
+    }
+
+    const char *names[] = {"Upstream", "Downstream"};
+    for (int direction = UPSTREAM; direction <= DOWNSTREAM; direction++) {
+        printf("%s: %lu received, %lu sent, %lu lost, %lu rate dropped, %lu duplicated, %lu reordered\n",
+               names[direction], stats[direction].received, stats[direction].sent, stats[direction].lost,
+               stats[direction].rate_dropped, stats[direction].duplicated, stats[direction].reordered);
+        if (stats[direction].memory_dropped > 0)
+            printf("Error: %s dropped %lu datagrams, out of memory.\n", names[direction], stats[direction].memory_dropped);
+    }
+
+    if (arrivals != NULL)
+        fclose(arrivals);
+    close(listen_fd);
+    for (int client = 0; client < clients_count; client++)
+        close(clients[client].upstream_fd);
+    return EXIT_SUCCESS;
+}